@@ -0,0 +1,106 @@
+/**
+  ******************************************************************************
+  * @file           : channels.h
+  * @brief          : Compile-time output channel table (relays, GP8413 channels)
+  ******************************************************************************
+  */
+
+#ifndef __CHANNELS_H
+#define __CHANNELS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define CHANNEL_PROBE_TIMEOUT_MS 2    // per address; an absent DAC just NACKs
+
+_Static_assert(RELAY_COUNT >= 1 && RELAY_COUNT <= 16, "relay masks are 16 bits; GET_STATUS reports relays 1-2");
+_Static_assert(DIMMER_COUNT >= 2 && DIMMER_COUNT <= 16, "dimmer masks are 16 bits; GET_STATUS reports dimmers 1-2");
+
+/* Dimmer levels on the wire and in powerpack_state are 16-bit fractions of
+ * full scale (0xFFFF = 100 %). Internally a setpoint is a Q16 DAC code: the
+ * 15-bit code in the upper half and 1/65536 LSB in the lower half, which
+ * the dither (dither.c) resolves over time. */
+static inline uint32_t Channels_LevelToQ16(uint16_t level)
+{
+  uint32_t t = (uint32_t)level * GP8413_CODE_MAX;
+
+  return t + (t >> 16);       // x 65536/65535 to within 1/65536 LSB, no divide
+}
+
+static inline uint16_t Channels_Q16ToCode(uint32_t q16)
+{
+  return (uint16_t)((q16 + 0x8000U) >> 16);
+}
+
+static inline uint16_t Channels_LevelToCode(uint16_t level)
+{
+  return Channels_Q16ToCode(Channels_LevelToQ16(level));
+}
+
+typedef struct {
+  GPIO_TypeDef* port;
+  uint16_t pin;               // relay drive, or the SET coil of a latching relay
+  uint16_t reset_pin;         // RESET coil of a latching relay, 0 = level-driven
+  uint8_t timer;              // RELAY_TIMER_* engine for timed edges, RELAY_TIMER_NONE = none
+  uint8_t safe_on;            // state the fault handler leaves: 1 = on, 0 = off
+} RelayChannel_t;
+
+typedef struct {
+  uint8_t address;            // GP8413 7-bit address, GP8413_ADDRESS..GP8413_ADDRESS_LAST; the
+                              // probe may move the row (Channels_DimmerAddress())
+  uint8_t reg;                // GP8413_REG_DAC1 or GP8413_REG_DAC2
+  uint8_t reg_stride;         // register step per code in one frame, 0 = this row is never merged
+  GPIO_TypeDef* enable_port;  // output enable pin
+  uint16_t enable_pin;
+  uint8_t safe_on;            // enable level the fault handler leaves
+} DimmerChannel_t;
+
+// Target state for Apply_Outputs(); only the channels in the masks are touched
+typedef struct {
+  uint16_t relay_mask;
+  uint16_t relay_on;
+  uint16_t enable_mask;
+  uint16_t enable_on;
+  uint16_t dimmer_mask;
+  uint16_t level[DIMMER_COUNT];
+} OutputUpdate_t;
+
+typedef struct {
+  uint16_t relays;
+  uint16_t enables;
+  uint16_t dimmers;
+} OutputChange_t;
+
+#define CHANNEL_MAX_PORTS       3     // GPIOA-GPIOC on the C8 package
+
+// Pins of one GPIO port that switch together, one BSRR store
+typedef struct {
+  GPIO_TypeDef* port;
+  uint16_t set;
+  uint16_t reset;
+} PortWrite_t;
+
+extern const RelayChannel_t relay_channels[RELAY_COUNT];
+extern const DimmerChannel_t dimmer_channels[DIMMER_COUNT];
+
+HAL_StatusTypeDef GP8413_WriteRange(uint8_t address, uint8_t range);
+uint8_t  Channels_Probe(void);
+uint8_t  Channels_GetDacsFound(void);
+uint8_t  Channels_DimmerAddress(uint8_t index);
+uint16_t Channels_DimmersPresent(void);
+uint16_t Channels_LatchingRelays(void);
+HAL_StatusTypeDef Channels_ConfigureDacs(void);
+HAL_StatusTypeDef Channels_WriteDimmers(uint16_t mask, const uint16_t* codes);
+uint8_t  Channels_PlanPins(PortWrite_t* ports, uint16_t relay_set, uint16_t relay_reset,
+                          uint16_t enable_set, uint16_t enable_reset);
+void Channels_WritePins(uint16_t relay_set, uint16_t relay_reset, uint16_t enable_set, uint16_t enable_reset);
+void Channels_SafeState(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CHANNELS_H */
@@ -0,0 +1,62 @@
+/**
+  ******************************************************************************
+  * @file           : config.h
+  * @brief          : Board settings kept in the last flash page
+  ******************************************************************************
+  */
+
+#ifndef __CONFIG_H
+#define __CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define CONFIG_MAGIC            0x43464731UL  // "CFG1"
+#define CONFIG_VERSION          2             // bump when a field changes meaning; append otherwise
+#define CONFIG_PAGE_SIZE        1024          // F103C8 flash page, see the CONFIG region in the .ld
+#define CONFIG_DELAY_MAX_US     50000         // longest relay operate/release time accepted
+
+// RELAY_CONFIG sub-commands (byte 1)
+#define CONFIG_CMD_GET          0x00  // reply only
+#define CONFIG_CMD_SET_DELAYS   0x01  // [cmd, 1, relay, 0, operate_us u16, release_us u16]
+#define CONFIG_CMD_SET_ZERO_CROSS 0x02  // [cmd, 2, mask u16, offset_us u16]
+#define CONFIG_CMD_SAVE         0x03  // write the settings to flash
+
+// RELAY_CONFIG status
+#define CONFIG_OK               0x00
+#define CONFIG_ERR_RANGE        0x01
+#define CONFIG_ERR_FLASH        0x02
+
+// [cmd, status, stored, relays, zc_mask u16, zc_offset_us u16, zc_interval_us u16,
+//  (operate_us u16, release_us u16) per relay], big-endian; above 13 relays
+// it takes two USB packets, which the host reads as one byte stream
+#define CONFIG_REPLY_SIZE       (10 + 4 * RELAY_COUNT)
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;              // sizeof(Config_t) when written
+  uint16_t relay_operate_us[RELAY_COUNT];   // coil on to contacts made, bench-measured per relay
+  uint16_t relay_release_us[RELAY_COUNT];   // coil off to contacts open
+  uint16_t zero_cross_mask;   // bit n: relay n+1 switches on a mains zero crossing
+  uint16_t zero_cross_offset_us;  // sync edge to the real zero crossing
+  uint16_t reserved;
+  uint16_t crc;               // CRC-16 over everything above
+} Config_t;
+
+_Static_assert(sizeof(Config_t) % 2 == 0, "flash is programmed in half-words");
+
+extern Config_t config;
+
+void              Config_Init(void);
+uint8_t           Config_IsStored(void);
+HAL_StatusTypeDef Config_Save(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CONFIG_H */
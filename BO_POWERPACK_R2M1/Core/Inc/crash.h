@@ -0,0 +1,60 @@
+/**
+  ******************************************************************************
+  * @file           : crash.h
+  * @brief          : Fault capture to no-init RAM and crash report on next boot
+  ******************************************************************************
+  */
+
+#ifndef __CRASH_H
+#define __CRASH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define CRASH_STACK_WORDS       12    // words above the exception frame
+#define CRASH_REPLY_SIZE        60    // both pages, below one full USB packet
+
+// Crash_GetResetFlags() bits
+#define RESET_FLAG_PIN          0x04
+#define RESET_FLAG_POR          0x08
+#define RESET_FLAG_SOFTWARE     0x10
+#define RESET_FLAG_IWDG         0x20
+#define RESET_FLAG_WWDG         0x40
+#define RESET_FLAG_LOW_POWER    0x80
+
+// GET_CRASH pages
+#define CRASH_PAGE_REGISTERS    0
+#define CRASH_PAGE_STACK        1
+#define CRASH_PAGE_CLEAR        0xFF
+
+typedef struct {
+  uint32_t magic;
+  uint16_t crc;               // CRC-16 of everything after this field
+  uint16_t count;             // faults since the report was last cleared
+  uint32_t ipsr;              // exception number: 3 HardFault, 4 MemManage, 5 BusFault, 6 UsageFault
+  uint32_t exc_return;
+  uint32_t r0, r1, r2, r3, r12, lr, pc, xpsr;
+  uint32_t sp;                // stack pointer before the exception
+  uint32_t cfsr, hfsr, bfar, mmfar;
+  uint32_t uptime_ms;
+  uint8_t  frame_valid;       // 0 if the stacked frame was outside RAM
+  uint8_t  stack_words;
+  uint16_t reserved;
+  uint32_t stack[CRASH_STACK_WORDS];
+} CrashReport_t;
+
+void    Crash_Init(void);
+uint8_t Crash_IsValid(void);
+uint8_t Crash_GetResetFlags(void);
+const CrashReport_t* Crash_GetReport(void);
+void    Crash_Clear(void);
+uint8_t Crash_Serialize(uint8_t page, uint8_t cmd, uint8_t* reply);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CRASH_H */
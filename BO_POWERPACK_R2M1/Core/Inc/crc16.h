@@ -0,0 +1,25 @@
+/**
+  ******************************************************************************
+  * @file           : crc16.h
+  * @brief          : CRC-16/CCITT-FALSE used to verify bulk USB transfers
+  ******************************************************************************
+  */
+
+#ifndef __CRC16_H
+#define __CRC16_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define CRC16_INIT              0xFFFF
+
+uint16_t CRC16_Update(uint16_t crc, const uint8_t* data, uint32_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CRC16_H */
@@ -0,0 +1,39 @@
+/**
+  ******************************************************************************
+  * @file           : curves.h
+  * @brief          : Per-channel perceptual dimming curves
+  ******************************************************************************
+  */
+
+#ifndef __CURVES_H
+#define __CURVES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+// Dimming curves (CMD_SET_CURVE param); the order matches PC_APP/dimming_curves.py
+#define CURVE_LINEAR            0     // level proportional to output, no table
+#define CURVE_CIE1931           1     // CIE 1931 lightness
+#define CURVE_GAMMA22           2
+#define CURVE_LOG               3     // 60 dB, constant ratio per step
+#define CURVE_USER              4     // points chosen at build time
+#define CURVE_COUNT             5
+
+#define CURVE_TABLE_COUNT       (CURVE_COUNT - 1)
+#define CURVE_SEGMENTS          64
+#define CURVE_POINTS            (CURVE_SEGMENTS + 1)
+
+// Q16 DAC codes, generated into curves_table.c by PC_APP/dimming_curves.py
+extern const uint32_t curve_tables[CURVE_TABLE_COUNT][CURVE_POINTS];
+
+uint32_t Curve_LevelToQ16(uint8_t slot, uint16_t level);
+uint16_t Curve_LevelToCode(uint8_t slot, uint16_t level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CURVES_H */
@@ -0,0 +1,29 @@
+/**
+  ******************************************************************************
+  * @file           : deferred.h
+  * @brief          : PendSV deferred work queue for interrupt handlers
+  ******************************************************************************
+  */
+
+#ifndef __DEFERRED_H
+#define __DEFERRED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define DEFERRED_QUEUE_SIZE     16    // power of two
+
+typedef void (*DeferredFunc_t)(uint32_t arg);
+
+uint8_t Deferred_Post(DeferredFunc_t func, uint32_t arg);
+void    Deferred_Run(void);
+uint8_t Deferred_GetHighWater(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DEFERRED_H */
@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file           : dither.h
+  * @brief          : Temporal (sigma-delta) dithering of the DAC codes
+  ******************************************************************************
+  */
+
+#ifndef __DITHER_H
+#define __DITHER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define DITHER_CHANNELS         2     // dimmers 1 and 2, the ones GP8413_WriteDMA() serves
+#define DITHER_TICK_HZ          1000  // TIM4, shared with the stream playout
+#define DITHER_MIN_RATE_HZ      100   // below this the toggling becomes visible flicker
+#define DITHER_REPLY_SIZE       32
+
+// CMD_DITHER param
+#define DITHER_CMD_SET          0     // value: update rate in Hz (divides 1000), 0 = off
+#define DITHER_CMD_STATS        1
+#define DITHER_CMD_STATS_RESET  2     // read, then restart the statistics window
+
+#define DITHER_OK               0x00
+#define DITHER_ERR_RANGE        0x01
+
+typedef struct {
+  uint32_t ticks;             // dither updates run
+  uint32_t writes;            // updates that put a frame on the bus
+  uint32_t busy;              // updates dropped because the bus was busy
+  uint32_t cycles;            // CPU cycles spent in the updates
+  uint32_t cycles_max;
+} DitherStats_t;
+
+uint8_t  Dither_SetRate(uint16_t rate_hz);
+uint16_t Dither_GetRate(void);
+void     Dither_SetLevel(uint8_t slot, uint16_t level);
+void     Dither_Hold(uint8_t hold);
+uint8_t  Dither_Serialize(uint8_t cmd, uint8_t status, uint8_t reset, uint8_t* reply);
+
+void     Dither_TimerTick(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DITHER_H */
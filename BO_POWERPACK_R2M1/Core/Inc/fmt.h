@@ -0,0 +1,26 @@
+/**
+  ******************************************************************************
+  * @file           : fmt.h
+  * @brief          : Minimal integer/string formatter for the diagnostics log
+  ******************************************************************************
+  */
+
+#ifndef __FMT_H
+#define __FMT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdarg.h>
+#include <stdint.h>
+
+uint16_t Fmt_Format(char* buf, uint16_t size, const char* format, ...)
+  __attribute__((format(printf, 3, 4)));
+uint16_t Fmt_VFormat(char* buf, uint16_t size, const char* format, va_list args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FMT_H */
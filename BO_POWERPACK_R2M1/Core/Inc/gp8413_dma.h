@@ -0,0 +1,31 @@
+/**
+  ******************************************************************************
+  * @file           : gp8413_dma.h
+  * @brief          : Non-blocking GP8413 DAC updates over the I2C1 TX DMA channel
+  ******************************************************************************
+  */
+
+#ifndef __GP8413_DMA_H
+#define __GP8413_DMA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define GP8413_DMA_CH1          0x01
+#define GP8413_DMA_CH2          0x02
+
+HAL_StatusTypeDef GP8413_WriteDMA(uint8_t channel_mask, uint16_t code1, uint16_t code2);
+HAL_StatusTypeDef GP8413_WriteLevelsDMA(uint8_t channel_mask, uint16_t level1, uint16_t level2);
+uint8_t GP8413_DMA_IsBusy(void);
+void    GP8413_DMA_WaitIdle(uint32_t timeout_ms);
+void    GP8413_DMA_TxComplete(void);
+void    GP8413_DMA_Error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GP8413_DMA_H */
@@ -0,0 +1,43 @@
+/**
+  ******************************************************************************
+  * @file           : health.h
+  * @brief          : MCU temperature and supply voltage from ADC1 in the background
+  ******************************************************************************
+  */
+
+#ifndef __HEALTH_H
+#define __HEALTH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define HEALTH_CHANNELS         2     // ADC1 scan order: temperature sensor, VREFINT
+#define HEALTH_BLOCK_SCANS      64    // scans summed per DMA half-transfer (+3 bits)
+#define HEALTH_FILTER_SHIFT     4     // block IIR: 1/16 of each new block, ~90 ms
+#define HEALTH_REPLY_SIZE       8
+
+// Typical values from the STM32F103 datasheet; the F1 has no factory calibration
+#define HEALTH_V25_UV           1430000   // sensor output at 25 C (1.34-1.52 V)
+#define HEALTH_SLOPE_UV_PER_C   4300      // 4.0-4.6 mV/C
+#define HEALTH_VREFINT_UV       1200000   // 1.16-1.24 V
+
+// GET_HEALTH status
+#define HEALTH_OK               0x00
+#define HEALTH_NOT_READY        0x01  // no block since the start or a STOP exit
+
+void    Health_Init(void);
+void    Health_Start(void);
+void    Health_Stop(void);
+uint8_t Health_Read(int16_t* temp_dc, uint16_t* vdda_mv);
+uint8_t Health_Serialize(uint8_t cmd, uint8_t* reply);
+
+void    DMA1_Channel1_IRQHandler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEALTH_H */
@@ -36,12 +36,66 @@ extern "C" {
 
 /* Exported types ------------------------------------------------------------*/
 /* USER CODE BEGIN ET */
+/* Relay drive by board revision. R2M1 switches two relays by level on
+ * GPIO_M1/GPIO_M2. R1M1 has one latching relay with its SET coil on
+ * GPIO_M1 and its RESET coil on GPIO_M2 (see UPGRADE_R1M1_TO_R2M1.md);
+ * build with -DRELAY_DRIVE=1 for that board. */
+#define RELAY_DRIVE_LEVEL       0
+#define RELAY_DRIVE_LATCHING    1
+
+#ifndef RELAY_DRIVE
+#define RELAY_DRIVE             RELAY_DRIVE_LEVEL
+#endif
 
+/* Output channels of this board, one row each in relay_channels[] and
+ * dimmer_channels[] (channels.c). Up to 16 of each; channel n is bit n-1
+ * in the masks below and in the bulk commands. */
+#if RELAY_DRIVE == RELAY_DRIVE_LATCHING
+#define RELAY_COUNT             1
+#else
+#define RELAY_COUNT             2
+#endif
+#define DIMMER_COUNT            2
+#define RELAY_ALL               ((uint16_t)((1UL << RELAY_COUNT) - 1))
+#define DIMMER_ALL              ((uint16_t)((1UL << DIMMER_COUNT) - 1))
+
+typedef struct {
+    uint16_t relays;                      // bit n: relay n+1 on
+    uint16_t dimmers_enabled;             // bit n: dimmer n+1 output enabled
+    uint16_t dimmer_value[DIMMER_COUNT];  // level, 0xFFFF = full scale
+    uint8_t  dimmer_curve[DIMMER_COUNT];  // CURVE_* applied to the level (curves.h)
+} PowerPackState_t;
+
+extern PowerPackState_t powerpack_state;
 /* USER CODE END ET */
 
 /* Exported constants --------------------------------------------------------*/
 /* USER CODE BEGIN EC */
-
+/* NVIC preemption priorities (NVIC_PRIORITYGROUP_4, lower number wins).
+ * The generated MSP code and the .ioc carry the same numbers.
+ *   0  EXTI3            external trigger input, pre-armed BSRR stores (see trigger.c)
+ *      EXTI2            mains zero-cross time stamps (see zero_cross.c)
+ *   1  USB LP/HP        endpoint servicing, never waits on anything else
+ *      USBWakeUp        STOP exit on resume (see power.c)
+ *   2  DMA1_Ch6, I2C1   DAC transfers started from the timers below
+ *   3  TIM4             stream playout clock (1 kHz)
+ *   4  TIM3             waveform pacing
+ *      RTC_Alarm        periodic STOP exit to feed the IWDG
+ *   5  DMA1_Ch1         ADC1 health blocks (see health.c)
+ *      DMA1_Ch4/7       end of a relay pulse or blink (see relay_timer.c)
+ *  14  SysTick          HAL tick
+ *  15  PendSV           deferred work queue (see deferred.c)
+ * Interrupts at 0-5 only do register work and Deferred_Post() the rest. */
+#define IRQ_PRIO_TRIGGER        0
+#define IRQ_PRIO_SYNC           0
+#define IRQ_PRIO_USB            1
+#define IRQ_PRIO_I2C            2
+#define IRQ_PRIO_STREAM         3
+#define IRQ_PRIO_TIM3           4
+#define IRQ_PRIO_ADC            5
+#define IRQ_PRIO_RELAY          5
+#define IRQ_PRIO_SYSTICK        14
+#define IRQ_PRIO_DEFERRED       15
 /* USER CODE END EC */
 
 /* Exported macro ------------------------------------------------------------*/
@@ -71,6 +125,19 @@ void Error_Handler(void);
 #define GP_I2C_SDA_GPIO_Port GPIOB
 
 /* USER CODE BEGIN Private defines */
+#define GP8413_ADDRESS          0x58  // 7-bit address with A2..A0 low
+#define GP8413_ADDRESS_LAST     0x5F  // A2..A0 high: up to 8 DACs per bus
+// Register map from the GP8413 datasheet: 0x01 output range (one byte),
+// 0x02/0x03 channel 0 data and 0x04/0x05 channel 1 data, so one frame
+// from 0x02 with four data bytes loads both channels
+#define GP8413_REG_RANGE        0x01
+#define GP8413_RANGE_10V        0x11  // 0-10 V outputs (0x00 = 0-5 V)
+#define GP8413_REG_DAC1         0x02
+#define GP8413_REG_DAC2         0x04
+#define GP8413_REG_STRIDE       2     // register step per 2-byte code (DimmerChannel_t.reg_stride)
+#define GP8413_CODE_BITS        15    // data registers: code left-aligned, low byte first
+#define GP8413_CODE_MAX         0x7FFF
+#define GP8413_CODE_SHIFT       (16 - GP8413_CODE_BITS)
 
 /* USER CODE END Private defines */
 
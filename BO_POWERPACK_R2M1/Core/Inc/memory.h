@@ -0,0 +1,48 @@
+/**
+  ******************************************************************************
+  * @file           : memory.h
+  * @brief          : Stack painting, heap tracking and RAM usage report
+  ******************************************************************************
+  */
+
+#ifndef __MEMORY_H
+#define __MEMORY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define MEMORY_PAINT            0xC5C5C5C5UL
+#define MEMORY_PAINT_MARGIN     64    // bytes below the caller's SP left alone
+#define MEMORY_REPLY_SIZE       22
+
+// MemoryUsage_t.flags
+#define MEMORY_FLAG_STACK_OVER  0x01  // stack peak exceeded _Min_Stack_Size
+#define MEMORY_FLAG_HEAP_OVER   0x02  // heap peak exceeded _Min_Heap_Size
+#define MEMORY_FLAG_COLLISION   0x04  // no painted word left between heap and stack
+
+typedef struct {
+  uint16_t ram_total;
+  uint16_t static_bytes;      // .RamFunc + .data + .bss + .noinit
+  uint16_t heap_reserved;     // _Min_Heap_Size
+  uint16_t heap_used;
+  uint16_t heap_peak;
+  uint16_t heap_failures;     // _sbrk requests refused
+  uint16_t stack_reserved;    // _Min_Stack_Size
+  uint16_t stack_now;
+  uint16_t stack_peak;        // deepest overwritten painted word, from _estack
+  uint16_t free_min;          // painted bytes never touched by heap or stack
+  uint8_t  flags;
+} MemoryUsage_t;
+
+void    Memory_PaintStack(void);
+void    Memory_GetUsage(MemoryUsage_t* usage);
+uint8_t Memory_Serialize(uint8_t cmd, uint8_t* reply);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MEMORY_H */
@@ -0,0 +1,69 @@
+/**
+  ******************************************************************************
+  * @file           : metrics.h
+  * @brief          : Fixed table of runtime counters reported by CMD_GET_METRICS
+  ******************************************************************************
+  */
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+/* Counter IDs. The order is the wire order of the GET_METRICS reply and
+ * must match METRIC_DEFS in PC_APP/powerpack_controller.py; only append. */
+typedef enum {
+  METRIC_UPTIME_MS = 0,       // HAL tick, sampled when the snapshot is taken
+  METRIC_USB_RX_PACKETS,
+  METRIC_CMD_RECEIVED,
+  METRIC_CMD_UNKNOWN,
+  METRIC_CMD_OVERRUN,         // packet replaced an undispatched one
+  METRIC_CRC_ERRORS,
+  METRIC_USB_TX_PACKETS,
+  METRIC_USB_TX_BUSY,         // CDC_Transmit_FS dropped the data
+  METRIC_I2C_ERRORS,
+  METRIC_RELAY1_SWITCHES,
+  METRIC_RELAY2_SWITCHES,
+  METRIC_DAC_WRITES,
+  METRIC_DIAG_DROPPED,        // log/trace writes refused, diagnostics buffer full
+  METRIC_DEFERRED_DROPPED,    // Deferred_Post() found the queue full
+  METRIC_COUNT
+} MetricId_t;
+
+#define METRICS_REPLY_HEADER    4     // cmd, count, 0, 0
+#define METRICS_REPLY_SIZE      (METRICS_REPLY_HEADER + 4 * METRIC_COUNT)
+
+_Static_assert(METRICS_REPLY_SIZE <= 64, "GET_METRICS reply must fit one USB packet");
+
+extern volatile uint32_t metrics[METRIC_COUNT];
+
+/**
+  * @brief Add to a counter; safe from any context (LDREX/STREX, no IRQ masking)
+  * @param id: Counter
+  * @param n: Increment
+  * @retval None
+  */
+static inline void Metrics_Add(MetricId_t id, uint32_t n)
+{
+  uint32_t v;
+  do {
+    v = __LDREXW(&metrics[id]) + n;
+  } while (__STREXW(v, &metrics[id]));
+}
+
+static inline void Metrics_Inc(MetricId_t id)
+{
+  Metrics_Add(id, 1);
+}
+
+void Metrics_Snapshot(uint8_t* reply, uint8_t cmd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __METRICS_H */
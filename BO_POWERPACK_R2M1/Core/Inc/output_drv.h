@@ -0,0 +1,69 @@
+/**
+  ******************************************************************************
+  * @file           : output_drv.h
+  * @brief          : Relay/enable GPIO and GP8413 I2C output driver layer
+  ******************************************************************************
+  */
+
+#ifndef __OUTPUT_DRV_H
+#define __OUTPUT_DRV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+/* Driver selection: OUTPUT_DRV_LL writes BSRR and the I2C1 registers
+ * directly, OUTPUT_DRV_HAL keeps HAL_GPIO_WritePin/HAL_I2C_Master_Transmit.
+ * Override from the compiler command line (-DOUTPUT_DRV=0) to compare. */
+#define OUTPUT_DRV_HAL          0
+#define OUTPUT_DRV_LL           1
+
+#ifndef OUTPUT_DRV
+#define OUTPUT_DRV              OUTPUT_DRV_LL
+#endif
+
+/**
+  * @brief Drive an output pin
+  * @param port: GPIO port
+  * @param pin: GPIO_PIN_x mask
+  * @param state: 0 = low, non-zero = high
+  * @retval None
+  */
+static inline void Output_WritePin(GPIO_TypeDef* port, uint16_t pin, uint8_t state)
+{
+#if OUTPUT_DRV == OUTPUT_DRV_LL
+  // Upper half of BSRR resets, lower half sets: one store, no read-modify-write
+  port->BSRR = state ? (uint32_t)pin : (uint32_t)pin << 16;
+#else
+  HAL_GPIO_WritePin(port, pin, state ? GPIO_PIN_SET : GPIO_PIN_RESET);
+#endif
+}
+
+/**
+  * @brief Set and reset several pins of one port together
+  * @param port: GPIO port
+  * @param set: Pins to drive high
+  * @param reset: Pins to drive low
+  * @retval None
+  */
+static inline void Output_WritePort(GPIO_TypeDef* port, uint16_t set, uint16_t reset)
+{
+#if OUTPUT_DRV == OUTPUT_DRV_LL
+  port->BSRR = set | (uint32_t)reset << 16;
+#else
+  // Two HAL calls: the pins change a few microseconds apart
+  if (reset) HAL_GPIO_WritePin(port, reset, GPIO_PIN_RESET);
+  if (set) HAL_GPIO_WritePin(port, set, GPIO_PIN_SET);
+#endif
+}
+
+HAL_StatusTypeDef Output_I2C_Write(uint8_t address, const uint8_t* data, uint8_t length);
+uint8_t Output_I2C_IsClaimed(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __OUTPUT_DRV_H */
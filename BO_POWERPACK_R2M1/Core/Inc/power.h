@@ -0,0 +1,49 @@
+/**
+  ******************************************************************************
+  * @file           : power.h
+  * @brief          : Low-power idle while the USB host is suspended
+  ******************************************************************************
+  */
+
+#ifndef __POWER_H
+#define __POWER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+#include "watchdog.h"
+
+// Longest STOP stretch: the IWDG keeps counting, so wake at half its timeout
+#define POWER_STOP_MAX_MS       (WDG_TIMEOUT_MS / 2)
+#define POWER_RTC_PRESCALER     40    // LSI 40 kHz / 40 = 1 ms RTC ticks (nominal)
+#define POWER_HSI_MHZ           8     // core clock between STOP exit and the PLL switch
+
+// GET_POWER flags
+#define POWER_FLAG_SUSPENDED    0x01  // USB bus suspended by the host
+#define POWER_FLAG_OUTPUTS_BUSY 0x02  // waveform, stream, dither, DAC transfer, relay pulse or armed trigger
+
+#define POWER_REPLY_SIZE        20
+
+typedef struct {
+  uint16_t suspends;          // USB suspend events
+  uint32_t stop_entries;      // STOP mode entries
+  uint32_t stop_ms;           // time spent in STOP (RTC, LSI accuracy)
+  uint32_t sleep_entries;     // clock-gated SLEEP entries while suspended
+  uint16_t wake_us_last;      // STOP exit to PLL running again
+  uint16_t wake_us_max;
+} PowerStats_t;
+
+void    Power_Init(void);
+void    Power_UsbSuspended(void);
+void    Power_UsbResumed(void);
+uint8_t Power_IsUsbSuspended(void);
+void    Power_Idle(void);
+uint8_t Power_Serialize(uint8_t cmd, uint8_t* reply);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __POWER_H */
@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file           : relay_timer.h
+  * @brief          : Hardware-timed relay edges: pulse, blink and latching coils
+  ******************************************************************************
+  */
+
+#ifndef __RELAY_TIMER_H
+#define __RELAY_TIMER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+// Timer engine of a relay row (RelayChannel_t.timer); each drives one row at most
+#define RELAY_TIMER_NONE        0     // no timed edges: the row only switches at once
+#define RELAY_TIMER_TIM2        1
+#define RELAY_TIMER_TIM1        2
+#define RELAY_TIMER_COUNT       2
+#define RELAY_TIMER_MIN_US      100   // shortest edge spacing, and earliest delayed coil edge
+#define RELAY_TIMER_MAX_US      65535000UL
+#define RELAY_LATCH_PULSE_MS    20    // coil pulse that moves a latching relay
+
+// PULSE_RELAY / BLINK_RELAY status
+#define RELAY_TIMER_OK          0x00
+#define RELAY_TIMER_ERR_RANGE   0x01
+#define RELAY_TIMER_ERR_LATCHED 0x02  // a latching relay only has positions, no timed toggling
+#define RELAY_TIMER_ERR_SOON    0x03  // delay shorter than the relay's operate/release time
+#define RELAY_TIMER_ERR_NO_TIMER 0x04 // the relay row has no timer engine
+
+void     RelayTimer_Init(void);
+uint8_t  RelayTimer_Blink(uint8_t relay_num, uint16_t on_ms, uint16_t period_ms, uint16_t count);
+uint8_t  RelayTimer_SwitchAt(uint8_t relay_num, uint8_t state, uint32_t delay_us);
+uint8_t  RelayTimer_SwitchZeroCross(uint8_t index, uint8_t on);
+uint16_t RelayTimer_Cancel(uint16_t mask);
+uint16_t RelayTimer_Abort(uint16_t mask);
+uint16_t RelayTimer_Active(void);
+void     RelayTimer_Latch(uint8_t index, uint8_t on);
+void     RelayTimer_Halt(void);
+
+void     DMA1_Channel4_IRQHandler(void);
+void     DMA1_Channel7_IRQHandler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RELAY_TIMER_H */
@@ -0,0 +1,52 @@
+/**
+  ******************************************************************************
+  * @file           : sched.h
+  * @brief          : Static cooperative scheduler for the main loop
+  ******************************************************************************
+  */
+
+#ifndef __SCHED_H
+#define __SCHED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+/* Task IDs, in priority order: when several are due the lowest ID runs
+ * first. The order is the wire order of the GET_TASKS reply and must
+ * match TASK_NAMES in PC_APP/powerpack_controller.py; only append. */
+typedef enum {
+  TASK_COMMANDS = 0,          // event: USB packet received
+  TASK_WATCHDOG,              // periodic: liveness check-in and IWDG feed
+  TASK_STATUS,                // periodic: unsolicited status push
+  TASK_TRIGGER,               // event: trigger fired, switch counters and late DAC/waveform work
+  TASK_TELEMETRY,             // periodic: compact status stream, when started
+  TASK_COUNT
+} SchedTaskId_t;
+
+typedef struct {
+  void (*run)(void);
+  uint16_t period_ms;         // 0 = runs only when signalled
+} SchedTaskDef_t;
+
+#define SCHED_REPLY_HEADER      8     // cmd, count, idle permille u16, elapsed_ms u32
+#define SCHED_ENTRY_SIZE        10    // runs u32, busy permille u16, max cycles u32
+#define SCHED_REPLY_SIZE        (SCHED_REPLY_HEADER + SCHED_ENTRY_SIZE * TASK_COUNT)
+
+_Static_assert(SCHED_REPLY_SIZE <= 64, "GET_TASKS reply must fit one USB packet");
+
+// Defined by the application (main.c)
+extern const SchedTaskDef_t sched_tasks[TASK_COUNT];
+
+void    Sched_Init(void);
+void    Sched_Signal(SchedTaskId_t id);
+void    Sched_Run(void) __attribute__((noreturn));
+uint8_t Sched_Serialize(uint8_t cmd, uint8_t reset, uint8_t* reply);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SCHED_H */
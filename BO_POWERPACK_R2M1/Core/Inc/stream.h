@@ -0,0 +1,52 @@
+/**
+  ******************************************************************************
+  * @file           : stream.h
+  * @brief          : Continuous dimmer setpoint streaming with a jitter buffer
+  ******************************************************************************
+  */
+
+#ifndef __STREAM_H
+#define __STREAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define STREAM_BUFFER_SLOTS     64    // power of two, 6 bytes per slot
+#define STREAM_RECORD_SIZE      6     // ts_ms(2) + dimmer1(2) + dimmer2(2) levels, big-endian
+#define STREAM_FRAME_HEADER     3     // cmd, seq, record count
+#define STREAM_FRAME_MAX_RECORDS 10   // 3 + 10 x 6 = 63 bytes per USB packet
+#define STREAM_DEFAULT_LATENCY_MS 20
+
+// Status codes (byte 2 of the data acknowledgement)
+#define STREAM_OK               0x00
+#define STREAM_ERR_STATE        0x01
+#define STREAM_ERR_RANGE        0x02
+#define STREAM_ERR_OVERFLOW     0x03  // host sent more records than credited
+
+typedef struct {
+  uint8_t  fill;          // records waiting now
+  uint8_t  fill_min;      // since the last stats read
+  uint8_t  fill_max;
+  uint16_t underruns;     // playout ticks that found the buffer empty
+  uint16_t late;          // records whose timestamp had already passed
+  uint16_t overflows;     // records dropped for lack of space
+  uint32_t played;
+} StreamStats_t;
+
+uint8_t Stream_Start(uint8_t channel_mask, uint16_t latency_ms);
+void    Stream_Stop(void);
+uint8_t Stream_IsActive(void);
+uint8_t Stream_Push(const uint8_t* frame, uint16_t length);
+uint8_t Stream_GetFreeSlots(void);
+void    Stream_GetStats(StreamStats_t* stats, uint8_t reset);
+
+void    Stream_TimerTick(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STREAM_H */
@@ -0,0 +1,82 @@
+/**
+  ******************************************************************************
+  * @file           : telemetry.h
+  * @brief          : Compact status stream: field bitmap and zigzag-varint deltas
+  ******************************************************************************
+  */
+
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define TELEMETRY_FRAME         0x29  // first byte of every stream frame (not a command)
+#define TELEMETRY_TICK_MS       5     // task period; intervals are rounded up to it
+#define TELEMETRY_MIN_INTERVAL_MS TELEMETRY_TICK_MS
+#define TELEMETRY_HISTORY       16    // snapshots kept for host acks, power of two
+#define TELEMETRY_DEFAULT_KEY_EVERY 100
+#define TELEMETRY_REPLY_SIZE    40
+
+// Snapshot fields, in bitmap order; PC_APP TELEMETRY_FIELDS must match (append only)
+typedef enum {
+  TELEMETRY_FIELD_RELAYS = 0,
+  TELEMETRY_FIELD_ENABLES,
+  TELEMETRY_FIELD_DIMMER,         // DIMMER_COUNT levels from here
+  TELEMETRY_FIELD_TEMPERATURE = TELEMETRY_FIELD_DIMMER + DIMMER_COUNT,  // 0.1 C
+  TELEMETRY_FIELD_VDDA,           // mV
+  TELEMETRY_FIELDS
+} TelemetryField_t;
+
+// [TELEMETRY_FRAME, seq, ref, bitmap varint, one zigzag varint per set bit].
+// Worst case with every field present: the zigzag delta of two n-bit values
+// has n + 1 bits (masks: channel count, levels, temperature, VDDA: 16).
+#define TELEMETRY_VARINT_SIZE(bits) (((bits) + 6) / 7)
+#define TELEMETRY_FRAME_MAX     (3 + TELEMETRY_VARINT_SIZE(TELEMETRY_FIELDS) +        \
+                                 TELEMETRY_VARINT_SIZE(RELAY_COUNT + 1) +             \
+                                 TELEMETRY_VARINT_SIZE(DIMMER_COUNT + 1) +            \
+                                 (DIMMER_COUNT + 2) * TELEMETRY_VARINT_SIZE(16 + 1))
+
+// CMD_TELEMETRY param
+#define TELEMETRY_CMD_STOP      0x00
+#define TELEMETRY_CMD_START     0x01  // [cmd, 1, interval_ms u16, key_every u16], 0 = default
+#define TELEMETRY_CMD_ACK       0x02  // [cmd, 2, seq], no reply
+#define TELEMETRY_CMD_STATS     0x03
+#define TELEMETRY_CMD_STATS_RESET 0x04
+
+#define TELEMETRY_OK            0x00
+#define TELEMETRY_ERR_RANGE     0x01
+
+typedef struct {
+  uint32_t frames;            // frames queued on the CDC endpoint
+  uint32_t key_frames;
+  uint32_t bytes;
+  uint32_t dropped;           // endpoint busy: frame not sent, seq not used
+  uint32_t acks;              // acks that moved the reference
+  uint32_t cycles;            // CPU cycles spent encoding
+  uint32_t cycles_max;
+} TelemetryStats_t;
+
+_Static_assert(TELEMETRY_FIELDS <= 32, "one bitmap bit per field");
+// Only a table of 16 relays and 16 dimmers can pass 64 bytes (66), and only
+// when nearly every field changes; such a frame goes out as two USB packets.
+// Relay rows past the two timer engines use RELAY_TIMER_NONE (relay_timer.h)
+_Static_assert(TELEMETRY_FRAME_MAX <= 2 * 64, "a frame must fit two USB packets");
+_Static_assert((TELEMETRY_HISTORY & (TELEMETRY_HISTORY - 1)) == 0 && TELEMETRY_HISTORY <= 128,
+               "seq is 8 bits wide");
+
+uint8_t Telemetry_Start(uint16_t interval_ms, uint16_t key_every);
+void    Telemetry_Stop(void);
+uint8_t Telemetry_IsActive(void);
+void    Telemetry_Ack(uint8_t seq);
+void    Telemetry_Tick(void);
+uint8_t Telemetry_Serialize(uint8_t cmd, uint8_t status, uint8_t reset, uint8_t* reply);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TELEMETRY_H */
@@ -0,0 +1,72 @@
+/**
+  ******************************************************************************
+  * @file           : timing.h
+  * @brief          : DWT cycle statistics for the USB ISR and command path
+  ******************************************************************************
+  */
+
+#ifndef __TIMING_H
+#define __TIMING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+/* Timed sections. The order is the wire order of the GET_TIMING reply and
+ * must match TIMING_NAMES in PC_APP/powerpack_controller.py; only append. */
+typedef enum {
+  TIMING_USB_ISR = 0,         // USB_LP_CAN1_RX0_IRQHandler entry to exit
+  TIMING_CMD_EXEC,            // Process_USB_Command() call
+  TIMING_CMD_LATENCY,         // packet received in the ISR to command done
+  TIMING_SOF_INTERVAL,        // between SOF callbacks: 48000 + USB ISR entry jitter
+  TIMING_COUNT
+} TimingId_t;
+
+#define TIMING_REPLY_HEADER     4     // cmd, flags, count, deferred queue high water
+#define TIMING_ENTRY_SIZE       14    // samples u16 (saturating), min, avg, max u32
+#define TIMING_REPLY_SIZE       (TIMING_REPLY_HEADER + TIMING_ENTRY_SIZE * TIMING_COUNT)
+#define TIMING_FLAG_RAM         0x01  // hot path runs from RAM (.RamFunc)
+
+_Static_assert(TIMING_REPLY_SIZE <= 64, "GET_TIMING reply must fit one USB packet");
+
+typedef struct {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t total;
+} TimingStat_t;
+
+extern TimingStat_t timing[TIMING_COUNT];
+
+static inline uint32_t Timing_Start(void)
+{
+  return DWT->CYCCNT;
+}
+
+/**
+  * @brief Add one sample; each section is recorded from a single context
+  * @param id: Section
+  * @param start: Timing_Start() value at entry
+  * @retval None
+  */
+static inline void Timing_Record(TimingId_t id, uint32_t start)
+{
+  uint32_t cycles = DWT->CYCCNT - start;
+  TimingStat_t* t = &timing[id];
+
+  if (t->count == 0 || cycles < t->min) t->min = cycles;
+  if (cycles > t->max) t->max = cycles;
+  t->total += cycles;
+  t->count++;
+}
+
+void Timing_Init(void);
+void Timing_Snapshot(uint8_t* reply, uint8_t cmd, uint8_t flags, uint8_t reset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TIMING_H */
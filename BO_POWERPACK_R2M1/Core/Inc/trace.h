@@ -0,0 +1,100 @@
+/**
+  ******************************************************************************
+  * @file           : trace.h
+  * @brief          : Always-on binary event trace ring buffer
+  ******************************************************************************
+  */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define TRACE_ENTRIES           128   // power of two, 12 bytes each
+#define TRACE_CYCLES_PER_US     48    // HCLK from SystemClock_Config()
+#define TRACE_WIRE_ENTRY_SIZE   9     // ts_us(4) + id(1) + arg(4), big-endian
+
+/* Event IDs. Must match TRACE_EVENT_NAMES in PC_APP/powerpack_controller.py. */
+typedef enum {
+  TRACE_CMD_RX = 1,       // USB receive path, arg: cmd | param << 8 | length << 16
+  TRACE_CMD_START,        // main loop dispatch, arg: cmd
+  TRACE_CMD_END,          // arg: cmd
+  TRACE_RELAY,            // arg: relay << 8 | state
+  TRACE_DIMMER,           // arg: channel << 16 | code
+  TRACE_DIMMER_ENABLE,    // arg: channel << 8 | enable
+  TRACE_I2C_START,        // arg: address << 24 | reg << 16 | value
+  TRACE_I2C_STOP,         // arg: 0 = OK, else HAL status / error code
+  TRACE_USB_TX_START,     // arg: length
+  TRACE_USB_TX_BUSY,      // arg: length
+  TRACE_USB_TX_DONE,      // arg: endpoint
+  TRACE_APPLY_STATE,      // arg: changed relays | enables << 8 | dimmers << 16 (channels 1-8)
+  TRACE_GPIO_WRITE,       // arg: BSRR value (reset pins << 16 | set pins)
+  TRACE_TRIGGER           // arg: TRIGGER_ACTION_* | entry-to-output cycles << 8
+} TraceEventId_t;
+
+typedef struct {
+  uint32_t ts_us;
+  uint32_t arg;
+  uint8_t  id;
+} TraceEntry_t;
+
+extern TraceEntry_t trace_buffer[TRACE_ENTRIES];
+extern volatile uint32_t trace_head;      // events recorded since reset
+extern volatile uint32_t trace_dropped;   // events lost while frozen
+extern volatile uint8_t trace_frozen;
+
+/**
+  * @brief Microseconds since reset from the HAL tick and the SysTick counter
+  * @note  Call with IRQs masked. A tick that is pending but not yet counted
+  *        (SysTick runs at the lowest priority) is added here.
+  * @retval Timestamp, wraps after 2^32 us
+  */
+static inline uint32_t Trace_Timestamp(void)
+{
+  uint32_t ms = uwTick;
+  uint32_t val = SysTick->VAL;
+
+  if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+    ms++;
+    val = SysTick->VAL;
+  }
+  return ms * 1000 + (SysTick->LOAD - val) / TRACE_CYCLES_PER_US;
+}
+
+/**
+  * @brief Record one event; safe from any context
+  * @param id: TRACE_* event
+  * @param arg: Event argument
+  * @retval None
+  */
+static inline void Trace_Event(uint8_t id, uint32_t arg)
+{
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  if (trace_frozen) {
+    trace_dropped++;
+  } else {
+    TraceEntry_t* e = &trace_buffer[trace_head++ & (TRACE_ENTRIES - 1)];
+    e->ts_us = Trace_Timestamp();
+    e->arg = arg;
+    e->id = id;
+  }
+  __set_PRIMASK(primask);
+}
+
+void     Trace_Freeze(uint8_t frozen);
+void     Trace_Clear(void);
+uint16_t Trace_GetCount(void);
+void     Trace_Serialize(uint16_t index, uint8_t* dest);
+uint32_t Trace_Now(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TRACE_H */
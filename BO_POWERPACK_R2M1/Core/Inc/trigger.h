@@ -0,0 +1,84 @@
+/**
+  ******************************************************************************
+  * @file           : trigger.h
+  * @brief          : External trigger input with a pre-armed output action
+  ******************************************************************************
+  */
+
+#ifndef __TRIGGER_H
+#define __TRIGGER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+#include "channels.h"
+
+#define TRIGGER_GPIO_Port       GPIOA
+#define TRIGGER_Pin             GPIO_PIN_3    // PA3, EXTI line 3, not used on either board revision
+#define TRIGGER_EXTI_LINE       (1UL << 3)
+
+#define TRIGGER_DEBOUNCE_MAX_US 200   // spent inside the interrupt, before the action
+#define TRIGGER_REPLY_SIZE      32
+
+// CMD_TRIGGER param; every sub-command replies with Trigger_Serialize()
+#define TRIGGER_CMD_DISARM      0x00
+#define TRIGGER_CMD_ARM_STATE   0x01  // [cmd, 1, STATE_* fields, on bits, level1 u16, level2 u16]
+#define TRIGGER_CMD_ARM_WAVE    0x02  // [cmd, 2, sample_rate u16, WAVE_MODE_*]
+#define TRIGGER_CMD_CONFIG      0x03  // [cmd, 3, holdoff_ms u16, TRIGGER_FLAG_*, 0, debounce_us u16]
+#define TRIGGER_CMD_STATS       0x04
+#define TRIGGER_CMD_STATS_RESET 0x05
+
+// TRIGGER_CMD_CONFIG flags
+#define TRIGGER_FLAG_FALLING    0x01  // falling edge with the pull-up, else rising with the pull-down
+#define TRIGGER_FLAG_REARM      0x02  // stay armed after firing, else one shot
+
+// Armed action
+#define TRIGGER_ACTION_NONE     0
+#define TRIGGER_ACTION_STATE    1
+#define TRIGGER_ACTION_WAVE     2
+
+// CMD_TRIGGER status
+#define TRIGGER_OK              0x00
+#define TRIGGER_ERR_RANGE       0x01
+#define TRIGGER_ERR_STATE       0x02  // no committed waveform, or it cannot play at that rate
+#define TRIGGER_ERR_NO_DEVICE   0x03  // no GP8413 answered for a dimmer in the action
+#define TRIGGER_ERR_LATCHED     0x04  // a latching relay moves with a 20 ms pulse, not on an edge
+
+typedef struct {
+  uint32_t fired;
+  uint32_t holdoff;           // edges inside the holdoff after a fire
+  uint32_t debounce;          // edges whose level did not hold for debounce_us
+  uint32_t late;              // fires whose DAC or waveform part went to the main loop
+  uint32_t latency_last;      // CPU cycles from interrupt entry to the outputs
+  uint32_t latency_max;
+} TriggerStats_t;
+
+// What a fire left for the main loop (Task_Trigger in main.c)
+typedef struct {
+  uint16_t relays;            // relays the fire switched, for the switch counters
+  uint16_t dimmer_mask;       // dimmers it could not write (bus, waveform or stream busy)
+  uint16_t level[DIMMER_COUNT];
+  uint8_t  wave_mode;         // waveform it could not start, WAVE_MODE_STOP if none
+  uint16_t wave_rate;
+} TriggerFollowUp_t;
+
+void    Trigger_Init(void);
+uint8_t Trigger_Configure(uint8_t flags, uint16_t holdoff_ms, uint16_t debounce_us);
+uint8_t Trigger_ArmState(const OutputUpdate_t* update);
+uint8_t Trigger_ArmWave(uint8_t mode, uint16_t sample_rate);
+void    Trigger_Disarm(void);
+void    Trigger_Hold(void);
+void    Trigger_Release(void);
+uint8_t Trigger_IsArmed(void);
+uint8_t Trigger_TakeFollowUp(TriggerFollowUp_t* follow);
+uint8_t Trigger_Serialize(uint8_t cmd, uint8_t status, uint8_t reset, uint8_t* reply);
+
+void    EXTI3_IRQHandler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TRIGGER_H */
@@ -0,0 +1,57 @@
+/**
+  ******************************************************************************
+  * @file           : watchdog.h
+  * @brief          : IWDG supervision with per-task liveness check-ins
+  ******************************************************************************
+  */
+
+#ifndef __WATCHDOG_H
+#define __WATCHDOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define WDG_TIMEOUT_MS          1000  // nominal; LSI is 30-60 kHz, so 0.67-1.33 s
+
+// Tasks that must check in between two feeds
+#define WDG_TASK_MAIN           0x01  // main loop pass
+#define WDG_TASK_USB            0x02  // USB SOF interrupt (only while configured)
+#define WDG_TASK_I2C            0x04  // I2C engine idle or completing transfers
+
+// CMD_WATCHDOG param
+#define WDG_CMD_INFO            0
+#define WDG_CMD_HANG_MAIN       1     // fault injection, DEBUG builds only
+#define WDG_CMD_HANG_USB        2
+#define WDG_CMD_HANG_I2C        3
+
+extern volatile uint8_t watchdog_alive;
+
+/**
+  * @brief Record that a task made progress (ISR safe)
+  * @param task: WDG_TASK_* bit
+  * @retval None
+  */
+static inline void Watchdog_CheckIn(uint8_t task)
+{
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  watchdog_alive |= task;
+  __set_PRIMASK(primask);
+}
+
+void     Watchdog_Init(void);
+void     Watchdog_Start(void);
+void     Watchdog_Service(void);
+uint8_t  Watchdog_GetRetainedState(PowerPackState_t* state);
+uint8_t  Watchdog_GetLastMissing(void);
+uint16_t Watchdog_GetResetCount(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WATCHDOG_H */
@@ -0,0 +1,55 @@
+/**
+  ******************************************************************************
+  * @file           : waveform.h
+  * @brief          : DAC waveform table upload and TIM3-paced playback
+  ******************************************************************************
+  */
+
+#ifndef __WAVEFORM_H
+#define __WAVEFORM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+/* Sample table: 2048 x 16-bit levels (0xFFFF = full scale) = 4 KB of the 20 KB RAM.
+ * With both channels selected the samples are interleaved (ch1, ch2, ...). */
+#define WAVE_MAX_SAMPLES        2048
+#define WAVE_CHUNK_MAX_SAMPLES  28    // 4 header + 56 data + 2 CRC <= 64-byte packet
+
+#define WAVE_CHANNEL_1          0x01
+#define WAVE_CHANNEL_2          0x02
+
+// Playback modes (CMD_WAVE_PLAY param)
+#define WAVE_MODE_STOP          0
+#define WAVE_MODE_ONESHOT       1
+#define WAVE_MODE_LOOP          2
+
+// Status codes returned in byte 1 of every waveform reply
+#define WAVE_OK                 0x00
+#define WAVE_ERR_RANGE          0x01
+#define WAVE_ERR_CRC            0x02
+#define WAVE_ERR_STATE          0x03
+#define WAVE_ERR_RATE           0x04
+
+uint8_t  Wave_BeginUpload(uint8_t channel_mask, uint16_t sample_count);
+uint8_t  Wave_WriteChunk(const uint8_t* frame, uint16_t length);
+uint8_t  Wave_Commit(uint16_t table_crc);
+uint8_t  Wave_Play(uint8_t mode, uint16_t sample_rate);
+uint8_t  Wave_CheckPlay(uint8_t mode, uint16_t sample_rate);
+void     Wave_Start(uint8_t mode, uint16_t sample_rate);
+void     Wave_Stop(void);
+uint8_t  Wave_IsPlaying(void);
+uint16_t Wave_GetNextOffset(void);
+uint16_t Wave_GetMaxSampleRate(void);
+uint32_t Wave_GetLateCount(void);
+
+void     Wave_TimerTick(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WAVEFORM_H */
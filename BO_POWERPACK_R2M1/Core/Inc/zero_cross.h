@@ -0,0 +1,37 @@
+/**
+  ******************************************************************************
+  * @file           : zero_cross.h
+  * @brief          : Mains zero-cross sync input for aligned relay switching
+  ******************************************************************************
+  */
+
+#ifndef __ZERO_CROSS_H
+#define __ZERO_CROSS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+#define ZERO_CROSS_GPIO_Port    GPIOA
+#define ZERO_CROSS_Pin          GPIO_PIN_2    // PA2, EXTI line 2, rising edge, pull-down
+#define ZERO_CROSS_EXTI_LINE    (1UL << 2)
+
+// Accepted edge spacing: 60 Hz half-wave to 40 Hz full-wave detectors
+#define ZERO_CROSS_MIN_US       4000
+#define ZERO_CROSS_MAX_US       25000
+#define ZERO_CROSS_TIMEOUT_US   60000         // no edge for this long: no mains, switch at once
+#define ZERO_CROSS_MARGIN_US    200           // earliest coil edge after the request
+
+void     ZeroCross_Init(void);
+uint8_t  ZeroCross_Delay(uint32_t lead_us, uint32_t* delay_us);
+uint16_t ZeroCross_GetIntervalUs(void);
+
+void     EXTI2_IRQHandler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ZERO_CROSS_H */
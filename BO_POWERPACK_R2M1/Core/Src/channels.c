@@ -0,0 +1,388 @@
+/**
+  ******************************************************************************
+  * @file           : channels.c
+  * @brief          : Compile-time output channel table (relays, GP8413 channels)
+  ******************************************************************************
+  * @attention
+  *
+  * Every output is a row in one of the tables below: a GPIO pin per relay
+  * with the timer engine for its timed edges (RELAY_TIMER_NONE if the
+  * row has none), and per dimmer the GP8413 address and register plus its enable pin. A
+  * larger PowerPack variant adds rows (and raises RELAY_COUNT/DIMMER_COUNT
+  * in main.h); the command handlers only see channel numbers and masks.
+  *
+  * GP8413s strap to 0x58-0x5F, two channels each. Dimmer rows that sit on
+  * the same device in register order go out as one I2C frame only when
+  * the row declares how far the register pointer moves per code
+  * (reg_stride); with 0 every channel gets its own frame. Keep each
+  * device's channels adjacent in the table so a declared stride can apply.
+  *
+  * safe_on in each row is the state the fault handler leaves that output
+  * in before the reset (Channels_SafeState()); this board keeps every
+  * relay and enable off.
+  *
+  * At boot Channels_Probe() addresses 0x58-0x5F once each and builds the
+  * channel map from the devices that answered. A row keeps its table
+  * address when that device is there. The rows of configured devices that
+  * are missing move, in address order, onto the devices that answered but
+  * no row names, so a chip strapped to 0x59 where the table says 0x58
+  * still drives its dimmers. Rows still without a device (or whose device
+  * refused its range write) are left out of every DAC write, and the
+  * command layer rejects them, so a missing chip is reported instead of
+  * failing silently. GET_CAPABILITIES reports the address each row uses.
+  *
+  ******************************************************************************
+  */
+
+#include "channels.h"
+#include "config.h"
+#include "dither.h"
+#include "output_drv.h"
+#include "relay_timer.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define CHANNEL_DAC_SLOTS       (GP8413_ADDRESS_LAST - GP8413_ADDRESS + 1)
+
+extern I2C_HandleTypeDef hi2c1;
+
+const RelayChannel_t relay_channels[RELAY_COUNT] = {
+#if RELAY_DRIVE == RELAY_DRIVE_LATCHING
+  { GPIO_M1_GPIO_Port, GPIO_M1_Pin, GPIO_M2_Pin, RELAY_TIMER_TIM2, 0 },   // relay 1, SET coil PB13, RESET coil PB12 (R1M1)
+#else
+  { GPIO_M1_GPIO_Port, GPIO_M1_Pin, 0, RELAY_TIMER_TIM2, 0 },             // relay 1, PB13
+  { GPIO_M2_GPIO_Port, GPIO_M2_Pin, 0, RELAY_TIMER_TIM1, 0 },             // relay 2, PB12
+#endif
+};
+
+const DimmerChannel_t dimmer_channels[DIMMER_COUNT] = {
+  { GP8413_ADDRESS, GP8413_REG_DAC1, GP8413_REG_STRIDE, DIM_OUT_EN_1_GPIO_Port, DIM_OUT_EN_1_Pin, 0 },   // dimmer 1, PB0
+  { GP8413_ADDRESS, GP8413_REG_DAC2, GP8413_REG_STRIDE, DIM_OUT_EN_2_GPIO_Port, DIM_OUT_EN_2_Pin, 0 },   // dimmer 2, PB1
+};
+
+static uint8_t dacs_found;                        // bit n: GP8413 at GP8413_ADDRESS + n answered
+static uint8_t dimmer_address[DIMMER_COUNT];      // device each row drives, set by Channels_Probe()
+static uint16_t dimmers_present = DIMMER_ALL;     // all rows until the bus has been probed
+
+/**
+  * @brief Select the output range of one GP8413
+  * @param address: 7-bit device address
+  * @param range: GP8413_RANGE_* byte for GP8413_REG_RANGE
+  * @retval HAL status
+  */
+HAL_StatusTypeDef GP8413_WriteRange(uint8_t address, uint8_t range)
+{
+  HAL_StatusTypeDef status;
+  uint8_t data[2];
+  data[0] = GP8413_REG_RANGE;
+  data[1] = range;
+
+  Trace_Event(TRACE_I2C_START, ((uint32_t)address << 24) | ((uint32_t)GP8413_REG_RANGE << 16) | range);
+  status = Output_I2C_Write(address, data, 2);
+  Trace_Event(TRACE_I2C_STOP, status);
+  Metrics_Inc((status == HAL_OK) ? METRIC_DAC_WRITES : METRIC_I2C_ERRORS);
+  return status;
+}
+
+/**
+  * @brief Find the GP8413s on the bus and map the table rows onto them
+  * @retval Bit n set if a device answered at GP8413_ADDRESS + n
+  * @note  Blocking; call at boot before any DAC write.
+  */
+uint8_t Channels_Probe(void)
+{
+  uint8_t slot[CHANNEL_DAC_SLOTS];    // configured slot -> slot used
+  uint8_t configured = 0;
+  uint8_t spare;
+  uint8_t next = 0;
+
+  dacs_found = 0;
+  for (uint8_t n = 0; n < CHANNEL_DAC_SLOTS; n++) {
+    if (HAL_I2C_IsDeviceReady(&hi2c1, (uint16_t)(GP8413_ADDRESS + n) << 1, 1, CHANNEL_PROBE_TIMEOUT_MS) == HAL_OK) {
+      dacs_found |= 1U << n;
+    }
+  }
+
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    configured |= 1U << (dimmer_channels[i].address - GP8413_ADDRESS);
+  }
+
+  // Missing configured devices take the unclaimed ones, both in address order
+  spare = dacs_found & ~configured;
+  for (uint8_t n = 0; n < CHANNEL_DAC_SLOTS; n++) {
+    slot[n] = n;
+    if (!(configured & ~dacs_found & (1U << n))) continue;
+    while (next < CHANNEL_DAC_SLOTS && !(spare & (1U << next))) next++;
+    if (next < CHANNEL_DAC_SLOTS) slot[n] = next++;
+  }
+
+  dimmers_present = 0;
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    uint8_t n = slot[dimmer_channels[i].address - GP8413_ADDRESS];
+
+    dimmer_address[i] = GP8413_ADDRESS + n;
+    if (dacs_found & (1U << n)) dimmers_present |= 1U << i;
+  }
+  return dacs_found;
+}
+
+/**
+  * @brief Device a dimmer row drives after the probe
+  * @param index: Dimmer row (0 = dimmer 1)
+  * @retval 7-bit address
+  */
+uint8_t Channels_DimmerAddress(uint8_t index)
+{
+  return dimmer_address[index];
+}
+
+uint8_t Channels_GetDacsFound(void)
+{
+  return dacs_found;
+}
+
+/**
+  * @brief Dimmer rows whose DAC is present
+  * @retval Bit n = dimmer n+1
+  */
+uint16_t Channels_DimmersPresent(void)
+{
+  return dimmers_present;
+}
+
+/**
+  * @brief Set the 0-10 V range on every GP8413 the present rows drive
+  * @retval HAL_OK, or the status of the first device that failed
+  * @note  A device that fails the write is dropped from the present rows.
+  */
+HAL_StatusTypeDef Channels_ConfigureDacs(void)
+{
+  HAL_StatusTypeDef result = HAL_OK;
+  uint8_t done = 0;           // bit per address 0x58-0x5F
+
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    uint8_t address = dimmer_address[i];
+    uint8_t bit = 1U << (address - GP8413_ADDRESS);
+    HAL_StatusTypeDef status;
+
+    if (!(dimmers_present & (1U << i)) || (done & bit)) continue;
+    done |= bit;
+    status = GP8413_WriteRange(address, GP8413_RANGE_10V);
+    if (status == HAL_OK) continue;
+
+    if (result == HAL_OK) result = status;
+    dacs_found &= ~bit;
+    for (uint8_t j = 0; j < DIMMER_COUNT; j++) {
+      if (dimmer_address[j] == address) dimmers_present &= ~(1U << j);
+    }
+  }
+  return result;
+}
+
+/**
+  * @brief Write a set of DAC channels, one I2C frame per run of declared-adjacent registers
+  * @param mask: Dimmer channels to write (bit n = dimmer n+1)
+  * @param codes: DIMMER_COUNT 15-bit codes indexed by channel; only masked ones are read
+  * @retval HAL_OK, or the status of the first frame that failed
+  * @note  Rows without a present DAC are skipped. The dither is held off
+  *        the bus for the duration.
+  * @note  Rows follow the first row of a frame only when its reg_stride is
+  *        set and their register is that many steps further; each merged
+  *        channel then costs 16 SCL periods instead of a whole frame.
+  */
+HAL_StatusTypeDef Channels_WriteDimmers(uint16_t mask, const uint16_t* codes)
+{
+  HAL_StatusTypeDef result = HAL_OK;
+  uint8_t data[1 + 2 * DIMMER_COUNT];
+  uint8_t i = 0;
+
+  mask &= dimmers_present;
+  Dither_Hold(1);
+
+  while (i < DIMMER_COUNT) {
+    const DimmerChannel_t* first = &dimmer_channels[i];
+    uint8_t address = dimmer_address[i];
+    uint8_t length = 1;
+    uint8_t n = i;
+    HAL_StatusTypeDef status;
+
+    if (!(mask & (1U << i))) {
+      i++;
+      continue;
+    }
+
+    data[0] = first->reg;
+    do {
+      uint16_t word = codes[n] << GP8413_CODE_SHIFT;
+      data[length++] = word & 0xFF;
+      data[length++] = (word >> 8) & 0xFF;
+      n++;
+    } while (first->reg_stride != 0 && n < DIMMER_COUNT && (mask & (1U << n)) &&
+             dimmer_address[n] == address &&
+             dimmer_channels[n].reg == first->reg + (n - i) * first->reg_stride);
+
+    Trace_Event(TRACE_I2C_START, ((uint32_t)address << 24) | ((uint32_t)first->reg << 16) | codes[i]);
+    status = Output_I2C_Write(address, data, length);
+    Trace_Event(TRACE_I2C_STOP, status);
+    Metrics_Inc((status == HAL_OK) ? METRIC_DAC_WRITES : METRIC_I2C_ERRORS);
+    if (status != HAL_OK && result == HAL_OK) result = status;
+    i = n;
+  }
+
+  Dither_Hold(0);
+  return result;
+}
+
+/**
+  * @brief Relay rows driven through SET/RESET coils
+  * @retval Bit n = relay n+1
+  */
+uint16_t Channels_LatchingRelays(void)
+{
+  uint16_t latching = 0;
+
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    if (relay_channels[i].reset_pin) latching |= 1U << i;
+  }
+  return latching;
+}
+
+static void Channels_AddPin(PortWrite_t* ports, uint8_t* count, GPIO_TypeDef* port, uint16_t pin, uint8_t on)
+{
+  uint8_t p;
+
+  for (p = 0; p < *count && ports[p].port != port; p++) {
+  }
+  if (p == *count) {
+    if (*count == CHANNEL_MAX_PORTS) return;
+    ports[(*count)++].port = port;
+  }
+  if (on) {
+    ports[p].set |= pin;
+  } else {
+    ports[p].reset |= pin;
+  }
+}
+
+/**
+  * @brief Group relay and enable pin changes into one set/reset pair per port
+  * @param ports: CHANNEL_MAX_PORTS entries, filled from the start
+  * @param relay_set: Relays to switch on
+  * @param relay_reset: Relays to switch off
+  * @param enable_set: Dimmer enables to switch on
+  * @param enable_reset: Dimmer enables to switch off
+  * @retval Entries used
+  * @note  Latching relays are left out: they move with a coil pulse.
+  */
+uint8_t Channels_PlanPins(PortWrite_t* ports, uint16_t relay_set, uint16_t relay_reset,
+                          uint16_t enable_set, uint16_t enable_reset)
+{
+  uint8_t count = 0;
+
+  for (uint8_t p = 0; p < CHANNEL_MAX_PORTS; p++) {
+    ports[p] = (PortWrite_t){0};
+  }
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    uint16_t bit = 1U << i;
+    if (!relay_channels[i].reset_pin && ((relay_set | relay_reset) & bit)) {
+      Channels_AddPin(ports, &count, relay_channels[i].port, relay_channels[i].pin, (relay_set & bit) != 0);
+    }
+  }
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    uint16_t bit = 1U << i;
+    if ((enable_set | enable_reset) & bit) {
+      Channels_AddPin(ports, &count, dimmer_channels[i].enable_port, dimmer_channels[i].enable_pin,
+                      (enable_set & bit) != 0);
+    }
+  }
+  return count;
+}
+
+/**
+  * @brief Switch relays and dimmer enables, one BSRR store per GPIO port
+  * @param relay_set: Relays to switch on
+  * @param relay_reset: Relays to switch off
+  * @param enable_set: Dimmer enables to switch on
+  * @param enable_reset: Dimmer enables to switch off
+  * @retval None
+  * @note  A latching relay gets its coil pulse after the stores. A relay
+  *        in config.zero_cross_mask is left to its timer, which switches
+  *        it on the next mains crossing.
+  */
+void Channels_WritePins(uint16_t relay_set, uint16_t relay_reset, uint16_t enable_set, uint16_t enable_reset)
+{
+  PortWrite_t ports[CHANNEL_MAX_PORTS];
+  uint16_t latch = 0;
+  uint16_t synced = 0;
+  uint8_t count;
+
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    uint16_t bit = 1U << i;
+    if (relay_channels[i].reset_pin) {
+      latch |= (relay_set | relay_reset) & bit;
+    } else if (((relay_set | relay_reset) & config.zero_cross_mask & bit) &&
+               RelayTimer_SwitchZeroCross(i, (relay_set & bit) != 0)) {
+      synced |= bit;
+    }
+  }
+  count = Channels_PlanPins(ports, relay_set & ~synced, relay_reset & ~synced, enable_set, enable_reset);
+
+  for (uint8_t p = 0; p < count; p++) {
+    Trace_Event(TRACE_GPIO_WRITE, ports[p].set | (uint32_t)ports[p].reset << 16);
+    Output_WritePort(ports[p].port, ports[p].set, ports[p].reset);
+  }
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    if (latch & (1U << i)) RelayTimer_Latch(i, (relay_set & (1U << i)) != 0);
+  }
+}
+
+/**
+  * @brief Drive every relay and dimmer enable to its row's safe_on without HAL calls
+  * @retval None
+  * @note  Called from the fault handler, on its private stack, and from
+  *        Error_Handler() before the IWDG resets the MCU. A latching relay
+  *        cannot be left to the reset: its safe coil gets a full
+  *        RELAY_LATCH_PULSE_MS here, timed on the DWT because interrupts
+  *        are off.
+  */
+void Channels_SafeState(void)
+{
+  uint8_t latching = 0;
+
+  RelayTimer_Halt();
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    const RelayChannel_t* relay = &relay_channels[i];
+
+    if (relay->reset_pin) {
+      uint16_t coil = relay->safe_on ? relay->pin : relay->reset_pin;
+      uint16_t other = relay->safe_on ? relay->reset_pin : relay->pin;
+
+      relay->port->BSRR = coil | (uint32_t)other << 16;
+      latching = 1;
+    } else {
+      relay->port->BSRR = relay->safe_on ? relay->pin : (uint32_t)relay->pin << 16;
+    }
+  }
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    const DimmerChannel_t* dimmer = &dimmer_channels[i];
+
+    dimmer->enable_port->BSRR = dimmer->safe_on ? dimmer->enable_pin : (uint32_t)dimmer->enable_pin << 16;
+  }
+
+  if (latching) {
+    uint32_t cycles = RELAY_LATCH_PULSE_MS * (SystemCoreClock / 1000);
+    uint32_t start;
+
+    // The fault may come before Timing_Init() has started the counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    start = DWT->CYCCNT;
+    while (DWT->CYCCNT - start < cycles) {
+    }
+    for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+      const RelayChannel_t* relay = &relay_channels[i];
+
+      if (relay->reset_pin) relay->port->BSRR = (uint32_t)(relay->pin | relay->reset_pin) << 16;
+    }
+  }
+}
@@ -0,0 +1,105 @@
+/**
+  ******************************************************************************
+  * @file           : config.c
+  * @brief          : Board settings kept in the last flash page
+  ******************************************************************************
+  * @attention
+  *
+  * Values that belong to one board rather than to the firmware (relay
+  * operate and release times measured on the bench, the zero-cross
+  * settings) live in the last 1 KB page of flash, which the linker script
+  * keeps out of the image. At boot the page is copied to RAM if its magic,
+  * version and CRC-16 check out; otherwise the defaults apply (no
+  * compensation, no zero-cross switching) and the page is left as it is.
+  *
+  * Commands change the RAM copy; Config_Save() writes it back. Erasing the
+  * page stalls the CPU, interrupts included, for 20-40 ms, well inside the
+  * watchdog timeout, so only an explicit save command does it.
+  *
+  ******************************************************************************
+  */
+
+#include "config.h"
+#include "crc16.h"
+
+#include <stddef.h>
+#include <string.h>
+
+extern uint32_t _config_start[];      // STM32F103C8TX_FLASH.ld
+
+Config_t config;
+
+static uint8_t config_stored;
+
+static uint16_t Config_Crc(const Config_t* c)
+{
+  return CRC16_Update(CRC16_INIT, (const uint8_t*)c, offsetof(Config_t, crc));
+}
+
+static void Config_Defaults(void)
+{
+  memset(&config, 0, sizeof(config));
+  config.magic = CONFIG_MAGIC;
+  config.version = CONFIG_VERSION;
+  config.size = sizeof(config);
+}
+
+/**
+  * @brief Load the stored settings, or the defaults if the page holds none
+  * @retval None
+  */
+void Config_Init(void)
+{
+  const Config_t* stored = (const Config_t*)_config_start;
+
+  if (stored->magic == CONFIG_MAGIC && stored->version == CONFIG_VERSION &&
+      stored->size == sizeof(Config_t) && stored->crc == Config_Crc(stored)) {
+    config = *stored;
+    config_stored = 1;
+  } else {
+    Config_Defaults();
+    config_stored = 0;
+  }
+}
+
+/**
+  * @brief 1 if the RAM copy came from flash or has been saved since
+  */
+uint8_t Config_IsStored(void)
+{
+  return config_stored;
+}
+
+/**
+  * @brief Erase the page and program the RAM copy into it
+  * @retval HAL status
+  */
+HAL_StatusTypeDef Config_Save(void)
+{
+  FLASH_EraseInitTypeDef erase = {
+    .TypeErase = FLASH_TYPEERASE_PAGES,
+    .PageAddress = (uint32_t)_config_start,
+    .NbPages = 1,
+  };
+  const uint16_t* src = (const uint16_t*)&config;
+  uint32_t page_error;
+  HAL_StatusTypeDef status;
+
+  config.magic = CONFIG_MAGIC;
+  config.version = CONFIG_VERSION;
+  config.size = sizeof(config);
+  config.crc = Config_Crc(&config);
+
+  HAL_FLASH_Unlock();
+  status = HAL_FLASHEx_Erase(&erase, &page_error);
+  for (uint32_t i = 0; status == HAL_OK && i < sizeof(config) / 2; i++) {
+    status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, (uint32_t)_config_start + 2 * i, src[i]);
+  }
+  HAL_FLASH_Lock();
+
+  if (status == HAL_OK && memcmp(_config_start, &config, sizeof(config)) != 0) {
+    status = HAL_ERROR;
+  }
+  config_stored = (status == HAL_OK);
+  return status;
+}
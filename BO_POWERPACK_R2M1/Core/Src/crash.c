@@ -0,0 +1,224 @@
+/**
+  ******************************************************************************
+  * @file           : crash.c
+  * @brief          : Fault capture to no-init RAM and crash report on next boot
+  ******************************************************************************
+  * @attention
+  *
+  * HardFault, MemManage, BusFault and UsageFault all enter Crash_FaultEntry.
+  * It drives every relay and dimmer enable of the channel table to the
+  * safe state its row configures (safe_on, all off on this board; a
+  * latching relay gets a coil pulse to get there),
+  * copies the stacked registers, the fault status registers and a few words
+  * of stack into a report in the .noinit section, and resets the MCU. The
+  * handler uses no HAL calls and runs on a private stack, so it still
+  * works after a stack overflow or handle corruption.
+  *
+  * .noinit is not touched by the startup code. After the reset the report
+  * is accepted only if its magic and CRC match, so a power-on leaves no
+  * stale report behind. The four handlers are not generated by CubeMX
+  * (NVIC "Generate IRQ handler" is off for them in the .ioc).
+  *
+  ******************************************************************************
+  */
+
+#include "crash.h"
+#include "channels.h"
+#include "crc16.h"
+#include <stddef.h>
+#include <string.h>
+
+#define CRASH_MAGIC             0xDEADC0DEUL
+#define CRASH_RAM_START         0x20000000UL
+#define CRASH_HANDLER_STACK     256   // bytes, see crash_stack in Crash_FaultEntry
+#define CRASH_STR_(x)           #x
+#define CRASH_STR(x)            CRASH_STR_(x)
+
+extern uint32_t _estack;
+
+__attribute__((section(".noinit"))) static CrashReport_t crash_report;
+
+// Private stack for Crash_Capture: the fault may be a main stack overflow.
+// Referenced by name from Crash_FaultEntry, so LTO must not rename it.
+__attribute__((used, externally_visible, aligned(8))) uint8_t crash_stack[CRASH_HANDLER_STACK];
+
+static uint8_t crash_valid;
+static uint8_t crash_reset_flags;
+
+/**
+  * @brief CRC over the report body (everything after the crc field)
+  * @retval CRC-16
+  */
+static uint16_t Crash_ReportCrc(void)
+{
+  const uint8_t* body = (const uint8_t*)&crash_report.count;
+
+  return CRC16_Update(CRC16_INIT, body, sizeof(crash_report) - offsetof(CrashReport_t, count));
+}
+
+/**
+  * @brief Check the report left by the previous run and latch the reset cause
+  * @retval None
+  * @note  Call first thing in main(), before HAL_Init()
+  */
+void Crash_Init(void)
+{
+  crash_reset_flags = (RCC->CSR >> 24) & 0xFC;
+  RCC->CSR |= RCC_CSR_RMVF;
+
+  // Report bus, memory and usage faults as themselves instead of escalated HardFaults
+  SCB->SHCSR |= SCB_SHCSR_MEMFAULTENA_Msk | SCB_SHCSR_BUSFAULTENA_Msk | SCB_SHCSR_USGFAULTENA_Msk;
+
+  crash_valid = (crash_report.magic == CRASH_MAGIC && crash_report.crc == Crash_ReportCrc());
+  if (!crash_valid) {
+    crash_report.magic = 0;
+  }
+}
+
+uint8_t Crash_IsValid(void)
+{
+  return crash_valid;
+}
+
+/**
+  * @brief Reset cause of this boot
+  * @retval RCC_CSR bits 31..26 (LPWR, WWDG, IWDG, SFT, POR, PIN) in bits 7..2
+  */
+uint8_t Crash_GetResetFlags(void)
+{
+  return crash_reset_flags;
+}
+
+const CrashReport_t* Crash_GetReport(void)
+{
+  return &crash_report;
+}
+
+void Crash_Clear(void)
+{
+  crash_report.magic = 0;
+  crash_valid = 0;
+}
+
+/**
+  * @brief Serialize one page of the report for GET_CRASH
+  * @param page: CRASH_PAGE_REGISTERS or CRASH_PAGE_STACK
+  * @param cmd: Command byte echoed in byte 0
+  * @param reply: CRASH_REPLY_SIZE bytes
+  * @retval Reply length
+  *
+  * Page 0: [cmd, 0, valid, reset_flags, ipsr, exc_return, r0, r1, r2, r3,
+  *          r12, lr, pc, xpsr, sp, cfsr, hfsr, bfar]
+  * Page 1: [cmd, 1, count, stack_words, mmfar, uptime_ms, stack...]
+  * valid: 0 = no report, 1 = report, 2 = report without registers (the
+  * stacked frame was outside RAM). Words are u32 big-endian.
+  */
+uint8_t Crash_Serialize(uint8_t page, uint8_t cmd, uint8_t* reply)
+{
+  const CrashReport_t* r = &crash_report;
+  uint32_t words[14] = {0};
+
+  reply[0] = cmd;
+  reply[1] = page;
+
+  if (page == CRASH_PAGE_REGISTERS) {
+    reply[2] = crash_valid ? (r->frame_valid ? 1 : 2) : 0;
+    reply[3] = crash_reset_flags;
+    if (crash_valid) {
+      uint32_t regs[14] = { r->ipsr, r->exc_return, r->r0, r->r1, r->r2, r->r3, r->r12,
+                            r->lr, r->pc, r->xpsr, r->sp, r->cfsr, r->hfsr, r->bfar };
+      memcpy(words, regs, sizeof(words));
+    }
+  } else {
+    reply[2] = crash_valid ? ((r->count > 255) ? 255 : r->count) : 0;
+    reply[3] = crash_valid ? r->stack_words : 0;
+    if (crash_valid) {
+      words[0] = r->mmfar;
+      words[1] = r->uptime_ms;
+      memcpy(&words[2], r->stack, sizeof(r->stack));
+    }
+  }
+
+  for (uint8_t i = 0; i < 14; i++) {
+    reply[4 + 4 * i] = (words[i] >> 24) & 0xFF;
+    reply[5 + 4 * i] = (words[i] >> 16) & 0xFF;
+    reply[6 + 4 * i] = (words[i] >> 8) & 0xFF;
+    reply[7 + 4 * i] = words[i] & 0xFF;
+  }
+  return CRASH_REPLY_SIZE;
+}
+
+/**
+  * @brief Record the fault and reset (called from Crash_FaultEntry)
+  * @param frame: Exception stack frame (r0, r1, r2, r3, r12, lr, pc, xpsr)
+  * @param exc_return: LR value on exception entry
+  * @retval None
+  */
+__attribute__((noreturn, used, externally_visible)) void Crash_Capture(uint32_t* frame, uint32_t exc_return)
+{
+  CrashReport_t* r = &crash_report;
+  uint32_t addr = (uint32_t)frame;
+  uint32_t ram_end = (uint32_t)&_estack;
+  uint16_t count = (r->magic == CRASH_MAGIC && r->crc == Crash_ReportCrc()) ? r->count : 0;
+
+  // Outputs first: a fault must not leave a relay or dimmer stuck on
+  Channels_SafeState();
+
+  memset(r, 0, sizeof(*r));
+  r->count = count + 1;
+  r->ipsr = __get_IPSR();
+  r->exc_return = exc_return;
+  r->cfsr = SCB->CFSR;
+  r->hfsr = SCB->HFSR;
+  r->bfar = SCB->BFAR;
+  r->mmfar = SCB->MMFAR;
+  r->uptime_ms = uwTick;
+
+  if (addr >= CRASH_RAM_START && addr + 32 <= ram_end && (addr & 3) == 0) {
+    r->frame_valid = 1;
+    r->r0 = frame[0];
+    r->r1 = frame[1];
+    r->r2 = frame[2];
+    r->r3 = frame[3];
+    r->r12 = frame[4];
+    r->lr = frame[5];
+    r->pc = frame[6];
+    r->xpsr = frame[7];
+    // Hardware aligned the frame to 8 bytes if xPSR bit 9 is set
+    r->sp = addr + 32 + ((r->xpsr & (1UL << 9)) ? 4 : 0);
+
+    for (uint32_t p = addr + 32; p + 4 <= ram_end && r->stack_words < CRASH_STACK_WORDS; p += 4) {
+      r->stack[r->stack_words++] = *(uint32_t*)p;
+    }
+  }
+
+  r->magic = CRASH_MAGIC;
+  r->crc = Crash_ReportCrc();
+
+  NVIC_SystemReset();
+}
+
+/**
+  * @brief Common entry for the fault handlers
+  * @retval None
+  * @note  Picks the stack the frame was pushed to, then moves MSP to
+  *        crash_stack before entering C.
+  */
+__attribute__((naked)) void Crash_FaultEntry(void)
+{
+  __asm volatile(
+    "tst   lr, #4                  \n"
+    "ite   eq                      \n"
+    "mrseq r0, msp                 \n"
+    "mrsne r0, psp                 \n"
+    "mov   r1, lr                  \n"
+    "ldr   r2, =crash_stack + " CRASH_STR(CRASH_HANDLER_STACK) " \n"
+    "msr   msp, r2                 \n"
+    "b     Crash_Capture           \n"
+    ".ltorg                        \n");
+}
+
+void HardFault_Handler(void) __attribute__((alias("Crash_FaultEntry")));
+void MemManage_Handler(void) __attribute__((alias("Crash_FaultEntry")));
+void BusFault_Handler(void) __attribute__((alias("Crash_FaultEntry")));
+void UsageFault_Handler(void) __attribute__((alias("Crash_FaultEntry")));
@@ -0,0 +1,36 @@
+/**
+  ******************************************************************************
+  * @file           : crc16.c
+  * @brief          : CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+  ******************************************************************************
+  * @attention
+  *
+  * The STM32F1 CRC unit only computes word-wide CRC-32, so the bulk path
+  * uses this nibble-table implementation instead (32 bytes of flash).
+  *
+  ******************************************************************************
+  */
+
+#include "crc16.h"
+
+static const uint16_t crc16_nibble_table[16] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/**
+  * @brief Feed bytes into a running CRC
+  * @param crc: Previous CRC value (CRC16_INIT for a new computation)
+  * @param data: Bytes to process
+  * @param length: Number of bytes
+  * @retval Updated CRC value
+  */
+uint16_t CRC16_Update(uint16_t crc, const uint8_t* data, uint32_t length)
+{
+  while (length--) {
+    crc = (crc << 4) ^ crc16_nibble_table[(crc >> 12) ^ (*data >> 4)];
+    crc = (crc << 4) ^ crc16_nibble_table[(crc >> 12) ^ (*data & 0x0F)];
+    data++;
+  }
+  return crc;
+}
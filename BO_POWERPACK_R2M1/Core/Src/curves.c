@@ -0,0 +1,59 @@
+/**
+  ******************************************************************************
+  * @file           : curves.c
+  * @brief          : Per-channel perceptual dimming curves
+  ******************************************************************************
+  * @attention
+  *
+  * Each dimmer maps its level through the curve selected in
+  * powerpack_state.dimmer_curve[] before the DAC sees it. The curves other
+  * than linear are flash tables of Q16 DAC codes at 65 evenly spaced
+  * levels, generated by PC_APP/dimming_curves.py (the host previews the
+  * same mapping from that script). Between two breakpoints the code is
+  * interpolated linearly, so a lookup costs an index, one UMULL and a
+  * shift, and a fade stays smooth instead of stepping at the breakpoints.
+  *
+  * The result keeps its 16 fractional bits, which matters at the low end
+  * of the steep curves: the dither turns them into sub-LSB output steps.
+  *
+  ******************************************************************************
+  */
+
+#include "curves.h"
+#include "channels.h"
+
+/**
+  * @brief Map a dimmer level through the channel's curve
+  * @param slot: Dimmer index (0 = dimmer 1)
+  * @param level: Level, 0xFFFF = full scale
+  * @retval Q16 DAC code, at most Channels_LevelToQ16(0xFFFF)
+  */
+uint32_t Curve_LevelToQ16(uint8_t slot, uint16_t level)
+{
+  uint8_t curve = (slot < DIMMER_COUNT) ? powerpack_state.dimmer_curve[slot] : CURVE_LINEAR;
+  const uint32_t* table;
+  uint32_t position, i, f;
+
+  if (curve == CURVE_LINEAR || curve >= CURVE_COUNT) {
+    return Channels_LevelToQ16(level);
+  }
+
+  table = curve_tables[curve - 1];
+  position = level + (level >> 15);     // 0..0x10000, so 0xFFFF lands on the last point
+  i = position >> 10;
+  f = position & 0x3FF;
+  if (i >= CURVE_SEGMENTS) return table[CURVE_SEGMENTS];
+
+  return table[i] + (uint32_t)(((uint64_t)(table[i + 1] - table[i]) * f) >> 10);
+}
+
+/**
+  * @brief Map a dimmer level to the nearest 15-bit DAC code
+  * @param slot: Dimmer index (0 = dimmer 1)
+  * @param level: Level, 0xFFFF = full scale
+  * @retval DAC code
+  */
+uint16_t Curve_LevelToCode(uint8_t slot, uint16_t level)
+{
+  return Channels_Q16ToCode(Curve_LevelToQ16(slot, level));
+}
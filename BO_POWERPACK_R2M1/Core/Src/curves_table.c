@@ -0,0 +1,69 @@
+/**
+  ******************************************************************************
+  * @file           : curves_table.c
+  * @brief          : Dimming curve lookup tables (generated)
+  ******************************************************************************
+  * @attention
+  *
+  * Generated by PC_APP/dimming_curves.py, do not edit. Q16 DAC codes at
+  * 65 evenly spaced levels; see curves.c for the interpolation.
+  *
+  ******************************************************************************
+  */
+
+#include "curves.h"
+
+const uint32_t curve_tables[CURVE_TABLE_COUNT][CURVE_POINTS] = {
+  { // CURVE_CIE1931
+    0x00000000, 0x0038ADE8, 0x00715BD1, 0x00AA09B9, 0x00E2B7A2, 0x011B658A,
+    0x0156FD52, 0x019A54CC, 0x01E5F4D6, 0x023A5871, 0x0297FA9D, 0x02FF565C,
+    0x0370E6AD, 0x03ED2692, 0x0474910B, 0x0507A118, 0x05A6D1BB, 0x06529DF5,
+    0x070B80C4, 0x07D1F52C, 0x08A6762B, 0x09897EC3, 0x0A7B89F4, 0x0B7D12BF,
+    0x0C8E9424, 0x0DB08925, 0x0EE36CC1, 0x1027B9FB, 0x117DEBD1, 0x12E67D45,
+    0x1461E957, 0x15F0AB09, 0x17933D5A, 0x194A1B4B, 0x1B15BFDE, 0x1CF6A612,
+    0x1EED48E9, 0x20FA2362, 0x231DB07F, 0x25586B41, 0x27AACEA7, 0x2A1555B3,
+    0x2C987B64, 0x2F34BABD, 0x31EA8EBD, 0x34BA7266, 0x37A4E0B7, 0x3AAA54B1,
+    0x3DCB4955, 0x410839A5, 0x4461A09F, 0x47D7F945, 0x4B6BBE98, 0x4F1D6B99,
+    0x52ED7B47, 0x56DC68A4, 0x5AEAAEB0, 0x5F18C86C, 0x636730D8, 0x67D662F5,
+    0x6C66D9C4, 0x71191046, 0x75ED817B, 0x7AE4A863, 0x7FFEFFFF,
+  },
+  { // CURVE_GAMMA22
+    0x00000000, 0x00037B6B, 0x000FFFE0, 0x00270A30, 0x004983B3, 0x00781BD9,
+    0x00B36139, 0x00FBCCE7, 0x0151C8A2, 0x01B5B29C, 0x0227E001, 0x02A89EB2,
+    0x0338368A, 0x03D6EA54, 0x0484F88A, 0x05429BE7, 0x06100BE1, 0x06ED7D0B,
+    0x07DB2168, 0x08D928A9, 0x09E7C071, 0x0B07147C, 0x0C374ED0, 0x0D7897E1,
+    0x0ECB16B1, 0x102EF0EB, 0x11A44AFE, 0x132B4834, 0x14C40AC4, 0x166EB3E4,
+    0x182B63DE, 0x19FA3A18, 0x1BDB5524, 0x1DCED2CE, 0x1FD4D026, 0x21ED6988,
+    0x2418BAA8, 0x2656DE9A, 0x28A7EFD9, 0x2B0C084F, 0x2D83415D, 0x300DB3DD,
+    0x32AB782E, 0x355CA635, 0x38215565, 0x3AF99CC0, 0x3DE592DF, 0x40E54DF5,
+    0x43F8E3D4, 0x472069EF, 0x4A5BF55C, 0x4DAB9ADE, 0x510F6EDF, 0x5487857B,
+    0x5813F27E, 0x5BB4C969, 0x5F6A1D72, 0x63340189, 0x67128858, 0x6B05C44A,
+    0x6F0DC784, 0x732AA3F1, 0x775C6B3E, 0x7BA32EDA, 0x7FFEFFFF,
+  },
+  { // CURVE_LOG
+    0x00000000, 0x0003BD03, 0x0007E718, 0x000C8AAF, 0x0011B5A1, 0x0017775A,
+    0x001DE10B, 0x002505D8, 0x002CFB15, 0x0035D882, 0x003FB898, 0x004AB8D0,
+    0x0056FA01, 0x0064A0C2, 0x0073D5D2, 0x0084C697, 0x0097A5A4, 0x00ACAB4D,
+    0x00C41655, 0x00DE2CA4, 0x00FB3C1A, 0x011B9B77, 0x013FAB5F, 0x0167D779,
+    0x019497B2, 0x01C671A1, 0x01FDFA16, 0x023BD6D9, 0x0280C097, 0x02CD8506,
+    0x03230954, 0x03824CC7, 0x03EC6BC3, 0x0462A312, 0x04E6539B, 0x0579067D,
+    0x061C71A6, 0x06D27CEB, 0x079D47BF, 0x087F2F82, 0x097AD694, 0x0A932C31,
+    0x0BCB7537, 0x0D2755E0, 0x0EAADCAB, 0x105A8E72, 0x123B73E7, 0x1453289E,
+    0x16A7EBCB, 0x1940B2E3, 0x1C253E68, 0x1F5E3108, 0x22F5296A, 0x26F4DEE0,
+    0x2B694168, 0x305F9D4B, 0x35E6C2D7, 0x3C0F328E, 0x42EB4E70, 0x4A8F90DA,
+    0x5312C9A7, 0x5C8E6248, 0x671EA9A2, 0x72E3288F, 0x7FFEFFFF,
+  },
+  { // CURVE_USER
+    0x00000000, 0x00199966, 0x003332CD, 0x004CCC33, 0x0066659A, 0x007FFF00,
+    0x00999866, 0x00EB8348, 0x0162F9D0, 0x01DA7059, 0x0251E6E1, 0x02C95D6A,
+    0x0340D3F2, 0x03B84A7B, 0x042FC103, 0x04A7378C, 0x051EAE14, 0x0666599A,
+    0x07AE051F, 0x08F5B0A4, 0x0A3D5C29, 0x0B8507AE, 0x0CCCB333, 0x0E145EB8,
+    0x0F5C0A3D, 0x10A3B5C3, 0x11EB6148, 0x13330CCD, 0x147AB852, 0x15C263D7,
+    0x170A0F5C, 0x1851BAE1, 0x19996666, 0x1C662D9A, 0x1F32F4CD, 0x21FFBC00,
+    0x24CC8333, 0x27994A66, 0x2A66119A, 0x2D32D8CD, 0x2FFFA000, 0x32CC6733,
+    0x35992E66, 0x3865F59A, 0x3B32BCCD, 0x3DFF8400, 0x40CC4B33, 0x43991266,
+    0x4665D99A, 0x49FF6C00, 0x4D98FE66, 0x513290CD, 0x54CC2333, 0x5865B59A,
+    0x5BFF4800, 0x5F98DA66, 0x63326CCD, 0x66CBFF33, 0x6A65919A, 0x6DFF2400,
+    0x7198B666, 0x753248CD, 0x78CBDB33, 0x7C656D9A, 0x7FFEFFFF,
+  },
+};
@@ -0,0 +1,83 @@
+/**
+  ******************************************************************************
+  * @file           : deferred.c
+  * @brief          : PendSV deferred work queue for interrupt handlers
+  ******************************************************************************
+  * @attention
+  *
+  * Interrupt handlers post a function and a 32-bit argument and return.
+  * PendSV, at the lowest priority (IRQ_PRIO_DEFERRED), runs the queue in
+  * posting order after every other pending interrupt has finished, and
+  * before the main loop resumes. Deferred work may be preempted by any
+  * interrupt but never by other deferred work, so items need no locking
+  * against each other. They must not wait on the HAL tick.
+  *
+  * Posting is safe from any priority; a full queue drops the item and
+  * counts it in METRIC_DEFERRED_DROPPED.
+  *
+  ******************************************************************************
+  */
+
+#include "deferred.h"
+#include "metrics.h"
+
+typedef struct {
+  DeferredFunc_t func;
+  uint32_t arg;
+} DeferredItem_t;
+
+static DeferredItem_t deferred_queue[DEFERRED_QUEUE_SIZE];
+static volatile uint8_t deferred_head;    // next slot to write
+static volatile uint8_t deferred_tail;    // next slot to run
+static uint8_t deferred_high_water;
+
+/**
+  * @brief Queue work for PendSV (ISR safe)
+  * @param func: Function to run
+  * @param arg: Argument passed to func
+  * @retval 1 if queued, 0 if the queue was full
+  */
+uint8_t Deferred_Post(DeferredFunc_t func, uint32_t arg)
+{
+  uint32_t primask = __get_PRIMASK();
+  uint8_t used;
+
+  __disable_irq();
+  used = (uint8_t)(deferred_head - deferred_tail);
+  if (used >= DEFERRED_QUEUE_SIZE) {
+    __set_PRIMASK(primask);
+    Metrics_Inc(METRIC_DEFERRED_DROPPED);
+    return 0;
+  }
+  deferred_queue[deferred_head & (DEFERRED_QUEUE_SIZE - 1)].func = func;
+  deferred_queue[deferred_head & (DEFERRED_QUEUE_SIZE - 1)].arg = arg;
+  deferred_head++;
+  if (used + 1 > deferred_high_water) deferred_high_water = used + 1;
+  __set_PRIMASK(primask);
+
+  SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+  return 1;
+}
+
+/**
+  * @brief Run all queued work in order (PendSV_Handler)
+  * @retval None
+  */
+void Deferred_Run(void)
+{
+  while (deferred_tail != deferred_head) {
+    DeferredItem_t item = deferred_queue[deferred_tail & (DEFERRED_QUEUE_SIZE - 1)];
+
+    deferred_tail++;
+    item.func(item.arg);
+  }
+}
+
+/**
+  * @brief Deepest queue fill level since reset
+  * @retval Items
+  */
+uint8_t Deferred_GetHighWater(void)
+{
+  return deferred_high_water;
+}
@@ -0,0 +1,230 @@
+/**
+  ******************************************************************************
+  * @file           : dither.c
+  * @brief          : Temporal (sigma-delta) dithering of the DAC codes
+  ******************************************************************************
+  * @attention
+  *
+  * A dimmer level maps to a Q16 DAC code, usually between two 15-bit
+  * codes. Every write rounds it to the nearest code; with the dither on,
+  * TIM4 also re-evaluates the setpoints of dimmers 1 and 2 at the chosen
+  * rate with a first-order error feedback: the fractional part is added
+  * to a 16-bit residue and the code steps up by one whenever it carries.
+  * The output then toggles between the two adjacent codes with a duty
+  * cycle equal to the fraction, so the average has 1/65536 LSB steps.
+  * The load filters the toggling; slow fades gain the most.
+  *
+  * A frame goes out only when a code changes, so a setpoint that sits on
+  * a code (or the ends of the range) costs no bus time. While a waveform
+  * plays it owns the bus and the dither pauses; a stream keeps running
+  * and only sets the targets. Blocking DAC writes hold the dither off the
+  * bus through Dither_Hold().
+  *
+  * Cost per rate (CPU cycles and frames per second) is counted here and
+  * read back with CMD_DITHER; "dither bench" in powerpack_controller.py
+  * steps through the rates and converts the counts to CPU and bus load.
+  *
+  ******************************************************************************
+  */
+
+#include "dither.h"
+#include "channels.h"
+#include "curves.h"
+#include "gp8413_dma.h"
+#include "stream.h"
+#include "waveform.h"
+
+extern TIM_HandleTypeDef htim4;
+
+#define DITHER_HOLD_TIMEOUT_MS  2
+
+typedef struct {
+  uint16_t rate_hz;           // 0 = off
+  uint8_t  period_ticks;      // TIM4 ticks per update
+  uint8_t  divider;
+  volatile uint8_t hold;      // a blocking DAC write owns the bus
+  uint32_t target[DITHER_CHANNELS];   // Q16 DAC codes
+  uint16_t residue[DITHER_CHANNELS];  // accumulated fraction, 1/65536 LSB
+  uint16_t code[DITHER_CHANNELS];     // code the DAC holds now
+  uint32_t since_ms;          // start of the statistics window
+  DitherStats_t stats;
+} Dither_t;
+
+static Dither_t dither;
+
+/**
+  * @brief Set the dither update rate and start or stop its TIM4 ticks
+  * @param rate_hz: Updates per second, a divisor of DITHER_TICK_HZ from
+  *        DITHER_MIN_RATE_HZ up, or 0 to switch the dither off
+  * @retval DITHER_OK or DITHER_ERR_RANGE
+  * @note  Switching off puts the rounded codes back on the DACs.
+  */
+uint8_t Dither_SetRate(uint16_t rate_hz)
+{
+  if (rate_hz != 0 && (rate_hz < DITHER_MIN_RATE_HZ || rate_hz > DITHER_TICK_HZ ||
+                       DITHER_TICK_HZ % rate_hz != 0)) {
+    return DITHER_ERR_RANGE;
+  }
+
+  __HAL_TIM_DISABLE_IT(&htim4, TIM_IT_UPDATE);
+  dither.rate_hz = rate_hz;
+  dither.period_ticks = rate_hz ? (uint8_t)(DITHER_TICK_HZ / rate_hz) : 0;
+  dither.divider = 0;
+  dither.stats = (DitherStats_t){0};
+  dither.since_ms = HAL_GetTick();
+  __HAL_TIM_ENABLE_IT(&htim4, TIM_IT_UPDATE);
+
+  if (rate_hz) {
+    HAL_TIM_Base_Start_IT(&htim4);      // no-op if the stream already runs it
+    return DITHER_OK;
+  }
+
+  if (!Stream_IsActive()) {
+    HAL_TIM_Base_Stop_IT(&htim4);
+  }
+  if (!Wave_IsPlaying()) {
+    uint16_t codes[DITHER_CHANNELS];
+    uint8_t mask = 0;
+
+    GP8413_DMA_WaitIdle(DITHER_HOLD_TIMEOUT_MS);
+    __HAL_TIM_DISABLE_IT(&htim4, TIM_IT_UPDATE);
+    for (uint8_t i = 0; i < DITHER_CHANNELS; i++) {
+      codes[i] = Channels_Q16ToCode(dither.target[i]);
+      if (codes[i] != dither.code[i]) mask |= 1U << i;
+    }
+    mask &= Channels_DimmersPresent();
+    if (mask && GP8413_WriteDMA(mask, codes[0], codes[1]) == HAL_OK) {
+      for (uint8_t i = 0; i < DITHER_CHANNELS; i++) dither.code[i] = codes[i];
+    }
+    __HAL_TIM_ENABLE_IT(&htim4, TIM_IT_UPDATE);
+  }
+  return DITHER_OK;
+}
+
+uint16_t Dither_GetRate(void)
+{
+  return dither.rate_hz;
+}
+
+/**
+  * @brief Record a new setpoint that was just written rounded (ISR safe)
+  * @param slot: 0 = dimmer 1, 1 = dimmer 2; other dimmers are not dithered
+  * @param level: Level written, 0xFFFF = full scale, before the channel's curve
+  * @retval None
+  * @note  The residue carries over, so a fade keeps its sub-LSB phase.
+  */
+void Dither_SetLevel(uint8_t slot, uint16_t level)
+{
+  uint32_t primask;
+
+  if (slot >= DITHER_CHANNELS) return;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  dither.target[slot] = Curve_LevelToQ16(slot, level);
+  dither.code[slot] = Channels_Q16ToCode(dither.target[slot]);
+  __set_PRIMASK(primask);
+}
+
+/**
+  * @brief Keep the dither off the bus around a blocking DAC write
+  * @param hold: 1 before the write, 0 after it
+  * @retval None
+  */
+void Dither_Hold(uint8_t hold)
+{
+  dither.hold = hold;
+  if (hold && dither.rate_hz) {
+    GP8413_DMA_WaitIdle(DITHER_HOLD_TIMEOUT_MS);
+  }
+}
+
+/**
+  * @brief Serialize the rate and cost statistics for CMD_DITHER
+  * @param cmd: Command byte echoed in byte 0
+  * @param status: DITHER_OK or DITHER_ERR_*
+  * @param reset: Non-zero restarts the statistics window after the copy
+  * @param reply: DITHER_REPLY_SIZE bytes
+  * @retval Reply length
+  *
+  * [cmd, status, rate_hz u16, elapsed_ms u32, ticks u32, writes u32,
+  *  busy u32, cycles u32, cycles_max u32, 0, 0, 0, 0], big-endian.
+  */
+uint8_t Dither_Serialize(uint8_t cmd, uint8_t status, uint8_t reset, uint8_t* reply)
+{
+  DitherStats_t s;
+  uint32_t words[6];
+  uint32_t now = HAL_GetTick();
+
+  __HAL_TIM_DISABLE_IT(&htim4, TIM_IT_UPDATE);
+  s = dither.stats;
+  words[0] = now - dither.since_ms;
+  if (reset) {
+    dither.stats = (DitherStats_t){0};
+    dither.since_ms = now;
+  }
+  __HAL_TIM_ENABLE_IT(&htim4, TIM_IT_UPDATE);
+
+  words[1] = s.ticks;
+  words[2] = s.writes;
+  words[3] = s.busy;
+  words[4] = s.cycles;
+  words[5] = s.cycles_max;
+
+  reply[0] = cmd;
+  reply[1] = status;
+  reply[2] = (dither.rate_hz >> 8) & 0xFF;
+  reply[3] = dither.rate_hz & 0xFF;
+  for (uint8_t i = 0; i < 6; i++) {
+    reply[4 + 4 * i] = (words[i] >> 24) & 0xFF;
+    reply[5 + 4 * i] = (words[i] >> 16) & 0xFF;
+    reply[6 + 4 * i] = (words[i] >> 8) & 0xFF;
+    reply[7 + 4 * i] = words[i] & 0xFF;
+  }
+  for (uint8_t i = 28; i < DITHER_REPLY_SIZE; i++) {
+    reply[i] = 0;
+  }
+  return DITHER_REPLY_SIZE;
+}
+
+/**
+  * @brief 1 kHz TIM4 tick, after the stream playout
+  * @retval None
+  */
+void Dither_TimerTick(void)
+{
+  uint16_t codes[DITHER_CHANNELS];
+  uint16_t residue[DITHER_CHANNELS];
+  uint8_t mask = 0;
+  uint32_t start, cycles;
+
+  if (dither.rate_hz == 0 || dither.hold || Wave_IsPlaying()) return;
+  if (++dither.divider < dither.period_ticks) return;
+  dither.divider = 0;
+
+  start = DWT->CYCCNT;
+  for (uint8_t i = 0; i < DITHER_CHANNELS; i++) {
+    uint32_t sum = (dither.target[i] & 0xFFFF) + dither.residue[i];
+
+    // target tops out at 0x7FFEFFFF, so the carry never passes GP8413_CODE_MAX
+    codes[i] = (uint16_t)((dither.target[i] >> 16) + (sum >> 16));
+    residue[i] = sum & 0xFFFF;
+    if (codes[i] != dither.code[i]) mask |= 1U << i;
+  }
+  mask &= Channels_DimmersPresent();
+
+  if (mask == 0 || GP8413_WriteDMA(mask, codes[0], codes[1]) == HAL_OK) {
+    for (uint8_t i = 0; i < DITHER_CHANNELS; i++) {
+      dither.code[i] = codes[i];
+      dither.residue[i] = residue[i];
+    }
+    if (mask) dither.stats.writes++;
+  } else {
+    dither.stats.busy++;
+  }
+
+  cycles = DWT->CYCCNT - start;
+  dither.stats.ticks++;
+  dither.stats.cycles += cycles;
+  if (cycles > dither.stats.cycles_max) dither.stats.cycles_max = cycles;
+}
@@ -0,0 +1,153 @@
+/**
+  ******************************************************************************
+  * @file           : fmt.c
+  * @brief          : Minimal integer/string formatter for the diagnostics log
+  ******************************************************************************
+  * @attention
+  *
+  * Replaces snprintf for USB_DEBUG so that no printf family code from
+  * newlib is linked. Supported conversions: %d %i %u %x %X %c %s %% with
+  * an optional '0' flag, a field width and the 'l' length modifier. There
+  * is no floating point, precision or '-' flag; anything else is copied
+  * through as text.
+  *
+  ******************************************************************************
+  */
+
+#include "fmt.h"
+
+typedef struct {
+  char* buf;
+  uint16_t size;
+  uint16_t len;
+} FmtOut_t;
+
+static void Fmt_Put(FmtOut_t* out, char c)
+{
+  if (out->len + 1 < out->size) {
+    out->buf[out->len++] = c;
+  }
+}
+
+/**
+  * @brief Emit an unsigned value right-aligned in a field
+  * @param out: Output buffer
+  * @param value: Magnitude
+  * @param base: 10 or 16
+  * @param upper: Use A-F for hex digits
+  * @param width: Minimum field width, including the sign
+  * @param pad: '0' or ' '
+  * @param negative: Prefix a '-'
+  * @retval None
+  */
+static void Fmt_Number(FmtOut_t* out, uint32_t value, uint8_t base, uint8_t upper,
+                       uint8_t width, char pad, uint8_t negative)
+{
+  const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+  char tmp[10];
+  uint8_t n = 0;
+
+  do {
+    tmp[n++] = digits[value % base];
+    value /= base;
+  } while (value);
+
+  if (negative && pad == '0') Fmt_Put(out, '-');
+  for (uint8_t i = n + negative; i < width; i++) {
+    Fmt_Put(out, pad);
+  }
+  if (negative && pad != '0') Fmt_Put(out, '-');
+  while (n) {
+    Fmt_Put(out, tmp[--n]);
+  }
+}
+
+/**
+  * @brief Format into buf; the result is always NUL terminated
+  * @param buf: Output buffer
+  * @param size: Buffer size in bytes
+  * @param format: printf-style format, subset described above
+  * @param args: Arguments
+  * @retval Characters written, excluding the NUL (truncated to size - 1)
+  */
+uint16_t Fmt_VFormat(char* buf, uint16_t size, const char* format, va_list args)
+{
+  FmtOut_t out = { buf, size, 0 };
+
+  if (size == 0) return 0;
+
+  while (*format) {
+    char c = *format++;
+    char pad = ' ';
+    uint8_t width = 0;
+    uint8_t is_long = 0;
+
+    if (c != '%') {
+      Fmt_Put(&out, c);
+      continue;
+    }
+
+    if (*format == '0') {
+      pad = '0';
+      format++;
+    }
+    while (*format >= '0' && *format <= '9') {
+      width = width * 10 + (*format++ - '0');
+    }
+    if (*format == 'l') {
+      is_long = 1;
+      format++;
+    }
+
+    c = *format;
+    if (c == '\0') break;
+    format++;
+
+    switch (c) {
+      case 'd':
+      case 'i': {
+        long v = is_long ? va_arg(args, long) : va_arg(args, int);
+        Fmt_Number(&out, (v < 0) ? 0UL - (unsigned long)v : (unsigned long)v, 10, 0, width, pad, v < 0);
+        break;
+      }
+      case 'u':
+      case 'x':
+      case 'X': {
+        unsigned long v = is_long ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+        Fmt_Number(&out, v, (c == 'u') ? 10 : 16, c == 'X', width, pad, 0);
+        break;
+      }
+      case 'c':
+        Fmt_Put(&out, (char)va_arg(args, int));
+        break;
+      case 's': {
+        const char* s = va_arg(args, const char*);
+        while (s && *s) {
+          Fmt_Put(&out, *s++);
+        }
+        break;
+      }
+      case '%':
+        Fmt_Put(&out, '%');
+        break;
+      default:
+        Fmt_Put(&out, '%');
+        Fmt_Put(&out, c);
+        break;
+    }
+  }
+
+  buf[out.len] = '\0';
+  return out.len;
+}
+
+uint16_t Fmt_Format(char* buf, uint16_t size, const char* format, ...)
+{
+  va_list args;
+  uint16_t n;
+
+  va_start(args, format);
+  n = Fmt_VFormat(buf, size, format, args);
+  va_end(args);
+  return n;
+}
@@ -0,0 +1,152 @@
+/**
+  ******************************************************************************
+  * @file           : gp8413_dma.c
+  * @brief          : Non-blocking GP8413 DAC updates over the I2C1 TX DMA channel
+  ******************************************************************************
+  * @attention
+  *
+  * Used by the timer-paced output paths (waveform playback, setpoint
+  * streaming) so that an update costs one DMA setup in the ISR instead of
+  * a blocking HAL_I2C_Master_Transmit. Updating both channels queues the
+  * DAC1 frame and chains the DAC2 frame from the TX complete callback.
+  *
+  * GP8413_WriteDMA() sends raw 15-bit codes; GP8413_WriteLevelsDMA() takes
+  * full-scale levels, maps them through each channel's dimming curve,
+  * records them as the new setpoints and hands them to the dither, which
+  * then works the sub-LSB remainder between updates.
+  *
+  ******************************************************************************
+  */
+
+#include "gp8413_dma.h"
+#include "channels.h"
+#include "curves.h"
+#include "dither.h"
+#include "metrics.h"
+#include "output_drv.h"
+
+extern I2C_HandleTypeDef hi2c1;
+
+static uint8_t gp8413_tx_frame[2][3];
+static volatile uint8_t gp8413_ch2_pending = 0;
+static uint16_t gp8413_ch2_code;
+
+/**
+  * @brief Queue one register frame on the DMA channel
+  * @param slot: 0 = dimmer 1, 1 = dimmer 2 (rows of dimmer_channels[])
+  * @param code: 15-bit DAC code
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef GP8413_SendFrame(uint8_t slot, uint16_t code)
+{
+  const DimmerChannel_t* channel = &dimmer_channels[slot];
+  uint8_t* frame = gp8413_tx_frame[slot];
+  uint16_t word = code << GP8413_CODE_SHIFT;
+
+  frame[0] = channel->reg;
+  frame[1] = word & 0xFF;         // LSB first
+  frame[2] = (word >> 8) & 0xFF;
+
+  if (HAL_I2C_Master_Transmit_DMA(&hi2c1, Channels_DimmerAddress(slot) << 1, frame, 3) != HAL_OK) {
+    return HAL_BUSY;
+  }
+  Metrics_Inc(METRIC_DAC_WRITES);
+  return HAL_OK;
+}
+
+/**
+  * @brief Start a DAC update without waiting for the bus (ISR safe)
+  * @param channel_mask: GP8413_DMA_CH1, GP8413_DMA_CH2 or both
+  * @param code1: DAC1 code (15-bit)
+  * @param code2: DAC2 code (15-bit)
+  * @retval HAL_OK, or HAL_BUSY if the previous update is still on the bus
+  */
+HAL_StatusTypeDef GP8413_WriteDMA(uint8_t channel_mask, uint16_t code1, uint16_t code2)
+{
+  if (GP8413_DMA_IsBusy()) return HAL_BUSY;
+
+  if (channel_mask & GP8413_DMA_CH1) {
+    if (GP8413_SendFrame(0, code1) != HAL_OK) return HAL_BUSY;
+    if (channel_mask & GP8413_DMA_CH2) {
+      gp8413_ch2_code = code2;
+      gp8413_ch2_pending = 1;
+    }
+    return HAL_OK;
+  }
+
+  if (channel_mask & GP8413_DMA_CH2) {
+    return GP8413_SendFrame(1, code2);
+  }
+  return HAL_OK;
+}
+
+/**
+  * @brief Start a setpoint update from full-scale levels (ISR safe)
+  * @param channel_mask: GP8413_DMA_CH1, GP8413_DMA_CH2 or both
+  * @param level1: Dimmer 1 level, 0xFFFF = full scale
+  * @param level2: Dimmer 2 level
+  * @retval HAL_OK, or HAL_BUSY if the previous update is still on the bus
+  */
+HAL_StatusTypeDef GP8413_WriteLevelsDMA(uint8_t channel_mask, uint16_t level1, uint16_t level2)
+{
+  if (GP8413_WriteDMA(channel_mask, Curve_LevelToCode(0, level1), Curve_LevelToCode(1, level2)) != HAL_OK) {
+    return HAL_BUSY;
+  }
+
+  if (channel_mask & GP8413_DMA_CH1) {
+    powerpack_state.dimmer_value[0] = level1;
+    Dither_SetLevel(0, level1);
+  }
+  if (channel_mask & GP8413_DMA_CH2) {
+    powerpack_state.dimmer_value[1] = level2;
+    Dither_SetLevel(1, level2);
+  }
+  return HAL_OK;
+}
+
+/**
+  * @brief Check whether a DMA update can start now without waiting (ISR safe)
+  * @retval 1 if a DMA update or a blocking write holds the bus, or a STOP
+  *         is still going out
+  */
+uint8_t GP8413_DMA_IsBusy(void)
+{
+  return gp8413_ch2_pending || Output_I2C_IsClaimed() ||
+         HAL_I2C_GetState(&hi2c1) != HAL_I2C_STATE_READY ||
+         (hi2c1.Instance->SR2 & I2C_SR2_BUSY) != 0;
+}
+
+/**
+  * @brief Let an in-flight update drain before blocking I2C access
+  * @param timeout_ms: Upper bound on the wait
+  * @retval None
+  */
+void GP8413_DMA_WaitIdle(uint32_t timeout_ms)
+{
+  uint32_t start = HAL_GetTick();
+
+  while (GP8413_DMA_IsBusy() && (HAL_GetTick() - start) < timeout_ms) {
+  }
+  gp8413_ch2_pending = 0;
+}
+
+/**
+  * @brief I2C TX complete hook: chains the DAC2 frame of a two-channel update
+  * @retval None
+  */
+void GP8413_DMA_TxComplete(void)
+{
+  if (gp8413_ch2_pending) {
+    gp8413_ch2_pending = 0;
+    GP8413_SendFrame(1, gp8413_ch2_code);
+  }
+}
+
+/**
+  * @brief I2C error hook: drop a chained DAC2 frame so the sender does not stay busy
+  * @retval None
+  */
+void GP8413_DMA_Error(void)
+{
+  gp8413_ch2_pending = 0;
+}
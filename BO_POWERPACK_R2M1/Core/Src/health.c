@@ -0,0 +1,249 @@
+/**
+  ******************************************************************************
+  * @file           : health.c
+  * @brief          : MCU temperature and supply voltage from ADC1 in the background
+  ******************************************************************************
+  * @attention
+  *
+  * ADC1 scans the internal temperature sensor and VREFINT continuously
+  * (ADCCLK 6 MHz, 239.5-cycle samples: one scan every 84 us) and DMA1
+  * channel 1 writes the results into a circular buffer of two blocks. The
+  * half- and full-transfer interrupts each sum one block of
+  * HEALTH_BLOCK_SCANS scans per channel and feed the sums to a first-order
+  * IIR filter; nothing polls the ADC. That is about 190 interrupts per
+  * second, and the cycles they take are counted so the load can be read
+  * back with every GET_HEALTH frame.
+  *
+  * The conversion to units happens in the main loop when a frame is built:
+  * VDDA from the VREFINT reading, the sensor voltage as a ratio to VREFINT
+  * (so it does not depend on VDDA), then the datasheet line through V25.
+  * The F1 has no factory calibration and V25 varies by up to 90 mV between
+  * parts (about 20 C), so the absolute temperature is coarse; the trend of
+  * one board is what the readings are good for.
+  *
+  * The HAL ADC driver is not part of this project (the ADC is not in the
+  * .ioc), so ADC1 is set up through its registers and the handler lives
+  * here rather than in stm32f1xx_it.c, like the ones in power.c. In STOP
+  * the ADC clock stops; Power_Stop() stops the conversions before and
+  * restarts them after, so the scan order never slips against the buffer.
+  *
+  ******************************************************************************
+  */
+
+#include "health.h"
+
+#define HEALTH_ADC_CH_TEMP      16
+#define HEALTH_ADC_CH_VREFINT   17
+#define HEALTH_ADC_FULL_SCALE   4095
+#define HEALTH_BLOCK_SIZE       (HEALTH_BLOCK_SCANS * HEALTH_CHANNELS)
+#define HEALTH_POWER_UP_US      2     // tSTAB is 1 us, calibration needs 2 ADC clocks
+
+static DMA_HandleTypeDef hdma_adc1;
+static uint16_t health_buffer[2 * HEALTH_BLOCK_SIZE];
+static uint32_t health_filter[HEALTH_CHANNELS];   // block sums << HEALTH_FILTER_SHIFT
+static volatile uint8_t health_ready;
+static uint64_t health_cycles;        // CPU cycles in the DMA interrupt
+static uint32_t health_since_ms;      // start of the load window
+
+static void Health_DelayUs(uint32_t us)
+{
+  uint32_t start = DWT->CYCCNT;
+  uint32_t cycles = us * (SystemCoreClock / 1000000);
+
+  while (DWT->CYCCNT - start < cycles) {
+  }
+}
+
+/**
+  * @brief Sum one block per channel and update the filters (DMA interrupt)
+  * @param block: HEALTH_BLOCK_SCANS scans, channels interleaved
+  * @retval None
+  */
+static void Health_Filter(const uint16_t* block)
+{
+  uint32_t sum[HEALTH_CHANNELS] = {0};
+
+  for (uint32_t i = 0; i < HEALTH_BLOCK_SIZE; i += HEALTH_CHANNELS) {
+    sum[0] += block[i];
+    sum[1] += block[i + 1];
+  }
+
+  for (uint8_t c = 0; c < HEALTH_CHANNELS; c++) {
+    if (health_ready) {
+      health_filter[c] += sum[c] - (health_filter[c] >> HEALTH_FILTER_SHIFT);
+    } else {
+      health_filter[c] = sum[c] << HEALTH_FILTER_SHIFT;
+    }
+  }
+  health_ready = 1;
+}
+
+static void Health_HalfComplete(DMA_HandleTypeDef* hdma)
+{
+  Health_Filter(&health_buffer[0]);
+}
+
+static void Health_FullComplete(DMA_HandleTypeDef* hdma)
+{
+  Health_Filter(&health_buffer[HEALTH_BLOCK_SIZE]);
+}
+
+/**
+  * @brief Set up ADC1 and its DMA channel, calibrate and start the scans
+  * @retval None
+  * @note  Call after MX_DMA_Init() and Timing_Init() (the delays use the DWT).
+  */
+void Health_Init(void)
+{
+  __HAL_RCC_ADC_CONFIG(RCC_ADCPCLK2_DIV8);
+  __HAL_RCC_ADC1_CLK_ENABLE();
+
+  ADC1->CR1 = ADC_CR1_SCAN;
+  ADC1->CR2 = ADC_CR2_TSVREFE | ADC_CR2_EXTTRIG | ADC_CR2_EXTSEL;  // EXTSEL 111: SWSTART
+  ADC1->SMPR1 = ADC_SMPR1_SMP16 | ADC_SMPR1_SMP17;                 // 239.5 cycles, sensor needs 17.1 us
+  ADC1->SQR1 = (HEALTH_CHANNELS - 1) << ADC_SQR1_L_Pos;
+  ADC1->SQR3 = (HEALTH_ADC_CH_TEMP << ADC_SQR3_SQ1_Pos) |
+               (HEALTH_ADC_CH_VREFINT << ADC_SQR3_SQ2_Pos);
+
+  ADC1->CR2 |= ADC_CR2_ADON;
+  Health_DelayUs(HEALTH_POWER_UP_US);
+  ADC1->CR2 |= ADC_CR2_RSTCAL;
+  while (ADC1->CR2 & ADC_CR2_RSTCAL) {
+  }
+  ADC1->CR2 |= ADC_CR2_CAL;
+  while (ADC1->CR2 & ADC_CR2_CAL) {
+  }
+
+  hdma_adc1.Instance = DMA1_Channel1;
+  hdma_adc1.Init.Direction = DMA_PERIPH_TO_MEMORY;
+  hdma_adc1.Init.PeriphInc = DMA_PINC_DISABLE;
+  hdma_adc1.Init.MemInc = DMA_MINC_ENABLE;
+  hdma_adc1.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+  hdma_adc1.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+  hdma_adc1.Init.Mode = DMA_CIRCULAR;
+  hdma_adc1.Init.Priority = DMA_PRIORITY_LOW;
+  if (HAL_DMA_Init(&hdma_adc1) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  hdma_adc1.XferHalfCpltCallback = Health_HalfComplete;
+  hdma_adc1.XferCpltCallback = Health_FullComplete;
+
+  HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, IRQ_PRIO_ADC, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+
+  health_since_ms = HAL_GetTick();
+  Health_Start();
+}
+
+/**
+  * @brief Start the DMA from the top of the buffer and the continuous scans
+  * @retval None
+  */
+void Health_Start(void)
+{
+  health_ready = 0;
+  HAL_DMA_Start_IT(&hdma_adc1, (uint32_t)&ADC1->DR, (uint32_t)health_buffer,
+                   2 * HEALTH_BLOCK_SIZE);
+  ADC1->CR2 |= ADC_CR2_DMA | ADC_CR2_CONT | ADC_CR2_ADON;
+  Health_DelayUs(HEALTH_POWER_UP_US);
+  ADC1->CR2 |= ADC_CR2_SWSTART;
+}
+
+/**
+  * @brief Power the ADC down and stop its DMA channel
+  * @retval None
+  */
+void Health_Stop(void)
+{
+  ADC1->CR2 &= ~(ADC_CR2_CONT | ADC_CR2_ADON);
+  HAL_DMA_Abort(&hdma_adc1);
+}
+
+/**
+  * @brief Convert the filtered readings
+  * @param temp_dc: Receives the temperature in 0.1 C, 0 if not ready
+  * @param vdda_mv: Receives VDDA in mV, 0 if not ready
+  * @retval 1 once a block has been filtered since the start or a STOP exit
+  */
+uint8_t Health_Read(int16_t* temp_dc, uint16_t* vdda_mv)
+{
+  uint32_t temp_acc, vref_acc;
+  uint32_t sense_uv;
+  uint8_t ready;
+
+  HAL_NVIC_DisableIRQ(DMA1_Channel1_IRQn);
+  temp_acc = health_filter[0];
+  vref_acc = health_filter[1];
+  ready = health_ready;
+  HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+
+  *temp_dc = 0;
+  *vdda_mv = 0;
+  if (!ready || vref_acc == 0) return 0;
+
+  // Both filters carry the same scale, so it cancels in the ratios
+  sense_uv = (uint32_t)((uint64_t)temp_acc * HEALTH_VREFINT_UV / vref_acc);
+
+  *temp_dc = 250 + ((int32_t)HEALTH_V25_UV - (int32_t)sense_uv) * 10 / HEALTH_SLOPE_UV_PER_C;
+  *vdda_mv = (uint32_t)((uint64_t)HEALTH_VREFINT_UV * HEALTH_ADC_FULL_SCALE *
+                        (HEALTH_BLOCK_SCANS << HEALTH_FILTER_SHIFT) / vref_acc / 1000);
+  return 1;
+}
+
+/**
+  * @brief Serialize the filtered readings and the ADC interrupt load
+  * @param cmd: Command byte echoed in byte 0
+  * @param reply: HEALTH_REPLY_SIZE bytes
+  * @retval Reply length
+  *
+  * [cmd, status, temperature i16 (0.1 C), vdda u16 (mV), load u16 (0.01 %)],
+  * big-endian. The load covers the time since the previous frame.
+  */
+uint8_t Health_Serialize(uint8_t cmd, uint8_t* reply)
+{
+  uint64_t cycles;
+  uint32_t now = HAL_GetTick();
+  uint32_t elapsed_ms;
+  int16_t temp_dc;
+  uint16_t vdda_mv;
+  uint8_t ready;
+  uint64_t load = 0;
+
+  ready = Health_Read(&temp_dc, &vdda_mv);
+
+  HAL_NVIC_DisableIRQ(DMA1_Channel1_IRQn);
+  cycles = health_cycles;
+  health_cycles = 0;
+  HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+
+  elapsed_ms = now - health_since_ms;
+  health_since_ms = now;
+
+  if (elapsed_ms != 0) {
+    load = cycles * 10000 / ((uint64_t)elapsed_ms * (SystemCoreClock / 1000));
+    if (load > 0xFFFF) load = 0xFFFF;
+  }
+
+  reply[0] = cmd;
+  reply[1] = ready ? HEALTH_OK : HEALTH_NOT_READY;
+  reply[2] = ((uint16_t)temp_dc >> 8) & 0xFF;
+  reply[3] = (uint16_t)temp_dc & 0xFF;
+  reply[4] = (vdda_mv >> 8) & 0xFF;
+  reply[5] = vdda_mv & 0xFF;
+  reply[6] = (load >> 8) & 0xFF;
+  reply[7] = load & 0xFF;
+  return HEALTH_REPLY_SIZE;
+}
+
+/**
+  * @brief DMA1 channel 1 (ADC1 blocks), timed for the load figure
+  * @retval None
+  */
+void DMA1_Channel1_IRQHandler(void)
+{
+  uint32_t start = DWT->CYCCNT;
+
+  HAL_DMA_IRQHandler(&hdma_adc1);
+  health_cycles += DWT->CYCCNT - start;
+}
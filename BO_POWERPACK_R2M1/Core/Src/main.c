@@ -24,28 +24,38 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "usbd_cdc_if.h"
+#include "waveform.h"
+#include "gp8413_dma.h"
+#include "output_drv.h"
+#include "stream.h"
+#include "metrics.h"
+#include "trace.h"
+#include "crash.h"
+#include "watchdog.h"
+#include "memory.h"
+#include "fmt.h"
+#include "timing.h"
+#include "deferred.h"
+#include "sched.h"
+#include "power.h"
+#include "channels.h"
+#include "dither.h"
+#include "curves.h"
+#include "health.h"
+#include "relay_timer.h"
+#include "trigger.h"
+#include "config.h"
+#include "zero_cross.h"
+#include "telemetry.h"
 #include <string.h>
-#include <stdio.h>
-
-// Debug message buffer
-char debug_msg[128];
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
 /* USER CODE BEGIN PTD */
-typedef struct {
-    uint8_t relay1_state;     // Relay 1 state (GPIO_M1)
-    uint8_t relay2_state;     // Relay 2 state (GPIO_M2)
-    uint16_t dimmer1_value;   // 0-4095 (12-bit DAC)
-    uint16_t dimmer2_value;   // 0-4095 (12-bit DAC)
-    uint8_t dimmer1_enabled;
-    uint8_t dimmer2_enabled;
-} PowerPackState_t;
-
 // Command definitions
 #define CMD_SET_RELAY1          0x01  // Control Relay 1
 #define CMD_SET_RELAY2          0x02  // Control Relay 2
-#define CMD_SET_DIMMER1         0x03
+#define CMD_SET_DIMMER1         0x03  // value: level, 0xFFFF = full scale
 #define CMD_SET_DIMMER2         0x04
 #define CMD_GET_STATUS          0x05
 #define CMD_ENABLE_DIMMER1      0x06
@@ -53,20 +63,51 @@ typedef struct {
 #define CMD_DISABLE_DIMMER1     0x08
 #define CMD_DISABLE_DIMMER2     0x09
 #define CMD_GET_VERSION         0x0A
+#define CMD_WAVE_BEGIN          0x0B  // param: channel mask, value: sample count
+#define CMD_WAVE_CHUNK          0x0C  // variable length, see Wave_WriteChunk()
+#define CMD_WAVE_COMMIT         0x0D  // value: CRC-16 of the whole table
+#define CMD_WAVE_PLAY           0x0E  // param: WAVE_MODE_*, value: sample rate (Hz)
+#define CMD_STREAM_START        0x0F  // param: channel mask, value: latency (ms)
+#define CMD_STREAM_DATA         0x10  // variable length, see Stream_Push()
+#define CMD_STREAM_STOP         0x11
+#define CMD_STREAM_STATS        0x12  // param: 1 = restart min/max window
+#define CMD_GET_METRICS         0x13
+#define CMD_DUMP_TRACE          0x14  // param: 1 = clear after the dump
+#define CMD_BENCH_OUTPUTS       0x15  // time Set_Relay/Set_Dimmer in CPU cycles
+#define CMD_APPLY_STATE         0x16  // [cmd, fields, on bits, 0, dimmer1 u16, dimmer2 u16]
+#define CMD_GET_CRASH           0x17  // param: CRASH_PAGE_*, see Crash_Serialize()
+#define CMD_WATCHDOG            0x18  // param: WDG_CMD_*
+#define CMD_GET_MEMORY          0x19  // stack/heap peaks, see Memory_Serialize()
+#define CMD_GET_TIMING          0x1A  // param: 1 = restart the statistics
+#define CMD_GET_TASKS           0x1B  // param: 1 = restart the accounting, see Sched_Serialize()
+#define CMD_GET_POWER           0x1C  // suspend/STOP statistics, see Power_Serialize()
+#define CMD_BULK_OUTPUTS        0x1D  // [cmd, BULK_*, mask u16, payload], see Bulk_Outputs()
+#define CMD_BENCH_CHANNELS      0x1E  // DAC update time for 1..DIMMER_COUNT channels
+#define CMD_GET_CAPABILITIES    0x1F  // channel map and features, see Send_Capabilities_Response()
+#define CMD_DITHER              0x20  // param: DITHER_CMD_*, see Dither_Serialize()
+#define CMD_SET_CURVE           0x21  // param: CURVE_*, value: dimmer mask
+#define CMD_GET_HEALTH          0x22  // MCU temperature and supply, see Health_Serialize()
+#define CMD_PULSE_RELAY         0x23  // param: relay, value: width (ms), timed by TIM1/TIM2
+#define CMD_BLINK_RELAY         0x24  // [cmd, relay, on_ms u16, period_ms u16, count u16], 0 = endless
+#define CMD_TRIGGER             0x25  // param: TRIGGER_CMD_*, see Trigger_Serialize()
+#define CMD_RELAY_CONFIG        0x26  // param: CONFIG_CMD_*, relay delays and zero-cross mode
+#define CMD_SWITCH_RELAY_AT     0x27  // [cmd, relay, delay_ms u16, state], contacts move after delay_ms
+#define CMD_TELEMETRY           0x28  // param: TELEMETRY_CMD_*; frames start with TELEMETRY_FRAME (0x29)
+#define CMD_HELLO               0x2A  // param: nonce; version, capabilities and state in one reply
 
 // Firmware version
 #define FIRMWARE_VERSION_MAJOR  2
 #define FIRMWARE_VERSION_MINOR  0
 #define FIRMWARE_VERSION_PATCH  1
+
+// Frame layout revision of the control channel. New commands do not bump
+// it; the host checks for them in the GET_CAPABILITIES feature bits.
+// 2: dimmer values are 16-bit levels (0xFFFF = full scale), not 12-bit codes
+#define PROTOCOL_VERSION        2
 /* USER CODE END PTD */
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
-#define GP8413_ADDRESS          0x58  // 7-bit address
-#define GP8413_REG_CONFIG       0x02
-#define GP8413_REG_DAC1         0x10
-#define GP8413_REG_DAC2         0x11
-
 // GPIO Pin Definitions (based on actual main.h)
 #define GPIO_M1_PIN             GPIO_M1_Pin      // PB13
 #define GPIO_M1_PORT            GPIO_M1_GPIO_Port // GPIOB
@@ -76,45 +117,181 @@ typedef struct {
 #define DIM_OUT_EN_1_PORT       DIM_OUT_EN_1_GPIO_Port // GPIOB
 #define DIM_OUT_EN_2_PIN        DIM_OUT_EN_2_Pin // PB1
 #define DIM_OUT_EN_2_PORT       DIM_OUT_EN_2_GPIO_Port // GPIOB
+
+// Log text (boot banner, RX hex dump, "CMD:" lines) on the diagnostics CDC
+// port. It is only formatted while a terminal holds that port open and never
+// touches the control channel, which carries framed binary only. Formatting
+// goes through Fmt_Format(), so no printf code from newlib is linked.
+#define USB_DEBUG_TEXT          1
+#define USB_DEBUG_LINE_SIZE     96
+
+#define CMD_TX_WAIT_MS          2     // a stream ack ahead of a reply leaves within one USB frame
+
+#define TRACE_DUMP_RECORDS      6     // 4 + 6 x 9 = 58 bytes per packet
+#define TRACE_DUMP_TIMEOUT_MS   50
+
+#define BENCH_RELAY_RUNS        32
+#define BENCH_DIMMER_RUNS       8
+
+#define STATUS_PERIOD_MS        5000  // unsolicited status push
+#define WATCHDOG_PERIOD_MS      100   // liveness check-in, well inside WDG_TIMEOUT_MS
+
+// CMD_APPLY_STATE fields: byte 1 selects them, byte 2 holds the on/off bits
+#define STATE_RELAY1            0x01
+#define STATE_RELAY2            0x02
+#define STATE_DIMMER1           0x04
+#define STATE_DIMMER2           0x08
+#define STATE_ENABLE1           0x10
+#define STATE_ENABLE2           0x20
+#define STATE_ALL               0x3F
+
+#define STATE_OK                0x00
+#define STATE_ERR_RANGE         0x01
+#define STATE_ERR_I2C           0x02  // DAC write failed; relays/enables left unchanged
+#define STATE_ERR_NO_DEVICE     0x03  // no GP8413 answered for a dimmer in the mask
+
+// GET_CAPABILITIES feature bits
+#define FEATURE_WAVEFORM        0x0001
+#define FEATURE_STREAM          0x0002
+#define FEATURE_APPLY_STATE     0x0004
+#define FEATURE_BULK_OUTPUTS    0x0008
+#define FEATURE_METRICS         0x0010
+#define FEATURE_TRACE           0x0020
+#define FEATURE_CRASH_REPORT    0x0040
+#define FEATURE_WATCHDOG        0x0080
+#define FEATURE_MEMORY          0x0100
+#define FEATURE_TIMING          0x0200
+#define FEATURE_TASKS           0x0400
+#define FEATURE_LOW_POWER       0x0800
+#define FEATURE_DIAG_TEXT       0x1000  // log text on the diagnostics CDC port
+#define FEATURE_FAULT_INJECTION 0x2000  // WDG_CMD_HANG_* (DEBUG builds)
+#define FEATURE_DITHER          0x4000
+#define FEATURE_CURVES          0x8000
+#define FEATURE_HEALTH          0x00010000  // GET_HEALTH, also appended to GET_STATUS
+#define FEATURE_RELAY_TIMING    0x00020000  // PULSE_RELAY, BLINK_RELAY
+#define FEATURE_LATCHING_RELAY  0x00040000  // RELAY_DRIVE_LATCHING build (R1M1)
+#define FEATURE_TRIGGER         0x00080000  // CMD_TRIGGER, external trigger input on PA3
+#define FEATURE_RELAY_CONFIG    0x00100000  // RELAY_CONFIG, SWITCH_RELAY_AT, flash config page
+#define FEATURE_ZERO_CROSS      0x00200000  // zero-cross sync input on PA2
+#define FEATURE_TELEMETRY       0x00400000  // TELEMETRY delta-coded status stream
+#define FEATURE_HELLO           0x00800000  // HELLO connect handshake
+
+#define CAPS_HEADER_SIZE        16
+_Static_assert(CAPS_HEADER_SIZE + 2 * DIMMER_COUNT <= 64, "GET_CAPABILITIES reply must fit one USB packet");
+
+// Up to 12 dimmers the reply is one USB packet; above that it is one
+// two-packet transfer, which the host reads as a byte stream
+#define HELLO_REPLY_SIZE        (26 + 3 * DIMMER_COUNT)
+_Static_assert(HELLO_REPLY_SIZE <= 2 * 64, "HELLO reply must fit two USB packets");
+
+// CMD_BULK_OUTPUTS byte 1
+#define BULK_RELAYS             0x00
+#define BULK_ENABLES            0x01
+#define BULK_DIMMERS            0x02  // one level per channel in the mask
+#define BULK_DIMMERS_SAME       0x03  // one level for all channels in the mask
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
 /* USER CODE BEGIN PM */
-
+#if USB_DEBUG_TEXT
+#define USB_DEBUG(...)  do { if (CDC_Diag_IsOpen()) { \
+                               char line_[USB_DEBUG_LINE_SIZE]; \
+                               uint16_t n_ = Fmt_Format(line_, sizeof(line_), __VA_ARGS__); \
+                               if (n_ > 0) CDC_Transmit_Diag_FS((uint8_t*)line_, n_); } } while (0)
+#else
+#define USB_DEBUG(...)  ((void)0)
+#endif
 /* USER CODE END PM */
 
 /* Private variables ---------------------------------------------------------*/
 I2C_HandleTypeDef hi2c1;
+DMA_HandleTypeDef hdma_i2c1_tx;
 
 TIM_HandleTypeDef htim3;
+TIM_HandleTypeDef htim4;
 
 /* USER CODE BEGIN PV */
 PowerPackState_t powerpack_state = {0};
 uint8_t usb_rx_buffer[64];
 uint8_t usb_tx_buffer[64];
 volatile uint8_t usb_data_received = 0;
+volatile uint16_t usb_rx_length = 0;
+volatile uint32_t usb_rx_cycles = 0;   // DWT stamp of the pending packet
+
+// Stream acknowledgement waiting for the main loop. The host treats an ack as
+// covering every earlier frame, so a newer frame replaces a pending one.
+static volatile struct {
+  uint8_t seq;
+  uint8_t status;             // first error since the last ack sent, else STREAM_OK
+  uint8_t credits;            // free slots right after the frame was queued
+  uint8_t pending;
+} stream_ack;
 
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_I2C1_Init(void);
 static void MX_TIM3_Init(void);
+static void MX_TIM4_Init(void);
 /* USER CODE BEGIN PFP */
 void PowerPack_Init(void);
 void Set_Relay(uint8_t relay_num, uint8_t state);
 void Set_Dimmer(uint8_t dimmer_num, uint16_t value);
 void Enable_Dimmer(uint8_t dimmer_num, uint8_t enable);
-HAL_StatusTypeDef GP8413_WriteRegister(uint8_t reg, uint16_t value);
+static void Relay_CountSwitch(uint16_t relays);
+uint8_t Apply_Outputs(const OutputUpdate_t* update, OutputChange_t* changed);
+uint8_t Set_Curve(uint8_t curve, uint16_t mask);
+static void State_ToUpdate(uint8_t fields, uint8_t on, uint16_t code1, uint16_t code2, OutputUpdate_t* update);
+uint8_t Apply_State(uint8_t fields, uint8_t on, uint16_t code1, uint16_t code2, uint8_t* changed);
+uint8_t Bulk_Outputs(const uint8_t* data, uint16_t length, uint16_t* changed);
 void Process_USB_Command(uint8_t* data, uint16_t length);
 void Send_Status_Response(void);
 void Send_Version_Response(void);
+void Send_Ack_Response(uint8_t cmd, uint8_t status, uint16_t value);
+uint8_t Send_Stream_Ack(uint8_t seq, uint8_t status, uint8_t credits);
+void Send_Stream_Stats(uint8_t reset);
+void Send_Metrics_Response(void);
+void Send_Trace_Dump(uint8_t clear);
+void Send_Output_Benchmark(void);
+void Send_Channel_Benchmark(void);
+void Send_Capabilities_Response(void);
+void Send_Hello_Response(uint8_t nonce);
+static void Capabilities_Header(uint8_t* out);
+void Send_Dither_Response(uint8_t param, uint16_t value);
+void Send_Crash_Response(uint8_t page);
+void Watchdog_Command(uint8_t param);
+void Send_Memory_Response(void);
+void Send_Timing_Response(uint8_t reset);
+void Send_Tasks_Response(uint8_t reset);
+void Send_Power_Response(void);
+void Send_Health_Response(void);
+void Send_Trigger_Response(const uint8_t* data, uint16_t length);
+void Send_Relay_Config_Response(const uint8_t* data, uint16_t length);
+void Send_Telemetry_Response(const uint8_t* data, uint16_t length);
+static void Task_Commands(void);
+static void Task_Watchdog(void);
+static void Task_Status(void);
+static void Task_Trigger(void);
+static void Task_Telemetry(void);
+#if USB_DEBUG_TEXT
+static void Rx_Log_Deferred(uint32_t arg);
+static void Boot_Banner(void);
+#endif
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
-
+// Main loop tasks, in SchedTaskId_t order
+const SchedTaskDef_t sched_tasks[TASK_COUNT] = {
+  [TASK_COMMANDS]  = { Task_Commands,  0 },
+  [TASK_WATCHDOG]  = { Task_Watchdog,  WATCHDOG_PERIOD_MS },
+  [TASK_STATUS]    = { Task_Status,    STATUS_PERIOD_MS },
+  [TASK_TRIGGER]   = { Task_Trigger,   0 },
+  [TASK_TELEMETRY] = { Task_Telemetry, TELEMETRY_TICK_MS },
+};
 /* USER CODE END 0 */
 
 /**
@@ -125,7 +302,10 @@ int main(void)
 {
 
   /* USER CODE BEGIN 1 */
-
+  Memory_PaintStack();
+  Crash_Init();
+  Watchdog_Init();
+  Timing_Init();
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -146,45 +326,27 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_I2C1_Init();
   MX_USB_DEVICE_Init();
   MX_TIM3_Init();
+  MX_TIM4_Init();
   /* USER CODE BEGIN 2 */
   
-  // Send boot message via USB CDC
-  HAL_Delay(2000);  // Wait for USB to initialize
-  
-  sprintf(debug_msg, "\r\n=== PowerPack R2M1 v%d.%d.%d Started ===\r\n", 
-          FIRMWARE_VERSION_MAJOR, FIRMWARE_VERSION_MINOR, FIRMWARE_VERSION_PATCH);
-  CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
-  HAL_Delay(100);
-  
-  sprintf(debug_msg, "System Clock: %lu MHz\r\n", HAL_RCC_GetHCLKFreq() / 1000000);
-  CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
-  HAL_Delay(100);
-  
-  sprintf(debug_msg, "Initializing PowerPack...\r\n");
-  CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
-  HAL_Delay(100);
-  
+  // Outputs first: after a watchdog reset they are restored within milliseconds
+  Config_Init();
   PowerPack_Init();
   
-  sprintf(debug_msg, "PowerPack initialized successfully\r\n");
-  CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
-  HAL_Delay(100);
-  
-  sprintf(debug_msg, "Relay 1: %s, Relay 2: %s\r\n", 
-          powerpack_state.relay1_state ? "ON" : "OFF",
-          powerpack_state.relay2_state ? "ON" : "OFF");
-  CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
-  HAL_Delay(100);
-  
-  sprintf(debug_msg, "Ready for commands!\r\n");
-  CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
-  HAL_Delay(100);
+  // TIM3 paces waveform samples; it stays stopped until Wave_Start() runs it
+  __HAL_TIM_CLEAR_FLAG(&htim3, TIM_FLAG_UPDATE);
+  __HAL_TIM_ENABLE_IT(&htim3, TIM_IT_UPDATE);
 
-  // Start timer for status updates
-  HAL_TIM_Base_Start_IT(&htim3);
+  Watchdog_Start();
+  Power_Init();
+  Health_Init();
+  Trigger_Init();
+  ZeroCross_Init();
+  Sched_Init();
 
   /* USER CODE END 2 */
 
@@ -196,15 +358,8 @@ int main(void)
 
     /* USER CODE BEGIN 3 */
 
-    // Process USB commands
-	  // Process USB commands
-	  // Process USB commands
-	  if (usb_data_received) {
-	    Process_USB_Command(usb_rx_buffer, 64);
-	    usb_data_received = 0;
-	  }
-
-	  HAL_Delay(10);
+    // Runs the task table and sleeps in WFI between deadlines; never returns
+    Sched_Run();
   }
   /* USER CODE END 3 */
 }
@@ -334,6 +489,67 @@ static void MX_TIM3_Init(void)
 
 }
 
+/**
+  * @brief TIM4 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM4_Init(void)
+{
+
+  /* USER CODE BEGIN TIM4_Init 0 */
+
+  /* USER CODE END TIM4_Init 0 */
+
+  TIM_ClockConfigTypeDef sClockSourceConfig = {0};
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+
+  /* USER CODE BEGIN TIM4_Init 1 */
+  // 48 MHz / 48 / 1000 = 1 kHz stream playout tick
+  /* USER CODE END TIM4_Init 1 */
+  htim4.Instance = TIM4;
+  htim4.Init.Prescaler = 47;
+  htim4.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim4.Init.Period = 999;
+  htim4.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim4.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim4) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
+  if (HAL_TIM_ConfigClockSource(&htim4, &sClockSourceConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim4, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM4_Init 2 */
+
+  /* USER CODE END TIM4_Init 2 */
+
+}
+
+/**
+  * Enable DMA controller clock
+  */
+static void MX_DMA_Init(void)
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Channel6_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 2, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+
+}
+
 /**
   * @brief GPIO Initialization Function
   * @param None
@@ -371,95 +587,382 @@ static void MX_GPIO_Init(void)
   */
 void PowerPack_Init(void)
 {
-  // Initialize GP8413 DAC
-  GP8413_WriteRegister(GP8413_REG_CONFIG, 0x0000);  // Default configuration
+  // Relay timers first: a latching relay moves with a timed coil pulse
+  RelayTimer_Init();
+
+  // Find the GP8413s that answer, then configure those
+  Channels_Probe();
+  Channels_ConfigureDacs();
 
   // Initialize state
-  powerpack_state.relay1_state = 0;
-  powerpack_state.relay2_state = 0;
-  powerpack_state.dimmer1_value = 0;
-  powerpack_state.dimmer2_value = 0;
-  powerpack_state.dimmer1_enabled = 0;
-  powerpack_state.dimmer2_enabled = 0;
+  memset(&powerpack_state, 0, sizeof(powerpack_state));
 
-  // Set initial relay states (both OFF)
-  Set_Relay(1, 0);
-  Set_Relay(2, 0);
+  // All relays and dimmer outputs start off
+  for (uint8_t i = 1; i <= RELAY_COUNT; i++) {
+    Set_Relay(i, 0);
+  }
+  for (uint8_t i = 1; i <= DIMMER_COUNT; i++) {
+    Enable_Dimmer(i, 0);
+  }
 
-  // Set initial dimmer states
-  Enable_Dimmer(1, 0);
-  Enable_Dimmer(2, 0);
+  // After a watchdog reset bring the outputs back to where they were
+  PowerPackState_t retained;
+  if (Watchdog_GetRetainedState(&retained)) {
+    OutputUpdate_t update = {
+      .relay_mask = RELAY_ALL, .relay_on = retained.relays,
+      .enable_mask = DIMMER_ALL, .enable_on = retained.dimmers_enabled,
+      .dimmer_mask = Channels_DimmersPresent(),
+    };
+    OutputChange_t changed;
+    for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+      if (retained.dimmer_curve[i] < CURVE_COUNT) powerpack_state.dimmer_curve[i] = retained.dimmer_curve[i];
+    }
+    memcpy(update.level, retained.dimmer_value, sizeof(update.level));
+    Apply_Outputs(&update, &changed);
+  }
 }
 
 /**
   * @brief Control relay output
-  * @param relay_num: Relay number (1 or 2)
+  * @param relay_num: Relay number (1..RELAY_COUNT)
   * @param state: Relay state (0 = OFF, 1 = ON)
   * @retval None
+  * @note  Ends a pulse or blink on the relay. A relay in the zero-cross
+  *        mask switches on the next mains crossing instead of at once.
   */
 void Set_Relay(uint8_t relay_num, uint8_t state)
 {
-  if (relay_num == 1) {
-    // Control Relay 1 via GPIO_M1
-    HAL_GPIO_WritePin(GPIO_M1_PORT, GPIO_M1_PIN, state ? GPIO_PIN_SET : GPIO_PIN_RESET);
-    powerpack_state.relay1_state = state;
-  } else if (relay_num == 2) {
-    // Control Relay 2 via GPIO_M2
-    HAL_GPIO_WritePin(GPIO_M2_PORT, GPIO_M2_PIN, state ? GPIO_PIN_SET : GPIO_PIN_RESET);
-    powerpack_state.relay2_state = state;
+  const RelayChannel_t* relay;
+  uint16_t bit;
+  uint8_t switched;
+
+  if (relay_num < 1 || relay_num > RELAY_COUNT) return;
+  relay = &relay_channels[relay_num - 1];
+  bit = 1U << (relay_num - 1);
+
+  Trace_Event(TRACE_RELAY, (relay_num << 8) | state);
+
+  RelayTimer_Cancel(bit);
+  Trigger_Hold();
+  switched = !state != !(powerpack_state.relays & bit);
+  if (!relay->reset_pin && !RelayTimer_SwitchZeroCross(relay_num - 1, state)) {
+    Output_WritePin(relay->port, relay->pin, state);
   }
+  if (state) {
+    powerpack_state.relays |= bit;
+  } else {
+    powerpack_state.relays &= ~bit;
+  }
+  Trigger_Release();
+
+  if (switched) Relay_CountSwitch(bit);
+  // The trigger never moves a latching relay, so its coil pulse runs outside the hold
+  if (relay->reset_pin) RelayTimer_Latch(relay_num - 1, state);
 }
 
 /**
   * @brief Set dimmer output value
-  * @param dimmer_num: Dimmer number (1 or 2)
-  * @param value: DAC value (0-4095)
+  * @param dimmer_num: Dimmer number (1..DIMMER_COUNT)
+  * @param value: Level, 0xFFFF = full scale
   * @retval None
+  * @note  Ignored for a dimmer whose GP8413 did not answer the boot probe.
   */
 void Set_Dimmer(uint8_t dimmer_num, uint16_t value)
 {
-  if (value > 4095) value = 4095;
+  uint16_t codes[DIMMER_COUNT];
+  uint16_t bit;
+
+  if (dimmer_num < 1 || dimmer_num > DIMMER_COUNT) return;
+  bit = 1U << (dimmer_num - 1);
+  if (!(Channels_DimmersPresent() & bit)) return;
+
+  Trace_Event(TRACE_DIMMER, ((uint32_t)dimmer_num << 16) | value);
 
-  if (dimmer_num == 1) {
-    GP8413_WriteRegister(GP8413_REG_DAC1, value);
-    powerpack_state.dimmer1_value = value;
-  } else if (dimmer_num == 2) {
-    GP8413_WriteRegister(GP8413_REG_DAC2, value);
-    powerpack_state.dimmer2_value = value;
+  // A manual setpoint overrides any waveform or stream that is playing
+  if (Wave_IsPlaying()) {
+    Wave_Stop();
+  }
+  if (Stream_IsActive()) {
+    Stream_Stop();
+  }
+
+  codes[dimmer_num - 1] = Curve_LevelToCode(dimmer_num - 1, value);
+  if (Channels_WriteDimmers(bit, codes) == HAL_OK) {
+    powerpack_state.dimmer_value[dimmer_num - 1] = value;
+    Dither_SetLevel(dimmer_num - 1, value);
   }
 }
 
 /**
   * @brief Enable/disable dimmer output
-  * @param dimmer_num: Dimmer number (1 or 2)
+  * @param dimmer_num: Dimmer number (1..DIMMER_COUNT)
   * @param enable: Enable state (0 = disabled, 1 = enabled)
   * @retval None
   */
 void Enable_Dimmer(uint8_t dimmer_num, uint8_t enable)
 {
-  if (dimmer_num == 1) {
-    HAL_GPIO_WritePin(DIM_OUT_EN_1_PORT, DIM_OUT_EN_1_PIN, enable ? GPIO_PIN_SET : GPIO_PIN_RESET);
-    powerpack_state.dimmer1_enabled = enable;
-  } else if (dimmer_num == 2) {
-    HAL_GPIO_WritePin(DIM_OUT_EN_2_PORT, DIM_OUT_EN_2_PIN, enable ? GPIO_PIN_SET : GPIO_PIN_RESET);
-    powerpack_state.dimmer2_enabled = enable;
+  const DimmerChannel_t* dimmer;
+  uint16_t bit;
+
+  if (dimmer_num < 1 || dimmer_num > DIMMER_COUNT) return;
+  dimmer = &dimmer_channels[dimmer_num - 1];
+  bit = 1U << (dimmer_num - 1);
+
+  Trace_Event(TRACE_DIMMER_ENABLE, (dimmer_num << 8) | enable);
+
+  Trigger_Hold();
+  Output_WritePin(dimmer->enable_port, dimmer->enable_pin, enable);
+  if (enable) {
+    powerpack_state.dimmers_enabled |= bit;
+  } else {
+    powerpack_state.dimmers_enabled &= ~bit;
+  }
+  Trigger_Release();
+}
+
+/**
+  * @brief Count relay switch operations (relays 1 and 2 have metrics)
+  * @param relays: Relays that changed state
+  * @retval None
+  */
+static void Relay_CountSwitch(uint16_t relays)
+{
+  if (relays & 0x01) Metrics_Inc(METRIC_RELAY1_SWITCHES);
+  if (relays & 0x02) Metrics_Inc(METRIC_RELAY2_SWITCHES);
+}
+
+/**
+  * @brief Apply several output channels together, touching only those that change
+  * @param update: Channels to apply and their target state
+  * @param changed: Receives the channels that actually changed
+  * @retval STATE_OK or STATE_ERR_*
+  *
+  * Order: enables that turn off switch first, so a disabled output never
+  * shows the new code; then the DAC codes go out (Channels_WriteDimmers(),
+  * merged per GP8413 where the table allows); then the relays and the enables that turn on switch together,
+  * one BSRR store per port, so they come up on the final codes.
+  *
+  * The trigger interrupt may switch the same pins during the DAC write,
+  * so each pin step compares against powerpack_state and stores the
+  * result with the trigger held off; the state always matches the pins.
+  */
+uint8_t Apply_Outputs(const OutputUpdate_t* update, OutputChange_t* changed)
+{
+  uint16_t codes[DIMMER_COUNT];
+  uint16_t early;
+  uint16_t latching;
+  uint16_t enables;
+  HAL_StatusTypeDef status = HAL_OK;
+
+  changed->relays = changed->enables = changed->dimmers = 0;
+  if ((update->relay_mask | update->enable_mask | update->dimmer_mask) == 0 ||
+      (update->relay_mask & ~RELAY_ALL) || (update->enable_mask & ~DIMMER_ALL) ||
+      (update->dimmer_mask & ~DIMMER_ALL)) {
+    return STATE_ERR_RANGE;
+  }
+  if (update->dimmer_mask & ~Channels_DimmersPresent()) return STATE_ERR_NO_DEVICE;
+
+  // A manual setpoint overrides any waveform or stream that is playing,
+  // and a relay write any pulse or blink
+  if (update->dimmer_mask) {
+    if (Wave_IsPlaying()) Wave_Stop();
+    if (Stream_IsActive()) Stream_Stop();
+  }
+  RelayTimer_Cancel(update->relay_mask);
+
+  Trigger_Hold();
+  changed->relays = update->relay_mask & (update->relay_on ^ powerpack_state.relays);
+  changed->enables = update->enable_mask & (update->enable_on ^ powerpack_state.dimmers_enabled);
+  early = changed->enables & ~update->enable_on;
+  if (early) {
+    Channels_WritePins(0, 0, 0, early);
+    powerpack_state.dimmers_enabled &= ~early;
+  }
+  Trigger_Release();
+
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    codes[i] = Curve_LevelToCode(i, update->level[i]);
+    if ((update->dimmer_mask & (1U << i)) && update->level[i] != powerpack_state.dimmer_value[i]) {
+      changed->dimmers |= 1U << i;
+    }
+  }
+
+  Trace_Event(TRACE_APPLY_STATE, (changed->relays & 0xFF) | (changed->enables & 0xFF) << 8 |
+                                 (uint32_t)(changed->dimmers & 0xFF) << 16);
+
+  if (changed->dimmers) {
+    status = Channels_WriteDimmers(changed->dimmers, codes);
+  }
+
+  if (status != HAL_OK) {
+    // Only the early switch-offs took effect
+    changed->relays = 0;
+    changed->dimmers = 0;
+    changed->enables = early;
+  } else {
+    for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+      if (!(changed->dimmers & (1U << i))) continue;
+      powerpack_state.dimmer_value[i] = update->level[i];
+      Dither_SetLevel(i, update->level[i]);
+    }
+
+    // Compare again: a trigger may have switched some of these since
+    latching = Channels_LatchingRelays();
+    Trigger_Hold();
+    changed->relays = update->relay_mask & (update->relay_on ^ powerpack_state.relays);
+    enables = update->enable_mask & (update->enable_on ^ powerpack_state.dimmers_enabled);
+    Channels_WritePins(changed->relays & ~latching & update->relay_on,
+                       changed->relays & ~latching & ~update->relay_on,
+                       enables & update->enable_on, enables & ~update->enable_on);
+    powerpack_state.relays = (powerpack_state.relays & ~update->relay_mask) |
+                             (update->relay_on & update->relay_mask);
+    powerpack_state.dimmers_enabled = (powerpack_state.dimmers_enabled & ~update->enable_mask) |
+                                      (update->enable_on & update->enable_mask);
+    Trigger_Release();
+    changed->enables = early | enables;
+
+    if (changed->relays & latching) {
+      Channels_WritePins(changed->relays & latching & update->relay_on,
+                         changed->relays & latching & ~update->relay_on, 0, 0);
+    }
+  }
+
+  Relay_CountSwitch(changed->relays);
+
+  return (status == HAL_OK) ? STATE_OK : STATE_ERR_I2C;
+}
+
+/**
+  * @brief Select the dimming curve of a set of dimmers
+  * @param curve: CURVE_*
+  * @param mask: Dimmers to change (bit n = dimmer n+1)
+  * @retval STATE_OK or STATE_ERR_*
+  * @note  The levels stay; the outputs move to where the new curve puts
+  *        them. A waveform or stream picks the curve up with its next sample.
+  */
+uint8_t Set_Curve(uint8_t curve, uint16_t mask)
+{
+  uint16_t codes[DIMMER_COUNT];
+  HAL_StatusTypeDef status = HAL_OK;
+
+  if (curve >= CURVE_COUNT || mask == 0 || (mask & ~DIMMER_ALL)) return STATE_ERR_RANGE;
+  if (mask & ~Channels_DimmersPresent()) return STATE_ERR_NO_DEVICE;
+
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    if (!(mask & (1U << i))) continue;
+    powerpack_state.dimmer_curve[i] = curve;
+    codes[i] = Curve_LevelToCode(i, powerpack_state.dimmer_value[i]);
+    Dither_SetLevel(i, powerpack_state.dimmer_value[i]);
   }
+
+  if (!Wave_IsPlaying() && !Stream_IsActive()) {
+    status = Channels_WriteDimmers(mask, codes);
+  }
+  return (status == HAL_OK) ? STATE_OK : STATE_ERR_I2C;
+}
+
+/**
+  * @brief Translate the STATE_* layout of CMD_APPLY_STATE into an output update
+  * @param fields: STATE_* bits to apply
+  * @param on: STATE_RELAYx / STATE_ENABLEx bits giving the new on/off state
+  * @param code1: Dimmer 1 level (STATE_DIMMER1), 0xFFFF = full scale
+  * @param code2: Dimmer 2 level (STATE_DIMMER2)
+  * @param update: Receives the masks and levels
+  * @retval None
+  */
+static void State_ToUpdate(uint8_t fields, uint8_t on, uint16_t code1, uint16_t code2, OutputUpdate_t* update)
+{
+  *update = (OutputUpdate_t){
+    .relay_mask = ((fields & STATE_RELAY1) ? 0x01 : 0) | ((fields & STATE_RELAY2) ? 0x02 : 0),
+    .relay_on = ((on & STATE_RELAY1) ? 0x01 : 0) | ((on & STATE_RELAY2) ? 0x02 : 0),
+    .enable_mask = ((fields & STATE_ENABLE1) ? 0x01 : 0) | ((fields & STATE_ENABLE2) ? 0x02 : 0),
+    .enable_on = ((on & STATE_ENABLE1) ? 0x01 : 0) | ((on & STATE_ENABLE2) ? 0x02 : 0),
+    .dimmer_mask = ((fields & STATE_DIMMER1) ? 0x01 : 0) | ((fields & STATE_DIMMER2) ? 0x02 : 0),
+  };
+  update->level[0] = code1;
+  update->level[1] = code2;
+}
+
+/**
+  * @brief Apply a CMD_APPLY_STATE frame (relays and dimmers 1 and 2)
+  * @param fields: STATE_* bits to apply
+  * @param on: STATE_RELAYx / STATE_ENABLEx bits giving the new on/off state
+  * @param code1: Dimmer 1 level (STATE_DIMMER1), 0xFFFF = full scale
+  * @param code2: Dimmer 2 level (STATE_DIMMER2)
+  * @param changed: Receives the STATE_* bits that actually changed
+  * @retval STATE_OK or STATE_ERR_*
+  */
+uint8_t Apply_State(uint8_t fields, uint8_t on, uint16_t code1, uint16_t code2, uint8_t* changed)
+{
+  OutputUpdate_t update;
+  OutputChange_t change;
+  uint8_t status;
+
+  *changed = 0;
+  if (fields == 0 || (fields & ~STATE_ALL)) return STATE_ERR_RANGE;
+  State_ToUpdate(fields, on, code1, code2, &update);
+
+  status = Apply_Outputs(&update, &change);
+  *changed = ((change.relays & 0x01) ? STATE_RELAY1 : 0) | ((change.relays & 0x02) ? STATE_RELAY2 : 0) |
+             ((change.dimmers & 0x01) ? STATE_DIMMER1 : 0) | ((change.dimmers & 0x02) ? STATE_DIMMER2 : 0) |
+             ((change.enables & 0x01) ? STATE_ENABLE1 : 0) | ((change.enables & 0x02) ? STATE_ENABLE2 : 0);
+  return status;
 }
 
 /**
-  * @brief Write to GP8413 register
-  * @param reg: Register address
-  * @param value: 16-bit value to write
-  * @retval HAL status
+  * @brief Apply a CMD_BULK_OUTPUTS frame: one kind of channel, selected by mask
+  * @param data: [cmd, BULK_*, mask u16, payload...]
+  * @param length: Frame length
+  * @param changed: Receives the channels that changed
+  * @retval STATE_OK or STATE_ERR_*
+  *
+  * BULK_RELAYS / BULK_ENABLES: payload is an on-mask u16. BULK_DIMMERS:
+  * one level u16 per channel in the mask, lowest channel first.
+  * BULK_DIMMERS_SAME: one level u16 for every channel in the mask.
   */
-HAL_StatusTypeDef GP8413_WriteRegister(uint8_t reg, uint16_t value)
+uint8_t Bulk_Outputs(const uint8_t* data, uint16_t length, uint16_t* changed)
 {
-  uint8_t data[3];
-  data[0] = reg;
-  data[1] = (value >> 8) & 0xFF;  // MSB
-  data[2] = value & 0xFF;         // LSB
+  OutputUpdate_t update = {0};
+  OutputChange_t change;
+  uint16_t mask;
+  uint8_t status;
+  uint8_t n = 0;
+
+  *changed = 0;
+  if (length < 6) return STATE_ERR_RANGE;
+  mask = (data[2] << 8) | data[3];
+
+  switch (data[1]) {
+    case BULK_RELAYS:
+      update.relay_mask = mask;
+      update.relay_on = (data[4] << 8) | data[5];
+      break;
+
+    case BULK_ENABLES:
+      update.enable_mask = mask;
+      update.enable_on = (data[4] << 8) | data[5];
+      break;
 
-  return HAL_I2C_Master_Transmit(&hi2c1, GP8413_ADDRESS << 1, data, 3, HAL_MAX_DELAY);
+    case BULK_DIMMERS:
+    case BULK_DIMMERS_SAME:
+      if (mask & ~DIMMER_ALL) return STATE_ERR_RANGE;
+      update.dimmer_mask = mask;
+      for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+        const uint8_t* p = &data[4 + 2 * n];
+        if (!(mask & (1U << i))) continue;
+        if (p + 2 > data + length) return STATE_ERR_RANGE;
+        update.level[i] = (p[0] << 8) | p[1];
+        if (data[1] == BULK_DIMMERS) n++;
+      }
+      break;
+
+    default:
+      return STATE_ERR_RANGE;
+  }
+
+  status = Apply_Outputs(&update, &change);
+  *changed = change.relays | change.enables | change.dimmers;
+  return status;
 }
 
 /**
@@ -475,75 +978,233 @@ void Process_USB_Command(uint8_t* data, uint16_t length)
   uint8_t cmd = data[0];
   uint8_t param = data[1];
   uint16_t value = (data[2] << 8) | data[3];
+
+  Metrics_Inc(METRIC_CMD_RECEIVED);
+
+  // Bulk-path frames are acknowledged in-band only: debug text on the same
+  // pipe would make CDC_Transmit_FS drop the acknowledgement as busy
+  switch (cmd) {
+    case CMD_WAVE_BEGIN:
+      Send_Ack_Response(cmd, Wave_BeginUpload(param, value), WAVE_MAX_SAMPLES);
+      return;
+
+    case CMD_WAVE_CHUNK:
+      Send_Ack_Response(cmd, Wave_WriteChunk(data, length), Wave_GetNextOffset());
+      return;
+
+    case CMD_WAVE_COMMIT:
+      Send_Ack_Response(cmd, Wave_Commit(value), Wave_GetMaxSampleRate());
+      return;
+
+    case CMD_WAVE_PLAY:
+      if (param != WAVE_MODE_STOP) {
+        Stream_Stop();
+      }
+      Send_Ack_Response(cmd, Wave_Play(param, value), Wave_GetMaxSampleRate());
+      return;
+
+    case CMD_STREAM_START:
+      Send_Ack_Response(cmd, Stream_Start(param, value), STREAM_BUFFER_SLOTS);
+      return;
+
+    case CMD_STREAM_STOP:
+      Stream_Stop();
+      Send_Ack_Response(cmd, STREAM_OK, 0);
+      return;
+
+    case CMD_STREAM_STATS:
+      Send_Stream_Stats(param);
+      return;
+
+    case CMD_GET_METRICS:
+      Send_Metrics_Response();
+      return;
+
+    case CMD_DUMP_TRACE:
+      Send_Trace_Dump(param);
+      return;
+
+    case CMD_BENCH_OUTPUTS:
+      Send_Output_Benchmark();
+      return;
+
+    case CMD_GET_CRASH:
+      Send_Crash_Response(param);
+      return;
+
+    case CMD_WATCHDOG:
+      Watchdog_Command(param);
+      return;
+
+    case CMD_GET_MEMORY:
+      Send_Memory_Response();
+      return;
+
+    case CMD_GET_TIMING:
+      Send_Timing_Response(param);
+      return;
+
+    case CMD_GET_TASKS:
+      Send_Tasks_Response(param);
+      return;
+
+    case CMD_GET_POWER:
+      Send_Power_Response();
+      return;
+
+    case CMD_GET_HEALTH:
+      Send_Health_Response();
+      return;
+
+    case CMD_BULK_OUTPUTS: {
+      uint16_t changed;
+      uint8_t status = Bulk_Outputs(data, length, &changed);
+      Send_Ack_Response(cmd, status, changed);
+      return;
+    }
+
+    case CMD_BENCH_CHANNELS:
+      Send_Channel_Benchmark();
+      return;
+
+    case CMD_HELLO:
+      Send_Hello_Response(param);
+      return;
+
+    case CMD_GET_CAPABILITIES:
+      Send_Capabilities_Response();
+      return;
+
+    case CMD_DITHER:
+      Send_Dither_Response(param, value);
+      return;
+
+    case CMD_SET_CURVE:
+      Send_Ack_Response(cmd, Set_Curve(param, value), value);
+      return;
+
+    case CMD_PULSE_RELAY:
+      Send_Ack_Response(cmd, RelayTimer_Blink(param, value, 0, 1), value);
+      return;
+
+    case CMD_BLINK_RELAY:
+      if (length < 8) {
+        Send_Ack_Response(cmd, RELAY_TIMER_ERR_RANGE, 0);
+      } else {
+        Send_Ack_Response(cmd, RelayTimer_Blink(param, value, (data[4] << 8) | data[5],
+                                                (data[6] << 8) | data[7]), value);
+      }
+      return;
+
+    case CMD_TRIGGER:
+      Send_Trigger_Response(data, length);
+      return;
+
+    case CMD_RELAY_CONFIG:
+      Send_Relay_Config_Response(data, length);
+      return;
+
+    case CMD_TELEMETRY:
+      Send_Telemetry_Response(data, length);
+      return;
+
+    case CMD_SWITCH_RELAY_AT:
+      if (length < 5) {
+        Send_Ack_Response(cmd, RELAY_TIMER_ERR_RANGE, 0);
+      } else {
+        uint16_t bit = 1U << (param - 1);
+        uint8_t switched = 0;
+        uint8_t status;
+
+        Trigger_Hold();
+        status = RelayTimer_SwitchAt(param, data[4], value * 1000UL);
+        if (status == RELAY_TIMER_OK) {
+          switched = !data[4] != !(powerpack_state.relays & bit);
+          if (data[4]) {
+            powerpack_state.relays |= bit;
+          } else {
+            powerpack_state.relays &= ~bit;
+          }
+        }
+        Trigger_Release();
+        if (switched) Relay_CountSwitch(bit);
+        Send_Ack_Response(cmd, status, value);
+      }
+      return;
+
+    case CMD_APPLY_STATE:
+      if (length < 8) {
+        Send_Ack_Response(cmd, STATE_ERR_RANGE, 0);
+      } else {
+        uint8_t changed;
+        uint8_t status = Apply_State(param, data[2], (data[4] << 8) | data[5],
+                                     (data[6] << 8) | data[7], &changed);
+        Send_Ack_Response(cmd, status, changed);
+      }
+      return;
+
+    default:
+      break;
+  }
   
   // Debug: Log received command
-  sprintf(debug_msg, "CMD: 0x%02X, param: %d, value: %d\r\n", cmd, param, value);
-  CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+  USB_DEBUG("CMD: 0x%02X, param: %d, value: %d\r\n", cmd, param, value);
 
   switch (cmd) {
     case CMD_SET_RELAY1:
       Set_Relay(1, param);
-      sprintf(debug_msg, "Relay 1 -> %s\r\n", param ? "ON" : "OFF");
-      CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+      USB_DEBUG("Relay 1 -> %s\r\n", param ? "ON" : "OFF");
       break;
 
     case CMD_SET_RELAY2:
       Set_Relay(2, param);
-      sprintf(debug_msg, "Relay 2 -> %s\r\n", param ? "ON" : "OFF");
-      CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+      USB_DEBUG("Relay 2 -> %s\r\n", param ? "ON" : "OFF");
       break;
 
     case CMD_SET_DIMMER1:
       Set_Dimmer(1, value);
-      sprintf(debug_msg, "Dimmer 1 -> %d\r\n", value);
-      CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+      USB_DEBUG("Dimmer 1 -> %d\r\n", value);
       break;
 
     case CMD_SET_DIMMER2:
       Set_Dimmer(2, value);
-      sprintf(debug_msg, "Dimmer 2 -> %d\r\n", value);
-      CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+      USB_DEBUG("Dimmer 2 -> %d\r\n", value);
       break;
 
     case CMD_ENABLE_DIMMER1:
       Enable_Dimmer(1, 1);
-      sprintf(debug_msg, "Dimmer 1 enabled\r\n");
-      CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+      USB_DEBUG("Dimmer 1 enabled\r\n");
       break;
 
     case CMD_ENABLE_DIMMER2:
       Enable_Dimmer(2, 1);
-      sprintf(debug_msg, "Dimmer 2 enabled\r\n");
-      CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+      USB_DEBUG("Dimmer 2 enabled\r\n");
       break;
 
     case CMD_DISABLE_DIMMER1:
       Enable_Dimmer(1, 0);
-      sprintf(debug_msg, "Dimmer 1 disabled\r\n");
-      CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+      USB_DEBUG("Dimmer 1 disabled\r\n");
       break;
 
     case CMD_DISABLE_DIMMER2:
       Enable_Dimmer(2, 0);
-      sprintf(debug_msg, "Dimmer 2 disabled\r\n");
-      CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+      USB_DEBUG("Dimmer 2 disabled\r\n");
       break;
 
     case CMD_GET_STATUS:
-      sprintf(debug_msg, "Status requested\r\n");
-      CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+      USB_DEBUG("Status requested\r\n");
       Send_Status_Response();
       break;
 
     case CMD_GET_VERSION:
-      sprintf(debug_msg, "Version requested\r\n");
-      CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+      USB_DEBUG("Version requested\r\n");
       Send_Version_Response();
       break;
+
       
     default:
-      sprintf(debug_msg, "Unknown command: 0x%02X\r\n", cmd);
-      CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+      Metrics_Inc(METRIC_CMD_UNKNOWN);
+      USB_DEBUG("Unknown command: 0x%02X\r\n", cmd);
       break;
   }
 }
@@ -551,20 +1212,22 @@ void Process_USB_Command(uint8_t* data, uint16_t length)
 /**
   * @brief Send status response via USB
   * @retval None
+  * @note  The GET_HEALTH frame follows in the same packet, so every status
+  *        poll and push also carries the temperature and supply readings.
   */
 void Send_Status_Response(void)
 {
-  uint8_t response[8];
+  static uint8_t response[8 + HEALTH_REPLY_SIZE];
   response[0] = CMD_GET_STATUS;
-  response[1] = powerpack_state.relay1_state;
-  response[2] = powerpack_state.relay2_state;
-  response[3] = (powerpack_state.dimmer1_value >> 8) & 0xFF;
-  response[4] = powerpack_state.dimmer1_value & 0xFF;
-  response[5] = (powerpack_state.dimmer2_value >> 8) & 0xFF;
-  response[6] = powerpack_state.dimmer2_value & 0xFF;
-  response[7] = (powerpack_state.dimmer1_enabled << 1) | powerpack_state.dimmer2_enabled;
-
-  CDC_Transmit_FS(response, 8);
+  response[1] = powerpack_state.relays & 0x01;
+  response[2] = (powerpack_state.relays >> 1) & 0x01;
+  response[3] = (powerpack_state.dimmer_value[0] >> 8) & 0xFF;
+  response[4] = powerpack_state.dimmer_value[0] & 0xFF;
+  response[5] = (powerpack_state.dimmer_value[1] >> 8) & 0xFF;
+  response[6] = powerpack_state.dimmer_value[1] & 0xFF;
+  response[7] = ((powerpack_state.dimmers_enabled & 0x01) << 1) | ((powerpack_state.dimmers_enabled >> 1) & 0x01);
+
+  CDC_Transmit_FS(response, 8 + Health_Serialize(CMD_GET_HEALTH, &response[8]));
 }
 
 /**
@@ -587,20 +1250,736 @@ void Send_Version_Response(void)
 }
 
 /**
-  * @brief Timer callback for periodic status updates
+  * @brief Send bulk-path command acknowledgement via USB
+  * @param cmd: Command being acknowledged
+  * @param status: Module status code (0 = OK)
+  * @param value: Command specific value (capacity, next offset or max rate)
+  * @retval None
+  */
+void Send_Ack_Response(uint8_t cmd, uint8_t status, uint16_t value)
+{
+  uint8_t response[8] = {0};
+  response[0] = cmd;
+  response[1] = status;
+  response[2] = (value >> 8) & 0xFF;
+  response[3] = value & 0xFF;
+
+  CDC_Transmit_FS(response, 8);
+}
+
+/**
+  * @brief Acknowledge a stream data frame and return credits
+  * @param seq: Sequence byte of the acknowledged frame
+  * @param status: STREAM_OK or STREAM_ERR_*
+  * @param credits: Free slots right after the frame was queued
+  * @retval USBD_OK, or USBD_BUSY if the IN endpoint is still sending
+  */
+uint8_t Send_Stream_Ack(uint8_t seq, uint8_t status, uint8_t credits)
+{
+  static uint8_t response[8];
+  response[0] = CMD_STREAM_DATA;
+  response[1] = seq;
+  response[2] = status;
+  response[3] = credits;
+  response[4] = STREAM_BUFFER_SLOTS - credits;
+  response[5] = 0;
+  response[6] = 0;
+  response[7] = 0;
+
+  return CDC_Transmit_FS(response, 8);
+}
+
+/**
+  * @brief Send jitter buffer statistics via USB
+  * @param reset: Non-zero restarts the min/max window
+  * @retval None
+  */
+void Send_Stream_Stats(uint8_t reset)
+{
+  StreamStats_t stats;
+  uint8_t response[16];
+
+  Stream_GetStats(&stats, reset);
+  response[0] = CMD_STREAM_STATS;
+  response[1] = Stream_IsActive();
+  response[2] = stats.fill;
+  response[3] = stats.fill_min;
+  response[4] = stats.fill_max;
+  response[5] = STREAM_BUFFER_SLOTS - stats.fill;
+  response[6] = (stats.underruns >> 8) & 0xFF;
+  response[7] = stats.underruns & 0xFF;
+  response[8] = (stats.late >> 8) & 0xFF;
+  response[9] = stats.late & 0xFF;
+  response[10] = (stats.overflows >> 8) & 0xFF;
+  response[11] = stats.overflows & 0xFF;
+  response[12] = (stats.played >> 24) & 0xFF;
+  response[13] = (stats.played >> 16) & 0xFF;
+  response[14] = (stats.played >> 8) & 0xFF;
+  response[15] = stats.played & 0xFF;
+
+  CDC_Transmit_FS(response, 16);
+}
+
+/**
+  * @brief Send a snapshot of the metrics table via USB
+  * @retval None
+  */
+void Send_Metrics_Response(void)
+{
+  static uint8_t response[METRICS_REPLY_SIZE];
+
+  Metrics_Snapshot(response, CMD_GET_METRICS);
+  CDC_Transmit_FS(response, METRICS_REPLY_SIZE);
+}
+
+/**
+  * @brief Send the RAM usage report (static, heap and stack peaks) via USB
+  * @retval None
+  */
+void Send_Memory_Response(void)
+{
+  static uint8_t response[MEMORY_REPLY_SIZE];
+
+  CDC_Transmit_FS(response, Memory_Serialize(CMD_GET_MEMORY, response));
+}
+
+/**
+  * @brief Send the ISR and command cycle statistics via USB
+  * @param reset: Non-zero to restart the statistics
+  * @retval None
+  */
+void Send_Timing_Response(uint8_t reset)
+{
+  static uint8_t response[TIMING_REPLY_SIZE];
+  uint8_t flags = 0;
+
+  if (((uint32_t)&Process_USB_Command & 0xF0000000UL) == SRAM_BASE) {
+    flags |= TIMING_FLAG_RAM;
+  }
+  Timing_Snapshot(response, CMD_GET_TIMING, flags, reset);
+  response[3] = Deferred_GetHighWater();
+  CDC_Transmit_FS(response, TIMING_REPLY_SIZE);
+}
+
+/**
+  * @brief Send the per-task CPU accounting of the scheduler via USB
+  * @param reset: Non-zero to restart the accounting window
+  * @retval None
+  */
+void Send_Tasks_Response(uint8_t reset)
+{
+  static uint8_t response[SCHED_REPLY_SIZE];
+
+  CDC_Transmit_FS(response, Sched_Serialize(CMD_GET_TASKS, reset, response));
+}
+
+/**
+  * @brief Send the USB suspend and low-power statistics via USB
+  * @retval None
+  */
+void Send_Power_Response(void)
+{
+  static uint8_t response[POWER_REPLY_SIZE];
+
+  CDC_Transmit_FS(response, Power_Serialize(CMD_GET_POWER, response));
+}
+
+/**
+  * @brief Send the MCU temperature, supply voltage and ADC load via USB
+  * @retval None
+  */
+void Send_Health_Response(void)
+{
+  static uint8_t response[HEALTH_REPLY_SIZE];
+
+  CDC_Transmit_FS(response, Health_Serialize(CMD_GET_HEALTH, response));
+}
+
+/**
+  * @brief Send one page of the crash report from the previous run via USB
+  * @param page: CRASH_PAGE_REGISTERS, CRASH_PAGE_STACK or CRASH_PAGE_CLEAR
+  * @retval None
+  */
+void Send_Crash_Response(uint8_t page)
+{
+  static uint8_t response[CRASH_REPLY_SIZE];
+
+  if (page == CRASH_PAGE_CLEAR) {
+    Crash_Clear();
+    Send_Ack_Response(CMD_GET_CRASH, 0, 0);
+    return;
+  }
+  if (page != CRASH_PAGE_REGISTERS && page != CRASH_PAGE_STACK) {
+    Send_Ack_Response(CMD_GET_CRASH, 1, 0);
+    return;
+  }
+  CDC_Transmit_FS(response, Crash_Serialize(page, CMD_GET_CRASH, response));
+}
+
+/**
+  * @brief Report the watchdog state; in DEBUG builds optionally inject a hang
+  * @param param: WDG_CMD_*
+  * @retval None
+  *
+  * Reply [cmd, reset_flags, missing tasks, restored, resets u16,
+  * timeout_ms u16]. A hang is injected after the reply has gone out, so the
+  * host can time the recovery.
+  */
+void Watchdog_Command(uint8_t param)
+{
+  static uint8_t response[8];
+  PowerPackState_t retained;
+  uint16_t resets = Watchdog_GetResetCount();
+
+  response[0] = CMD_WATCHDOG;
+  response[1] = Crash_GetResetFlags();
+  response[2] = Watchdog_GetLastMissing();
+  response[3] = Watchdog_GetRetainedState(&retained);
+  response[4] = (resets >> 8) & 0xFF;
+  response[5] = resets & 0xFF;
+  response[6] = (WDG_TIMEOUT_MS >> 8) & 0xFF;
+  response[7] = WDG_TIMEOUT_MS & 0xFF;
+  CDC_Transmit_FS(response, 8);
+
+#ifdef DEBUG
+  if (param == WDG_CMD_INFO) return;
+  HAL_Delay(5);
+
+  switch (param) {
+    case WDG_CMD_HANG_MAIN:
+      while (1) {
+      }
+
+    case WDG_CMD_HANG_USB:
+      HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+      break;
+
+    case WDG_CMD_HANG_I2C:
+      // Looks like a DMA transfer that never completes
+      hi2c1.State = HAL_I2C_STATE_BUSY_TX;
+      break;
+
+    default:
+      break;
+  }
+#else
+  (void)param;
+#endif
+}
+
+/**
+  * @brief Queue a packet on the diagnostics port, waiting for buffer space
+  * @param data: Packet (copied)
+  * @param length: Packet length
+  * @retval 1 if queued, 0 if the port is closed or stayed full
+  */
+static uint8_t Diag_Send_Blocking(const uint8_t* data, uint16_t length)
+{
+  uint32_t start = HAL_GetTick();
+
+  while (CDC_Diag_IsOpen() && CDC_Diag_GetFree() < length) {
+    if ((HAL_GetTick() - start) >= TRACE_DUMP_TIMEOUT_MS) return 0;
+    // Still making progress: a long dump must not starve the watchdog
+    Watchdog_CheckIn(WDG_TASK_MAIN);
+    Watchdog_Service();
+  }
+  return CDC_Transmit_Diag_FS(data, length) == length;
+}
+
+/**
+  * @brief Stream the trace buffer on the diagnostics port (main loop only)
+  * @param clear: Non-zero empties the buffer afterwards
+  * @retval None
+  *
+  * Header [cmd, 'H', count u16, total u32, dropped u32, now_us u32], then
+  * [cmd, 'D', first u16, n, n x (ts_us u32, id, arg u32)] packets and a
+  * closing [cmd, 'E', count u16, 0, 0, 0, 0]; all fields big-endian.
+  */
+void Send_Trace_Dump(uint8_t clear)
+{
+  uint8_t packet[5 + TRACE_DUMP_RECORDS * TRACE_WIRE_ENTRY_SIZE];
+  uint8_t ok;
+  uint16_t count;
+  uint32_t total, dropped, now;
+
+  Trace_Freeze(1);
+  count = Trace_GetCount();
+  total = trace_head;
+  dropped = trace_dropped;
+  now = Trace_Now();
+
+  packet[0] = CMD_DUMP_TRACE;
+  packet[1] = 'H';
+  packet[2] = (count >> 8) & 0xFF;
+  packet[3] = count & 0xFF;
+  for (uint8_t i = 0; i < 4; i++) {
+    packet[4 + i] = (total >> (24 - 8 * i)) & 0xFF;
+    packet[8 + i] = (dropped >> (24 - 8 * i)) & 0xFF;
+    packet[12 + i] = (now >> (24 - 8 * i)) & 0xFF;
+  }
+  ok = Diag_Send_Blocking(packet, 16);
+
+  for (uint16_t first = 0; first < count && ok; first += TRACE_DUMP_RECORDS) {
+    uint8_t n = (count - first < TRACE_DUMP_RECORDS) ? count - first : TRACE_DUMP_RECORDS;
+
+    packet[1] = 'D';
+    packet[2] = (first >> 8) & 0xFF;
+    packet[3] = first & 0xFF;
+    packet[4] = n;
+    for (uint8_t i = 0; i < n; i++) {
+      Trace_Serialize(first + i, &packet[5 + i * TRACE_WIRE_ENTRY_SIZE]);
+    }
+    ok = Diag_Send_Blocking(packet, 5 + n * TRACE_WIRE_ENTRY_SIZE);
+  }
+
+  if (ok) {
+    memset(packet, 0, 8);
+    packet[0] = CMD_DUMP_TRACE;
+    packet[1] = 'E';
+    packet[2] = (count >> 8) & 0xFF;
+    packet[3] = count & 0xFF;
+    Diag_Send_Blocking(packet, 8);
+  }
+
+  if (clear) Trace_Clear();
+  Trace_Freeze(0);
+}
+
+/**
+  * @brief Time Set_Relay and Set_Dimmer with the DWT cycle counter and send the result
+  * @retval None
+  *
+  * Both calls rewrite the current state, so no relay switches and no output
+  * moves (a running waveform or stream is stopped like for any manual
+  * setpoint). Reply [cmd, OUTPUT_DRV, i2c_khz u16, relay_min u32,
+  * relay_avg u32, dimmer_min u32, dimmer_avg u32], cycles at 48 MHz with the
+  * DWT read overhead removed; the dimmer figures include the I2C bus time.
+  */
+void Send_Output_Benchmark(void)
+{
+  static uint8_t response[20];
+  uint32_t result[4];
+  uint32_t start, cycles, overhead, min, total;
+  uint16_t i2c_khz = hi2c1.Init.ClockSpeed / 1000;
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  start = DWT->CYCCNT;
+  overhead = DWT->CYCCNT - start;
+
+  min = UINT32_MAX;
+  total = 0;
+  for (uint8_t i = 0; i < BENCH_RELAY_RUNS; i++) {
+    start = DWT->CYCCNT;
+    Set_Relay(1, powerpack_state.relays & 0x01);
+    cycles = DWT->CYCCNT - start - overhead;
+    if (cycles < min) min = cycles;
+    total += cycles;
+  }
+  result[0] = min;
+  result[1] = total / BENCH_RELAY_RUNS;
+
+  min = UINT32_MAX;
+  total = 0;
+  for (uint8_t i = 0; i < BENCH_DIMMER_RUNS; i++) {
+    start = DWT->CYCCNT;
+    Set_Dimmer(1, powerpack_state.dimmer_value[0]);
+    cycles = DWT->CYCCNT - start - overhead;
+    if (cycles < min) min = cycles;
+    total += cycles;
+  }
+  result[2] = min;
+  result[3] = total / BENCH_DIMMER_RUNS;
+
+  response[0] = CMD_BENCH_OUTPUTS;
+  response[1] = OUTPUT_DRV;
+  response[2] = (i2c_khz >> 8) & 0xFF;
+  response[3] = i2c_khz & 0xFF;
+  for (uint8_t i = 0; i < 4; i++) {
+    response[4 + 4 * i] = (result[i] >> 24) & 0xFF;
+    response[5 + 4 * i] = (result[i] >> 16) & 0xFF;
+    response[6 + 4 * i] = (result[i] >> 8) & 0xFF;
+    response[7 + 4 * i] = result[i] & 0xFF;
+  }
+
+  CDC_Transmit_FS(response, sizeof(response));
+}
+
+/**
+  * @brief Time DAC updates of 1..DIMMER_COUNT channels and send the result
+  * @retval None
+  *
+  * Rewrites the current codes, so no output changes. Reply [cmd, count,
+  * i2c_khz u16, count x best time in us u16]: entry k is channels 1..k+1
+  * in one Channels_WriteDimmers() call, I2C bus time included.
+  */
+void Send_Channel_Benchmark(void)
+{
+  static uint8_t response[4 + 2 * DIMMER_COUNT];
+  uint16_t codes[DIMMER_COUNT];
+  uint16_t i2c_khz = hi2c1.Init.ClockSpeed / 1000;
+
+  if (Wave_IsPlaying()) Wave_Stop();
+  if (Stream_IsActive()) Stream_Stop();
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    codes[i] = Curve_LevelToCode(i, powerpack_state.dimmer_value[i]);
+  }
+
+  response[0] = CMD_BENCH_CHANNELS;
+  response[1] = DIMMER_COUNT;
+  response[2] = (i2c_khz >> 8) & 0xFF;
+  response[3] = i2c_khz & 0xFF;
+
+  for (uint8_t k = 1; k <= DIMMER_COUNT; k++) {
+    uint32_t start, cycles;
+    uint32_t min = UINT32_MAX;
+    uint16_t us;
+
+    for (uint8_t i = 0; i < BENCH_DIMMER_RUNS; i++) {
+      start = DWT->CYCCNT;
+      Channels_WriteDimmers((uint16_t)((1UL << k) - 1), codes);
+      cycles = DWT->CYCCNT - start;
+      if (cycles < min) min = cycles;
+    }
+    us = (uint16_t)(min / (SystemCoreClock / 1000000));
+    response[2 + 2 * k] = (us >> 8) & 0xFF;
+    response[3 + 2 * k] = us & 0xFF;
+  }
+
+  CDC_Transmit_FS(response, sizeof(response));
+}
+
+/**
+  * @brief The common part of the GET_CAPABILITIES and HELLO replies
+  * @param out: 15 bytes: [protocol, major, minor, patch, relays, dimmers,
+  *        dacs_found, dimmers_present u16, i2c_khz u16, features u32]
+  * @retval None
+  */
+static void Capabilities_Header(uint8_t* out)
+{
+  uint16_t present = Channels_DimmersPresent();
+  uint16_t i2c_khz = hi2c1.Init.ClockSpeed / 1000;
+  uint32_t features = FEATURE_WAVEFORM | FEATURE_STREAM | FEATURE_APPLY_STATE |
+                      FEATURE_BULK_OUTPUTS | FEATURE_METRICS | FEATURE_TRACE |
+                      FEATURE_CRASH_REPORT | FEATURE_WATCHDOG | FEATURE_MEMORY |
+                      FEATURE_TIMING | FEATURE_TASKS | FEATURE_LOW_POWER | FEATURE_DITHER |
+                      FEATURE_CURVES | FEATURE_HEALTH | FEATURE_RELAY_TIMING | FEATURE_TRIGGER |
+                      FEATURE_RELAY_CONFIG | FEATURE_ZERO_CROSS | FEATURE_TELEMETRY | FEATURE_HELLO;
+
+#if USB_DEBUG_TEXT
+  features |= FEATURE_DIAG_TEXT;
+#endif
+#if RELAY_DRIVE == RELAY_DRIVE_LATCHING
+  features |= FEATURE_LATCHING_RELAY;
+#endif
+#ifdef DEBUG
+  features |= FEATURE_FAULT_INJECTION;
+#endif
+
+  out[0] = PROTOCOL_VERSION;
+  out[1] = FIRMWARE_VERSION_MAJOR;
+  out[2] = FIRMWARE_VERSION_MINOR;
+  out[3] = FIRMWARE_VERSION_PATCH;
+  out[4] = RELAY_COUNT;
+  out[5] = DIMMER_COUNT;
+  out[6] = Channels_GetDacsFound();
+  out[7] = (present >> 8) & 0xFF;
+  out[8] = present & 0xFF;
+  out[9] = (i2c_khz >> 8) & 0xFF;
+  out[10] = i2c_khz & 0xFF;
+  out[11] = (features >> 24) & 0xFF;
+  out[12] = (features >> 16) & 0xFF;
+  out[13] = (features >> 8) & 0xFF;
+  out[14] = features & 0xFF;
+}
+
+/**
+  * @brief Send the channel map and firmware features via USB
+  * @retval None
+  *
+  * Reply [cmd, protocol, major, minor, patch, relays, dimmers, dacs_found,
+  * dimmers_present u16, i2c_khz u16, features u32], then per dimmer
+  * [address, resolution bits]. dacs_found bit n is a GP8413 at 0x58 + n;
+  * the address is the device the probe mapped the row to, which differs
+  * from the table when its chip answered elsewhere. A dimmer whose bit is
+  * clear in dimmers_present rejects commands.
+  */
+void Send_Capabilities_Response(void)
+{
+  static uint8_t response[CAPS_HEADER_SIZE + 2 * DIMMER_COUNT];
+
+  response[0] = CMD_GET_CAPABILITIES;
+  Capabilities_Header(&response[1]);
+
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    response[CAPS_HEADER_SIZE + 2 * i] = Channels_DimmerAddress(i);
+    response[CAPS_HEADER_SIZE + 2 * i + 1] = GP8413_CODE_BITS;
+  }
+
+  CDC_Transmit_FS(response, sizeof(response));
+}
+
+/**
+  * @brief Answer the connect handshake with everything a host needs to start
+  * @param nonce: Echoed, so the host can tell the reply to its latest try
+  * @retval None
+  *
+  * Reply [cmd, nonce, the 15 GET_CAPABILITIES header bytes after cmd,
+  * reset_flags, uptime_ms u32, relays u16, enables u16], then a level u16
+  * per dimmer and a curve u8 per dimmer, big-endian. More than 12 dimmers
+  * take the reply past 64 bytes into a second USB packet.
+  */
+void Send_Hello_Response(uint8_t nonce)
+{
+  static uint8_t response[HELLO_REPLY_SIZE];
+  uint32_t uptime = HAL_GetTick();
+  uint8_t n = 26;
+
+  response[0] = CMD_HELLO;
+  response[1] = nonce;
+  Capabilities_Header(&response[2]);
+  response[17] = Crash_GetResetFlags();
+  response[18] = (uptime >> 24) & 0xFF;
+  response[19] = (uptime >> 16) & 0xFF;
+  response[20] = (uptime >> 8) & 0xFF;
+  response[21] = uptime & 0xFF;
+  response[22] = (powerpack_state.relays >> 8) & 0xFF;
+  response[23] = powerpack_state.relays & 0xFF;
+  response[24] = (powerpack_state.dimmers_enabled >> 8) & 0xFF;
+  response[25] = powerpack_state.dimmers_enabled & 0xFF;
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    response[n++] = (powerpack_state.dimmer_value[i] >> 8) & 0xFF;
+    response[n++] = powerpack_state.dimmer_value[i] & 0xFF;
+  }
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    response[n++] = powerpack_state.dimmer_curve[i];
+  }
+
+  CDC_Transmit_FS(response, sizeof(response));
+}
+
+/**
+  * @brief Set the dither rate or read its cost statistics, and reply via USB
+  * @param param: DITHER_CMD_*
+  * @param value: Update rate in Hz for DITHER_CMD_SET (0 = off)
+  * @retval None
+  */
+void Send_Dither_Response(uint8_t param, uint16_t value)
+{
+  static uint8_t response[DITHER_REPLY_SIZE];
+  uint8_t status = DITHER_OK;
+
+  if (param == DITHER_CMD_SET) {
+    status = Dither_SetRate(value);
+  } else if (param != DITHER_CMD_STATS && param != DITHER_CMD_STATS_RESET) {
+    status = DITHER_ERR_RANGE;
+  }
+
+  CDC_Transmit_FS(response, Dither_Serialize(CMD_DITHER, status, param == DITHER_CMD_STATS_RESET, response));
+}
+
+/**
+  * @brief Arm, configure or read the external trigger, and reply via USB
+  * @param data: [cmd, TRIGGER_CMD_*, ...], layouts in trigger.h
+  * @param length: Frame length
+  * @retval None
+  */
+void Send_Trigger_Response(const uint8_t* data, uint16_t length)
+{
+  static uint8_t response[TRIGGER_REPLY_SIZE];
+  uint16_t value = (length >= 4) ? (data[2] << 8) | data[3] : 0;
+  uint8_t status = TRIGGER_OK;
+
+  switch (data[1]) {
+    case TRIGGER_CMD_DISARM:
+      Trigger_Disarm();
+      break;
+
+    case TRIGGER_CMD_ARM_STATE:
+      if (length < 8 || data[2] == 0 || (data[2] & ~STATE_ALL)) {
+        status = TRIGGER_ERR_RANGE;
+      } else {
+        OutputUpdate_t update;
+        State_ToUpdate(data[2], data[3], (data[4] << 8) | data[5], (data[6] << 8) | data[7], &update);
+        status = Trigger_ArmState(&update);
+      }
+      break;
+
+    case TRIGGER_CMD_ARM_WAVE:
+      status = (length < 5) ? TRIGGER_ERR_RANGE : Trigger_ArmWave(data[4], value);
+      break;
+
+    case TRIGGER_CMD_CONFIG:
+      status = (length < 8) ? TRIGGER_ERR_RANGE
+                            : Trigger_Configure(data[4], value, (data[6] << 8) | data[7]);
+      break;
+
+    case TRIGGER_CMD_STATS:
+    case TRIGGER_CMD_STATS_RESET:
+      break;
+
+    default:
+      status = TRIGGER_ERR_RANGE;
+      break;
+  }
+
+  CDC_Transmit_FS(response, Trigger_Serialize(CMD_TRIGGER, status,
+                                              data[1] == TRIGGER_CMD_STATS_RESET, response));
+}
+
+/**
+  * @brief Read or change the relay delays and zero-cross mode, and reply via USB
+  * @param data: [cmd, CONFIG_CMD_*, ...], layouts in config.h
+  * @param length: Frame length
+  * @retval None
+  * @note  Changes apply at once; only CONFIG_CMD_SAVE makes them survive a reset.
+  */
+void Send_Relay_Config_Response(const uint8_t* data, uint16_t length)
+{
+  static uint8_t response[CONFIG_REPLY_SIZE];
+  uint16_t a = (length >= 6) ? (data[4] << 8) | data[5] : 0;
+  uint16_t b = (length >= 8) ? (data[6] << 8) | data[7] : 0;
+  uint16_t words[3];
+  uint8_t status = CONFIG_OK;
+
+  switch (data[1]) {
+    case CONFIG_CMD_GET:
+      break;
+
+    case CONFIG_CMD_SET_DELAYS:
+      if (length < 8 || data[2] < 1 || data[2] > RELAY_COUNT ||
+          a > CONFIG_DELAY_MAX_US || b > CONFIG_DELAY_MAX_US) {
+        status = CONFIG_ERR_RANGE;
+      } else {
+        config.relay_operate_us[data[2] - 1] = a;
+        config.relay_release_us[data[2] - 1] = b;
+      }
+      break;
+
+    case CONFIG_CMD_SET_ZERO_CROSS: {
+      uint16_t mask = (data[2] << 8) | data[3];
+      if (length < 6 || (mask & ~RELAY_ALL) || a >= ZERO_CROSS_MAX_US) {
+        status = CONFIG_ERR_RANGE;
+      } else {
+        config.zero_cross_mask = mask;
+        config.zero_cross_offset_us = a;
+      }
+      break;
+    }
+
+    case CONFIG_CMD_SAVE:
+      if (Config_Save() != HAL_OK) status = CONFIG_ERR_FLASH;
+      break;
+
+    default:
+      status = CONFIG_ERR_RANGE;
+      break;
+  }
+
+  words[0] = config.zero_cross_mask;
+  words[1] = config.zero_cross_offset_us;
+  words[2] = ZeroCross_GetIntervalUs();
+  response[0] = CMD_RELAY_CONFIG;
+  response[1] = status;
+  response[2] = Config_IsStored();
+  response[3] = RELAY_COUNT;
+  for (uint8_t i = 0; i < 3; i++) {
+    response[4 + 2 * i] = (words[i] >> 8) & 0xFF;
+    response[5 + 2 * i] = words[i] & 0xFF;
+  }
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    response[10 + 4 * i] = (config.relay_operate_us[i] >> 8) & 0xFF;
+    response[11 + 4 * i] = config.relay_operate_us[i] & 0xFF;
+    response[12 + 4 * i] = (config.relay_release_us[i] >> 8) & 0xFF;
+    response[13 + 4 * i] = config.relay_release_us[i] & 0xFF;
+  }
+
+  CDC_Transmit_FS(response, sizeof(response));
+}
+
+/**
+  * @brief Start, stop or ack the telemetry stream, and reply via USB
+  * @param data: [cmd, TELEMETRY_CMD_*, ...], layouts in telemetry.h
+  * @param length: Frame length
+  * @retval None
+  * @note  Acks get no reply: they come at the stream rate.
+  */
+void Send_Telemetry_Response(const uint8_t* data, uint16_t length)
+{
+  static uint8_t response[TELEMETRY_REPLY_SIZE];
+  uint8_t status = TELEMETRY_OK;
+
+  switch (data[1]) {
+    case TELEMETRY_CMD_ACK:
+      if (length >= 3) Telemetry_Ack(data[2]);
+      return;
+
+    case TELEMETRY_CMD_START:
+      status = (length < 6) ? TELEMETRY_ERR_RANGE
+                            : Telemetry_Start((data[2] << 8) | data[3], (data[4] << 8) | data[5]);
+      break;
+
+    case TELEMETRY_CMD_STOP:
+      Telemetry_Stop();
+      break;
+
+    case TELEMETRY_CMD_STATS:
+    case TELEMETRY_CMD_STATS_RESET:
+      break;
+
+    default:
+      status = TELEMETRY_ERR_RANGE;
+      break;
+  }
+
+  CDC_Transmit_FS(response, Telemetry_Serialize(CMD_TELEMETRY, status,
+                                                data[1] == TELEMETRY_CMD_STATS_RESET, response));
+}
+
+/**
+  * @brief Timer callback for waveform pacing and the stream clock
   * @param htim: Timer handle
   * @retval None
   */
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
   if (htim->Instance == TIM3) {
-    // Send periodic status update every 5 seconds (reduced frequency)
-    static uint8_t counter = 0;
-    counter++;
-    if (counter >= 5) {  // 5 timer interrupts = 5 seconds
-      counter = 0;
-      Send_Status_Response();
+    // TIM3 paces waveform samples while a table is playing
+    if (Wave_IsPlaying()) {
+      Wave_TimerTick();
     }
+  } else if (htim->Instance == TIM4) {
+    Stream_TimerTick();
+    Dither_TimerTick();
+  }
+}
+
+/**
+  * @brief I2C master TX complete callback (DMA transfers only)
+  * @param hi2c: I2C handle
+  * @retval None
+  */
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+  if (hi2c->Instance == I2C1) {
+    Trace_Event(TRACE_I2C_STOP, 0);
+    Watchdog_CheckIn(WDG_TASK_I2C);
+    GP8413_DMA_TxComplete();
+  }
+}
+
+/**
+  * @brief I2C error callback (DMA transfers only)
+  * @param hi2c: I2C handle
+  * @retval None
+  */
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+  if (hi2c->Instance == I2C1) {
+    Metrics_Inc(METRIC_I2C_ERRORS);
+    Trace_Event(TRACE_I2C_STOP, hi2c->ErrorCode);
+    GP8413_DMA_Error();
   }
 }
 
@@ -612,36 +1991,217 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
   */
 void USB_DataReceived(uint8_t* Buf, uint32_t Len)
 {
+  if (Len > 0) {
+    Trace_Event(TRACE_CMD_RX, Buf[0] | ((Len > 1) ? Buf[1] << 8 : 0) | (Len << 16));
+  }
+
+  // Stream records bypass the main loop and go straight into the jitter
+  // buffer; only the acknowledgement waits for Task_Commands
+  if (Len > 0 && Len <= 64 && Buf[0] == CMD_STREAM_DATA) {
+    uint8_t status;
+
+    Metrics_Inc(METRIC_CMD_RECEIVED);
+    status = Stream_Push(Buf, Len);
+    if (!stream_ack.pending || status != STREAM_OK) stream_ack.status = status;
+    stream_ack.seq = Buf[1];
+    stream_ack.credits = Stream_GetFreeSlots();
+    stream_ack.pending = 1;
+    Sched_Signal(TASK_COMMANDS);
+    return;
+  }
+
   if (Len > 0 && Len <= 64) {
-	// Debug: Log received data
-	sprintf(debug_msg, "RX: %lu bytes [", Len);
-	CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
-	
-	for(uint32_t i = 0; i < Len && i < 8; i++) {
-	  sprintf(debug_msg, " %02X", Buf[i]);
-	  CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
+	// Copy received data to processing buffer; the main loop dispatches it
+	// exactly once with the real packet length
+	if (usb_data_received) {
+	  Metrics_Inc(METRIC_CMD_OVERRUN);
 	}
-	sprintf(debug_msg, " ]\r\n");
-	CDC_Transmit_FS((uint8_t*)debug_msg, strlen(debug_msg));
-	HAL_Delay(50);
-	
-	// Copy received data to processing buffer
 	memcpy(usb_rx_buffer, Buf, Len);
+	usb_rx_length = Len;
+	usb_rx_cycles = Timing_Start();
 	usb_data_received = 1;
+	Sched_Signal(TASK_COMMANDS);
+
+#if USB_DEBUG_TEXT
+	// Debug: log received data once the USB interrupt has returned
+	if (CDC_Diag_IsOpen()) {
+	  Deferred_Post(Rx_Log_Deferred, Len);
+	}
+#endif
+  }
+}
+
+/**
+  * @brief USB control IN endpoint finished a packet (USB interrupt)
+  * @retval None
+  */
+void USB_TransmitComplete(void)
+{
+  if (stream_ack.pending) {
+    Sched_Signal(TASK_COMMANDS);
+  }
+}
+
+/**
+  * @brief Send the pending stream acknowledgement if the IN endpoint is free
+  * @retval None
+  * @note  Left pending when busy; USB_TransmitComplete() signals the retry.
+  */
+static void Stream_SendAck(void)
+{
+  uint8_t seq, status, credits;
+
+  __disable_irq();
+  seq = stream_ack.seq;
+  status = stream_ack.status;
+  credits = stream_ack.credits;
+  __enable_irq();
+
+  if (Send_Stream_Ack(seq, status, credits) != USBD_OK) return;
+
+  // Clear only if no newer frame came in while the ack was being sent
+  __disable_irq();
+  if (stream_ack.seq == seq) {
+    stream_ack.pending = 0;
+    stream_ack.status = STREAM_OK;
+  }
+  __enable_irq();
+}
+
+/**
+  * @brief Task: dispatch the packet stored by USB_DataReceived() and send
+  *        the stream acknowledgement
+  * @retval None
+  *
+  * Every control channel packet goes out from the main loop, so
+  * CDC_Transmit_FS() is never re-entered from an interrupt.
+  */
+static void Task_Commands(void)
+{
+  uint32_t start;
+
+  if (usb_data_received) {
+    start = Timing_Start();
+    Trace_Event(TRACE_CMD_START, usb_rx_buffer[0]);
+    CDC_WaitTxIdle_FS(CMD_TX_WAIT_MS);
+    Process_USB_Command(usb_rx_buffer, usb_rx_length);
+    Trace_Event(TRACE_CMD_END, usb_rx_buffer[0]);
+    Timing_Record(TIMING_CMD_EXEC, start);
+    Timing_Record(TIMING_CMD_LATENCY, usb_rx_cycles);
+    usb_data_received = 0;
+  }
+
+  if (stream_ack.pending) {
+    Stream_SendAck();
+  }
+}
+
+/**
+  * @brief Task: main loop check-in and IWDG feed, and the boot banner
+  * @retval None
+  */
+static void Task_Watchdog(void)
+{
+#if USB_DEBUG_TEXT
+  static uint8_t banner_sent;
+
+  // The boot banner waits for a terminal here instead of holding up the start
+  if (!banner_sent && CDC_Diag_IsOpen()) {
+    banner_sent = 1;
+    Boot_Banner();
+  }
+#endif
+  Watchdog_CheckIn(WDG_TASK_MAIN);
+  Watchdog_Service();
+}
+
+/**
+  * @brief Task: unsolicited status push, skipped while the host is suspended
+  *        or the telemetry stream carries the same values
+  * @retval None
+  */
+static void Task_Status(void)
+{
+  if (Power_IsUsbSuspended() || Telemetry_IsActive()) return;
+  Send_Status_Response();
+}
 
-	// Process command immediately
-	Process_USB_Command(Buf, Len);
+/**
+  * @brief Task: telemetry frame when its interval has elapsed
+  * @retval None
+  */
+static void Task_Telemetry(void)
+{
+  if (Power_IsUsbSuspended()) return;
+  Telemetry_Tick();
+}
 
-	// Debug echo - gelen veriyi geri gönder
-	uint8_t echo[8] = {0xEE, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-	if (Len >= 1) echo[1] = Buf[0];
-	if (Len >= 2) echo[2] = Buf[1];
-	if (Len >= 3) echo[3] = Buf[2];
-	if (Len >= 4) echo[4] = Buf[3];
+/**
+  * @brief Task: the part of a trigger fire that did not fit in the interrupt
+  * @retval None
+  *
+  * Counts the relay switches, and writes the dimmers or starts the
+  * waveform when the DACs were busy at the edge.
+  */
+static void Task_Trigger(void)
+{
+  TriggerFollowUp_t follow;
+
+  if (!Trigger_TakeFollowUp(&follow)) return;
 
-	CDC_Transmit_FS(echo, 8);
+  Relay_CountSwitch(follow.relays);
+  if (follow.dimmer_mask) {
+    OutputUpdate_t update = { .dimmer_mask = follow.dimmer_mask };
+    OutputChange_t changed;
+    memcpy(update.level, follow.level, sizeof(update.level));
+    Apply_Outputs(&update, &changed);
+  }
+  if (follow.wave_mode != WAVE_MODE_STOP) {
+    Stream_Stop();
+    Wave_Play(follow.wave_mode, follow.wave_rate);
+  }
+}
+
+#if USB_DEBUG_TEXT
+/**
+  * @brief Hex dump of the first bytes of a received packet
+  * @param arg: Packet length
+  * @retval None
+  */
+static void Rx_Log_Deferred(uint32_t arg)
+{
+  USB_DEBUG("RX: %lu bytes [", arg);
+  for (uint32_t i = 0; i < arg && i < 8; i++) {
+    USB_DEBUG(" %02X", usb_rx_buffer[i]);
+  }
+  USB_DEBUG(" ]\r\n");
+}
+
+/**
+  * @brief Start-up report on the diagnostics port, once it is first opened
+  * @retval None
+  * @note  About 450 bytes, within the diagnostics transmit buffer.
+  */
+static void Boot_Banner(void)
+{
+  USB_DEBUG("\r\n=== PowerPack R2M1 v%d.%d.%d Started ===\r\n",
+            FIRMWARE_VERSION_MAJOR, FIRMWARE_VERSION_MINOR, FIRMWARE_VERSION_PATCH);
+  USB_DEBUG("System Clock: %lu MHz, up %lu ms\r\n", HAL_RCC_GetHCLKFreq() / 1000000, HAL_GetTick());
+  USB_DEBUG("Reset cause: 0x%02X, watchdog resets: %u\r\n",
+            Crash_GetResetFlags(), Watchdog_GetResetCount());
+  if (Crash_IsValid()) {
+    USB_DEBUG("Crash report: exception %lu at PC 0x%08lX, LR 0x%08lX, CFSR 0x%08lX\r\n",
+              Crash_GetReport()->ipsr, Crash_GetReport()->pc,
+              Crash_GetReport()->lr, Crash_GetReport()->cfsr);
   }
+  USB_DEBUG("GP8413 found: 0x%02X (bit n = address 0x%02X + n), dimmers present: 0x%04X\r\n",
+            Channels_GetDacsFound(), GP8413_ADDRESS, Channels_DimmersPresent());
+  USB_DEBUG("Relay 1: %s, Relay 2: %s\r\n",
+            (powerpack_state.relays & 0x01) ? "ON" : "OFF",
+            (powerpack_state.relays & 0x02) ? "ON" : "OFF");
+  USB_DEBUG("Ready for commands!\r\n");
 }
+#endif
 /* USER CODE END 4 */
 
 /**
@@ -653,6 +2213,8 @@ void Error_Handler(void)
   /* USER CODE BEGIN Error_Handler_Debug */
   /* User can add his own implementation to report the HAL error return state */
   __disable_irq();
+  // Nothing restores the outputs while this waits for the IWDG reset
+  Channels_SafeState();
   while (1)
   {
   }
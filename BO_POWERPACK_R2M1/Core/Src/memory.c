@@ -0,0 +1,132 @@
+/**
+  ******************************************************************************
+  * @file           : memory.c
+  * @brief          : Stack painting, heap tracking and RAM usage report
+  ******************************************************************************
+  * @attention
+  *
+  * RAM layout: .RamFunc, .data, .bss and .noinit from the start, then the
+  * newlib heap growing up from _end and the MSP stack growing down from
+  * _estack. The linker only checks that _Min_Heap_Size + _Min_Stack_Size fit.
+  *
+  * Memory_PaintStack() fills everything between the heap end and the
+  * current stack pointer with MEMORY_PAINT. Painted words that are still
+  * intact were never used, so a scan from the bottom gives the deepest
+  * stack excursion since boot, interrupts included. The paint keeps the
+  * mark, so scanning on demand (GET_MEMORY) loses nothing against a
+  * periodic scan and costs nothing while idle. The heap peak comes from
+  * _sbrk() in sysmem.c.
+  *
+  ******************************************************************************
+  */
+
+#include "memory.h"
+#include <stddef.h>
+
+extern uint8_t _sramfunc;     // first RAM section
+extern uint8_t _end;
+extern uint8_t _estack;
+extern uint8_t _Min_Heap_Size;
+extern uint8_t _Min_Stack_Size;
+
+// sysmem.c
+extern uint8_t* __sbrk_heap_peak;
+extern uint32_t __sbrk_heap_failures;
+void* _sbrk(ptrdiff_t incr);
+
+static uint32_t* memory_paint_start;
+static uint32_t* memory_paint_end;
+
+/**
+  * @brief Paint the unused RAM between the heap and the stack
+  * @retval None
+  * @note  Call first thing in main(); everything deeper than the caller's
+  *        frame is overwritten.
+  */
+void Memory_PaintStack(void)
+{
+  uint32_t heap_end = (uint32_t)_sbrk(0);
+  uint32_t* p = (uint32_t*)((heap_end + 3) & ~3UL);
+
+  memory_paint_start = p;
+  memory_paint_end = (uint32_t*)((__get_MSP() - MEMORY_PAINT_MARGIN) & ~3UL);
+
+  while (p < memory_paint_end) {
+    *p++ = MEMORY_PAINT;
+  }
+}
+
+/**
+  * @brief Measure the current and peak RAM usage
+  * @param usage: Receives the figures in bytes
+  * @retval None
+  */
+void Memory_GetUsage(MemoryUsage_t* usage)
+{
+  uint32_t ram_start = (uint32_t)&_sramfunc;
+  uint32_t heap_start = (uint32_t)&_end;
+  uint32_t stack_top = (uint32_t)&_estack;
+  uint32_t heap_end = (uint32_t)_sbrk(0);
+  uint32_t heap_peak = __sbrk_heap_peak ? (uint32_t)__sbrk_heap_peak : heap_start;
+  uint32_t* p = memory_paint_start;
+
+  // Heap growth overwrites paint from below; start above it
+  if ((uint32_t)p < heap_peak) {
+    p = (uint32_t*)((heap_peak + 3) & ~3UL);
+  }
+  while (p < memory_paint_end && *p == MEMORY_PAINT) {
+    p++;
+  }
+
+  usage->ram_total = stack_top - ram_start;
+  usage->static_bytes = heap_start - ram_start;
+  usage->heap_reserved = (uint32_t)&_Min_Heap_Size;
+  usage->heap_used = heap_end - heap_start;
+  usage->heap_peak = heap_peak - heap_start;
+  usage->heap_failures = (__sbrk_heap_failures > 0xFFFF) ? 0xFFFF : __sbrk_heap_failures;
+  usage->stack_reserved = (uint32_t)&_Min_Stack_Size;
+  usage->stack_now = stack_top - __get_MSP();
+  usage->stack_peak = stack_top - (uint32_t)p;
+  usage->free_min = ((uint32_t)p > heap_peak) ? (uint32_t)p - heap_peak : 0;
+
+  usage->flags = 0;
+  if (usage->stack_peak > usage->stack_reserved) usage->flags |= MEMORY_FLAG_STACK_OVER;
+  if (usage->heap_peak > usage->heap_reserved) usage->flags |= MEMORY_FLAG_HEAP_OVER;
+  if (usage->free_min == 0) usage->flags |= MEMORY_FLAG_COLLISION;
+}
+
+/**
+  * @brief Serialize Memory_GetUsage() for GET_MEMORY
+  * @param cmd: Command byte echoed in byte 0
+  * @param reply: MEMORY_REPLY_SIZE bytes
+  * @retval Reply length
+  *
+  * [cmd, flags, ram_total, static, heap_reserved, heap_used, heap_peak,
+  *  heap_failures, stack_reserved, stack_now, stack_peak, free_min]
+  * with all fields u16 big-endian.
+  */
+uint8_t Memory_Serialize(uint8_t cmd, uint8_t* reply)
+{
+  MemoryUsage_t usage;
+  uint16_t fields[10];
+
+  Memory_GetUsage(&usage);
+  fields[0] = usage.ram_total;
+  fields[1] = usage.static_bytes;
+  fields[2] = usage.heap_reserved;
+  fields[3] = usage.heap_used;
+  fields[4] = usage.heap_peak;
+  fields[5] = usage.heap_failures;
+  fields[6] = usage.stack_reserved;
+  fields[7] = usage.stack_now;
+  fields[8] = usage.stack_peak;
+  fields[9] = usage.free_min;
+
+  reply[0] = cmd;
+  reply[1] = usage.flags;
+  for (uint8_t i = 0; i < 10; i++) {
+    reply[2 + 2 * i] = (fields[i] >> 8) & 0xFF;
+    reply[3 + 2 * i] = fields[i] & 0xFF;
+  }
+  return MEMORY_REPLY_SIZE;
+}
@@ -0,0 +1,49 @@
+/**
+  ******************************************************************************
+  * @file           : metrics.c
+  * @brief          : Fixed table of runtime counters reported by CMD_GET_METRICS
+  ******************************************************************************
+  * @attention
+  *
+  * Counters are plain uint32_t words updated with Metrics_Inc() on the hot
+  * paths. They are free-running and wrap at 2^32; the host treats them as
+  * monotonic counters and handles resets via the uptime value.
+  *
+  ******************************************************************************
+  */
+
+#include "metrics.h"
+
+volatile uint32_t metrics[METRIC_COUNT];
+
+/**
+  * @brief Serialize all counters in one consistent snapshot
+  * @param reply: METRICS_REPLY_SIZE bytes, [cmd, count, 0, 0, count x u32 BE]
+  * @param cmd: Command byte to echo
+  * @retval None
+  */
+void Metrics_Snapshot(uint8_t* reply, uint8_t cmd)
+{
+  uint32_t copy[METRIC_COUNT];
+  uint32_t primask = __get_PRIMASK();
+
+  // Copy with IRQs masked so USB/timer updates cannot tear the snapshot
+  __disable_irq();
+  for (uint8_t i = 0; i < METRIC_COUNT; i++) {
+    copy[i] = metrics[i];
+  }
+  copy[METRIC_UPTIME_MS] = HAL_GetTick();
+  __set_PRIMASK(primask);
+
+  reply[0] = cmd;
+  reply[1] = METRIC_COUNT;
+  reply[2] = 0;
+  reply[3] = 0;
+  for (uint8_t i = 0; i < METRIC_COUNT; i++) {
+    uint8_t* p = &reply[METRICS_REPLY_HEADER + 4 * i];
+    p[0] = (copy[i] >> 24) & 0xFF;
+    p[1] = (copy[i] >> 16) & 0xFF;
+    p[2] = (copy[i] >> 8) & 0xFF;
+    p[3] = copy[i] & 0xFF;
+  }
+}
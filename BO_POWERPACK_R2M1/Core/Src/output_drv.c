@@ -0,0 +1,168 @@
+/**
+  ******************************************************************************
+  * @file           : output_drv.c
+  * @brief          : Relay/enable GPIO and GP8413 I2C output driver layer
+  ******************************************************************************
+  * @attention
+  *
+  * Blocking writes of the short, fixed GP8413 register frames. With
+  * OUTPUT_DRV_LL the frame is clocked out by polling the I2C1 status flags
+  * directly: START, address, n data bytes, STOP, with no handle locking,
+  * state machine or HAL_GetTick() calls in the loop. Every flag wait is
+  * bounded by a spin budget instead of the HAL_MAX_DELAY the HAL path uses,
+  * so a stuck bus costs milliseconds rather than hanging the main loop.
+  *
+  * The DMA path in gp8413_dma.c still owns the I2C1 handle. A blocking
+  * write claims the bus first, with interrupts masked: it is refused with
+  * HAL_BUSY while the handle is not READY, and while the claim is held
+  * GP8413_DMA_IsBusy() reports the bus as taken, so the timer and trigger
+  * interrupts skip or defer their DMA frame instead of starting a second
+  * START on the bus or spinning on the BUSY flag.
+  *
+  ******************************************************************************
+  */
+
+#include "output_drv.h"
+#if OUTPUT_DRV == OUTPUT_DRV_LL
+#include "stm32f1xx_ll_i2c.h"
+#endif
+
+extern I2C_HandleTypeDef hi2c1;
+
+static volatile uint8_t output_i2c_claimed;
+
+#if OUTPUT_DRV == OUTPUT_DRV_LL
+
+#define OUTPUT_I2C              I2C1
+#define OUTPUT_I2C_WAIT_LOOPS   10000   // ~2 ms at 48 MHz, one byte at 100 kHz is 90 us
+#define OUTPUT_I2C_ERROR_FLAGS  (I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO)
+
+/**
+  * @brief Spin until an SR1 event flag is set
+  * @param flag: I2C_SR1_SB, I2C_SR1_ADDR, I2C_SR1_TXE or I2C_SR1_BTF
+  * @retval HAL_OK, HAL_ERROR on NACK/bus error/arbitration loss, HAL_TIMEOUT
+  */
+static HAL_StatusTypeDef Output_I2C_WaitFlag(uint32_t flag)
+{
+  uint32_t loops = OUTPUT_I2C_WAIT_LOOPS;
+  uint32_t sr1;
+
+  while (((sr1 = OUTPUT_I2C->SR1) & flag) == 0) {
+    if (sr1 & OUTPUT_I2C_ERROR_FLAGS) return HAL_ERROR;
+    if (--loops == 0) return HAL_TIMEOUT;
+  }
+  return HAL_OK;
+}
+
+/**
+  * @brief Clock out START, address and data, up to the last BTF
+  * @param address: 7-bit slave address
+  * @param data: Bytes to send
+  * @param length: Byte count
+  * @retval HAL status of the first step that failed
+  */
+static HAL_StatusTypeDef Output_I2C_Frame(uint8_t address, const uint8_t* data, uint8_t length)
+{
+  HAL_StatusTypeDef status;
+
+  LL_I2C_DisableBitPOS(OUTPUT_I2C);
+  LL_I2C_GenerateStartCondition(OUTPUT_I2C);
+  if ((status = Output_I2C_WaitFlag(I2C_SR1_SB)) != HAL_OK) return status;
+
+  LL_I2C_TransmitData8(OUTPUT_I2C, address << 1);
+  if ((status = Output_I2C_WaitFlag(I2C_SR1_ADDR)) != HAL_OK) return status;
+  LL_I2C_ClearFlag_ADDR(OUTPUT_I2C);
+
+  while (length--) {
+    if ((status = Output_I2C_WaitFlag(I2C_SR1_TXE)) != HAL_OK) return status;
+    LL_I2C_TransmitData8(OUTPUT_I2C, *data++);
+  }
+  return Output_I2C_WaitFlag(I2C_SR1_BTF);
+}
+
+/**
+  * @brief Write a frame on the claimed bus (register level)
+  * @param address: 7-bit slave address
+  * @param data: Bytes to send
+  * @param length: Byte count
+  * @retval HAL_OK, HAL_BUSY if the bus stays busy, HAL_ERROR, HAL_TIMEOUT
+  */
+static HAL_StatusTypeDef Output_I2C_Transfer(uint8_t address, const uint8_t* data, uint8_t length)
+{
+  HAL_StatusTypeDef status;
+  uint32_t loops = OUTPUT_I2C_WAIT_LOOPS;
+
+  // The previous STOP may still be on the bus
+  while (LL_I2C_IsActiveFlag_BUSY(OUTPUT_I2C)) {
+    if (--loops == 0) return HAL_BUSY;
+  }
+
+  status = Output_I2C_Frame(address, data, length);
+  LL_I2C_GenerateStopCondition(OUTPUT_I2C);
+
+  if (status != HAL_OK) {
+    // Clear the sticky error flags (rc_w0) so the next frame starts clean
+    OUTPUT_I2C->SR1 = ~OUTPUT_I2C_ERROR_FLAGS & 0xFFFF;
+  }
+  return status;
+}
+
+#else /* OUTPUT_DRV_HAL */
+
+/**
+  * @brief Write a frame on the claimed bus (HAL)
+  * @param address: 7-bit slave address
+  * @param data: Bytes to send
+  * @param length: Byte count
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef Output_I2C_Transfer(uint8_t address, const uint8_t* data, uint8_t length)
+{
+  return HAL_I2C_Master_Transmit(&hi2c1, address << 1, (uint8_t*)data, length, HAL_MAX_DELAY);
+}
+
+#endif /* OUTPUT_DRV */
+
+/**
+  * @brief Take I2C1 for a blocking write unless the DMA path has it
+  * @retval 1 if claimed
+  */
+static uint8_t Output_I2C_Claim(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  uint8_t claimed = 0;
+
+  __disable_irq();
+  if (!output_i2c_claimed && hi2c1.State == HAL_I2C_STATE_READY) {
+    output_i2c_claimed = 1;
+    claimed = 1;
+  }
+  __set_PRIMASK(primask);
+  return claimed;
+}
+
+/**
+  * @brief Write a frame to an I2C1 slave (blocking, main loop)
+  * @param address: 7-bit slave address
+  * @param data: Bytes to send
+  * @param length: Byte count
+  * @retval HAL_OK, HAL_BUSY if the bus or the DMA path is busy, HAL_ERROR, HAL_TIMEOUT
+  */
+HAL_StatusTypeDef Output_I2C_Write(uint8_t address, const uint8_t* data, uint8_t length)
+{
+  HAL_StatusTypeDef status;
+
+  if (!Output_I2C_Claim()) return HAL_BUSY;
+  status = Output_I2C_Transfer(address, data, length);
+  output_i2c_claimed = 0;
+  return status;
+}
+
+/**
+  * @brief Check whether a blocking write holds the bus (ISR safe)
+  * @retval 1 while Output_I2C_Write() is between its claim and its STOP
+  */
+uint8_t Output_I2C_IsClaimed(void)
+{
+  return output_i2c_claimed;
+}
@@ -0,0 +1,268 @@
+/**
+  ******************************************************************************
+  * @file           : power.c
+  * @brief          : Low-power idle while the USB host is suspended
+  ******************************************************************************
+  * @attention
+  *
+  * Power_Idle() replaces the scheduler's plain WFI. While the bus is
+  * active it is exactly that. Once the host suspends the bus it picks:
+  *
+  *  - STOP, if no output is moving (no waveform, stream, dither, DAC transfer
+  *    or relay pulse) and no trigger is armed.
+  *    HSE, PLL and all peripheral clocks stop; GPIO and the DAC keep their
+  *    levels, so the outputs do not change. The health ADC is powered down
+  *    around it. The USB wake-up line (EXTI 18) or the RTC alarm (EXTI 17)
+  *    ends it. The alarm is needed because the IWDG keeps counting in STOP:
+  *    the core wakes every POWER_STOP_MAX_MS, lets the watchdog task feed
+  *    it and goes back to sleep.
+  *  - SLEEP with the flash interface clock gated otherwise, so playback
+  *    timing is unaffected.
+  *
+  * On STOP exit the core runs from HSI. SystemClock_Config() brings HSE,
+  * the PLL and the 48 MHz USB clock back before any handler runs (PRIMASK
+  * is still set), and the HAL tick is advanced by the RTC count so that
+  * scheduler deadlines stay in step. The RTC runs from LSI like the IWDG,
+  * so the wake-up period tracks the watchdog timeout whatever the LSI
+  * frequency; the tick correction is only as accurate as LSI (30-60 kHz).
+  *
+  * USBWakeUp_IRQHandler and RTC_Alarm_IRQHandler are not configured in the
+  * .ioc, so they live here rather than in stm32f1xx_it.c.
+  *
+  ******************************************************************************
+  */
+
+#include "power.h"
+#include "dither.h"
+#include "gp8413_dma.h"
+#include "health.h"
+#include "relay_timer.h"
+#include "stream.h"
+#include "trigger.h"
+#include "waveform.h"
+
+#define POWER_RTC_EXTI_LINE     (1UL << 17)
+
+extern void SystemClock_Config(void);
+
+static volatile uint8_t power_suspended;
+static PowerStats_t power_stats;
+
+static void Power_RtcWaitWrite(void)
+{
+  while (!(RTC->CRL & RTC_CRL_RTOFF)) {
+  }
+}
+
+/**
+  * @brief RTC counter, synchronised after a STOP exit
+  */
+static uint32_t Power_RtcRead(void)
+{
+  uint16_t high;
+  uint16_t low;
+
+  RTC->CRL &= ~RTC_CRL_RSF;
+  while (!(RTC->CRL & RTC_CRL_RSF)) {
+  }
+  do {
+    high = RTC->CNTH;
+    low = RTC->CNTL;
+  } while (high != RTC->CNTH);
+  return ((uint32_t)high << 16) | low;
+}
+
+static void Power_RtcSetAlarm(uint32_t count)
+{
+  Power_RtcWaitWrite();
+  RTC->CRL |= RTC_CRL_CNF;
+  RTC->ALRH = count >> 16;
+  RTC->ALRL = count & 0xFFFF;
+  RTC->CRL &= ~(RTC_CRL_CNF | RTC_CRL_ALRF);
+  Power_RtcWaitWrite();
+}
+
+/**
+  * @brief Start the RTC on LSI and enable the STOP wake-up lines
+  * @retval None
+  */
+void Power_Init(void)
+{
+  RCC->CSR |= RCC_CSR_LSION;
+  while (!(RCC->CSR & RCC_CSR_LSIRDY)) {
+  }
+
+  __HAL_RCC_BKP_CLK_ENABLE();
+  HAL_PWR_EnableBkUpAccess();
+  if ((RCC->BDCR & RCC_BDCR_RTCSEL) != RCC_BDCR_RTCSEL_LSI) {
+    // The clock source can only be changed after a backup domain reset
+    __HAL_RCC_BACKUPRESET_FORCE();
+    __HAL_RCC_BACKUPRESET_RELEASE();
+    RCC->BDCR |= RCC_BDCR_RTCSEL_LSI;
+  }
+  RCC->BDCR |= RCC_BDCR_RTCEN;
+
+  Power_RtcWaitWrite();
+  RTC->CRL |= RTC_CRL_CNF;
+  RTC->PRLH = 0;
+  RTC->PRLL = POWER_RTC_PRESCALER - 1;
+  RTC->CRL &= ~RTC_CRL_CNF;
+  Power_RtcWaitWrite();
+  RTC->CRH |= RTC_CRH_ALRIE;
+
+  EXTI->RTSR |= POWER_RTC_EXTI_LINE;
+  EXTI->IMR |= POWER_RTC_EXTI_LINE;
+  __HAL_USB_WAKEUP_EXTI_ENABLE_RISING_EDGE();
+  __HAL_USB_WAKEUP_EXTI_ENABLE_IT();
+
+  HAL_NVIC_SetPriority(USBWakeUp_IRQn, IRQ_PRIO_USB, 0);
+  HAL_NVIC_EnableIRQ(USBWakeUp_IRQn);
+  HAL_NVIC_SetPriority(RTC_Alarm_IRQn, IRQ_PRIO_TIM3, 0);
+  HAL_NVIC_EnableIRQ(RTC_Alarm_IRQn);
+
+#ifdef DEBUG
+  // Keep the debugger connected through STOP
+  DBGMCU->CR |= DBGMCU_CR_DBG_STOP;
+#endif
+}
+
+/**
+  * @brief USB suspend callback hook (USB interrupt)
+  * @retval None
+  */
+void Power_UsbSuspended(void)
+{
+  power_suspended = 1;
+  power_stats.suspends++;
+}
+
+/**
+  * @brief USB resume or reset callback hook (USB interrupt)
+  * @retval None
+  */
+void Power_UsbResumed(void)
+{
+  power_suspended = 0;
+}
+
+uint8_t Power_IsUsbSuspended(void)
+{
+  return power_suspended;
+}
+
+static uint8_t Power_OutputsBusy(void)
+{
+  return Wave_IsPlaying() || Stream_IsActive() || Dither_GetRate() != 0 || GP8413_DMA_IsBusy() ||
+         RelayTimer_Active() != 0 || Trigger_IsArmed();
+}
+
+/**
+  * @brief STOP until the USB wake-up line or the RTC alarm, then restore clocks
+  * @retval None
+  */
+static void Power_Stop(void)
+{
+  uint32_t rtc_start = Power_RtcRead();
+  uint32_t wake;
+  uint32_t slept;
+  uint16_t wake_us;
+
+  Power_RtcSetAlarm(rtc_start + POWER_STOP_MAX_MS);
+  Health_Stop();
+  HAL_SuspendTick();
+  HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+  wake = DWT->CYCCNT;
+
+  // HSE start-up timeouts do not expire with PRIMASK set; the IWDG covers a dead crystal
+  SystemClock_Config();
+  HAL_ResumeTick();
+  wake_us = (uint16_t)((DWT->CYCCNT - wake) / POWER_HSI_MHZ);
+  Health_Start();
+
+  slept = Power_RtcRead() - rtc_start;
+  uwTick += slept;
+
+  power_stats.stop_entries++;
+  power_stats.stop_ms += slept;
+  power_stats.wake_us_last = wake_us;
+  if (wake_us > power_stats.wake_us_max) power_stats.wake_us_max = wake_us;
+}
+
+/**
+  * @brief Idle until the next interrupt, in the deepest mode the state allows
+  * @retval None
+  * @note  Call with interrupts disabled (PRIMASK set); the wake-up
+  *        interrupt is taken once the caller enables them again.
+  */
+void Power_Idle(void)
+{
+  if (!power_suspended) {
+    __DSB();
+    __WFI();
+    return;
+  }
+
+  if (Power_OutputsBusy()) {
+    power_stats.sleep_entries++;
+    RCC->AHBENR &= ~RCC_AHBENR_FLITFEN;
+    __DSB();
+    __WFI();
+    RCC->AHBENR |= RCC_AHBENR_FLITFEN;
+    return;
+  }
+
+  Power_Stop();
+}
+
+/**
+  * @brief Serialize the power statistics for GET_POWER
+  * @param cmd: Command byte echoed in byte 0
+  * @param reply: POWER_REPLY_SIZE bytes
+  * @retval Reply length
+  *
+  * [cmd, flags, suspends u16, stop_entries u32, stop_ms u32,
+  *  sleep_entries u32, wake_us_last u16, wake_us_max u16], big-endian.
+  */
+uint8_t Power_Serialize(uint8_t cmd, uint8_t* reply)
+{
+  PowerStats_t s = power_stats;
+  uint32_t words[3] = { s.stop_entries, s.stop_ms, s.sleep_entries };
+
+  reply[0] = cmd;
+  reply[1] = (power_suspended ? POWER_FLAG_SUSPENDED : 0) |
+             (Power_OutputsBusy() ? POWER_FLAG_OUTPUTS_BUSY : 0);
+  reply[2] = (s.suspends >> 8) & 0xFF;
+  reply[3] = s.suspends & 0xFF;
+  for (uint8_t i = 0; i < 3; i++) {
+    reply[4 + 4 * i] = (words[i] >> 24) & 0xFF;
+    reply[5 + 4 * i] = (words[i] >> 16) & 0xFF;
+    reply[6 + 4 * i] = (words[i] >> 8) & 0xFF;
+    reply[7 + 4 * i] = words[i] & 0xFF;
+  }
+  reply[16] = (s.wake_us_last >> 8) & 0xFF;
+  reply[17] = s.wake_us_last & 0xFF;
+  reply[18] = (s.wake_us_max >> 8) & 0xFF;
+  reply[19] = s.wake_us_max & 0xFF;
+  return POWER_REPLY_SIZE;
+}
+
+/**
+  * @brief USB wake-up from STOP (EXTI line 18)
+  * @retval None
+  * @note  The USB interrupt then reports the resume once the clock is back.
+  */
+void USBWakeUp_IRQHandler(void)
+{
+  __HAL_USB_WAKEUP_EXTI_CLEAR_FLAG();
+}
+
+/**
+  * @brief RTC alarm (EXTI line 17): periodic wake-up to feed the IWDG
+  * @retval None
+  */
+void RTC_Alarm_IRQHandler(void)
+{
+  Power_RtcWaitWrite();
+  RTC->CRL &= ~RTC_CRL_ALRF;
+  EXTI->PR = POWER_RTC_EXTI_LINE;
+}
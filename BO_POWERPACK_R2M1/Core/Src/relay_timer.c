@@ -0,0 +1,471 @@
+/**
+  ******************************************************************************
+  * @file           : relay_timer.c
+  * @brief          : Hardware-timed relay edges: pulse, blink and latching coils
+  ******************************************************************************
+  * @attention
+  *
+  * The relay pins (PB12, PB13) are not timer outputs, so the timers drive
+  * them through the DMA instead: a relay row that names a timer engine in
+  * the channel table (RelayChannel_t.timer) has a timer whose update
+  * request copies a "start" word and whose
+  * compare request copies an "end" word into the port's BSRR. The first
+  * start edge is written right before the counter is enabled, and every
+  * later edge is a DMA transfer triggered by the counter. Widths and
+  * periods are exact to the crystal, and USB traffic or the main loop
+  * cannot stretch them. Times are kept in microseconds; each sequence
+  * counts at the finest tick (1 MHz down to 1 kHz) that fits its span in
+  * the 16-bit counter.
+  *
+  *   RELAY_TIMER_TIM2  update -> DMA1 ch2, CC2 -> DMA1 ch7
+  *   RELAY_TIMER_TIM1  update -> DMA1 ch5, CC4 -> DMA1 ch4
+  *
+  * Each engine serves one row at most. Rows beyond the engines (a larger
+  * variant) have RELAY_TIMER_NONE: pulses, blinks and delayed switches
+  * are refused with RELAY_TIMER_ERR_NO_TIMER, a zero-cross row switches
+  * at once, and a latching row gets its coil pulse from a busy-wait.
+  *
+  * A pulse runs the timer in one-pulse mode (ARR = CCR = width), so the
+  * counter stops by itself. A blink repeats every period: the end channel
+  * moves count words and its transfer-complete interrupt retires the
+  * sequence; the start channel moves count - 1, so the last period adds
+  * no edge. With count 0 both channels run circular until the relay is
+  * written again.
+  *
+  * A level-driven relay pulses and blinks away from its current state and
+  * comes back to it; powerpack_state.relays does not change. A latching
+  * relay (R1M1, RELAY_DRIVE_LATCHING) has its SET and RESET coils on the
+  * two pins; RelayTimer_Latch() gives the coil RELAY_LATCH_PULSE_MS and
+  * then leaves it unpowered.
+  *
+  * A relay's contacts follow its coil after an operate (close) or release
+  * (open) time, measured per relay on the bench and kept in the flash
+  * config. Pulses and blinks stretch the coil's on-time by operate minus
+  * release so the contacts stay closed (or open) for the time asked.
+  * RelayTimer_SwitchAt() switches one relay later, with the coil edge
+  * moved forward by that time, so the contacts change when asked: the
+  * start word is empty and the end word is the new level. With
+  * config.zero_cross_mask set for a row, plain relay writes go the same
+  * way, aimed at the next mains zero crossing (zero_cross.c) to cut
+  * inrush and contact wear. Latching rows are never delayed.
+  *
+  ******************************************************************************
+  */
+
+#include "relay_timer.h"
+#include "channels.h"
+#include "config.h"
+#include "metrics.h"
+#include "zero_cross.h"
+
+#define RELAY_LATCH_TIMEOUT_MS  (RELAY_LATCH_PULSE_MS + 2)
+
+static const uint32_t relay_ticks_hz[] = { 1000000, 100000, 10000, 1000 };
+
+typedef struct {
+  TIM_TypeDef* tim;
+  DMA_Channel_TypeDef* dma_start;     // update request
+  DMA_Channel_TypeDef* dma_end;       // compare request
+  IRQn_Type end_irq;
+  __IO uint32_t* ccr;
+  uint16_t cc_dma;                    // TIM_DIER_CCxDE of that compare channel
+} RelayEngine_t;
+
+static const RelayEngine_t relay_engines[RELAY_TIMER_COUNT] = {
+  { TIM2, DMA1_Channel2, DMA1_Channel7, DMA1_Channel7_IRQn, &TIM2->CCR2, TIM_DIER_CC2DE },
+  { TIM1, DMA1_Channel5, DMA1_Channel4, DMA1_Channel4_IRQn, &TIM1->CCR4, TIM_DIER_CC4DE },
+};
+
+static DMA_HandleTypeDef relay_dma[RELAY_TIMER_COUNT][2];   // [e][0] start edge, [e][1] end edge
+static uint32_t relay_words[RELAY_TIMER_COUNT][2];          // BSRR words the DMA copies
+static uint8_t relay_engine_row[RELAY_TIMER_COUNT];         // row served by engine e
+static volatile uint16_t relay_active;                      // bit n: a sequence runs on row n
+static uint16_t relay_latched;                              // bit n: latching row n last pulsed SET
+static uint16_t relay_latch_known;                          // bit n: row n pulsed since boot
+
+/**
+  * @brief Timer kernel clock: twice PCLK when the APB prescaler divides
+  */
+static uint32_t RelayTimer_Clock(const RelayEngine_t* e)
+{
+  if (e->tim == TIM1) {
+    return HAL_RCC_GetPCLK2Freq() * ((RCC->CFGR & RCC_CFGR_PPRE2_2) ? 2 : 1);
+  }
+  return HAL_RCC_GetPCLK1Freq() * ((RCC->CFGR & RCC_CFGR_PPRE1_2) ? 2 : 1);
+}
+
+/**
+  * @brief Coil edge to contact change for a row
+  * @param n: Relay row
+  * @param on: 1 = operate time (closing), 0 = release time (opening)
+  */
+static uint32_t RelayTimer_Delay(uint8_t n, uint8_t on)
+{
+  return on ? config.relay_operate_us[n] : config.relay_release_us[n];
+}
+
+/**
+  * @brief Engine index of a relay row
+  * @param n: Relay row with a timer
+  */
+static uint8_t RelayTimer_Engine(uint8_t n)
+{
+  return relay_channels[n].timer - 1;
+}
+
+/**
+  * @brief Stop a row's timer and both of its DMA channels
+  * @param n: Relay row with a timer
+  * @retval None
+  */
+static void RelayTimer_Stop(uint8_t n)
+{
+  uint8_t k = RelayTimer_Engine(n);
+  const RelayEngine_t* e = &relay_engines[k];
+
+  e->tim->CR1 = 0;
+  e->tim->DIER = 0;
+  HAL_NVIC_DisableIRQ(e->end_irq);
+  HAL_DMA_Abort(&relay_dma[k][0]);
+  HAL_DMA_Abort(&relay_dma[k][1]);
+  relay_active &= ~(1U << n);
+  HAL_NVIC_EnableIRQ(e->end_irq);
+}
+
+/**
+  * @brief Run an edge sequence on a row
+  * @param n: Relay row with a timer
+  * @param port: GPIO port of the pins in the words
+  * @param start: BSRR word at 0, period, 2 x period, ...
+  * @param end: BSRR word at on_us, period + on_us, ...
+  * @param on_us: Start to end edge, RELAY_TIMER_MIN_US..RELAY_TIMER_MAX_US
+  * @param period_us: Start to start edge, above on_us and at most
+  *        RELAY_TIMER_MAX_US; ignored for count 1
+  * @param count: Start/end pairs, 0 = until RelayTimer_Cancel()
+  * @retval None
+  */
+static void RelayTimer_Run(uint8_t n, GPIO_TypeDef* port, uint32_t start, uint32_t end,
+                           uint32_t on_us, uint32_t period_us, uint16_t count)
+{
+  uint8_t k = RelayTimer_Engine(n);
+  const RelayEngine_t* e = &relay_engines[k];
+  uint32_t bsrr = (uint32_t)&port->BSRR;
+  uint32_t circular = (count == 0) ? DMA_CCR_CIRC : 0;
+  uint32_t span_us = (count == 1) ? on_us : period_us;
+  uint32_t us_per_tick = 1;
+  uint32_t on_ticks;
+  uint32_t primask;
+
+  RelayTimer_Stop(n);
+  relay_words[k][0] = start;
+  relay_words[k][1] = end;
+
+  for (uint8_t t = 0; t < sizeof(relay_ticks_hz) / sizeof(relay_ticks_hz[0]); t++) {
+    us_per_tick = 1000000 / relay_ticks_hz[t];
+    if (span_us / us_per_tick <= 0xFFFF) break;
+  }
+
+  e->tim->PSC = RelayTimer_Clock(e) / (1000000 / us_per_tick) - 1;
+  on_ticks = on_us / us_per_tick;
+  if (on_ticks == 0) on_ticks = 1;
+  e->tim->ARR = (count == 1) ? on_ticks : period_us / us_per_tick - 1;
+  *e->ccr = on_ticks;
+  e->tim->CNT = 0;
+  e->tim->EGR = TIM_EGR_UG;           // load PSC now; no DMA request is enabled yet
+  e->tim->SR = 0;
+
+  MODIFY_REG(relay_dma[k][1].Instance->CCR, DMA_CCR_CIRC, circular);
+  if (count == 0) {
+    HAL_DMA_Start(&relay_dma[k][1], (uint32_t)&relay_words[k][1], bsrr, 1);
+  } else {
+    HAL_DMA_Start_IT(&relay_dma[k][1], (uint32_t)&relay_words[k][1], bsrr, count);
+  }
+  if (count != 1) {
+    MODIFY_REG(relay_dma[k][0].Instance->CCR, DMA_CCR_CIRC, circular);
+    HAL_DMA_Start(&relay_dma[k][0], (uint32_t)&relay_words[k][0], bsrr, count ? count - 1 : 1);
+  }
+  e->tim->DIER = e->cc_dma | ((count != 1) ? TIM_DIER_UDE : 0);
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  relay_active |= 1U << n;
+  port->BSRR = start;
+  e->tim->CR1 = TIM_CR1_CEN | ((count == 1) ? TIM_CR1_OPM : 0);
+  __set_PRIMASK(primask);
+}
+
+static void RelayTimer_EndComplete(DMA_HandleTypeDef* hdma)
+{
+  for (uint8_t k = 0; k < RELAY_TIMER_COUNT; k++) {
+    if (hdma == &relay_dma[k][1]) {
+      relay_engines[k].tim->CR1 = 0;
+      relay_engines[k].tim->DIER = 0;
+      relay_active &= ~(1U << relay_engine_row[k]);
+    }
+  }
+}
+
+/**
+  * @brief Clock the timers and set up their DMA channels
+  * @retval None
+  * @note  Call after MX_DMA_Init(). Two rows naming the same engine are a
+  *        table error.
+  */
+void RelayTimer_Init(void)
+{
+  uint8_t used = 0;
+
+  for (uint8_t n = 0; n < RELAY_COUNT; n++) {
+    uint8_t timer = relay_channels[n].timer;
+
+    if (timer == RELAY_TIMER_NONE) continue;
+    if (timer > RELAY_TIMER_COUNT || (used & (1U << (timer - 1))))
+    {
+      Error_Handler();
+    }
+    used |= 1U << (timer - 1);
+    relay_engine_row[timer - 1] = n;
+  }
+
+  __HAL_RCC_TIM2_CLK_ENABLE();
+  __HAL_RCC_TIM1_CLK_ENABLE();
+
+  for (uint8_t n = 0; n < RELAY_TIMER_COUNT; n++) {
+    for (uint8_t edge = 0; edge < 2; edge++) {
+      DMA_HandleTypeDef* hdma = &relay_dma[n][edge];
+
+      hdma->Instance = edge ? relay_engines[n].dma_end : relay_engines[n].dma_start;
+      hdma->Init.Direction = DMA_MEMORY_TO_PERIPH;
+      hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+      hdma->Init.MemInc = DMA_MINC_DISABLE;
+      hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+      hdma->Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+      hdma->Init.Mode = DMA_NORMAL;
+      hdma->Init.Priority = DMA_PRIORITY_MEDIUM;
+      if (HAL_DMA_Init(hdma) != HAL_OK)
+      {
+        Error_Handler();
+      }
+    }
+    relay_dma[n][1].XferCpltCallback = RelayTimer_EndComplete;
+
+    HAL_NVIC_SetPriority(relay_engines[n].end_irq, IRQ_PRIO_RELAY, 0);
+    HAL_NVIC_EnableIRQ(relay_engines[n].end_irq);
+  }
+}
+
+/**
+  * @brief Pulse or blink a level-driven relay away from its state and back
+  * @param relay_num: Relay number (1..RELAY_COUNT)
+  * @param on_ms: Time away from the current state, 1..65535 ms
+  * @param period_ms: Blink period, above on_ms; ignored for count 1
+  * @param count: Pulses, 1 = single pulse, 0 = until the relay is written
+  * @retval RELAY_TIMER_OK or RELAY_TIMER_ERR_*
+  * @note  on_ms is contact time: the coil is held for on_ms plus the
+  *        delay of the edge away minus that of the edge back.
+  */
+uint8_t RelayTimer_Blink(uint8_t relay_num, uint16_t on_ms, uint16_t period_ms, uint16_t count)
+{
+  const RelayChannel_t* relay;
+  uint32_t away, back;
+  int32_t coil_us;
+  uint8_t n = relay_num - 1;
+  uint8_t on;
+
+  if (relay_num < 1 || relay_num > RELAY_COUNT || on_ms == 0 ||
+      (count != 1 && period_ms <= on_ms)) {
+    return RELAY_TIMER_ERR_RANGE;
+  }
+  relay = &relay_channels[n];
+  if (relay->reset_pin) return RELAY_TIMER_ERR_LATCHED;
+  if (relay->timer == RELAY_TIMER_NONE) return RELAY_TIMER_ERR_NO_TIMER;
+
+  on = (powerpack_state.relays & (1U << n)) != 0;
+  away = relay->pin;
+  back = (uint32_t)relay->pin << 16;
+  if (on) {
+    away = back;
+    back = relay->pin;
+  }
+
+  coil_us = (int32_t)on_ms * 1000 + RelayTimer_Delay(n, !on) - RelayTimer_Delay(n, on);
+  if (coil_us < RELAY_TIMER_MIN_US || (count != 1 && coil_us >= (int32_t)period_ms * 1000)) {
+    return RELAY_TIMER_ERR_RANGE;
+  }
+  RelayTimer_Run(n, relay->port, away, back, (uint32_t)coil_us, (uint32_t)period_ms * 1000, count);
+
+  // Both edges of every pulse are state changes; an endless blink is not counted
+  if (n < 2) Metrics_Add((MetricId_t)(METRIC_RELAY1_SWITCHES + n), 2U * count);
+  return RELAY_TIMER_OK;
+}
+
+/**
+  * @brief Switch a level-driven relay so that its contacts move after a delay
+  * @param n: Relay row with a timer
+  * @param on: New level
+  * @param delay_us: Request to contact change
+  * @retval RELAY_TIMER_OK, or RELAY_TIMER_ERR_SOON if the coil edge would
+  *         fall before RELAY_TIMER_MIN_US
+  */
+static uint8_t RelayTimer_Switch(uint8_t n, uint8_t on, uint32_t delay_us)
+{
+  const RelayChannel_t* relay = &relay_channels[n];
+  uint32_t lead = RelayTimer_Delay(n, on);
+
+  if (delay_us < lead + RELAY_TIMER_MIN_US) return RELAY_TIMER_ERR_SOON;
+  RelayTimer_Run(n, relay->port, 0, on ? relay->pin : (uint32_t)relay->pin << 16,
+                 delay_us - lead, 0, 1);
+  return RELAY_TIMER_OK;
+}
+
+/**
+  * @brief Switch a relay with its contacts moving delay_us from now
+  * @param relay_num: Relay number (1..RELAY_COUNT)
+  * @param state: New state
+  * @param delay_us: Up to RELAY_TIMER_MAX_US
+  * @retval RELAY_TIMER_OK or RELAY_TIMER_ERR_*
+  * @note  The caller updates powerpack_state. Writing the relay before
+  *        the edge (or RelayTimer_Cancel()) applies the new state at once.
+  */
+uint8_t RelayTimer_SwitchAt(uint8_t relay_num, uint8_t state, uint32_t delay_us)
+{
+  if (relay_num < 1 || relay_num > RELAY_COUNT || delay_us > RELAY_TIMER_MAX_US) {
+    return RELAY_TIMER_ERR_RANGE;
+  }
+  if (relay_channels[relay_num - 1].reset_pin) return RELAY_TIMER_ERR_LATCHED;
+  if (relay_channels[relay_num - 1].timer == RELAY_TIMER_NONE) return RELAY_TIMER_ERR_NO_TIMER;
+  return RelayTimer_Switch(relay_num - 1, state != 0, delay_us);
+}
+
+/**
+  * @brief Switch a relay on the next usable mains zero crossing
+  * @param index: Relay row (0 = relay 1)
+  * @param on: New level
+  * @retval 1 if the switch is scheduled, 0 if the caller must write the pin
+  *         (row not in config.zero_cross_mask, latching, without a timer,
+  *         or no sync edges)
+  */
+uint8_t RelayTimer_SwitchZeroCross(uint8_t index, uint8_t on)
+{
+  const RelayChannel_t* relay = &relay_channels[index];
+  uint32_t delay_us;
+
+  if (!(config.zero_cross_mask & (1U << index)) || relay->reset_pin ||
+      relay->timer == RELAY_TIMER_NONE) {
+    return 0;
+  }
+  if (!ZeroCross_Delay(RelayTimer_Delay(index, on), &delay_us)) return 0;
+  return RelayTimer_Switch(index, on, delay_us) == RELAY_TIMER_OK;
+}
+
+/**
+  * @brief Stop the pulse or blink of some relays and put them back to their state
+  * @param mask: Relays (bit n = relay n+1)
+  * @retval Relays whose sequence was stopped
+  * @note  A delayed switch takes effect at once.
+  * @note  A latching coil pulse is never cut short; see RelayTimer_Latch().
+  */
+uint16_t RelayTimer_Cancel(uint16_t mask)
+{
+  uint16_t stopped = RelayTimer_Abort(mask);
+
+  for (uint8_t n = 0; n < RELAY_COUNT; n++) {
+    if (stopped & (1U << n)) relay_channels[n].port->BSRR = relay_words[RelayTimer_Engine(n)][1];
+  }
+  return stopped;
+}
+
+/**
+  * @brief Stop the pulse or blink of some relays where they are (ISR safe)
+  * @param mask: Relays (bit n = relay n+1)
+  * @retval Relays whose sequence was stopped
+  * @note  For a caller that drives the pins itself right after.
+  */
+uint16_t RelayTimer_Abort(uint16_t mask)
+{
+  uint16_t stopped = 0;
+
+  for (uint8_t n = 0; n < RELAY_COUNT; n++) {
+    if (!(mask & relay_active & (1U << n)) || relay_channels[n].reset_pin) continue;
+    RelayTimer_Stop(n);
+    stopped |= 1U << n;
+  }
+  return stopped;
+}
+
+uint16_t RelayTimer_Active(void)
+{
+  return relay_active;
+}
+
+/**
+  * @brief Move a latching relay with one timed coil pulse
+  * @param index: Relay row (0 = relay 1) with a reset_pin
+  * @param on: 1 = pulse the SET coil, 0 = the RESET coil
+  * @retval None
+  * @note  Waits for a pulse still running on the row, so the relay always
+  *        gets a full pulse; returns once the new pulse has started. The
+  *        position cannot be read back, so the first call after a reset
+  *        always pulses; later ones only when the position changes.
+  * @note  A row without a timer holds the coil for the whole pulse here.
+  */
+void RelayTimer_Latch(uint8_t index, uint8_t on)
+{
+  const RelayChannel_t* relay = &relay_channels[index];
+  uint16_t coil = on ? relay->pin : relay->reset_pin;
+  uint16_t other = on ? relay->reset_pin : relay->pin;
+  uint16_t bit = 1U << index;
+  uint32_t start;
+
+  if ((relay_latch_known & bit) && !(relay_latched & bit) == !on) return;
+  relay_latch_known |= bit;
+  if (on) {
+    relay_latched |= bit;
+  } else {
+    relay_latched &= ~bit;
+  }
+
+  start = HAL_GetTick();
+  if (relay->timer == RELAY_TIMER_NONE) {
+    relay->port->BSRR = coil | (uint32_t)other << 16;
+    while (HAL_GetTick() - start < RELAY_LATCH_PULSE_MS) {
+    }
+    relay->port->BSRR = (uint32_t)coil << 16;
+    return;
+  }
+  while ((relay_active & bit) && HAL_GetTick() - start < RELAY_LATCH_TIMEOUT_MS) {
+  }
+  RelayTimer_Run(index, relay->port, coil | (uint32_t)other << 16, (uint32_t)coil << 16,
+                 RELAY_LATCH_PULSE_MS * 1000UL, 0, 1);
+}
+
+/**
+  * @brief Stop every timer without HAL calls, so no DMA edge follows
+  * @retval None
+  * @note  Called from the fault handler before the pins go low.
+  */
+void RelayTimer_Halt(void)
+{
+  for (uint8_t k = 0; k < RELAY_TIMER_COUNT; k++) {
+    relay_engines[k].tim->CR1 = 0;
+    relay_engines[k].tim->DIER = 0;
+  }
+}
+
+/**
+  * @brief DMA1 channel 4: TIM1 engine sequence done
+  * @retval None
+  */
+void DMA1_Channel4_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&relay_dma[RELAY_TIMER_TIM1 - 1][1]);
+}
+
+/**
+  * @brief DMA1 channel 7: TIM2 engine sequence done
+  * @retval None
+  */
+void DMA1_Channel7_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&relay_dma[RELAY_TIMER_TIM2 - 1][1]);
+}
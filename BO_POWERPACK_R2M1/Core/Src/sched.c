@@ -0,0 +1,203 @@
+/**
+  ******************************************************************************
+  * @file           : sched.c
+  * @brief          : Static cooperative scheduler for the main loop
+  ******************************************************************************
+  * @attention
+  *
+  * Tasks are plain functions in a fixed table (sched_tasks[], main.c). A
+  * task runs when its period has elapsed on the HAL tick or when an
+  * interrupt has called Sched_Signal() for it, and always runs to
+  * completion. Each run is timed with the DWT cycle counter.
+  *
+  * When nothing is due the core sleeps in Power_Idle() (__WFI, or STOP
+  * while the USB host is suspended) with interrupts masked, so an event
+  * that arrives between the check and the sleep still wakes it; the
+  * handler runs once PRIMASK is cleared again. The HAL tick keeps
+  * running (HAL timeouts depend on it and USB SOF wakes the core every
+  * millisecond anyway), so "until the next deadline" means re-checking
+  * on every wake-up rather than reprogramming the tick.
+  *
+  ******************************************************************************
+  */
+
+#include "sched.h"
+#include "power.h"
+#include <string.h>
+
+typedef struct {
+  uint32_t next_ms;
+  uint32_t runs;
+  uint32_t max_cycles;
+  uint64_t cycles;
+} SchedTaskState_t;
+
+static SchedTaskState_t sched_state[TASK_COUNT];
+static volatile uint32_t sched_pending;   // bit per task, set by Sched_Signal()
+static uint64_t sched_idle_cycles;
+static uint32_t sched_window_start;       // DWT stamp of the last statistics reset
+static uint64_t sched_window_cycles;      // elapsed cycles before the current stamp
+
+/**
+  * @brief Prepare the task deadlines
+  * @retval None
+  * @note  The DWT cycle counter must already run (Timing_Init()).
+  */
+void Sched_Init(void)
+{
+  uint32_t now = HAL_GetTick();
+
+  memset(sched_state, 0, sizeof(sched_state));
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    sched_state[i].next_ms = now + sched_tasks[i].period_ms;
+  }
+  sched_idle_cycles = 0;
+  sched_window_cycles = 0;
+  sched_window_start = DWT->CYCCNT;
+
+#ifdef DEBUG
+  // Keep the debugger connected while the core sleeps
+  DBGMCU->CR |= DBGMCU_CR_DBG_SLEEP;
+#endif
+}
+
+/**
+  * @brief Mark a task runnable (ISR safe)
+  * @param id: Task
+  * @retval None
+  */
+void Sched_Signal(SchedTaskId_t id)
+{
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  sched_pending |= 1UL << id;
+  __set_PRIMASK(primask);
+}
+
+/**
+  * @brief Next task that is due, -1 if none
+  */
+static int8_t Sched_NextDue(uint32_t now)
+{
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    if (sched_pending & (1UL << i)) return i;
+    if (sched_tasks[i].period_ms != 0 && (int32_t)(now - sched_state[i].next_ms) >= 0) return i;
+  }
+  return -1;
+}
+
+/**
+  * @brief Elapsed cycles since the last statistics reset, wrap safe if called
+  *        at least every 89 s (the wake-ups come every millisecond)
+  */
+static void Sched_UpdateWindow(void)
+{
+  uint32_t now = DWT->CYCCNT;
+
+  sched_window_cycles += now - sched_window_start;
+  sched_window_start = now;
+}
+
+/**
+  * @brief Run the task loop; never returns
+  * @retval None
+  */
+void Sched_Run(void)
+{
+  while (1) {
+    int8_t id = Sched_NextDue(HAL_GetTick());
+
+    if (id >= 0) {
+      SchedTaskState_t* t = &sched_state[id];
+      uint32_t start;
+      uint32_t cycles;
+
+      __disable_irq();
+      sched_pending &= ~(1UL << id);
+      __enable_irq();
+      if (sched_tasks[id].period_ms != 0) {
+        t->next_ms = HAL_GetTick() + sched_tasks[id].period_ms;
+      }
+
+      start = DWT->CYCCNT;
+      sched_tasks[id].run();
+      cycles = DWT->CYCCNT - start;
+
+      t->runs++;
+      t->cycles += cycles;
+      if (cycles > t->max_cycles) t->max_cycles = cycles;
+      continue;
+    }
+
+    // Nothing due: sleep until the next interrupt
+    __disable_irq();
+    if (Sched_NextDue(HAL_GetTick()) < 0) {
+      uint32_t start = DWT->CYCCNT;
+      Power_Idle();
+      sched_idle_cycles += DWT->CYCCNT - start;
+    }
+    __enable_irq();
+    Sched_UpdateWindow();
+  }
+}
+
+/**
+  * @brief Serialize the CPU accounting for GET_TASKS
+  * @param cmd: Command byte echoed in byte 0
+  * @param reset: Non-zero to restart the accounting window
+  * @param reply: SCHED_REPLY_SIZE bytes
+  * @retval Reply length
+  *
+  * [cmd, count, idle permille u16, elapsed_ms u32, count x (runs u32,
+  *  busy permille u16, max cycles u32)], big-endian. The remainder up to
+  * 1000 permille is interrupt handlers and scheduler overhead.
+  */
+uint8_t Sched_Serialize(uint8_t cmd, uint8_t reset, uint8_t* reply)
+{
+  uint64_t window;
+  uint32_t elapsed_ms;
+  uint16_t idle;
+
+  Sched_UpdateWindow();
+  window = sched_window_cycles ? sched_window_cycles : 1;
+  elapsed_ms = (uint32_t)(sched_window_cycles / (SystemCoreClock / 1000));
+  idle = (uint16_t)(sched_idle_cycles * 1000 / window);
+
+  reply[0] = cmd;
+  reply[1] = TASK_COUNT;
+  reply[2] = (idle >> 8) & 0xFF;
+  reply[3] = idle & 0xFF;
+  reply[4] = (elapsed_ms >> 24) & 0xFF;
+  reply[5] = (elapsed_ms >> 16) & 0xFF;
+  reply[6] = (elapsed_ms >> 8) & 0xFF;
+  reply[7] = elapsed_ms & 0xFF;
+
+  for (uint8_t i = 0; i < TASK_COUNT; i++) {
+    const SchedTaskState_t* t = &sched_state[i];
+    uint16_t busy = (uint16_t)(t->cycles * 1000 / window);
+    uint8_t* p = &reply[SCHED_REPLY_HEADER + SCHED_ENTRY_SIZE * i];
+
+    p[0] = (t->runs >> 24) & 0xFF;
+    p[1] = (t->runs >> 16) & 0xFF;
+    p[2] = (t->runs >> 8) & 0xFF;
+    p[3] = t->runs & 0xFF;
+    p[4] = (busy >> 8) & 0xFF;
+    p[5] = busy & 0xFF;
+    p[6] = (t->max_cycles >> 24) & 0xFF;
+    p[7] = (t->max_cycles >> 16) & 0xFF;
+    p[8] = (t->max_cycles >> 8) & 0xFF;
+    p[9] = t->max_cycles & 0xFF;
+  }
+
+  if (reset) {
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+      sched_state[i].runs = 0;
+      sched_state[i].cycles = 0;
+      sched_state[i].max_cycles = 0;
+    }
+    sched_idle_cycles = 0;
+    sched_window_cycles = 0;
+  }
+  return SCHED_REPLY_SIZE;
+}
@@ -0,0 +1,214 @@
+/**
+  ******************************************************************************
+  * @file           : stream.c
+  * @brief          : Continuous dimmer setpoint streaming with a jitter buffer
+  ******************************************************************************
+  * @attention
+  *
+  * The host streams timestamped (ts_ms, dimmer1, dimmer2) records in
+  * CMD_STREAM_DATA frames. Records are queued straight from the USB receive
+  * path into a ring buffer and played out by TIM4 at 1 kHz: the first
+  * record fixes the mapping host time -> device time plus the configured
+  * latency, after which each record is applied when its timestamp is due.
+  *
+  * Flow control: every data frame is acknowledged with the number of free
+  * slots after it was queued. The host's credit is that figure minus the
+  * records it has sent since, so it can never overrun the buffer. The ack
+  * is sent from the main loop (Task_Commands in main.c); frames that arrive
+  * before it goes out share one ack for the newest. When the buffer runs
+  * dry the outputs simply hold their last value.
+  *
+  ******************************************************************************
+  */
+
+#include "stream.h"
+#include "channels.h"
+#include "dither.h"
+#include "gp8413_dma.h"
+#include "waveform.h"
+
+extern TIM_HandleTypeDef htim4;
+
+#define STREAM_SLOT_MASK        (STREAM_BUFFER_SLOTS - 1)
+#define STREAM_MAX_LATENCY_MS   1000
+#define STREAM_STOP_TIMEOUT_MS  2
+
+typedef struct {
+  uint16_t ts_ms;
+  uint16_t level1;        // 0xFFFF = full scale
+  uint16_t level2;
+} StreamRecord_t;
+
+typedef struct {
+  volatile uint8_t active;
+  uint8_t  channel_mask;
+  uint16_t latency_ms;
+  uint8_t  synced;
+  uint16_t ts_offset;     // device_ms - host_ms for the current stream
+  uint16_t now_ms;
+  volatile uint8_t head;  // written by the USB receive path
+  volatile uint8_t tail;  // advanced by the TIM4 playout tick
+  StreamStats_t stats;
+} StreamState_t;
+
+static StreamRecord_t stream_buffer[STREAM_BUFFER_SLOTS];
+static StreamState_t stream;
+
+static inline uint8_t Stream_Fill(void)
+{
+  return (uint8_t)(stream.head - stream.tail);
+}
+
+/**
+  * @brief Start a stream and the TIM4 playout clock
+  * @param channel_mask: GP8413_DMA_CH1, GP8413_DMA_CH2 or both
+  * @param latency_ms: Jitter buffer depth in time (0 = default)
+  * @retval STREAM_OK or STREAM_ERR_*
+  */
+uint8_t Stream_Start(uint8_t channel_mask, uint16_t latency_ms)
+{
+  if (channel_mask == 0 || channel_mask > (GP8413_DMA_CH1 | GP8413_DMA_CH2)) return STREAM_ERR_RANGE;
+  if (channel_mask & ~Channels_DimmersPresent()) return STREAM_ERR_RANGE;
+  if (latency_ms == 0) latency_ms = STREAM_DEFAULT_LATENCY_MS;
+  if (latency_ms > STREAM_MAX_LATENCY_MS) return STREAM_ERR_RANGE;
+
+  Stream_Stop();
+  Wave_Stop();
+
+  stream.channel_mask = channel_mask;
+  stream.latency_ms = latency_ms;
+  stream.synced = 0;
+  stream.now_ms = 0;
+  stream.head = 0;
+  stream.tail = 0;
+  stream.stats = (StreamStats_t){0};
+  stream.active = 1;
+
+  HAL_TIM_Base_Start_IT(&htim4);
+  return STREAM_OK;
+}
+
+/**
+  * @brief Stop the stream; outputs keep their last value
+  * @retval None
+  */
+void Stream_Stop(void)
+{
+  if (!stream.active) return;
+
+  stream.active = 0;
+  if (Dither_GetRate() == 0) {
+    HAL_TIM_Base_Stop_IT(&htim4);       // the dither keeps TIM4 when it is on
+  }
+  GP8413_DMA_WaitIdle(STREAM_STOP_TIMEOUT_MS);
+}
+
+uint8_t Stream_IsActive(void)
+{
+  return stream.active;
+}
+
+uint8_t Stream_GetFreeSlots(void)
+{
+  return STREAM_BUFFER_SLOTS - Stream_Fill();
+}
+
+/**
+  * @brief Queue the records of one data frame (called from the USB receive path)
+  * @param frame: [cmd, seq, n, n x (ts_hi, ts_lo, d1_hi, d1_lo, d2_hi, d2_lo)]
+  * @param length: Received frame length
+  * @retval STREAM_OK or STREAM_ERR_*
+  */
+uint8_t Stream_Push(const uint8_t* frame, uint16_t length)
+{
+  uint8_t n = frame[2];
+  uint8_t status = STREAM_OK;
+  const uint8_t* rec = &frame[STREAM_FRAME_HEADER];
+
+  if (!stream.active) return STREAM_ERR_STATE;
+  if (n > STREAM_FRAME_MAX_RECORDS || length < STREAM_FRAME_HEADER + n * STREAM_RECORD_SIZE) {
+    return STREAM_ERR_RANGE;
+  }
+
+  for (uint8_t i = 0; i < n; i++, rec += STREAM_RECORD_SIZE) {
+    if (Stream_Fill() >= STREAM_BUFFER_SLOTS) {
+      stream.stats.overflows++;
+      status = STREAM_ERR_OVERFLOW;
+      continue;
+    }
+
+    StreamRecord_t* slot = &stream_buffer[stream.head & STREAM_SLOT_MASK];
+    slot->ts_ms = (rec[0] << 8) | rec[1];
+    slot->level1 = (rec[2] << 8) | rec[3];
+    slot->level2 = (rec[4] << 8) | rec[5];
+    stream.head++;
+  }
+  return status;
+}
+
+/**
+  * @brief Copy the buffer statistics
+  * @param stats: Destination
+  * @param reset: Non-zero restarts the min/max window
+  * @retval None
+  */
+void Stream_GetStats(StreamStats_t* stats, uint8_t reset)
+{
+  stream.stats.fill = Stream_Fill();
+  *stats = stream.stats;
+
+  if (reset) {
+    stream.stats.fill_min = stream.stats.fill;
+    stream.stats.fill_max = stream.stats.fill;
+  }
+}
+
+/**
+  * @brief 1 kHz TIM4 playout tick
+  * @retval None
+  */
+void Stream_TimerTick(void)
+{
+  StreamRecord_t* rec;
+  uint16_t due;
+  uint8_t fill;
+
+  if (!stream.active) return;
+
+  stream.now_ms++;
+  fill = Stream_Fill();
+  if (fill < stream.stats.fill_min) stream.stats.fill_min = fill;
+  if (fill > stream.stats.fill_max) stream.stats.fill_max = fill;
+
+  if (fill == 0) {
+    // Underrun: hold the last value until new records arrive
+    if (stream.synced) stream.stats.underruns++;
+    return;
+  }
+
+  rec = &stream_buffer[stream.tail & STREAM_SLOT_MASK];
+  if (!stream.synced) {
+    stream.ts_offset = stream.now_ms + stream.latency_ms - rec->ts_ms;
+    stream.synced = 1;
+  }
+
+  due = rec->ts_ms + stream.ts_offset;
+  if ((int16_t)(stream.now_ms - due) < 0) return;
+
+  // Catch up after a stall: skip to the newest record that is already due
+  while (fill > 1) {
+    StreamRecord_t* next = &stream_buffer[(stream.tail + 1) & STREAM_SLOT_MASK];
+    if ((int16_t)(stream.now_ms - (uint16_t)(next->ts_ms + stream.ts_offset)) < 0) break;
+    stream.tail++;
+    stream.stats.late++;
+    fill--;
+    rec = next;
+  }
+
+  if (GP8413_WriteLevelsDMA(stream.channel_mask, rec->level1, rec->level2) != HAL_OK) {
+    return;   // bus still busy, retry on the next tick
+  }
+
+  stream.tail++;
+  stream.stats.played++;
+}
@@ -29,6 +29,12 @@
  */
 static uint8_t *__sbrk_heap_end = NULL;
 
+/**
+ * Highest heap end reached and number of refused requests (see memory.c)
+ */
+uint8_t *__sbrk_heap_peak = NULL;
+uint32_t __sbrk_heap_failures = 0;
+
 /**
  * @brief _sbrk() allocates memory to the newlib heap and is used by malloc
  *        and others from the C library
@@ -68,12 +74,17 @@ void *_sbrk(ptrdiff_t incr)
   /* Protect heap from growing into the reserved MSP stack */
   if (__sbrk_heap_end + incr > max_heap)
   {
+    __sbrk_heap_failures++;
     errno = ENOMEM;
     return (void *)-1;
   }
 
   prev_heap_end = __sbrk_heap_end;
   __sbrk_heap_end += incr;
+  if (__sbrk_heap_end > __sbrk_heap_peak)
+  {
+    __sbrk_heap_peak = __sbrk_heap_end;
+  }
 
   return (void *)prev_heap_end;
 }
@@ -0,0 +1,233 @@
+/**
+  ******************************************************************************
+  * @file           : telemetry.c
+  * @brief          : Compact status stream: field bitmap and zigzag-varint deltas
+  ******************************************************************************
+  * @attention
+  *
+  * The status push sends the same 16 bytes (status and health frames) every
+  * time, though at a high rate almost nothing changes between two of them.
+  * The telemetry stream sends, at a chosen interval, a snapshot of the same
+  * values coded against a reference snapshot the host is known to hold:
+  *
+  *   [TELEMETRY_FRAME, seq, ref, bitmap, value, value, ...]
+  *
+  * The bitmap (a varint) marks the fields that differ from snapshot ref;
+  * each one follows as a zigzag varint (LEB128 of (d << 1) ^ (d >> 31)) of
+  * the difference, in field order. A frame with ref == seq is a key frame:
+  * every field is present and coded against zero, so it stands alone.
+  * With no change the frame is 4 bytes. A frame longer than one USB packet
+  * (TELEMETRY_FRAME_MAX, large channel tables only) is sent as one
+  * two-packet transfer; the host decodes a byte stream either way.
+  *
+  * The reference is the last key frame until the host acks a later frame
+  * (TELEMETRY_CMD_ACK); deltas are never chained, so a lost frame costs
+  * only itself. Key frames come every key_every frames, when the
+  * reference has fallen out of the TELEMETRY_HISTORY snapshots kept for
+  * acks, and first after a start, so a host that joins late or loses the
+  * reference resyncs within one key interval. A frame that finds the CDC
+  * endpoint busy is dropped before it takes a sequence number.
+  *
+  * Everything runs in main-loop tasks (acks arrive as commands), so no
+  * state is shared with an interrupt.
+  *
+  ******************************************************************************
+  */
+
+#include "telemetry.h"
+#include "health.h"
+#include "usbd_cdc_if.h"
+#include <string.h>
+
+typedef struct {
+  uint16_t interval_ms;       // 0 = stopped
+  uint16_t key_every;
+  uint16_t since_key;
+  uint8_t seq;                // next frame
+  uint8_t ref;                // snapshot the deltas are coded against
+  uint8_t ref_valid;
+  uint32_t next_ms;
+  uint32_t since_ms;          // statistics window start
+  TelemetryStats_t stats;
+  int32_t history[TELEMETRY_HISTORY][TELEMETRY_FIELDS];
+} Telemetry_t;
+
+static Telemetry_t telemetry;
+static uint8_t telemetry_frame[TELEMETRY_FRAME_MAX];
+
+static uint8_t Telemetry_PutVarint(uint8_t* out, uint32_t value)
+{
+  uint8_t n = 0;
+
+  while (value >= 0x80) {
+    out[n++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = value;
+  return n;
+}
+
+static void Telemetry_Snapshot(int32_t* fields)
+{
+  int16_t temp_dc;
+  uint16_t vdda_mv;
+
+  Health_Read(&temp_dc, &vdda_mv);
+  fields[TELEMETRY_FIELD_RELAYS] = powerpack_state.relays;
+  fields[TELEMETRY_FIELD_ENABLES] = powerpack_state.dimmers_enabled;
+  for (uint8_t i = 0; i < DIMMER_COUNT; i++) {
+    fields[TELEMETRY_FIELD_DIMMER + i] = powerpack_state.dimmer_value[i];
+  }
+  fields[TELEMETRY_FIELD_TEMPERATURE] = temp_dc;
+  fields[TELEMETRY_FIELD_VDDA] = vdda_mv;
+}
+
+/**
+  * @brief Start (or restart) the stream; the first frame is a key frame
+  * @param interval_ms: Frame interval, TELEMETRY_MIN_INTERVAL_MS and up,
+  *        in steps of TELEMETRY_TICK_MS
+  * @param key_every: Frames from one key frame to the next, 0 = default
+  * @retval TELEMETRY_OK or TELEMETRY_ERR_RANGE
+  */
+uint8_t Telemetry_Start(uint16_t interval_ms, uint16_t key_every)
+{
+  if (interval_ms < TELEMETRY_MIN_INTERVAL_MS) return TELEMETRY_ERR_RANGE;
+
+  telemetry.interval_ms = interval_ms;
+  telemetry.key_every = key_every ? key_every : TELEMETRY_DEFAULT_KEY_EVERY;
+  telemetry.ref_valid = 0;
+  telemetry.next_ms = HAL_GetTick();
+  telemetry.since_ms = telemetry.next_ms;
+  telemetry.stats = (TelemetryStats_t){0};
+  return TELEMETRY_OK;
+}
+
+void Telemetry_Stop(void)
+{
+  telemetry.interval_ms = 0;
+}
+
+uint8_t Telemetry_IsActive(void)
+{
+  return telemetry.interval_ms != 0;
+}
+
+/**
+  * @brief Host holds frame seq: code the next frames against it
+  * @param seq: Sequence number of a decoded frame
+  * @retval None
+  * @note  Acks for frames older than the reference or no longer in the
+  *        history are ignored.
+  */
+void Telemetry_Ack(uint8_t seq)
+{
+  uint8_t age = (uint8_t)(telemetry.seq - 1 - seq);
+  uint8_t ahead = (uint8_t)(seq - telemetry.ref);
+
+  if (!telemetry.ref_valid || age >= TELEMETRY_HISTORY || ahead == 0 || ahead >= 0x80) return;
+  telemetry.ref = seq;
+  telemetry.stats.acks++;
+}
+
+/**
+  * @brief Send a frame if the interval has elapsed
+  * @retval None
+  * @note  Called from the main-loop task every TELEMETRY_TICK_MS.
+  */
+void Telemetry_Tick(void)
+{
+  static const int32_t zero[TELEMETRY_FIELDS];
+  int32_t fields[TELEMETRY_FIELDS];
+  const int32_t* base;
+  uint32_t now = HAL_GetTick();
+  uint32_t start, cycles, bitmap = 0;
+  uint8_t key, length;
+
+  if (telemetry.interval_ms == 0 || (int32_t)(now - telemetry.next_ms) < 0) return;
+  telemetry.next_ms += telemetry.interval_ms;
+  if ((int32_t)(now - telemetry.next_ms) >= 0) telemetry.next_ms = now + telemetry.interval_ms;
+
+  start = DWT->CYCCNT;
+  Telemetry_Snapshot(fields);
+
+  key = !telemetry.ref_valid || telemetry.since_key >= telemetry.key_every ||
+        (uint8_t)(telemetry.seq - telemetry.ref) >= TELEMETRY_HISTORY;
+  base = key ? zero : telemetry.history[telemetry.ref % TELEMETRY_HISTORY];
+
+  for (uint8_t f = 0; f < TELEMETRY_FIELDS; f++) {
+    if (key || fields[f] != base[f]) bitmap |= 1UL << f;
+  }
+
+  telemetry_frame[0] = TELEMETRY_FRAME;
+  telemetry_frame[1] = telemetry.seq;
+  telemetry_frame[2] = key ? telemetry.seq : telemetry.ref;
+  length = 3 + Telemetry_PutVarint(&telemetry_frame[3], bitmap);
+  for (uint8_t f = 0; f < TELEMETRY_FIELDS; f++) {
+    if (bitmap & (1UL << f)) {
+      int32_t d = fields[f] - base[f];
+      length += Telemetry_PutVarint(&telemetry_frame[length], ((uint32_t)d << 1) ^ (uint32_t)(d >> 31));
+    }
+  }
+  cycles = DWT->CYCCNT - start;
+
+  if (CDC_Transmit_FS(telemetry_frame, length) != USBD_OK) {
+    telemetry.stats.dropped++;
+    return;
+  }
+
+  memcpy(telemetry.history[telemetry.seq % TELEMETRY_HISTORY], fields, sizeof(fields));
+  if (key) {
+    telemetry.ref = telemetry.seq;
+    telemetry.ref_valid = 1;
+    telemetry.since_key = 0;
+    telemetry.stats.key_frames++;
+  } else {
+    telemetry.since_key++;
+  }
+  telemetry.seq++;
+  telemetry.stats.frames++;
+  telemetry.stats.bytes += length;
+  telemetry.stats.cycles += cycles;
+  if (cycles > telemetry.stats.cycles_max) telemetry.stats.cycles_max = cycles;
+}
+
+/**
+  * @brief Serialize the stream settings and statistics
+  * @param cmd: Command byte echoed in byte 0
+  * @param status: TELEMETRY_OK or TELEMETRY_ERR_*
+  * @param reset: Restart the statistics window after reading
+  * @param reply: TELEMETRY_REPLY_SIZE bytes
+  * @retval Reply length
+  *
+  * [cmd, status, active, fields, interval_ms u16, key_every u16,
+  *  elapsed_ms, frames, key_frames, bytes, dropped, acks, cycles,
+  *  cycles_max (u32 each)], big-endian.
+  */
+uint8_t Telemetry_Serialize(uint8_t cmd, uint8_t status, uint8_t reset, uint8_t* reply)
+{
+  TelemetryStats_t s = telemetry.stats;
+  uint32_t now = HAL_GetTick();
+  uint32_t words[8] = { now - telemetry.since_ms, s.frames, s.key_frames, s.bytes,
+                        s.dropped, s.acks, s.cycles, s.cycles_max };
+
+  if (reset) {
+    telemetry.stats = (TelemetryStats_t){0};
+    telemetry.since_ms = now;
+  }
+
+  reply[0] = cmd;
+  reply[1] = status;
+  reply[2] = Telemetry_IsActive();
+  reply[3] = TELEMETRY_FIELDS;
+  reply[4] = (telemetry.interval_ms >> 8) & 0xFF;
+  reply[5] = telemetry.interval_ms & 0xFF;
+  reply[6] = (telemetry.key_every >> 8) & 0xFF;
+  reply[7] = telemetry.key_every & 0xFF;
+  for (uint8_t i = 0; i < 8; i++) {
+    reply[8 + 4 * i] = (words[i] >> 24) & 0xFF;
+    reply[9 + 4 * i] = (words[i] >> 16) & 0xFF;
+    reply[10 + 4 * i] = (words[i] >> 8) & 0xFF;
+    reply[11 + 4 * i] = words[i] & 0xFF;
+  }
+  return TELEMETRY_REPLY_SIZE;
+}
@@ -0,0 +1,73 @@
+/**
+  ******************************************************************************
+  * @file           : timing.c
+  * @brief          : DWT cycle statistics for the USB ISR and command path
+  ******************************************************************************
+  * @attention
+  *
+  * Min/avg/max CPU cycles (48 per us) of the sections in TimingId_t, read
+  * with GET_TIMING. The reply flags tell whether the hot path was linked
+  * into .RamFunc, so a flash build and a RAM build can be compared with
+  * the same host command.
+  *
+  ******************************************************************************
+  */
+
+#include "timing.h"
+#include <string.h>
+
+TimingStat_t timing[TIMING_COUNT];
+
+/**
+  * @brief Start the DWT cycle counter
+  * @retval None
+  */
+void Timing_Init(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+  * @brief Serialize the statistics
+  * @param reply: TIMING_REPLY_SIZE bytes, [cmd, flags, count, 0, count x
+  *               (samples u16, min u32, avg u32, max u32)] BE; byte 3 is
+  *               left for the caller
+  * @param cmd: Command byte to echo
+  * @param flags: TIMING_FLAG_*
+  * @param reset: Non-zero to restart the statistics after the snapshot
+  * @retval None
+  */
+void Timing_Snapshot(uint8_t* reply, uint8_t cmd, uint8_t flags, uint8_t reset)
+{
+  TimingStat_t copy[TIMING_COUNT];
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  memcpy(copy, timing, sizeof(copy));
+  if (reset) {
+    memset(timing, 0, sizeof(timing));
+  }
+  __set_PRIMASK(primask);
+
+  reply[0] = cmd;
+  reply[1] = flags;
+  reply[2] = TIMING_COUNT;
+  reply[3] = 0;
+  for (uint8_t i = 0; i < TIMING_COUNT; i++) {
+    uint32_t avg = copy[i].count ? (uint32_t)(copy[i].total / copy[i].count) : 0;
+    uint32_t words[3] = { copy[i].min, avg, copy[i].max };
+    uint16_t samples = (copy[i].count > 0xFFFF) ? 0xFFFF : copy[i].count;
+    uint8_t* p = &reply[TIMING_REPLY_HEADER + TIMING_ENTRY_SIZE * i];
+
+    p[0] = (samples >> 8) & 0xFF;
+    p[1] = samples & 0xFF;
+    for (uint8_t w = 0; w < 3; w++) {
+      p[2 + 4 * w] = (words[w] >> 24) & 0xFF;
+      p[3 + 4 * w] = (words[w] >> 16) & 0xFF;
+      p[4 + 4 * w] = (words[w] >> 8) & 0xFF;
+      p[5 + 4 * w] = words[w] & 0xFF;
+    }
+  }
+}
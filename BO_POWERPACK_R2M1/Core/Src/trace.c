@@ -0,0 +1,79 @@
+/**
+  ******************************************************************************
+  * @file           : trace.c
+  * @brief          : Always-on binary event trace ring buffer
+  ******************************************************************************
+  * @attention
+  *
+  * Each event is a 12-byte record (microsecond timestamp derived from the
+  * HAL tick and SysTick, event ID, 32-bit argument) written with IRQs masked
+  * for a few cycles. The newest TRACE_ENTRIES events are kept. CMD_DUMP_TRACE freezes
+  * the buffer while it is sent so the dump's own USB traffic cannot
+  * overwrite it; events in that window are only counted.
+  *
+  * Timestamps wrap after 2^32 us (71.6 min). The host unwraps them in
+  * order, so gaps longer than that between two events are not recoverable.
+  *
+  ******************************************************************************
+  */
+
+#include "trace.h"
+
+TraceEntry_t trace_buffer[TRACE_ENTRIES];
+volatile uint32_t trace_head = 0;
+volatile uint32_t trace_dropped = 0;
+volatile uint8_t trace_frozen = 0;
+
+void Trace_Freeze(uint8_t frozen)
+{
+  trace_frozen = frozen;
+}
+
+void Trace_Clear(void)
+{
+  __disable_irq();
+  trace_head = 0;
+  trace_dropped = 0;
+  __enable_irq();
+}
+
+/**
+  * @brief Number of events currently held
+  * @retval 0..TRACE_ENTRIES
+  */
+uint16_t Trace_GetCount(void)
+{
+  return (trace_head < TRACE_ENTRIES) ? trace_head : TRACE_ENTRIES;
+}
+
+/**
+  * @brief Serialize one held event, oldest first (buffer must be frozen)
+  * @param index: 0..Trace_GetCount()-1
+  * @param dest: TRACE_WIRE_ENTRY_SIZE bytes, [ts_us BE, id, arg BE]
+  * @retval None
+  */
+void Trace_Serialize(uint16_t index, uint8_t* dest)
+{
+  const TraceEntry_t* e = &trace_buffer[(trace_head - Trace_GetCount() + index) & (TRACE_ENTRIES - 1)];
+
+  dest[0] = (e->ts_us >> 24) & 0xFF;
+  dest[1] = (e->ts_us >> 16) & 0xFF;
+  dest[2] = (e->ts_us >> 8) & 0xFF;
+  dest[3] = e->ts_us & 0xFF;
+  dest[4] = e->id;
+  dest[5] = (e->arg >> 24) & 0xFF;
+  dest[6] = (e->arg >> 16) & 0xFF;
+  dest[7] = (e->arg >> 8) & 0xFF;
+  dest[8] = e->arg & 0xFF;
+}
+
+uint32_t Trace_Now(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  uint32_t now;
+
+  __disable_irq();
+  now = Trace_Timestamp();
+  __set_PRIMASK(primask);
+  return now;
+}
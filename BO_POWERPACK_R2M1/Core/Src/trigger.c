@@ -0,0 +1,393 @@
+/**
+  ******************************************************************************
+  * @file           : trigger.c
+  * @brief          : External trigger input with a pre-armed output action
+  ******************************************************************************
+  * @attention
+  *
+  * A show controller output on PA3 fires an action that the host armed
+  * ahead of time, so the outputs follow the edge instead of a USB round
+  * trip. Arming does all the work that can be done early: the masks are
+  * checked and the relay and enable changes are turned into one BSRR word
+  * per GPIO port. The EXTI 3 interrupt runs at the highest priority
+  * (IRQ_PRIO_TRIGGER) and only stores those words, so the pins switch a
+  * fixed number of cycles after the edge; the cycles from entry to the
+  * stores are measured with the DWT and read back with the counters.
+  *
+  * Dimmer levels in a state action go out from the same interrupt through
+  * the I2C DMA path, one frame per DAC after the pins. A waveform action
+  * starts TIM3 there, so the first sample follows one sample period after
+  * the edge. When the bus is busy (a DMA frame, or a blocking write from the
+  * main loop that it interrupted), or a waveform or stream owns the DACs,
+  * that part is handed to the main loop (Task_Trigger in main.c) and the
+  * fire is counted as late. The relay switch counters are updated there
+  * too. Enables and relays switch on the edge even when the dimmer codes
+  * come later, so arm a level change with its enable already on.
+  *
+  * The interrupt records the relays and enables it drove in
+  * powerpack_state together with the pin stores. The main loop changes
+  * the same fields, so it holds the interrupt off (Trigger_Hold()) around
+  * each of its pin writes and the state update that goes with them; a
+  * fire in that window waits a few microseconds, never for an I2C write.
+  *
+  * The holdoff ignores edges for a time after each fire (1 ms
+  * resolution); the debounce re-reads the pin after a few microseconds and
+  * drops the edge if the level did not hold. Both are off by default. A
+  * one-shot trigger masks its line when it fires. While armed the MCU only
+  * sleeps, never enters STOP, so the clock is running when the edge comes.
+  *
+  ******************************************************************************
+  */
+
+#include "trigger.h"
+#include "gp8413_dma.h"
+#include "relay_timer.h"
+#include "sched.h"
+#include "stream.h"
+#include "trace.h"
+#include "waveform.h"
+
+typedef struct {
+  volatile uint8_t action;    // TRIGGER_ACTION_*
+  uint8_t  flags;             // TRIGGER_FLAG_*
+  uint16_t holdoff_ms;
+  uint16_t debounce_us;
+  uint32_t debounce_cycles;
+  uint8_t  port_count;
+  PortWrite_t ports[CHANNEL_MAX_PORTS];
+  OutputUpdate_t update;      // TRIGGER_ACTION_STATE
+  uint8_t  wave_mode;         // TRIGGER_ACTION_WAVE
+  uint16_t wave_rate;
+  uint8_t  has_fired;
+  uint32_t last_fire_ms;
+  uint8_t  follow_pending;
+  TriggerFollowUp_t follow;
+  TriggerStats_t stats;
+} Trigger_t;
+
+static Trigger_t trigger = { .follow.wave_mode = WAVE_MODE_STOP };
+
+/**
+  * @brief Mask the line and forget edges that came before
+  * @retval None
+  */
+static void Trigger_Mask(void)
+{
+  EXTI->IMR &= ~TRIGGER_EXTI_LINE;
+  EXTI->PR = TRIGGER_EXTI_LINE;
+  HAL_NVIC_ClearPendingIRQ(EXTI3_IRQn);
+}
+
+/**
+  * @brief Set up PA3 as the trigger input, disarmed, rising edge
+  * @retval None
+  * @note  Call after Timing_Init() (the debounce uses the DWT).
+  */
+void Trigger_Init(void)
+{
+  __HAL_RCC_AFIO_CLK_ENABLE();
+  AFIO->EXTICR[0] &= ~AFIO_EXTICR1_EXTI3;           // EXTI 3 from port A
+
+  Trigger_Mask();
+  Trigger_Configure(0, 0, 0);
+
+  HAL_NVIC_SetPriority(EXTI3_IRQn, IRQ_PRIO_TRIGGER, 0);
+  HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+}
+
+/**
+  * @brief Select the edge, one-shot or re-arm, holdoff and debounce
+  * @param flags: TRIGGER_FLAG_*
+  * @param holdoff_ms: Edges ignored after a fire, 0 = none
+  * @param debounce_us: Time the level must hold, 0 to TRIGGER_DEBOUNCE_MAX_US
+  * @retval TRIGGER_OK or TRIGGER_ERR_RANGE
+  * @note  The armed action stays armed; edges seen during the change are dropped.
+  */
+uint8_t Trigger_Configure(uint8_t flags, uint16_t holdoff_ms, uint16_t debounce_us)
+{
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+  if ((flags & ~(TRIGGER_FLAG_FALLING | TRIGGER_FLAG_REARM)) || debounce_us > TRIGGER_DEBOUNCE_MAX_US) {
+    return TRIGGER_ERR_RANGE;
+  }
+
+  Trigger_Mask();
+
+  // The pull holds the input at its idle level while nothing is connected
+  GPIO_InitStruct.Pin = TRIGGER_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Pull = (flags & TRIGGER_FLAG_FALLING) ? GPIO_PULLUP : GPIO_PULLDOWN;
+  HAL_GPIO_Init(TRIGGER_GPIO_Port, &GPIO_InitStruct);
+
+  if (flags & TRIGGER_FLAG_FALLING) {
+    EXTI->RTSR &= ~TRIGGER_EXTI_LINE;
+    EXTI->FTSR |= TRIGGER_EXTI_LINE;
+  } else {
+    EXTI->FTSR &= ~TRIGGER_EXTI_LINE;
+    EXTI->RTSR |= TRIGGER_EXTI_LINE;
+  }
+
+  trigger.flags = flags;
+  trigger.holdoff_ms = holdoff_ms;
+  trigger.debounce_us = debounce_us;
+  trigger.debounce_cycles = debounce_us * (SystemCoreClock / 1000000);
+
+  if (trigger.action != TRIGGER_ACTION_NONE) {
+    EXTI->PR = TRIGGER_EXTI_LINE;       // the pull change can look like an edge
+    EXTI->IMR |= TRIGGER_EXTI_LINE;
+  }
+  return TRIGGER_OK;
+}
+
+/**
+  * @brief Arm a state: relays, dimmer enables and levels, as in Apply_Outputs()
+  * @param update: Channels to apply and their target state
+  * @retval TRIGGER_OK or TRIGGER_ERR_*
+  */
+uint8_t Trigger_ArmState(const OutputUpdate_t* update)
+{
+  if ((update->relay_mask | update->enable_mask | update->dimmer_mask) == 0 ||
+      (update->relay_mask & ~RELAY_ALL) || (update->enable_mask & ~DIMMER_ALL) ||
+      (update->dimmer_mask & ~DIMMER_ALL)) {
+    return TRIGGER_ERR_RANGE;
+  }
+  if (update->dimmer_mask & ~Channels_DimmersPresent()) return TRIGGER_ERR_NO_DEVICE;
+  if (update->relay_mask & Channels_LatchingRelays()) return TRIGGER_ERR_LATCHED;
+
+  Trigger_Mask();
+  trigger.action = TRIGGER_ACTION_NONE;
+  trigger.update = *update;
+  trigger.port_count = Channels_PlanPins(trigger.ports,
+                                         update->relay_mask & update->relay_on,
+                                         update->relay_mask & ~update->relay_on,
+                                         update->enable_mask & update->enable_on,
+                                         update->enable_mask & ~update->enable_on);
+  trigger.action = TRIGGER_ACTION_STATE;
+  EXTI->IMR |= TRIGGER_EXTI_LINE;
+  return TRIGGER_OK;
+}
+
+/**
+  * @brief Arm the start of the committed waveform
+  * @param mode: WAVE_MODE_ONESHOT or WAVE_MODE_LOOP
+  * @param sample_rate: Frames per second
+  * @retval TRIGGER_OK or TRIGGER_ERR_*
+  * @note  Uploading a new table before the edge turns the fire into a late one.
+  */
+uint8_t Trigger_ArmWave(uint8_t mode, uint16_t sample_rate)
+{
+  switch (Wave_CheckPlay(mode, sample_rate)) {
+    case WAVE_OK:
+      break;
+    case WAVE_ERR_RANGE:
+      return TRIGGER_ERR_RANGE;
+    default:
+      return TRIGGER_ERR_STATE;
+  }
+
+  Trigger_Mask();
+  trigger.action = TRIGGER_ACTION_NONE;
+  trigger.wave_mode = mode;
+  trigger.wave_rate = sample_rate;
+  trigger.action = TRIGGER_ACTION_WAVE;
+  EXTI->IMR |= TRIGGER_EXTI_LINE;
+  return TRIGGER_OK;
+}
+
+/**
+  * @brief Hold the trigger interrupt off while the main loop switches outputs
+  * @retval None
+  * @note  Keep the window to pin stores and powerpack_state updates;
+  *        an edge in it is taken at Trigger_Release().
+  */
+void Trigger_Hold(void)
+{
+  HAL_NVIC_DisableIRQ(EXTI3_IRQn);
+}
+
+void Trigger_Release(void)
+{
+  HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+}
+
+void Trigger_Disarm(void)
+{
+  Trigger_Mask();
+  trigger.action = TRIGGER_ACTION_NONE;
+}
+
+uint8_t Trigger_IsArmed(void)
+{
+  return trigger.action != TRIGGER_ACTION_NONE;
+}
+
+/**
+  * @brief Take the work the last fires left for the main loop
+  * @param follow: Receives relays to count, dimmers to write, waveform to start
+  * @retval 1 if a fire happened since the previous call
+  */
+uint8_t Trigger_TakeFollowUp(TriggerFollowUp_t* follow)
+{
+  uint8_t pending;
+
+  HAL_NVIC_DisableIRQ(EXTI3_IRQn);
+  pending = trigger.follow_pending;
+  *follow = trigger.follow;
+  trigger.follow_pending = 0;
+  trigger.follow = (TriggerFollowUp_t){ .wave_mode = WAVE_MODE_STOP };
+  HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+  return pending;
+}
+
+/**
+  * @brief Serialize the armed action, the settings and the counters for CMD_TRIGGER
+  * @param cmd: Command byte echoed in byte 0
+  * @param status: TRIGGER_OK or TRIGGER_ERR_*
+  * @param reset: Non-zero clears the counters after the copy
+  * @param reply: TRIGGER_REPLY_SIZE bytes
+  * @retval Reply length
+  *
+  * [cmd, status, action, flags, holdoff_ms u16, debounce_us u16, fired u32,
+  *  holdoff u32, debounce u32, late u32, latency_last u32, latency_max u32],
+  * big-endian. Latencies are CPU cycles at SystemCoreClock.
+  */
+uint8_t Trigger_Serialize(uint8_t cmd, uint8_t status, uint8_t reset, uint8_t* reply)
+{
+  TriggerStats_t s;
+  uint32_t words[6];
+
+  HAL_NVIC_DisableIRQ(EXTI3_IRQn);
+  s = trigger.stats;
+  if (reset) trigger.stats = (TriggerStats_t){0};
+  HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+
+  words[0] = s.fired;
+  words[1] = s.holdoff;
+  words[2] = s.debounce;
+  words[3] = s.late;
+  words[4] = s.latency_last;
+  words[5] = s.latency_max;
+
+  reply[0] = cmd;
+  reply[1] = status;
+  reply[2] = trigger.action;
+  reply[3] = trigger.flags;
+  reply[4] = (trigger.holdoff_ms >> 8) & 0xFF;
+  reply[5] = trigger.holdoff_ms & 0xFF;
+  reply[6] = (trigger.debounce_us >> 8) & 0xFF;
+  reply[7] = trigger.debounce_us & 0xFF;
+  for (uint8_t i = 0; i < 6; i++) {
+    reply[8 + 4 * i] = (words[i] >> 24) & 0xFF;
+    reply[9 + 4 * i] = (words[i] >> 16) & 0xFF;
+    reply[10 + 4 * i] = (words[i] >> 8) & 0xFF;
+    reply[11 + 4 * i] = words[i] & 0xFF;
+  }
+  return TRIGGER_REPLY_SIZE;
+}
+
+/**
+  * @brief Apply the armed state (trigger interrupt)
+  * @param entry: DWT cycle count at interrupt entry
+  * @retval None
+  */
+static void Trigger_FireState(uint32_t entry)
+{
+  const OutputUpdate_t* u = &trigger.update;
+  uint32_t latency;
+  uint16_t relays;
+
+  RelayTimer_Abort(u->relay_mask);
+  for (uint8_t p = 0; p < trigger.port_count; p++) {
+    trigger.ports[p].port->BSRR = trigger.ports[p].set | (uint32_t)trigger.ports[p].reset << 16;
+  }
+  latency = DWT->CYCCNT - entry;
+
+  relays = u->relay_mask & (u->relay_on ^ powerpack_state.relays);
+  powerpack_state.relays ^= relays;
+  powerpack_state.dimmers_enabled = (powerpack_state.dimmers_enabled & ~u->enable_mask) |
+                                    (u->enable_on & u->enable_mask);
+  trigger.follow.relays |= relays;
+
+  if (u->dimmer_mask) {
+    if ((u->dimmer_mask & ~(GP8413_DMA_CH1 | GP8413_DMA_CH2)) || Wave_IsPlaying() ||
+        Stream_IsActive() ||
+        GP8413_WriteLevelsDMA(u->dimmer_mask, u->level[0], u->level[1]) != HAL_OK) {
+      trigger.follow.dimmer_mask = u->dimmer_mask;
+      for (uint8_t i = 0; i < DIMMER_COUNT; i++) trigger.follow.level[i] = u->level[i];
+      trigger.stats.late++;
+    }
+  }
+
+  trigger.stats.latency_last = latency;
+  if (latency > trigger.stats.latency_max) trigger.stats.latency_max = latency;
+}
+
+/**
+  * @brief Start the armed waveform (trigger interrupt)
+  * @param entry: DWT cycle count at interrupt entry
+  * @retval None
+  */
+static void Trigger_FireWave(uint32_t entry)
+{
+  uint32_t latency;
+
+  if (Wave_IsPlaying() || Stream_IsActive() ||
+      Wave_CheckPlay(trigger.wave_mode, trigger.wave_rate) != WAVE_OK) {
+    trigger.follow.wave_mode = trigger.wave_mode;
+    trigger.follow.wave_rate = trigger.wave_rate;
+    trigger.stats.late++;
+    return;
+  }
+
+  Wave_Start(trigger.wave_mode, trigger.wave_rate);
+  latency = DWT->CYCCNT - entry;
+  trigger.stats.latency_last = latency;
+  if (latency > trigger.stats.latency_max) trigger.stats.latency_max = latency;
+}
+
+/**
+  * @brief EXTI line 3: the trigger edge
+  * @retval None
+  */
+void EXTI3_IRQHandler(void)
+{
+  uint32_t entry = DWT->CYCCNT;
+  uint8_t action = trigger.action;
+
+  EXTI->PR = TRIGGER_EXTI_LINE;
+  if (action == TRIGGER_ACTION_NONE) return;
+
+  if (trigger.has_fired && trigger.holdoff_ms &&
+      HAL_GetTick() - trigger.last_fire_ms < trigger.holdoff_ms) {
+    trigger.stats.holdoff++;
+    return;
+  }
+  if (trigger.debounce_cycles) {
+    uint8_t level;
+
+    while (DWT->CYCCNT - entry < trigger.debounce_cycles) {
+    }
+    level = (TRIGGER_GPIO_Port->IDR & TRIGGER_Pin) != 0;
+    if (level != !(trigger.flags & TRIGGER_FLAG_FALLING)) {
+      trigger.stats.debounce++;
+      return;
+    }
+  }
+
+  if (action == TRIGGER_ACTION_STATE) {
+    Trigger_FireState(entry);
+  } else {
+    Trigger_FireWave(entry);
+  }
+
+  if (!(trigger.flags & TRIGGER_FLAG_REARM)) {
+    EXTI->IMR &= ~TRIGGER_EXTI_LINE;
+    trigger.action = TRIGGER_ACTION_NONE;
+  }
+  trigger.has_fired = 1;
+  trigger.last_fire_ms = HAL_GetTick();
+  trigger.stats.fired++;
+  trigger.follow_pending = 1;
+  Trace_Event(TRACE_TRIGGER, action | (trigger.stats.latency_last << 8));
+  Sched_Signal(TASK_TRIGGER);
+}
@@ -0,0 +1,163 @@
+/**
+  ******************************************************************************
+  * @file           : watchdog.c
+  * @brief          : IWDG supervision with per-task liveness check-ins
+  ******************************************************************************
+  * @attention
+  *
+  * The IWDG is fed from the main loop, but only once every required task
+  * has checked in since the previous feed: the main loop itself, the USB
+  * SOF interrupt while the device is configured, and the I2C engine, which
+  * counts as alive when it is idle or completes a transfer. A wedged main
+  * loop (e.g. in a blocking I2C call), a dead USB interrupt or a DMA
+  * transfer that never finishes all let the watchdog expire.
+  *
+  * The output state and the check-in masks live in .noinit. After an IWDG
+  * reset PowerPack_Init() puts the outputs back from the retained copy,
+  * and the tasks that had not checked in are reported over USB. Any other
+  * reset (power-on, pin, fault handler) starts with the outputs off.
+  *
+  ******************************************************************************
+  */
+
+#include "watchdog.h"
+#include "crash.h"
+#include "crc16.h"
+#include "gp8413_dma.h"
+#include "usb_device.h"
+#include <stddef.h>
+#include <string.h>
+
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+#define WDG_MAGIC               0x57444F47UL   // "WDOG"
+#define WDG_LSI_HZ              40000
+#define WDG_PRESCALER_DIV       64
+#define WDG_KEY_RELOAD          0xAAAA
+#define WDG_KEY_ENABLE          0xCCCC
+#define WDG_KEY_ACCESS          0x5555
+
+typedef struct {
+  uint32_t magic;
+  uint16_t crc;               // CRC-16 of everything after this field
+  uint16_t resets;            // IWDG resets since power-on
+  PowerPackState_t state;
+} WatchdogRetained_t;
+
+__attribute__((section(".noinit"))) static WatchdogRetained_t wdg_retained;
+__attribute__((section(".noinit"))) volatile uint8_t watchdog_alive;
+__attribute__((section(".noinit"))) static volatile uint8_t wdg_required;
+
+static uint8_t wdg_running;
+static uint8_t wdg_restore;
+static uint8_t wdg_last_missing;
+
+static uint16_t Watchdog_RetainedCrc(void)
+{
+  const uint8_t* body = (const uint8_t*)&wdg_retained.resets;
+
+  return CRC16_Update(CRC16_INIT, body, sizeof(wdg_retained) - offsetof(WatchdogRetained_t, resets));
+}
+
+/**
+  * @brief Evaluate the retained block after a reset
+  * @retval None
+  * @note  Call after Crash_Init(), which latches the reset flags
+  */
+void Watchdog_Init(void)
+{
+  uint8_t valid = (wdg_retained.magic == WDG_MAGIC && wdg_retained.crc == Watchdog_RetainedCrc());
+
+  if (!valid) {
+    memset(&wdg_retained, 0, sizeof(wdg_retained));
+    wdg_retained.magic = WDG_MAGIC;
+  }
+
+  if (valid && (Crash_GetResetFlags() & RESET_FLAG_IWDG)) {
+    wdg_last_missing = wdg_required & ~watchdog_alive;
+    wdg_retained.resets++;
+    wdg_restore = 1;
+  }
+
+  watchdog_alive = 0;
+  wdg_required = 0;
+  wdg_retained.crc = Watchdog_RetainedCrc();
+}
+
+/**
+  * @brief Start the IWDG; it cannot be stopped again until the next reset
+  * @retval None
+  */
+void Watchdog_Start(void)
+{
+  // Keep the counter still while a debugger holds the core
+  DBGMCU->CR |= DBGMCU_CR_DBG_IWDG_STOP;
+
+  IWDG->KR = WDG_KEY_ENABLE;
+  IWDG->KR = WDG_KEY_ACCESS;
+  IWDG->PR = IWDG_PR_PR_2;                      // LSI / 64
+  IWDG->RLR = (uint32_t)WDG_TIMEOUT_MS * (WDG_LSI_HZ / WDG_PRESCALER_DIV) / 1000 - 1;
+  while (IWDG->SR != 0) {
+  }
+  IWDG->KR = WDG_KEY_RELOAD;
+
+  watchdog_alive = 0;
+  wdg_running = 1;
+}
+
+/**
+  * @brief Main loop hook: keep the retained state current and feed the IWDG
+  * @retval None
+  */
+void Watchdog_Service(void)
+{
+  uint8_t required = WDG_TASK_MAIN | WDG_TASK_I2C;
+
+  if (hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED) {
+    required |= WDG_TASK_USB;
+  }
+  wdg_required = required;
+
+  if (!GP8413_DMA_IsBusy()) {
+    Watchdog_CheckIn(WDG_TASK_I2C);
+  }
+
+  if (memcmp(&wdg_retained.state, &powerpack_state, sizeof(powerpack_state)) != 0) {
+    wdg_retained.state = powerpack_state;
+    wdg_retained.crc = Watchdog_RetainedCrc();
+  }
+
+  if (wdg_running && (watchdog_alive & required) == required) {
+    IWDG->KR = WDG_KEY_RELOAD;
+    __disable_irq();
+    watchdog_alive = 0;
+    __enable_irq();
+  }
+}
+
+/**
+  * @brief Output state to restore after a watchdog reset
+  * @param state: Receives the retained state
+  * @retval 1 if the last reset was the IWDG and the retained copy is valid
+  */
+uint8_t Watchdog_GetRetainedState(PowerPackState_t* state)
+{
+  if (!wdg_restore) return 0;
+
+  *state = wdg_retained.state;
+  return 1;
+}
+
+/**
+  * @brief Tasks that had not checked in when the IWDG expired
+  * @retval WDG_TASK_* mask, 0 if the last reset was not a watchdog reset
+  */
+uint8_t Watchdog_GetLastMissing(void)
+{
+  return wdg_last_missing;
+}
+
+uint16_t Watchdog_GetResetCount(void)
+{
+  return wdg_retained.resets;
+}
@@ -0,0 +1,314 @@
+/**
+  ******************************************************************************
+  * @file           : waveform.c
+  * @brief          : DAC waveform table upload and TIM3-paced playback
+  ******************************************************************************
+  * @attention
+  *
+  * A sample table is uploaded over USB in CRC-checked chunks, then played
+  * back on one or both GP8413 channels. TIM3 is stopped while no table
+  * plays; Wave_Start() runs it at the sample rate and the end of playback
+  * stops it again, so it only interrupts per sample; each tick hands the
+  * sample to GP8413_WriteLevelsDMA(), which puts it on the I2C1 TX DMA
+  * channel. Samples are levels (0xFFFF = full scale), rounded to the
+  * 15-bit DAC code on the way out.
+  *
+  * Maximum sustainable sample rate (bus-bound, 38 SCL periods per 3-byte
+  * frame incl. START/address/STOP, using 80% of the bus and keeping 20% as
+  * margin for DMA/IRQ setup):
+  *   I2C 100 kHz: 2105 S/s single channel, 1052 S/s both channels
+  *   I2C 400 kHz: 8421 S/s single channel, 4210 S/s both channels
+  * Ticks that arrive while the previous frame is still on the bus are
+  * skipped and counted as late.
+  *
+  ******************************************************************************
+  */
+
+#include "waveform.h"
+#include "channels.h"
+#include "crc16.h"
+#include "gp8413_dma.h"
+#include "metrics.h"
+
+extern I2C_HandleTypeDef hi2c1;
+extern TIM_HandleTypeDef htim3;
+
+#define WAVE_I2C_BITS_PER_FRAME     38
+#define WAVE_TIMER_TICK_HZ          1000000UL
+#define WAVE_MIN_SAMPLE_RATE        16    // ARR must fit in 16 bits at 1 MHz
+#define WAVE_STOP_TIMEOUT_MS        2
+
+typedef struct {
+  uint8_t  channel_mask;
+  uint8_t  channels;          // 1 or 2 samples per frame
+  uint16_t sample_count;
+  uint16_t next_offset;       // first sample not yet received
+  uint8_t  committed;
+  volatile uint8_t  mode;     // WAVE_MODE_*
+  uint16_t frame_index;
+  volatile uint32_t late_ticks;
+} WaveState_t;
+
+static uint16_t wave_table[WAVE_MAX_SAMPLES];
+static WaveState_t wave = { .channels = 1 };
+
+/**
+  * @brief Frequency of the clock feeding TIM3
+  * @retval Timer kernel clock in Hz
+  */
+static uint32_t Wave_TimerClock(void)
+{
+  uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+
+  // APB1 timers run at 2x PCLK1 whenever the APB1 prescaler is not 1
+  if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_HCLK_DIV1) {
+    pclk1 *= 2;
+  }
+  return pclk1;
+}
+
+/**
+  * @brief Reload TIM3 with a new time base without losing the IRQ setup
+  * @param prescaler: PSC value
+  * @param period: ARR value
+  * @retval None
+  */
+static void Wave_ConfigureTimer(uint32_t prescaler, uint32_t period)
+{
+  __HAL_TIM_DISABLE(&htim3);
+  __HAL_TIM_SET_PRESCALER(&htim3, prescaler);
+  __HAL_TIM_SET_AUTORELOAD(&htim3, period);
+  __HAL_TIM_SET_COUNTER(&htim3, 0);
+  htim3.Instance->EGR = TIM_EGR_UG;             // latch the new prescaler
+  __HAL_TIM_CLEAR_FLAG(&htim3, TIM_FLAG_UPDATE);
+  __HAL_TIM_ENABLE(&htim3);
+}
+
+/**
+  * @brief End playback and stop TIM3 (ISR safe)
+  * @retval None
+  */
+static void Wave_Finish(void)
+{
+  // Timer first: Wave_Start() from a trigger only takes TIM3 once the mode reads STOP
+  __HAL_TIM_DISABLE(&htim3);
+  __HAL_TIM_CLEAR_FLAG(&htim3, TIM_FLAG_UPDATE);
+  wave.mode = WAVE_MODE_STOP;
+}
+
+/**
+  * @brief Start a new table upload
+  * @param channel_mask: WAVE_CHANNEL_1, WAVE_CHANNEL_2 or both
+  * @param sample_count: Total samples (interleaved when both channels)
+  * @retval WAVE_OK or WAVE_ERR_*
+  */
+uint8_t Wave_BeginUpload(uint8_t channel_mask, uint16_t sample_count)
+{
+  uint8_t channels;
+
+  if (wave.mode != WAVE_MODE_STOP) return WAVE_ERR_STATE;
+
+  if (channel_mask == WAVE_CHANNEL_1 || channel_mask == WAVE_CHANNEL_2) {
+    channels = 1;
+  } else if (channel_mask == (WAVE_CHANNEL_1 | WAVE_CHANNEL_2)) {
+    channels = 2;
+  } else {
+    return WAVE_ERR_RANGE;
+  }
+  if (channel_mask & ~Channels_DimmersPresent()) return WAVE_ERR_RANGE;
+
+  if (sample_count == 0 || sample_count > WAVE_MAX_SAMPLES || (sample_count % channels) != 0) {
+    return WAVE_ERR_RANGE;
+  }
+
+  wave.channel_mask = channel_mask;
+  wave.channels = channels;
+  wave.sample_count = sample_count;
+  wave.next_offset = 0;
+  wave.committed = 0;
+  return WAVE_OK;
+}
+
+/**
+  * @brief Store one upload chunk
+  * @param frame: [cmd, n, offset_hi, offset_lo, n x (level_hi, level_lo), crc_hi, crc_lo]
+  * @param length: Received frame length
+  * @retval WAVE_OK or WAVE_ERR_*
+  * @note  Chunks must arrive in order; resending the previous chunk is accepted
+  *        so the host can retry after a lost acknowledgement. Any stored chunk
+  *        drops the commit, so the table must pass Wave_Commit() again.
+  */
+uint8_t Wave_WriteChunk(const uint8_t* frame, uint16_t length)
+{
+  uint8_t n = frame[1];
+  uint16_t offset = (frame[2] << 8) | frame[3];
+  uint16_t crc_pos = 4 + 2 * n;
+
+  if (wave.mode != WAVE_MODE_STOP || wave.sample_count == 0) return WAVE_ERR_STATE;
+  if (n == 0 || n > WAVE_CHUNK_MAX_SAMPLES || length < crc_pos + 2) return WAVE_ERR_RANGE;
+  if (offset > wave.next_offset || offset + n > wave.sample_count) return WAVE_ERR_RANGE;
+
+  if (CRC16_Update(CRC16_INIT, frame, crc_pos) != ((frame[crc_pos] << 8) | frame[crc_pos + 1])) {
+    Metrics_Inc(METRIC_CRC_ERRORS);
+    return WAVE_ERR_CRC;
+  }
+
+  for (uint8_t i = 0; i < n; i++) {
+    wave_table[offset + i] = (frame[4 + 2 * i] << 8) | frame[5 + 2 * i];
+  }
+  wave.committed = 0;
+
+  if (offset + n > wave.next_offset) {
+    wave.next_offset = offset + n;
+  }
+  return WAVE_OK;
+}
+
+/**
+  * @brief Verify the complete table against the host CRC
+  * @param table_crc: CRC-16 of all samples, big-endian byte order
+  * @retval WAVE_OK or WAVE_ERR_*
+  */
+uint8_t Wave_Commit(uint16_t table_crc)
+{
+  uint16_t crc = CRC16_INIT;
+
+  if (wave.sample_count == 0 || wave.next_offset != wave.sample_count) return WAVE_ERR_STATE;
+
+  for (uint16_t i = 0; i < wave.sample_count; i++) {
+    uint8_t be[2] = { wave_table[i] >> 8, wave_table[i] & 0xFF };
+    crc = CRC16_Update(crc, be, 2);
+  }
+
+  if (crc != table_crc) {
+    Metrics_Inc(METRIC_CRC_ERRORS);
+    wave.committed = 0;
+    return WAVE_ERR_CRC;
+  }
+
+  wave.committed = 1;
+  return WAVE_OK;
+}
+
+/**
+  * @brief Start or stop playback
+  * @param mode: WAVE_MODE_STOP, WAVE_MODE_ONESHOT or WAVE_MODE_LOOP
+  * @param sample_rate: Frames per second
+  * @retval WAVE_OK or WAVE_ERR_*
+  */
+uint8_t Wave_Play(uint8_t mode, uint16_t sample_rate)
+{
+  uint8_t status;
+
+  if (mode == WAVE_MODE_STOP) {
+    Wave_Stop();
+    return WAVE_OK;
+  }
+
+  status = Wave_CheckPlay(mode, sample_rate);
+  if (status != WAVE_OK) return status;
+
+  Wave_Stop();
+  Wave_Start(mode, sample_rate);
+  return WAVE_OK;
+}
+
+/**
+  * @brief Check that the committed table can play in a mode and at a rate
+  * @param mode: WAVE_MODE_ONESHOT or WAVE_MODE_LOOP
+  * @param sample_rate: Frames per second
+  * @retval WAVE_OK or WAVE_ERR_*
+  */
+uint8_t Wave_CheckPlay(uint8_t mode, uint16_t sample_rate)
+{
+  if (mode != WAVE_MODE_ONESHOT && mode != WAVE_MODE_LOOP) return WAVE_ERR_RANGE;
+  if (!wave.committed) return WAVE_ERR_STATE;
+  if (sample_rate < WAVE_MIN_SAMPLE_RATE || sample_rate > Wave_GetMaxSampleRate()) {
+    return WAVE_ERR_RATE;
+  }
+  return WAVE_OK;
+}
+
+/**
+  * @brief Start playback from the first frame (ISR safe)
+  * @param mode: WAVE_MODE_ONESHOT or WAVE_MODE_LOOP, checked by Wave_CheckPlay()
+  * @param sample_rate: Frames per second, checked by Wave_CheckPlay()
+  * @retval None
+  * @note  Nothing may be playing: this does not wait for the bus.
+  */
+void Wave_Start(uint8_t mode, uint16_t sample_rate)
+{
+  wave.frame_index = 0;
+  wave.late_ticks = 0;
+
+  Wave_ConfigureTimer(Wave_TimerClock() / WAVE_TIMER_TICK_HZ - 1,
+                      WAVE_TIMER_TICK_HZ / sample_rate - 1);
+  wave.mode = mode;
+}
+
+/**
+  * @brief Stop playback and wait for the last frame to leave the bus
+  * @retval None
+  */
+void Wave_Stop(void)
+{
+  if (wave.mode == WAVE_MODE_STOP) return;
+
+  __HAL_TIM_DISABLE_IT(&htim3, TIM_IT_UPDATE);
+  Wave_Finish();
+  __HAL_TIM_ENABLE_IT(&htim3, TIM_IT_UPDATE);
+
+  GP8413_DMA_WaitIdle(WAVE_STOP_TIMEOUT_MS);
+}
+
+uint8_t Wave_IsPlaying(void)
+{
+  return wave.mode != WAVE_MODE_STOP;
+}
+
+uint16_t Wave_GetNextOffset(void)
+{
+  return wave.next_offset;
+}
+
+uint32_t Wave_GetLateCount(void)
+{
+  return wave.late_ticks;
+}
+
+/**
+  * @brief Highest sample rate the I2C bus can sustain for the loaded table
+  * @retval Frames per second
+  */
+uint16_t Wave_GetMaxSampleRate(void)
+{
+  return (uint16_t)((hi2c1.Init.ClockSpeed * 4) / (5 * WAVE_I2C_BITS_PER_FRAME * wave.channels));
+}
+
+/**
+  * @brief TIM3 update handler while playback owns the timer
+  * @retval None
+  */
+void Wave_TimerTick(void)
+{
+  const uint16_t* frame;
+  uint16_t frame_count;
+
+  if (wave.mode == WAVE_MODE_STOP) return;
+
+  frame = &wave_table[wave.frame_index * wave.channels];
+  if (GP8413_WriteLevelsDMA(wave.channel_mask, frame[0],
+                            (wave.channels == 2) ? frame[1] : frame[0]) != HAL_OK) {
+    wave.late_ticks++;
+    return;
+  }
+
+  frame_count = wave.sample_count / wave.channels;
+  if (++wave.frame_index >= frame_count) {
+    if (wave.mode == WAVE_MODE_LOOP) {
+      wave.frame_index = 0;
+    } else {
+      Wave_Finish();
+    }
+  }
+}
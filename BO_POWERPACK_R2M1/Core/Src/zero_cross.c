@@ -0,0 +1,152 @@
+/**
+  ******************************************************************************
+  * @file           : zero_cross.c
+  * @brief          : Mains zero-cross sync input for aligned relay switching
+  ******************************************************************************
+  * @attention
+  *
+  * A zero-cross detector (optocoupler on the mains side) drives PA2. Each
+  * rising edge is time-stamped with the DWT cycle counter in the EXTI 2
+  * interrupt, and the spacing of the edges is averaged (1/8 per edge), so
+  * the next crossings can be predicted. Both half-wave detectors (one edge
+  * per crossing) and full-wave ones (one per cycle) work: any spacing
+  * between ZERO_CROSS_MIN_US and ZERO_CROSS_MAX_US is taken as the
+  * interval, and a relay aligned to it closes or opens on a crossing
+  * either way. An edge sooner than that after a good one is noise and
+  * ignored.
+  *
+  * ZeroCross_Delay() returns the time to the first crossing that leaves
+  * room for the relay's operate or release time (the lead), so the coil
+  * can be driven that much earlier and the contacts change at the
+  * crossing. config.zero_cross_offset_us moves the target from the edge to
+  * the real crossing, for detectors that fire early or late. Without edges
+  * for ZERO_CROSS_TIMEOUT_US there is nothing to align to and the caller
+  * switches at once. The interval is dropped then, and the edge age is
+  * also kept in SysTick milliseconds: the cycle counter wraps every
+  * ~89 s at 48 MHz, and a stale time stamp must not look fresh again
+  * after a wrap. Only a new pair of edges re-arms alignment.
+  *
+  * The interrupt shares the top priority with the trigger input: it only
+  * reads the counter, so the time stamps do not jitter with USB traffic.
+  *
+  ******************************************************************************
+  */
+
+#include "zero_cross.h"
+#include "config.h"
+
+typedef struct {
+  uint32_t last_edge;         // DWT cycles
+  uint32_t last_tick;         // HAL_GetTick() of that edge, for ages past a counter wrap
+  uint32_t interval;          // averaged edge spacing, DWT cycles, 0 = none yet
+  uint32_t min_cycles;
+  uint32_t max_cycles;
+} ZeroCross_t;
+
+static volatile ZeroCross_t zc;
+
+/**
+  * @brief Set up PA2 as the sync input and its EXTI line
+  * @retval None
+  * @note  Call after Timing_Init() (time stamps come from the DWT).
+  */
+void ZeroCross_Init(void)
+{
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+  uint32_t cycles_per_us = SystemCoreClock / 1000000;
+
+  zc.min_cycles = ZERO_CROSS_MIN_US * cycles_per_us;
+  zc.max_cycles = ZERO_CROSS_MAX_US * cycles_per_us;
+
+  GPIO_InitStruct.Pin = ZERO_CROSS_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+  HAL_GPIO_Init(ZERO_CROSS_GPIO_Port, &GPIO_InitStruct);
+
+  __HAL_RCC_AFIO_CLK_ENABLE();
+  AFIO->EXTICR[0] &= ~AFIO_EXTICR1_EXTI2;           // EXTI 2 from port A
+  EXTI->FTSR &= ~ZERO_CROSS_EXTI_LINE;
+  EXTI->RTSR |= ZERO_CROSS_EXTI_LINE;
+  EXTI->PR = ZERO_CROSS_EXTI_LINE;
+  EXTI->IMR |= ZERO_CROSS_EXTI_LINE;
+
+  HAL_NVIC_SetPriority(EXTI2_IRQn, IRQ_PRIO_SYNC, 0);
+  HAL_NVIC_EnableIRQ(EXTI2_IRQn);
+}
+
+/**
+  * @brief Time from now to the next crossing that is at least lead_us away
+  * @param lead_us: Relay operate or release time to leave room for
+  * @param delay_us: Receives the time to that crossing
+  * @retval 1, or 0 if the sync input has no recent edges
+  */
+uint8_t ZeroCross_Delay(uint32_t lead_us, uint32_t* delay_us)
+{
+  uint32_t cycles_per_us = SystemCoreClock / 1000000;
+  uint32_t last, last_tick, interval, since_us, interval_us, target_us;
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  last = zc.last_edge;
+  last_tick = zc.last_tick;
+  interval = zc.interval;
+  __set_PRIMASK(primask);
+
+  if (interval == 0) return 0;
+  since_us = (DWT->CYCCNT - last) / cycles_per_us;
+  if (since_us > ZERO_CROSS_TIMEOUT_US || HAL_GetTick() - last_tick > ZERO_CROSS_TIMEOUT_US / 1000) {
+    // Mains gone: forget the interval unless an edge came in meanwhile
+    __disable_irq();
+    if (zc.last_edge == last) zc.interval = 0;
+    __set_PRIMASK(primask);
+    return 0;
+  }
+
+  interval_us = interval / cycles_per_us;
+  target_us = config.zero_cross_offset_us % interval_us;
+  while (target_us < since_us + lead_us + ZERO_CROSS_MARGIN_US) {
+    target_us += interval_us;
+  }
+  *delay_us = target_us - since_us;
+  return 1;
+}
+
+/**
+  * @brief Averaged edge spacing, 0 while the input is idle
+  */
+uint16_t ZeroCross_GetIntervalUs(void)
+{
+  uint32_t dummy;
+
+  if (!ZeroCross_Delay(0, &dummy)) return 0;
+  return (uint16_t)(zc.interval / (SystemCoreClock / 1000000));
+}
+
+/**
+  * @brief EXTI line 2: a sync edge
+  * @retval None
+  */
+void EXTI2_IRQHandler(void)
+{
+  uint32_t now = DWT->CYCCNT;
+  uint32_t tick = HAL_GetTick();
+  uint32_t dt = now - zc.last_edge;
+
+  EXTI->PR = ZERO_CROSS_EXTI_LINE;
+
+  // After a long gap dt may have wrapped into range: start over
+  if (tick - zc.last_tick > ZERO_CROSS_TIMEOUT_US / 1000) {
+    zc.interval = 0;
+    dt = 0;
+  }
+  if (dt < zc.min_cycles && zc.interval != 0) return;       // noise after a good edge
+  zc.last_edge = now;
+  zc.last_tick = tick;
+  if (dt > zc.max_cycles || dt < zc.min_cycles) return;     // first edge after a gap
+
+  if (zc.interval == 0) {
+    zc.interval = dt;
+  } else {
+    zc.interval += (int32_t)(dt - zc.interval) / 8;
+  }
+}
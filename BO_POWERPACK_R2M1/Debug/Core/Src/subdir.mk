@@ -5,28 +5,103 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../Core/Src/channels.c \
+../Core/Src/config.c \
+../Core/Src/crash.c \
+../Core/Src/crc16.c \
+../Core/Src/curves.c \
+../Core/Src/curves_table.c \
+../Core/Src/deferred.c \
+../Core/Src/dither.c \
+../Core/Src/fmt.c \
+../Core/Src/gp8413_dma.c \
+../Core/Src/health.c \
 ../Core/Src/main.c \
+../Core/Src/memory.c \
+../Core/Src/metrics.c \
+../Core/Src/output_drv.c \
+../Core/Src/power.c \
+../Core/Src/relay_timer.c \
+../Core/Src/sched.c \
 ../Core/Src/stm32f1xx_hal_msp.c \
 ../Core/Src/stm32f1xx_it.c \
+../Core/Src/stream.c \
 ../Core/Src/syscalls.c \
 ../Core/Src/sysmem.c \
-../Core/Src/system_stm32f1xx.c 
+../Core/Src/system_stm32f1xx.c \
+../Core/Src/telemetry.c \
+../Core/Src/timing.c \
+../Core/Src/trace.c \
+../Core/Src/trigger.c \
+../Core/Src/watchdog.c \
+../Core/Src/waveform.c \
+../Core/Src/zero_cross.c 
 
 OBJS += \
+./Core/Src/channels.o \
+./Core/Src/config.o \
+./Core/Src/crash.o \
+./Core/Src/crc16.o \
+./Core/Src/curves.o \
+./Core/Src/curves_table.o \
+./Core/Src/deferred.o \
+./Core/Src/dither.o \
+./Core/Src/fmt.o \
+./Core/Src/gp8413_dma.o \
+./Core/Src/health.o \
 ./Core/Src/main.o \
+./Core/Src/memory.o \
+./Core/Src/metrics.o \
+./Core/Src/output_drv.o \
+./Core/Src/power.o \
+./Core/Src/relay_timer.o \
+./Core/Src/sched.o \
 ./Core/Src/stm32f1xx_hal_msp.o \
 ./Core/Src/stm32f1xx_it.o \
+./Core/Src/stream.o \
 ./Core/Src/syscalls.o \
 ./Core/Src/sysmem.o \
-./Core/Src/system_stm32f1xx.o 
+./Core/Src/system_stm32f1xx.o \
+./Core/Src/telemetry.o \
+./Core/Src/timing.o \
+./Core/Src/trace.o \
+./Core/Src/trigger.o \
+./Core/Src/watchdog.o \
+./Core/Src/waveform.o \
+./Core/Src/zero_cross.o 
 
 C_DEPS += \
+./Core/Src/channels.d \
+./Core/Src/config.d \
+./Core/Src/crash.d \
+./Core/Src/crc16.d \
+./Core/Src/curves.d \
+./Core/Src/curves_table.d \
+./Core/Src/deferred.d \
+./Core/Src/dither.d \
+./Core/Src/fmt.d \
+./Core/Src/gp8413_dma.d \
+./Core/Src/health.d \
 ./Core/Src/main.d \
+./Core/Src/memory.d \
+./Core/Src/metrics.d \
+./Core/Src/output_drv.d \
+./Core/Src/power.d \
+./Core/Src/relay_timer.d \
+./Core/Src/sched.d \
 ./Core/Src/stm32f1xx_hal_msp.d \
 ./Core/Src/stm32f1xx_it.d \
+./Core/Src/stream.d \
 ./Core/Src/syscalls.d \
 ./Core/Src/sysmem.d \
-./Core/Src/system_stm32f1xx.d 
+./Core/Src/system_stm32f1xx.d \
+./Core/Src/telemetry.d \
+./Core/Src/timing.d \
+./Core/Src/trace.d \
+./Core/Src/trigger.d \
+./Core/Src/watchdog.d \
+./Core/Src/waveform.d \
+./Core/Src/zero_cross.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -36,7 +111,7 @@ Core/Src/%.o Core/Src/%.su Core/Src/%.cyclo: ../Core/Src/%.c Core/Src/subdir.mk
 clean: clean-Core-2f-Src
 
 clean-Core-2f-Src:
-	-$(RM) ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/stm32f1xx_hal_msp.cyclo ./Core/Src/stm32f1xx_hal_msp.d ./Core/Src/stm32f1xx_hal_msp.o ./Core/Src/stm32f1xx_hal_msp.su ./Core/Src/stm32f1xx_it.cyclo ./Core/Src/stm32f1xx_it.d ./Core/Src/stm32f1xx_it.o ./Core/Src/stm32f1xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32f1xx.cyclo ./Core/Src/system_stm32f1xx.d ./Core/Src/system_stm32f1xx.o ./Core/Src/system_stm32f1xx.su
+	-$(RM) ./Core/Src/channels.cyclo ./Core/Src/channels.d ./Core/Src/channels.o ./Core/Src/channels.su ./Core/Src/config.cyclo ./Core/Src/config.d ./Core/Src/config.o ./Core/Src/config.su ./Core/Src/crash.cyclo ./Core/Src/crash.d ./Core/Src/crash.o ./Core/Src/crash.su ./Core/Src/crc16.cyclo ./Core/Src/crc16.d ./Core/Src/crc16.o ./Core/Src/crc16.su ./Core/Src/curves.cyclo ./Core/Src/curves.d ./Core/Src/curves.o ./Core/Src/curves.su ./Core/Src/curves_table.cyclo ./Core/Src/curves_table.d ./Core/Src/curves_table.o ./Core/Src/curves_table.su ./Core/Src/deferred.cyclo ./Core/Src/deferred.d ./Core/Src/deferred.o ./Core/Src/deferred.su ./Core/Src/dither.cyclo ./Core/Src/dither.d ./Core/Src/dither.o ./Core/Src/dither.su ./Core/Src/fmt.cyclo ./Core/Src/fmt.d ./Core/Src/fmt.o ./Core/Src/fmt.su ./Core/Src/gp8413_dma.cyclo ./Core/Src/gp8413_dma.d ./Core/Src/gp8413_dma.o ./Core/Src/gp8413_dma.su ./Core/Src/health.cyclo ./Core/Src/health.d ./Core/Src/health.o ./Core/Src/health.su ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/memory.cyclo ./Core/Src/memory.d ./Core/Src/memory.o ./Core/Src/memory.su ./Core/Src/metrics.cyclo ./Core/Src/metrics.d ./Core/Src/metrics.o ./Core/Src/metrics.su ./Core/Src/output_drv.cyclo ./Core/Src/output_drv.d ./Core/Src/output_drv.o ./Core/Src/output_drv.su ./Core/Src/power.cyclo ./Core/Src/power.d ./Core/Src/power.o ./Core/Src/power.su ./Core/Src/relay_timer.cyclo ./Core/Src/relay_timer.d ./Core/Src/relay_timer.o ./Core/Src/relay_timer.su ./Core/Src/sched.cyclo ./Core/Src/sched.d ./Core/Src/sched.o ./Core/Src/sched.su ./Core/Src/stm32f1xx_hal_msp.cyclo ./Core/Src/stm32f1xx_hal_msp.d ./Core/Src/stm32f1xx_hal_msp.o ./Core/Src/stm32f1xx_hal_msp.su ./Core/Src/stm32f1xx_it.cyclo ./Core/Src/stm32f1xx_it.d ./Core/Src/stm32f1xx_it.o ./Core/Src/stm32f1xx_it.su ./Core/Src/stream.cyclo ./Core/Src/stream.d ./Core/Src/stream.o ./Core/Src/stream.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32f1xx.cyclo ./Core/Src/system_stm32f1xx.d ./Core/Src/system_stm32f1xx.o ./Core/Src/system_stm32f1xx.su ./Core/Src/telemetry.cyclo ./Core/Src/telemetry.d ./Core/Src/telemetry.o ./Core/Src/telemetry.su ./Core/Src/timing.cyclo ./Core/Src/timing.d ./Core/Src/timing.o ./Core/Src/timing.su ./Core/Src/trace.cyclo ./Core/Src/trace.d ./Core/Src/trace.o ./Core/Src/trace.su ./Core/Src/trigger.cyclo ./Core/Src/trigger.d ./Core/Src/trigger.o ./Core/Src/trigger.su ./Core/Src/watchdog.cyclo ./Core/Src/watchdog.d ./Core/Src/watchdog.o ./Core/Src/watchdog.su ./Core/Src/waveform.cyclo ./Core/Src/waveform.d ./Core/Src/waveform.o ./Core/Src/waveform.su ./Core/Src/zero_cross.cyclo ./Core/Src/zero_cross.d ./Core/Src/zero_cross.o ./Core/Src/zero_cross.su
 
 .PHONY: clean-Core-2f-Src
 
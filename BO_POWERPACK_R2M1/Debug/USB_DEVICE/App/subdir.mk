@@ -7,16 +7,19 @@
 C_SRCS += \
 ../USB_DEVICE/App/usb_device.c \
 ../USB_DEVICE/App/usbd_cdc_if.c \
+../USB_DEVICE/App/usbd_composite.c \
 ../USB_DEVICE/App/usbd_desc.c 
 
 OBJS += \
 ./USB_DEVICE/App/usb_device.o \
 ./USB_DEVICE/App/usbd_cdc_if.o \
+./USB_DEVICE/App/usbd_composite.o \
 ./USB_DEVICE/App/usbd_desc.o 
 
 C_DEPS += \
 ./USB_DEVICE/App/usb_device.d \
 ./USB_DEVICE/App/usbd_cdc_if.d \
+./USB_DEVICE/App/usbd_composite.d \
 ./USB_DEVICE/App/usbd_desc.d 
 
 
@@ -27,7 +30,7 @@ USB_DEVICE/App/%.o USB_DEVICE/App/%.su USB_DEVICE/App/%.cyclo: ../USB_DEVICE/App
 clean: clean-USB_DEVICE-2f-App
 
 clean-USB_DEVICE-2f-App:
-	-$(RM) ./USB_DEVICE/App/usb_device.cyclo ./USB_DEVICE/App/usb_device.d ./USB_DEVICE/App/usb_device.o ./USB_DEVICE/App/usb_device.su ./USB_DEVICE/App/usbd_cdc_if.cyclo ./USB_DEVICE/App/usbd_cdc_if.d ./USB_DEVICE/App/usbd_cdc_if.o ./USB_DEVICE/App/usbd_cdc_if.su ./USB_DEVICE/App/usbd_desc.cyclo ./USB_DEVICE/App/usbd_desc.d ./USB_DEVICE/App/usbd_desc.o ./USB_DEVICE/App/usbd_desc.su
+	-$(RM) ./USB_DEVICE/App/usb_device.cyclo ./USB_DEVICE/App/usb_device.d ./USB_DEVICE/App/usb_device.o ./USB_DEVICE/App/usb_device.su ./USB_DEVICE/App/usbd_cdc_if.cyclo ./USB_DEVICE/App/usbd_cdc_if.d ./USB_DEVICE/App/usbd_cdc_if.o ./USB_DEVICE/App/usbd_cdc_if.su ./USB_DEVICE/App/usbd_composite.cyclo ./USB_DEVICE/App/usbd_composite.d ./USB_DEVICE/App/usbd_composite.o ./USB_DEVICE/App/usbd_composite.su ./USB_DEVICE/App/usbd_desc.cyclo ./USB_DEVICE/App/usbd_desc.d ./USB_DEVICE/App/usbd_desc.o ./USB_DEVICE/App/usbd_desc.su
 
 .PHONY: clean-USB_DEVICE-2f-App
 
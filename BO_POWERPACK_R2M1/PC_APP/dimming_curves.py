@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+"""
+PowerPack dimming curves
+
+Single source of the perceptual dimming curves. The firmware lookup tables
+in Core/Src/curves_table.c are generated from this file, and
+powerpack_controller.py imports it to preview the same mapping, so the two
+sides cannot drift apart.
+
+A curve maps a dimmer level (0..LEVEL_MAX, the value the host sends) to a
+Q16 DAC code: the 15-bit GP8413 code in the upper 16 bits, 1/65536 LSB in
+the lower 16, which the dither resolves. The tables hold CURVE_POINTS
+breakpoints; the firmware interpolates linearly between them (see
+Curve_LevelToQ16 in curves.c).
+
+Usage:
+python dimming_curves.py --c=../Core/Src/curves_table.c [--user=points.csv]
+python dimming_curves.py [--user=points.csv]          print the tables
+
+The user curve comes from a CSV of "level_percent, output_percent" rows,
+linearly interpolated; without --user it is USER_POINTS below. Regenerate
+after changing either ("make curves" in the Debug directory) and commit the
+generated file with it.
+"""
+
+import math
+import os
+import sys
+
+LEVEL_MAX = 0xFFFF
+DAC_CODE_MAX = 0x7FFF
+CURVE_SEGMENTS = 64                     # must match curves.h
+CURVE_POINTS = CURVE_SEGMENTS + 1
+Q16_MAX = 0x7FFEFFFF                    # Channels_LevelToQ16(0xFFFF), keeps the dither carry in range
+LOG_RANGE = 1000                        # 60 dB from the first step to full output
+
+# Default user curve: gentle S for incandescent-like fades (level %, output %)
+USER_POINTS = [(0, 0), (10, 0.5), (25, 4), (50, 20), (75, 55), (90, 82), (100, 100)]
+
+
+def cie1931(x):
+    """CIE 1931 lightness: x is L*/100, returns relative luminance Y"""
+    lightness = x * 100
+    if lightness <= 8:
+        return lightness / 903.3
+    return ((lightness + 16) / 116) ** 3
+
+
+def gamma22(x):
+    return x ** 2.2
+
+
+def logarithmic(x):
+    """Constant ratio per step, 0 at 0 and 1 at 1"""
+    return (LOG_RANGE ** x - 1) / (LOG_RANGE - 1)
+
+
+def piecewise(points):
+    """Curve through (level %, output %) points, linear in between"""
+    points = sorted(points)
+    if points[0][0] != 0 or points[-1][0] != 100:
+        raise ValueError("user curve must start at 0 % and end at 100 % level")
+    for (x0, y0), (x1, y1) in zip(points, points[1:]):
+        if x1 <= x0 or y1 < y0:
+            raise ValueError("user curve points must rise in level and not fall in output")
+
+    def curve(x):
+        x *= 100
+        for (x0, y0), (x1, y1) in zip(points, points[1:]):
+            if x <= x1:
+                return (y0 + (y1 - y0) * (x - x0) / (x1 - x0)) / 100
+        return points[-1][1] / 100
+    return curve
+
+
+def read_points(path):
+    points = []
+    with open(path) as f:
+        for line in f:
+            line = line.split("#", 1)[0].strip()
+            if line:
+                x, y = (float(v) for v in line.split(","))
+                points.append((x, y))
+    return points
+
+
+def curves(user_points=None):
+    """Curve name, C identifier suffix and function, in CURVE_* order after CURVE_LINEAR"""
+    return [
+        ("cie1931", "CIE1931", cie1931),
+        ("gamma2.2", "GAMMA22", gamma22),
+        ("log", "LOG", logarithmic),
+        ("user", "USER", piecewise(user_points or USER_POINTS)),
+    ]
+
+
+CURVE_NAMES = ["linear"] + [name for name, _, _ in curves()]
+
+
+def table(curve):
+    """CURVE_POINTS Q16 DAC codes for a curve"""
+    values = []
+    for i in range(CURVE_POINTS):
+        y = min(max(curve(i / CURVE_SEGMENTS), 0.0), 1.0)
+        values.append(min(int(round(y * (DAC_CODE_MAX << 16))), Q16_MAX))
+    values[0] = 0
+    values[-1] = Q16_MAX
+    for a, b in zip(values, values[1:]):
+        if b < a:
+            raise ValueError("curve is not monotonic")
+    return values
+
+
+def linear_q16(level):
+    """Same as Channels_LevelToQ16 in channels.h"""
+    t = level * DAC_CODE_MAX
+    return t + (t >> 16)
+
+
+def level_to_q16(level, tab=None):
+    """Level to Q16 DAC code, the way Curve_LevelToQ16 computes it"""
+    if tab is None:
+        return linear_q16(level)
+    position = level + (level >> 15)    # 0..0x10000
+    i, f = position >> 10, position & 0x3FF
+    if i >= CURVE_SEGMENTS:
+        return tab[CURVE_SEGMENTS]
+    return tab[i] + (((tab[i + 1] - tab[i]) * f) >> 10)
+
+
+def level_to_code(level, name="linear", user_points=None):
+    """Level to the 15-bit code the firmware writes without dithering"""
+    tab = None
+    if name != "linear":
+        tab = table(dict((n, c) for n, _, c in curves(user_points))[name])
+    return (level_to_q16(level, tab) + 0x8000) >> 16
+
+
+def c_source(user_points=None, source="PC_APP/dimming_curves.py"):
+    lines = [
+        "/**",
+        "  ******************************************************************************",
+        "  * @file           : curves_table.c",
+        "  * @brief          : Dimming curve lookup tables (generated)",
+        "  ******************************************************************************",
+        "  * @attention",
+        "  *",
+        f"  * Generated by {source}, do not edit. Q16 DAC codes at",
+        f"  * {CURVE_POINTS} evenly spaced levels; see curves.c for the interpolation.",
+        "  *",
+        "  ******************************************************************************",
+        "  */",
+        "",
+        '#include "curves.h"',
+        "",
+        "const uint32_t curve_tables[CURVE_TABLE_COUNT][CURVE_POINTS] = {",
+    ]
+    for name, ident, curve in curves(user_points):
+        values = table(curve)
+        lines.append(f"  {{ // CURVE_{ident}")
+        for i in range(0, CURVE_POINTS, 6):
+            row = ", ".join(f"0x{v:08X}" for v in values[i:i + 6])
+            lines.append(f"    {row},")
+        lines.append("  },")
+    lines.append("};")
+    return "\n".join(lines) + "\n"
+
+
+def main(argv):
+    options = dict(a[2:].split("=", 1) for a in argv if a.startswith("--") and "=" in a)
+    user_points = read_points(options["user"]) if "user" in options else None
+    if "c" in options:
+        with open(options["c"], "w", newline="\n") as f:
+            f.write(c_source(user_points))
+        print(f"Wrote {os.path.normpath(options['c'])}")
+        return 0
+    for name, _, curve in curves(user_points):
+        values = table(curve)
+        print(f"{name}:")
+        for pct in (1, 5, 10, 25, 50, 75, 100):
+            level = round(pct * LEVEL_MAX / 100)
+            print(f"  {pct:>3}% -> code {level_to_q16(level, values) / 65536:9.2f}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+"""
+PowerPack firmware memory report
+
+Stack: reads the .su files that -fstack-usage writes next to each object in
+the build directory and the heap/stack reserves from the linker script, and
+lists the largest stack frames. Compare the result with the stack peak the
+device measures at runtime (GET_MEMORY, "memory" in powerpack_controller.py)
+before tightening _Min_Stack_Size.
+
+Image: with --map, reads the linker map file instead and reports flash and
+RAM per module (object file or library) against the memory regions. In an
+LTO build the map only shows the ltrans partitions, so use the Debug map
+for the per-module split and the Release map for the totals.
+
+Usage:
+python memory_report.py [build_dir] [linker_script] [--top=N] [--max-frame=BYTES]
+python memory_report.py --map=BO_POWERPACK_R2M1.map [--top=N]
+                        [--flash-max=BYTES|PCT%] [--ram-max=BYTES|PCT%] [--module-max=BYTES]
+
+Exit code 1 if a frame is larger than --max-frame or unbounded, or if the
+image exceeds one of the map thresholds.
+"""
+
+import os
+import re
+import sys
+
+
+def read_su_files(build_dir):
+    """Return [(function, file, bytes, qualifier)] from every .su file under build_dir"""
+    frames = []
+    for root, _, files in os.walk(build_dir):
+        for name in files:
+            if not name.endswith(".su"):
+                continue
+            with open(os.path.join(root, name)) as f:
+                for line in f:
+                    # ../Core/Src/main.c:538:6:Set_Relay\t24\tstatic
+                    parts = line.rstrip("\n").split("\t")
+                    if len(parts) != 3:
+                        continue
+                    location, size, qualifier = parts
+                    source, function = location.rsplit(":", 1)
+                    source = re.sub(r":\d+:\d+$", "", source)
+                    frames.append((function, os.path.normpath(source), int(size), qualifier))
+    return frames
+
+
+def read_reserves(linker_script):
+    """Return {symbol: bytes} for _Min_Heap_Size and _Min_Stack_Size"""
+    reserves = {}
+    with open(linker_script) as f:
+        for m in re.finditer(r"(_Min_\w+_Size)\s*=\s*(0x[0-9A-Fa-f]+|\d+)", f.read()):
+            reserves[m.group(1)] = int(m.group(2), 0)
+    return reserves
+
+
+def module_name(path):
+    """libc_nano.a(lib_a-memcpy.o) -> libc_nano.a, ./Core/Src/main.o -> main.o"""
+    path = path.strip()
+    if path.endswith(")") and "(" in path:
+        path = path[:path.index("(")]
+    return os.path.basename(path)
+
+
+def read_map(map_path):
+    """Parse a GNU ld map file
+    
+    Returns (regions, modules, sections): regions {name: (origin, length)},
+    modules {module: [flash, ram]} from the input sections, and the output
+    sections as [(name, address, size, load_address)].
+    """
+    with open(map_path) as f:
+        text = f.read()
+    regions = {}
+    config = text.split("Memory Configuration", 1)[-1].split("Linker script and memory map", 1)[0]
+    for m in re.finditer(r"^(\w+)\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)", config, re.M):
+        regions[m.group(1)] = (int(m.group(2), 16), int(m.group(3), 16))
+
+    modules = {}
+    sections = []
+    output = None
+    pending = None
+    body = text.split("Linker script and memory map", 1)[-1]
+    for line in body.splitlines():
+        m = re.match(r"^(\.\S+)(?:\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)(?:\s+load address\s+(0x[0-9a-fA-F]+))?)?\s*$", line)
+        if m:
+            if m.group(2) is None:
+                pending = ("out", m.group(1))
+                continue
+            load = int(m.group(4), 16) if m.group(4) else None
+            output = (m.group(1), int(m.group(2), 16), int(m.group(3), 16), load)
+            sections.append(output)
+            pending = None
+            continue
+        m = re.match(r"^\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)(?:\s+load address\s+(0x[0-9a-fA-F]+))?\s*$", line)
+        if m and pending and pending[0] == "out":
+            load = int(m.group(3), 16) if m.group(3) else None
+            output = (pending[1], int(m.group(1), 16), int(m.group(2), 16), load)
+            sections.append(output)
+            pending = None
+            continue
+        m = re.match(r"^ (\S+)\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)\s*(.*)$", line)
+        if not m:
+            m2 = re.match(r"^ (\S+)$", line)
+            if m2:
+                pending = ("in", m2.group(1))
+                continue
+            m2 = re.match(r"^\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)\s+(\S.*)$", line)
+            if not (m2 and pending and pending[0] == "in"):
+                continue
+            name, address, size, source = pending[1], m2.group(1), m2.group(2), m2.group(3)
+        else:
+            name, address, size, source = m.groups()
+        pending = None
+        address, size = int(address, 16), int(size, 16)
+        if output is None or size == 0 or address == 0:
+            continue
+        module = "(fill)" if name == "*fill*" else module_name(source) or "(linker)"
+        counts = modules.setdefault(module, [0, 0])
+        in_ram = address >= 0x20000000
+        if not in_ram or output[3] is not None:
+            counts[0] += size       # flash, including the .data init image
+        if in_ram:
+            counts[1] += size
+    return regions, modules, sections
+
+
+def limit(value, total):
+    """'12000' -> 12000, '90%' -> 90 % of total"""
+    if value.endswith("%"):
+        return total * float(value[:-1]) / 100
+    return int(value, 0)
+
+
+def map_report(map_path, options):
+    top = int(options.get("top", 15))
+    regions, modules, sections = read_map(map_path)
+    flash = regions.get("FLASH", (0x08000000, 0))
+    ram = regions.get("RAM", (0x20000000, 0))
+
+    flash_used = sum(size for name, address, size, load in sections
+                     if flash[0] <= address < flash[0] + flash[1] or load is not None)
+    ram_used = sum(size for name, address, size, load in sections
+                   if ram[0] <= address < ram[0] + ram[1])
+    reserve = sum(size for name, address, size, load in sections if name == "._user_heap_stack")
+
+    print(f"Image from {map_path}")
+    print(f"  FLASH {flash_used:>6} / {flash[1]} B ({100 * flash_used / max(flash[1], 1):.1f}%)")
+    print(f"  RAM   {ram_used:>6} / {ram[1]} B ({100 * ram_used / max(ram[1], 1):.1f}%), "
+          f"{reserve} B of it heap/stack reserve")
+    print()
+    print(f"  {'flash':>6}  {'ram':>6}  module")
+    ranked = sorted(modules.items(), key=lambda m: (m[1][0], m[1][1]), reverse=True)
+    for module, (module_flash, module_ram) in ranked[:top]:
+        print(f"  {module_flash:>6}  {module_ram:>6}  {module}")
+    if len(ranked) > top:
+        rest = ranked[top:]
+        print(f"  {sum(m[1][0] for m in rest):>6}  {sum(m[1][1] for m in rest):>6}  ({len(rest)} more)")
+
+    failed = []
+    if "flash-max" in options and flash_used > limit(options["flash-max"], flash[1]):
+        failed.append(f"flash {flash_used} B > {options['flash-max']}")
+    if "ram-max" in options and ram_used > limit(options["ram-max"], ram[1]):
+        failed.append(f"RAM {ram_used} B > {options['ram-max']}")
+    if "module-max" in options:
+        module_max = int(options["module-max"], 0)
+        failed += [f"{module} flash {counts[0]} B > {module_max}"
+                   for module, counts in ranked if counts[0] > module_max]
+    for message in failed:
+        print(f"BUDGET: {message}")
+    return 1 if failed else 0
+
+
+def stack_report(build_dir, linker_script, options):
+    top = int(options.get("top", 15))
+    max_frame = int(options["max-frame"], 0) if "max-frame" in options else None
+
+    frames = read_su_files(build_dir)
+    if not frames:
+        print(f"No .su files under {build_dir} (build with -fstack-usage first)")
+        return 1
+    frames.sort(key=lambda f: f[2], reverse=True)
+    reserves = read_reserves(linker_script)
+    stack_reserve = reserves.get("_Min_Stack_Size", 0)
+
+    print(f"Stack frames from {len(frames)} functions in {build_dir}")
+    print(f"  _Min_Stack_Size = {stack_reserve} B, _Min_Heap_Size = {reserves.get('_Min_Heap_Size', 0)} B")
+    print()
+    print(f"  {'bytes':>6}  {'type':<16} function")
+    for function, source, size, qualifier in frames[:top]:
+        print(f"  {size:>6}  {qualifier:<16} {function}  ({os.path.basename(source)})")
+
+    dynamic = [f for f in frames if f[3] != "static"]
+    if dynamic:
+        print()
+        print("Frames with a dynamic part (alloca/VLA, the size is a lower bound):")
+        for function, source, size, qualifier in dynamic:
+            print(f"  {size:>6}  {qualifier:<16} {function}  ({os.path.basename(source)})")
+
+    # Frames only: call depth and interrupt nesting come on top of this
+    print()
+    print(f"Largest frame {frames[0][2]} B is {100 * frames[0][2] // max(stack_reserve, 1)}% of the stack reserve;")
+    print("  the call chain and interrupt nesting add to it, see the runtime peak from GET_MEMORY")
+
+    failed = [f for f in frames if f[3] == "dynamic" or (max_frame is not None and f[2] > max_frame)]
+    for function, _, size, qualifier in failed:
+        print(f"BUDGET: {function} {size} B ({qualifier})")
+    return 1 if failed else 0
+
+
+def main(argv):
+    here = os.path.dirname(os.path.abspath(__file__))
+    args = [a for a in argv if not a.startswith("--")]
+    options = dict(a[2:].split("=", 1) for a in argv if a.startswith("--") and "=" in a)
+    if "map" in options:
+        return map_report(options["map"], options)
+    build_dir = args[0] if args else os.path.join(here, "..", "Debug")
+    linker_script = args[1] if len(args) > 1 else os.path.join(here, "..", "STM32F103C8TX_FLASH.ld")
+    return stack_report(build_dir, linker_script, options)
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
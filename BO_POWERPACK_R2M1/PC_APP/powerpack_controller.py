@@ -22,7 +22,13 @@ import threading
 import tkinter as tk
 from tkinter import ttk, messagebox
 import queue
+import os
+import json
 import logging
+import subprocess
+from fractions import Fraction
+
+import dimming_curves
 
 # Version information
 PYTHON_APP_VERSION = "v2.0.0"
@@ -39,10 +45,401 @@ CMD_ENABLE_DIMMER2 = 0x07
 CMD_DISABLE_DIMMER1 = 0x08
 CMD_DISABLE_DIMMER2 = 0x09
 CMD_GET_VERSION = 0x0A
+CMD_WAVE_BEGIN = 0x0B
+CMD_WAVE_CHUNK = 0x0C
+CMD_WAVE_COMMIT = 0x0D
+CMD_WAVE_PLAY = 0x0E
+CMD_STREAM_START = 0x0F
+CMD_STREAM_DATA = 0x10
+CMD_STREAM_STOP = 0x11
+CMD_STREAM_STATS = 0x12
+CMD_GET_METRICS = 0x13
+CMD_DUMP_TRACE = 0x14
+CMD_BENCH_OUTPUTS = 0x15
+CMD_APPLY_STATE = 0x16
+
+# CMD_APPLY_STATE field bits (must match firmware main.c)
+STATE_RELAY1 = 0x01
+STATE_RELAY2 = 0x02
+STATE_DIMMER1 = 0x04
+STATE_DIMMER2 = 0x08
+STATE_ENABLE1 = 0x10
+STATE_ENABLE2 = 0x20
+STATE_STATUS_TEXT = {0: "OK", 1: "out of range", 2: "DAC write failed", 3: "no DAC at that channel"}
+CMD_GET_CRASH = 0x17
+
+# Crash report decoding (must match firmware crash.h / crash.c)
+CRASH_PAGE_REGISTERS = 0
+CRASH_PAGE_STACK = 1
+CRASH_PAGE_CLEAR = 0xFF
+CRASH_REPLY_SIZE = 60
+CRASH_REGISTER_NAMES = ("ipsr", "exc_return", "r0", "r1", "r2", "r3", "r12", "lr", "pc",
+                        "xpsr", "sp", "cfsr", "hfsr", "bfar")
+CRASH_EXCEPTION_NAMES = {3: "HardFault", 4: "MemManage", 5: "BusFault", 6: "UsageFault"}
+CRASH_CFSR_BITS = {
+    0: "IACCVIOL", 1: "DACCVIOL", 3: "MUNSTKERR", 4: "MSTKERR", 7: "MMARVALID",
+    8: "IBUSERR", 9: "PRECISERR", 10: "IMPRECISERR", 11: "UNSTKERR", 12: "STKERR", 15: "BFARVALID",
+    16: "UNDEFINSTR", 17: "INVSTATE", 18: "INVPC", 19: "NOCP", 24: "UNALIGNED", 25: "DIVBYZERO",
+}
+CRASH_HFSR_BITS = {1: "VECTTBL", 30: "FORCED", 31: "DEBUGEVT"}
+RESET_FLAG_BITS = {2: "pin", 3: "power-on", 4: "software", 5: "independent watchdog",
+                   6: "window watchdog", 7: "low-power"}
+CMD_WATCHDOG = 0x18
+WDG_CMD_INFO = 0
+WDG_CMD_HANG = {"main": 1, "usb": 2, "i2c": 3}     # DEBUG firmware only
+WDG_TASK_NAMES = {0x01: "main", 0x02: "usb", 0x04: "i2c"}
+CMD_GET_MEMORY = 0x19
+MEMORY_FIELDS = ("ram_total", "static", "heap_reserved", "heap_used", "heap_peak",
+                 "heap_failures", "stack_reserved", "stack_now", "stack_peak", "free_min")
+MEMORY_FLAG_TEXT = {0x01: "stack peak exceeds _Min_Stack_Size",
+                    0x02: "heap peak exceeds _Min_Heap_Size",
+                    0x04: "heap and stack have met"}
+CMD_GET_TIMING = 0x1A
+TIMING_NAMES = ("usb_isr", "cmd_exec", "cmd_latency", "sof_interval")   # wire order of GET_TIMING
+SOF_CYCLES = 48000          # 1 ms USB frame at 48 MHz
+CPU_HZ = 48000000
+CMD_GET_TASKS = 0x1B
+TASK_NAMES = ("commands", "watchdog", "status", "trigger", "telemetry")   # wire order of GET_TASKS
+CMD_GET_POWER = 0x1C
+POWER_REPLY_SIZE = 20
+CMD_BULK_OUTPUTS = 0x1D
+BULK_RELAYS = 0x00
+BULK_ENABLES = 0x01
+BULK_DIMMERS = 0x02             # one code per channel in the mask
+BULK_DIMMERS_SAME = 0x03        # one code for every channel in the mask
+CMD_BENCH_CHANNELS = 0x1E
+GP8413_ADDRESS = 0x58           # first of up to 8 DACs (0x58-0x5F), two channels each
+MAX_DAC_CHANNELS = 16
+CMD_GET_CAPABILITIES = 0x1F
+CAPS_HEADER_SIZE = 16
+PROTOCOL_VERSION = 2            # frame layout revision this script speaks
+FEATURE_NAMES = ["waveform", "stream", "apply_state", "bulk_outputs", "metrics", "trace",
+                 "crash_report", "watchdog", "memory", "timing", "tasks", "low_power",
+                 "diag_text", "fault_injection", "dither", "curves", "health",
+                 "relay_timing", "latching_relay", "trigger", "relay_config", "zero_cross",
+                 "telemetry", "hello"]
+LEVEL_MAX = 0xFFFF              # dimmer levels: 16-bit fraction of full scale
+DAC_CODE_MAX = 0x7FFF           # GP8413 15-bit code
+CMD_DITHER = 0x20
+DITHER_CMD_SET = 0
+DITHER_CMD_STATS = 1
+DITHER_CMD_STATS_RESET = 2
+DITHER_REPLY_SIZE = 32
+DITHER_RATES = [100, 125, 200, 250, 500, 1000]
+CMD_SET_CURVE = 0x21
+CURVE_NAMES = dimming_curves.CURVE_NAMES     # index = CURVE_* id in curves.h
+CMD_GET_HEALTH = 0x22           # also follows every GET_STATUS frame
+HEALTH_MAX_AGE = 10.0           # seconds a health frame from the status poll stays current
+CMD_PULSE_RELAY = 0x23
+CMD_BLINK_RELAY = 0x24
+RELAY_TIMER_STATUS_TEXT = {1: "out of range", 2: "latching relay (positions only)",
+                           3: "delay shorter than the relay's operate/release time",
+                           4: "relay has no timer"}
+CMD_TRIGGER = 0x25              # external trigger input on PA3
+TRIGGER_CMD_DISARM = 0
+TRIGGER_CMD_ARM_STATE = 1
+TRIGGER_CMD_ARM_WAVE = 2
+TRIGGER_CMD_CONFIG = 3
+TRIGGER_CMD_STATS = 4
+TRIGGER_CMD_STATS_RESET = 5
+TRIGGER_FLAG_FALLING = 0x01
+TRIGGER_FLAG_REARM = 0x02
+TRIGGER_REPLY_SIZE = 32
+TRIGGER_ACTION_NAMES = ("disarmed", "state", "waveform")
+TRIGGER_STATUS_TEXT = {1: "out of range", 2: "no committed waveform, or rate too high",
+                       3: "no DAC at that channel", 4: "latching relay (not switchable on an edge)"}
+CMD_RELAY_CONFIG = 0x26         # relay operate/release times and zero-cross mode
+CONFIG_CMD_GET = 0
+CONFIG_CMD_SET_DELAYS = 1
+CONFIG_CMD_SET_ZERO_CROSS = 2
+CONFIG_CMD_SAVE = 3
+CONFIG_STATUS_TEXT = {1: "out of range", 2: "flash write failed"}
+CMD_SWITCH_RELAY_AT = 0x27
+CMD_TELEMETRY = 0x28            # compact status stream control
+TELEMETRY_FRAME = 0x29          # first byte of each stream frame
+TELEMETRY_CMD_STOP = 0
+TELEMETRY_CMD_START = 1
+TELEMETRY_CMD_ACK = 2
+TELEMETRY_CMD_STATS = 3
+TELEMETRY_CMD_STATS_RESET = 4
+TELEMETRY_REPLY_SIZE = 40
+TELEMETRY_FIELDS = ("relays", "enables", "dimmer1", "dimmer2", "temperature_dc", "vdda_mv")  # telemetry.h order
+FIXED_STATUS_BYTES = 16         # status frame + health frame of the GET_STATUS push
+CMD_HELLO = 0x2A                # connect handshake: version, capabilities and state
+HELLO_HEADER_SIZE = 26          # then a level u16 and a curve u8 per dimmer
+HELLO_RETRY_S = (0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0)   # reply wait per try, ~1.9 s in all
+FLASH_START = 0x08000000
+
+
+def percent_to_level(percentage):
+    """0-100 % to a dimmer level, rounded to nearest in exact integer arithmetic"""
+    level = Fraction(percentage) * LEVEL_MAX / 100
+    return int(level + Fraction(1, 2))
+
+
+def level_to_q16(level):
+    """Level to the firmware's Q16 DAC code (see Channels_LevelToQ16)"""
+    t = level * DAC_CODE_MAX
+    return t + (t >> 16)
+
+FLASH_END = 0x08020000
+
+# Waveform playback (must match firmware waveform.h)
+WAVE_MAX_SAMPLES = 2048
+WAVE_CHUNK_MAX_SAMPLES = 28
+WAVE_MODE_STOP = 0
+WAVE_MODE_ONESHOT = 1
+WAVE_MODE_LOOP = 2
+WAVE_STATUS_TEXT = {0: "OK", 1: "out of range", 2: "CRC mismatch", 3: "wrong state", 4: "rate too high"}
+
+# Setpoint streaming (must match firmware stream.h)
+STREAM_FRAME_MAX_RECORDS = 10
+STREAM_DEFAULT_LATENCY_MS = 20
+STREAM_ACK_TIMEOUT = 1.0
+STREAM_STATUS_TEXT = {0: "OK", 1: "not started", 2: "out of range", 3: "buffer overflow"}
+
+# Device metrics in GET_METRICS wire order (must match firmware metrics.h)
+METRIC_DEFS = [
+    ("uptime_seconds", "gauge", "Time since device reset"),
+    ("usb_rx_packets", "counter", "USB packets received"),
+    ("commands_received", "counter", "Commands dispatched"),
+    ("commands_unknown", "counter", "Commands with an unknown opcode"),
+    ("commands_overrun", "counter", "Commands replaced before the main loop dispatched them"),
+    ("crc_errors", "counter", "Frames or tables rejected for a CRC mismatch"),
+    ("usb_tx_packets", "counter", "USB packets queued for transmission"),
+    ("usb_tx_busy", "counter", "USB transmissions dropped because the endpoint was busy"),
+    ("i2c_errors", "counter", "Failed I2C transfers to the DAC"),
+    ("relay1_switches", "counter", "Relay 1 state changes"),
+    ("relay2_switches", "counter", "Relay 2 state changes"),
+    ("dac_writes", "counter", "DAC register writes started"),
+    ("diag_dropped", "counter", "Log or trace writes dropped because the diagnostics buffer was full"),
+    ("deferred_dropped", "counter", "Interrupt work dropped because the PendSV queue was full"),
+]
+
+# Gauges from the GET_HEALTH frame, exported after METRIC_DEFS
+HEALTH_METRIC_DEFS = [
+    ("mcu_temperature_celsius", "MCU die temperature (datasheet calibration, for trends)"),
+    ("supply_volts", "VDDA measured against VREFINT"),
+    ("adc_cpu_percent", "CPU time spent filtering the health ADC samples"),
+]
+
+# Trace event IDs (must match firmware trace.h)
+TRACE_EVENT_NAMES = {
+    1: "cmd_rx", 2: "cmd_start", 3: "cmd_end", 4: "relay", 5: "dimmer", 6: "dimmer_enable",
+    7: "i2c_start", 8: "i2c_stop", 9: "usb_tx_start", 10: "usb_tx_busy", 11: "usb_tx_done",
+    12: "apply_state", 13: "gpio_write", 14: "trigger",
+}
+TRACE_WIRE_ENTRY_SIZE = 9
+
+# Composite USB device: interface 0 = control (framed binary), 2 = diagnostics (logs, traces)
+CONTROL_INTERFACE = 0
+DIAG_INTERFACE = 2
+
+
+def state_fields(relay1, relay2, dimmer1, dimmer2, enable1, enable2):
+    """STATE_* fields, on bits and the two levels of an APPLY_STATE-style frame
+    
+    None leaves a field out; dimmer values are percentages.
+    """
+    fields = on = 0
+    codes = [0, 0]
+    for bit, state in ((STATE_RELAY1, relay1), (STATE_RELAY2, relay2),
+                       (STATE_ENABLE1, enable1), (STATE_ENABLE2, enable2)):
+        if state is not None:
+            fields |= bit
+            on |= bit if state else 0
+    for i, (bit, percentage) in enumerate(((STATE_DIMMER1, dimmer1), (STATE_DIMMER2, dimmer2))):
+        if percentage is not None:
+            if not 0 <= percentage <= 100:
+                raise ValueError("Percentage must be 0-100")
+            fields |= bit
+            codes[i] = percent_to_level(percentage)
+    return fields, on, codes
+
+
+class TelemetryDecoder:
+    """Rebuild full snapshots from TELEMETRY_FRAME bytes
+    
+    A frame is [0x29, seq, ref, bitmap varint, zigzag varint per set bit];
+    each value is the difference to snapshot ref (to zero in a key frame,
+    ref == seq). Frames against a snapshot this decoder does not hold are
+    counted in unsynced and skipped until the next key frame.
+    """
+    
+    def __init__(self):
+        self.snapshots = [None] * 256
+        self.last_seq = None
+        self.frames = 0
+        self.key_frames = 0
+        self.unsynced = 0
+        self.lost = 0
+    
+    @staticmethod
+    def _varint(data, pos):
+        value = shift = 0
+        while True:
+            if pos >= len(data):
+                return None, pos
+            byte = data[pos]
+            pos += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value, pos
+    
+    def decode(self, data, pos=0):
+        """Decode one frame at data[pos]; return (seq, snapshot or None, next pos),
+        or None if the frame is not complete yet"""
+        if len(data) < pos + 4:
+            return None
+        seq, ref = data[pos + 1], data[pos + 2]
+        bitmap, p = self._varint(data, pos + 3)
+        if bitmap is None:
+            return None
+        deltas = []
+        for _ in range(bin(bitmap).count("1")):
+            z, p = self._varint(data, p)
+            if z is None:
+                return None
+            deltas.append((z >> 1) ^ -(z & 1))
+        
+        if self.last_seq is not None:
+            gap = (seq - self.last_seq - 1) & 0xFF
+            self.lost += gap
+            for k in range(gap):
+                self.snapshots[(self.last_seq + 1 + k) & 0xFF] = None
+        self.last_seq = seq
+        
+        key = ref == seq
+        base = [0] * len(TELEMETRY_FIELDS) if key else self.snapshots[ref]
+        if base is None:
+            self.snapshots[seq] = None
+            self.unsynced += 1
+            return seq, None, p
+        values = list(base)
+        it = iter(deltas)
+        for f in range(len(TELEMETRY_FIELDS)):
+            if bitmap & (1 << f):
+                values[f] += next(it)
+        self.snapshots[seq] = values
+        self.frames += 1
+        self.key_frames += key
+        return seq, dict(zip(TELEMETRY_FIELDS, values)), p
+
+
+def trace_to_chrome_json(events, path):
+    """Write trace events as a Chrome trace / Perfetto JSON file
+    
+    events: list of (ts_us, event_id, arg) as returned by dump_trace(),
+    already unwrapped to a monotonic microsecond timeline.
+    """
+    threads = {"usb_rx": 1, "main": 2, "i2c": 3, "usb_tx": 4, "gpio": 5}
+    out = [{"ph": "M", "pid": 1, "name": "process_name", "args": {"name": "PowerPack"}}]
+    for name, tid in threads.items():
+        out.append({"ph": "M", "pid": 1, "tid": tid, "name": "thread_name", "args": {"name": name}})
+    
+    for ts, event_id, arg in events:
+        name = TRACE_EVENT_NAMES.get(event_id, f"event_{event_id}")
+        base = {"pid": 1, "ts": ts}
+        if name == "cmd_rx":
+            out.append(dict(base, ph="i", s="t", tid=threads["usb_rx"], name=f"rx 0x{arg & 0xFF:02X}",
+                            args={"param": (arg >> 8) & 0xFF, "length": arg >> 16}))
+        elif name in ("cmd_start", "cmd_end"):
+            out.append(dict(base, ph="B" if name == "cmd_start" else "E", tid=threads["main"],
+                            name=f"cmd 0x{arg & 0xFF:02X}"))
+        elif name == "relay":
+            out.append(dict(base, ph="C", name=f"relay{arg >> 8}", args={"state": arg & 0xFF}))
+        elif name == "dimmer":
+            out.append(dict(base, ph="C", name=f"setpoint{arg >> 16}", args={"code": arg & 0xFFFF}))
+        elif name == "dimmer_enable":
+            out.append(dict(base, ph="C", name=f"dimmer{arg >> 8}_enable", args={"enabled": arg & 0xFF}))
+        elif name == "i2c_start":
+            address, reg = arg >> 24, (arg >> 16) & 0xFF
+            out.append(dict(base, ph="B", tid=threads["i2c"], name=f"write reg 0x{reg:02X}",
+                            args={"address": f"0x{address:02X}", "value": arg & 0xFFFF}))
+            if reg in (0x02, 0x04):     # GP8413 channel 0/1 data registers
+                device = "" if address in (0, GP8413_ADDRESS) else f"@0x{address:02X}"
+                out.append(dict(base, ph="C", name=f"dac{reg // 2}{device}", args={"code": arg & 0xFFFF}))
+        elif name == "i2c_stop":
+            out.append(dict(base, ph="E", tid=threads["i2c"], args={"status": arg}))
+        elif name == "usb_tx_start":
+            out.append(dict(base, ph="B", tid=threads["usb_tx"], name=f"tx {arg} B"))
+        elif name == "usb_tx_done":
+            out.append(dict(base, ph="E", tid=threads["usb_tx"]))
+        elif name == "usb_tx_busy":
+            out.append(dict(base, ph="i", s="t", tid=threads["usb_tx"], name=f"tx busy ({arg} B dropped)"))
+        elif name == "apply_state":
+            out.append(dict(base, ph="i", s="t", tid=threads["main"], name="apply state",
+                            args={"relays": f"0x{arg & 0xFF:02X}", "enables": f"0x{(arg >> 8) & 0xFF:02X}",
+                                  "dimmers": f"0x{(arg >> 16) & 0xFF:02X}"}))
+        elif name == "gpio_write":
+            out.append(dict(base, ph="i", s="t", tid=threads["gpio"], name="BSRR",
+                            args={"set": f"0x{arg & 0xFFFF:04X}", "reset": f"0x{arg >> 16:04X}"}))
+        else:
+            out.append(dict(base, ph="i", s="t", tid=threads["main"], name=name, args={"arg": arg}))
+    
+    with open(path, "w", encoding="utf-8") as f:
+        json.dump({"traceEvents": out, "displayTimeUnit": "ms"}, f)
+
+
+def symbolize(addresses, elf_path, addr2line="arm-none-eabi-addr2line"):
+    """Map code addresses to 'function at file:line' with addr2line, returns {address: text}"""
+    addresses = [a & ~1 for a in addresses]     # drop the Thumb bit
+    if not addresses:
+        return {}
+    out = subprocess.run([addr2line, "-f", "-C", "-e", elf_path] + [f"0x{a:08X}" for a in addresses],
+                         capture_output=True, text=True, check=True).stdout.splitlines()
+    return {a: f"{out[2 * i]} at {out[2 * i + 1]}" for i, a in enumerate(addresses)}
+
+
+def format_crash_report(report, elf_path=None):
+    """Render a get_crash() report as text, symbolized when an ELF is given"""
+    if not report["valid"]:
+        return f"No crash report (reset cause: {', '.join(report['reset_cause']) or 'unknown'})"
+    
+    def bits(value, names):
+        return " ".join(name for bit, name in names.items() if value & (1 << bit)) or "-"
+    
+    lines = [f"Fault #{report['count']}: {CRASH_EXCEPTION_NAMES.get(report['ipsr'], report['ipsr'])} "
+             f"after {report['uptime_ms'] / 1000.0:.3f} s",
+             f"  CFSR 0x{report['cfsr']:08X} ({bits(report['cfsr'], CRASH_CFSR_BITS)})",
+             f"  HFSR 0x{report['hfsr']:08X} ({bits(report['hfsr'], CRASH_HFSR_BITS)})"]
+    if report["cfsr"] & (1 << 15):
+        lines.append(f"  BFAR 0x{report['bfar']:08X}")
+    if report["cfsr"] & (1 << 7):
+        lines.append(f"  MMFAR 0x{report['mmfar']:08X}")
+    if not report["frame_valid"]:
+        lines.append("  Stacked frame was outside RAM: registers not captured")
+        return "\n".join(lines)
+    
+    code = [report["pc"], report["lr"]] + [w for w in report["stack"] if FLASH_START <= w < FLASH_END and w & 1]
+    names = symbolize(code, elf_path) if elf_path else {}
+    for reg in ("pc", "lr"):
+        value = report[reg]
+        lines.append(f"  {reg.upper():<3} 0x{value:08X}  {names.get(value & ~1, '')}".rstrip())
+    lines.append("  " + "  ".join(f"{r.upper()} 0x{report[r]:08X}" for r in ("r0", "r1", "r2", "r3", "r12")))
+    lines.append(f"  xPSR 0x{report['xpsr']:08X}  SP 0x{report['sp']:08X}  EXC_RETURN 0x{report['exc_return']:08X}")
+    lines.append("  Stack:")
+    for i, word in enumerate(report["stack"]):
+        hint = names.get(word & ~1, "") if (FLASH_START <= word < FLASH_END and word & 1) else ""
+        lines.append(f"    [SP+{4 * i:02d}] 0x{word:08X}  {hint}".rstrip())
+    return "\n".join(lines)
+
+
+def crc16_ccitt(data, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE, same as CRC16_Update() in the firmware"""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
 
 class PowerPackController:
     def __init__(self):
         self.serial_conn = None
+        self.diag_conn = None           # Diagnostics CDC port (logs, trace dumps)
         self.status_queue = queue.Queue()
         self.running = False
         self.status_thread = None
@@ -50,6 +447,7 @@ class PowerPackController:
         self.communication_timeout = 5.0  # 5 seconds timeout (increased)
         self.connection_attempts = 0
         self.max_connection_attempts = 3
+        self.monitor_paused = False     # Set during bulk transfers
         
         # Device status
         self.relay1_state = False       # Relay 1
@@ -59,6 +457,10 @@ class PowerPackController:
         self.dimmer1_enabled = False
         self.dimmer2_enabled = False
         self.firmware_version = "Unknown"
+        self.health = None              # last GET_HEALTH frame, see parse_health_response()
+        self.hello_info = None          # HELLO reply of the current connection, see hello()
+        self.connect_ms = None          # port open to first reply, last connect_usb()
+        self.hello_nonce = 0
         
         # Setup logging
         logging.basicConfig(
@@ -67,13 +469,48 @@ class PowerPackController:
         )
         self.logger = logging.getLogger(__name__)
     
-    def find_powerpack_port(self):
-        """Find the PowerPack device on USB ports"""
-        ports = serial.tools.list_ports.comports()
-        for port in ports:
+    def find_powerpack_ports(self):
+        """Map USB interface number -> serial device for the PowerPack's CDC ports"""
+        found = {}
+        for port in serial.tools.list_ports.comports():
             if "STM32" in port.description or "Virtual COM Port" in port.description:
-                return port.device
-        return None
+                # location ends in ":<config>.<interface>", e.g. "1-1:1.2"
+                try:
+                    interface = int((port.location or "").rsplit(".", 1)[1])
+                except (IndexError, ValueError):
+                    interface = len(found) * 2
+                found[interface] = port.device
+        return found
+    
+    def find_powerpack_port(self):
+        """Find the PowerPack control port"""
+        ports = self.find_powerpack_ports()
+        if not ports:
+            return None
+        return ports.get(CONTROL_INTERFACE, ports[min(ports)])
+    
+    def connect_diag(self, port=None):
+        """Open the diagnostics port (log text and trace dumps)"""
+        if port is None:
+            port = self.find_powerpack_ports().get(DIAG_INTERFACE)
+            if port is None:
+                raise Exception("Diagnostics port not found (firmware without composite USB?)")
+        if self.diag_conn and self.diag_conn.is_open:
+            self.diag_conn.close()
+        # Opening asserts DTR, which tells the firmware to start sending log text
+        self.diag_conn = serial.Serial(port=port, baudrate=115200, timeout=0.2)
+        self.diag_conn.dtr = True
+        self.logger.info(f"Diagnostics port opened: {port}")
+    
+    def read_diag_log(self, duration=1.0):
+        """Collect log text from the diagnostics port for duration seconds"""
+        if not self.diag_conn or not self.diag_conn.is_open:
+            self.connect_diag()
+        data = b""
+        deadline = time.time() + duration
+        while time.time() < deadline:
+            data += self.diag_conn.read(self.diag_conn.in_waiting or 1)
+        return data.decode("ascii", errors="replace")
     
     def get_port_list_with_descriptions(self):
         """Get list of ports with descriptions"""
@@ -109,8 +546,8 @@ class PowerPackController:
             if self.serial_conn and self.serial_conn.is_open:
                 self.logger.info("Closing existing connection")
                 self.serial_conn.close()
-                time.sleep(0.5)
             
+            start = time.perf_counter()
             self.serial_conn = serial.Serial(
                 port=port,
                 baudrate=115200,
@@ -131,20 +568,15 @@ class PowerPackController:
             self.serial_conn.reset_output_buffer()
             self.logger.info("Buffers cleared")
             
-            # Wait for connection to stabilize and check for boot message
-            self.logger.info("Waiting 3 seconds for device to stabilize...")
-            time.sleep(3)
-            
-            # Check for any initial data (boot message)
-            bytes_waiting = self.serial_conn.in_waiting
-            self.logger.info(f"Bytes waiting after stabilization: {bytes_waiting}")
-            
-            if bytes_waiting > 0:
-                boot_data = self.serial_conn.read(bytes_waiting)
-                self.logger.info(f"*** Received boot data ({len(boot_data)} bytes): {boot_data}")
-                self.logger.info(f"*** Boot data hex: {boot_data.hex()}")
+            # The control port carries framed binary only (boot and log text go
+            # to the diagnostics port), so the handshake reply is the first
+            # thing to wait for; stale bytes are skipped by the nonce
+            self.hello_info = self.hello()
+            self.connect_ms = (time.perf_counter() - start) * 1000
+            if self.hello_info is None:
+                self.logger.warning("No HELLO reply: firmware without the handshake, state unknown until a status reply")
             else:
-                self.logger.warning("!!! No boot message received from device !!!")
+                self.logger.info(f"HELLO from firmware {self.firmware_version} after {self.connect_ms:.1f} ms")
             
             # Update communication timestamp
             self.last_communication = time.time()
@@ -164,6 +596,92 @@ class PowerPackController:
                 self.serial_conn = None
             return False
     
+    def hello(self, schedule=HELLO_RETRY_S):
+        """HELLO handshake: firmware version, capabilities and output state in one reply
+        
+        Each try waits the next time in schedule for a reply carrying its
+        nonce, so a reply to an earlier try or a stale frame is not taken.
+        Updates the cached state and queues 'version' and 'status' entries
+        for the GUI. Returns the reply as a dict, None if nothing answered.
+        """
+        saved_timeout = self.serial_conn.timeout
+        self.serial_conn.timeout = 0.002
+        buffer = b""
+        try:
+            for attempt, wait in enumerate(schedule):
+                self.hello_nonce = (self.hello_nonce + 1) & 0xFF
+                nonce = self.hello_nonce
+                self.send_frame(struct.pack('>BBHBBBB', CMD_HELLO, nonce, 0, 0, 0, 0, 0))
+                deadline = time.perf_counter() + wait
+                while time.perf_counter() < deadline:
+                    buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                    i = buffer.find(bytes([CMD_HELLO, nonce]))
+                    if i < 0 or len(buffer) < i + HELLO_HEADER_SIZE or \
+                            len(buffer) < i + HELLO_HEADER_SIZE + 3 * buffer[i + 7]:
+                        continue
+                    (protocol, major, minor, patch, relays, dimmers, dacs_found, present, i2c_khz,
+                     features, reset_flags, uptime_ms, relay_bits, enables) = struct.unpack(
+                        '>7BHHIBIHH', buffer[i + 2:i + HELLO_HEADER_SIZE])
+                    tail = buffer[i + HELLO_HEADER_SIZE:i + HELLO_HEADER_SIZE + 3 * dimmers]
+                    levels = struct.unpack(f'>{dimmers}H', tail[:2 * dimmers])
+                    curves = tail[2 * dimmers:]
+                    info = {
+                        "attempts": attempt + 1,
+                        "protocol": protocol,
+                        "firmware": f"{major}.{minor}.{patch}",
+                        "relays": relays,
+                        "dimmers": dimmers,
+                        "dacs_found": [GP8413_ADDRESS + n for n in range(8) if dacs_found & (1 << n)],
+                        "dimmers_present": present,
+                        "i2c_khz": i2c_khz,
+                        "features": [name for n, name in enumerate(FEATURE_NAMES) if features & (1 << n)],
+                        "reset_flags": reset_flags,
+                        "uptime_ms": uptime_ms,
+                        "relay_bits": relay_bits,
+                        "enable_bits": enables,
+                        "levels": list(levels),
+                        "curves": [CURVE_NAMES[c] if c < len(CURVE_NAMES) else c for c in curves],
+                    }
+                    self.last_communication = time.time()
+                    self.firmware_version = f"v{info['firmware']}"
+                    self.relay1_state = bool(relay_bits & 0x01)
+                    self.relay2_state = bool(relay_bits & 0x02)
+                    self.dimmer1_enabled = bool(enables & 0x01)
+                    self.dimmer2_enabled = bool(enables & 0x02)
+                    self.dimmer1_value = levels[0] if dimmers > 0 else 0
+                    self.dimmer2_value = levels[1] if dimmers > 1 else 0
+                    self.status_queue.put({'type': 'version', 'version': self.firmware_version})
+                    self.status_queue.put({
+                        'type': 'status',
+                        'relay1': self.relay1_state, 'relay2': self.relay2_state,
+                        'dimmer1_value': self.dimmer1_value, 'dimmer2_value': self.dimmer2_value,
+                        'dimmer1_enabled': self.dimmer1_enabled, 'dimmer2_enabled': self.dimmer2_enabled,
+                    })
+                    return info
+                self.logger.debug(f"No HELLO reply within {wait * 1000:.0f} ms (try {attempt + 1})")
+            return None
+        finally:
+            self.serial_conn.timeout = saved_timeout
+    
+    def bench_connect(self, port=None, runs=10):
+        """Time connect_usb() (port open to HELLO reply) and the handshake alone
+        
+        Reopens the port runs times; call before start_monitoring(). Returns
+        {"connect_ms": [...], "hello_ms": [...]}.
+        """
+        if port is None:
+            port = self.serial_conn.port if self.serial_conn else self.find_powerpack_port()
+        connect_ms, hello_ms = [], []
+        for _ in range(runs):
+            if not self.connect_usb(port) or self.hello_info is None:
+                raise Exception("Connect or HELLO failed")
+            connect_ms.append(self.connect_ms)
+            start = time.perf_counter()
+            if self.hello() is None:
+                raise Exception("HELLO failed")
+            hello_ms.append((time.perf_counter() - start) * 1000)
+        return {"connect_ms": connect_ms, "hello_ms": hello_ms}
+    
     def disconnect(self):
         """Disconnect from PowerPack"""
         self.running = False
@@ -172,6 +690,13 @@ class PowerPackController:
         if self.status_thread and self.status_thread.is_alive():
             self.status_thread.join(timeout=2.0)  # Wait max 2 seconds
         
+        if self.diag_conn:
+            try:
+                self.diag_conn.close()
+            except Exception:
+                pass
+            self.diag_conn = None
+        
         # Close serial connection
         if self.serial_conn:
             try:
@@ -256,8 +781,8 @@ class PowerPackController:
         if not 0 <= percentage <= 100:
             raise ValueError("Percentage must be 0-100")
         
-        # Convert percentage to 12-bit DAC value (0-4095)
-        dac_value = int((percentage / 100.0) * 4095)
+        # 16-bit level; the device scales it to the 15-bit DAC in fixed point
+        dac_value = percent_to_level(percentage)
         
         cmd = CMD_SET_DIMMER1 if dimmer_num == 1 else CMD_SET_DIMMER2
         self.send_command(cmd, 0, dac_value)
@@ -278,6 +803,111 @@ class PowerPackController:
         
         self.send_command(cmd)
     
+    def apply_state(self, relay1=None, relay2=None, dimmer1=None, dimmer2=None,
+                    enable1=None, enable2=None):
+        """Apply several outputs at once; None leaves a field as it is
+        
+        Dimmer values are percentages like set_dimmer(). The device switches
+        only the fields that differ from its current state and returns them
+        as a STATE_* mask.
+        """
+        fields, on, codes = state_fields(relay1, relay2, dimmer1, dimmer2, enable1, enable2)
+        if not fields:
+            return 0
+        
+        self.monitor_paused = True
+        try:
+            status, changed = self.wave_transaction(
+                struct.pack('>BBBBHH', CMD_APPLY_STATE, fields, on, 0, codes[0], codes[1]))
+        finally:
+            self.monitor_paused = False
+        if status != 0:
+            raise Exception(f"Apply state failed: {STATE_STATUS_TEXT.get(status, status)}")
+        
+        if relay1 is not None: self.relay1_state = relay1
+        if relay2 is not None: self.relay2_state = relay2
+        if dimmer1 is not None: self.dimmer1_value = codes[0]
+        if dimmer2 is not None: self.dimmer2_value = codes[1]
+        if enable1 is not None: self.dimmer1_enabled = enable1
+        if enable2 is not None: self.dimmer2_enabled = enable2
+        return changed
+    
+    def bulk_outputs(self, kind, mask, payload):
+        """Send one CMD_BULK_OUTPUTS frame, returns the mask of channels that changed
+        
+        kind is BULK_*; payload is the on-mask for relays and enables, or the
+        list of levels (0-LEVEL_MAX) for BULK_DIMMERS (one per channel in the
+        mask, lowest channel first) and BULK_DIMMERS_SAME (one level).
+        """
+        if kind in (BULK_RELAYS, BULK_ENABLES):
+            frame = struct.pack('>BBHHBB', CMD_BULK_OUTPUTS, kind, mask, payload, 0, 0)
+        else:
+            codes = [max(0, min(LEVEL_MAX, int(c))) for c in payload]
+            frame = struct.pack(f'>BBH{len(codes)}H', CMD_BULK_OUTPUTS, kind, mask, *codes)
+            frame += bytes(max(0, 8 - len(frame)))
+        self.monitor_paused = True
+        try:
+            status, changed = self.wave_transaction(frame)
+        finally:
+            self.monitor_paused = False
+        if status != 0:
+            raise Exception(f"Bulk update failed: {STATE_STATUS_TEXT.get(status, status)}")
+        return changed
+    
+    def set_relays(self, mask, on_mask):
+        """Switch the relays in mask (bit n = relay n+1) to the bits of on_mask"""
+        return self.bulk_outputs(BULK_RELAYS, mask, on_mask)
+    
+    def enable_dimmers(self, mask, on_mask):
+        """Switch the dimmer output enables in mask to the bits of on_mask"""
+        return self.bulk_outputs(BULK_ENABLES, mask, on_mask)
+    
+    def set_dimmers(self, mask, percentages):
+        """Set the dimmers in mask; one percentage for all, or one per channel"""
+        if any(not 0 <= p <= 100 for p in percentages):
+            raise ValueError("Percentage must be 0-100")
+        codes = [percent_to_level(p) for p in percentages]
+        kind = BULK_DIMMERS_SAME if len(codes) == 1 else BULK_DIMMERS
+        if kind == BULK_DIMMERS and len(codes) != bin(mask).count("1"):
+            raise ValueError("One percentage per channel in the mask, or a single one for all")
+        return self.bulk_outputs(kind, mask, codes)
+    
+    def bench_channels(self):
+        """Time DAC updates as the channel count grows, in microseconds
+        
+        The device times 1..N channels of its own table (N = channels it
+        has). Counts beyond that up to MAX_DAC_CHANNELS are modelled from the
+        measured one- and two-channel times: channels pair up per GP8413, in
+        one I2C frame or two depending on the firmware's channel table.
+        Returns (i2c_khz, [(channels, us, measured)]).
+        """
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHBBBB', CMD_BENCH_CHANNELS, 0, 0, 0, 0, 0, 0))
+            buffer = b""
+            deadline = time.time() + 1.0
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(bytes([CMD_BENCH_CHANNELS]))
+                if i >= 0 and len(buffer) >= i + 4 and len(buffer) >= i + 4 + 2 * buffer[i + 1]:
+                    count = buffer[i + 1]
+                    i2c_khz = struct.unpack('>H', buffer[i + 2:i + 4])[0]
+                    times = struct.unpack(f'>{count}H', buffer[i + 4:i + 4 + 2 * count])
+                    self.last_communication = time.time()
+                    break
+            else:
+                raise Exception("No channel benchmark received")
+        finally:
+            self.monitor_paused = False
+        
+        rows = [(n + 1, t, True) for n, t in enumerate(times)]
+        if count >= 2:
+            one, pair = times[0], times[1]
+            for n in range(count + 1, MAX_DAC_CHANNELS + 1):
+                rows.append((n, (n // 2) * pair + (n % 2) * one, False))
+        return i2c_khz, rows
+    
     def debug_test(self):
         """Debug test - send raw commands"""
         try:
@@ -334,6 +964,993 @@ class PowerPackController:
         except Exception as e:
             self.update_status(f"[DEBUG] Debug test failed: {e}")
     
+    def send_frame(self, frame):
+        """Send a raw (up to 64 byte) frame via USB"""
+        if not self.serial_conn or not self.serial_conn.is_open:
+            raise Exception("USB not connected")
+        self.serial_conn.write(frame)
+        self.serial_conn.flush()
+        self.last_communication = time.time()
+    
+    def wait_for_ack(self, cmd, timeout=0.5):
+        """Wait for an 8-byte [cmd, status, value_hi, value_lo, 0, 0, 0, 0] acknowledgement"""
+        buffer = b""
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            waiting = self.serial_conn.in_waiting
+            if waiting:
+                buffer += self.serial_conn.read(waiting)
+                # Debug text may share the pipe; find the binary ack inside it
+                for i in range(len(buffer) - 7):
+                    if buffer[i] == cmd and buffer[i + 4:i + 8] == b"\x00\x00\x00\x00":
+                        self.last_communication = time.time()
+                        return buffer[i + 1], (buffer[i + 2] << 8) | buffer[i + 3]
+            else:
+                time.sleep(0.002)
+        return None
+    
+    def wave_transaction(self, frame, retries=3):
+        """Send a waveform frame and return (status, value), retrying lost acks"""
+        for attempt in range(retries):
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(frame)
+            ack = self.wait_for_ack(frame[0])
+            if ack is not None:
+                return ack
+            self.logger.warning(f"No ack for 0x{frame[0]:02X} (attempt {attempt + 1})")
+        raise Exception(f"Waveform command 0x{frame[0]:02X} not acknowledged")
+    
+    def upload_waveform(self, samples, channel_mask=1):
+        """Upload a table of levels (interleaved ch1, ch2 when channel_mask is 3)"""
+        samples = [max(0, min(LEVEL_MAX, int(v))) for v in samples]
+        if not 0 < len(samples) <= WAVE_MAX_SAMPLES:
+            raise ValueError(f"1-{WAVE_MAX_SAMPLES} samples required")
+        
+        self.monitor_paused = True
+        try:
+            status, _ = self.wave_transaction(struct.pack('>BBHBBBB', CMD_WAVE_BEGIN, channel_mask, len(samples), 0, 0, 0, 0))
+            if status != 0:
+                raise Exception(f"Upload rejected: {WAVE_STATUS_TEXT.get(status, status)}")
+            
+            for offset in range(0, len(samples), WAVE_CHUNK_MAX_SAMPLES):
+                chunk = samples[offset:offset + WAVE_CHUNK_MAX_SAMPLES]
+                frame = struct.pack(f'>BBH{len(chunk)}H', CMD_WAVE_CHUNK, len(chunk), offset, *chunk)
+                frame += struct.pack('>H', crc16_ccitt(frame))
+                status, next_offset = self.wave_transaction(frame)
+                if status != 0 or next_offset != offset + len(chunk):
+                    raise Exception(f"Chunk at {offset} failed: {WAVE_STATUS_TEXT.get(status, status)}")
+            
+            table_crc = crc16_ccitt(struct.pack(f'>{len(samples)}H', *samples))
+            status, max_rate = self.wave_transaction(struct.pack('>BBHBBBB', CMD_WAVE_COMMIT, 0, table_crc, 0, 0, 0, 0))
+            if status != 0:
+                raise Exception(f"Commit failed: {WAVE_STATUS_TEXT.get(status, status)}")
+            
+            self.logger.info(f"Waveform uploaded: {len(samples)} samples, max rate {max_rate} Hz")
+            return max_rate
+        finally:
+            self.monitor_paused = False
+    
+    def play_waveform(self, sample_rate, loop=True):
+        """Start playback of the uploaded table"""
+        mode = WAVE_MODE_LOOP if loop else WAVE_MODE_ONESHOT
+        self.monitor_paused = True
+        try:
+            status, max_rate = self.wave_transaction(struct.pack('>BBHBBBB', CMD_WAVE_PLAY, mode, sample_rate, 0, 0, 0, 0))
+        finally:
+            self.monitor_paused = False
+        if status != 0:
+            raise Exception(f"Playback rejected: {WAVE_STATUS_TEXT.get(status, status)} (max {max_rate} Hz)")
+    
+    def stop_waveform(self):
+        """Stop waveform playback"""
+        self.monitor_paused = True
+        try:
+            self.wave_transaction(struct.pack('>BBHBBBB', CMD_WAVE_PLAY, WAVE_MODE_STOP, 0, 0, 0, 0, 0))
+        finally:
+            self.monitor_paused = False
+    
+    def start_stream(self, channel_mask=3, latency_ms=STREAM_DEFAULT_LATENCY_MS):
+        """Start setpoint streaming, returns the number of buffer slots (initial credit)"""
+        status, slots = self.wave_transaction(struct.pack('>BBHBBBB', CMD_STREAM_START, channel_mask, latency_ms, 0, 0, 0, 0))
+        if status != 0:
+            raise Exception(f"Stream rejected: {STREAM_STATUS_TEXT.get(status, status)}")
+        return slots
+    
+    def stop_stream(self):
+        """Stop setpoint streaming; outputs keep their last value"""
+        self.wave_transaction(struct.pack('>BBHBBBB', CMD_STREAM_STOP, 0, 0, 0, 0, 0, 0))
+    
+    def get_stream_stats(self, reset=True):
+        """Read the jitter buffer statistics"""
+        self.serial_conn.reset_input_buffer()
+        self.send_frame(struct.pack('>BBHBBBB', CMD_STREAM_STATS, 1 if reset else 0, 0, 0, 0, 0, 0))
+        buffer = b""
+        deadline = time.time() + 0.5
+        while time.time() < deadline:
+            buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+            i = buffer.find(bytes([CMD_STREAM_STATS]))
+            if i >= 0 and len(buffer) >= i + 16:
+                fields = struct.unpack('>BBBBBBHHHI', buffer[i:i + 16])
+                return dict(zip(("active", "fill", "fill_min", "fill_max", "free",
+                                 "underruns", "late", "overflows", "played"), fields[1:]))
+        raise Exception("No stream statistics received")
+    
+    def stream_setpoints(self, records, channel_mask=3, latency_ms=STREAM_DEFAULT_LATENCY_MS):
+        """Stream (ts_ms, dimmer1_code, dimmer2_code) records to the device
+        
+        The device acknowledges every data frame with its free slot count. The
+        credit is that count minus the records sent after the acknowledged
+        frame, so the jitter buffer is never overrun; the device clock sets
+        the pace. Returns the buffer statistics once all records are queued.
+        """
+        self.monitor_paused = True
+        try:
+            credit = self.start_stream(channel_mask, latency_ms)
+            in_flight = {}      # seq -> records, in send order
+            rx = b""
+            seq = 0
+            
+            def collect_acks(wait):
+                """Apply every ack received so far; with wait, block until credit or in-flight frames drain"""
+                nonlocal credit, rx
+                deadline = time.time() + wait
+                while True:
+                    rx += self.serial_conn.read(self.serial_conn.in_waiting or (1 if wait else 0))
+                    while True:
+                        i = rx.find(bytes([CMD_STREAM_DATA]))
+                        if i < 0 or len(rx) < i + 8:
+                            rx = rx[i:] if i >= 0 else b""
+                            break
+                        ack, rx = rx[i:i + 8], rx[i + 8:]
+                        if ack[5:8] != b"\x00\x00\x00" or ack[1] not in in_flight:
+                            continue
+                        if ack[2] != 0:
+                            self.logger.warning(f"Stream frame {ack[1]}: {STREAM_STATUS_TEXT.get(ack[2], ack[2])}")
+                        for acked in list(in_flight):
+                            del in_flight[acked]
+                            if acked == ack[1]:
+                                break
+                        credit = ack[3] - sum(in_flight.values())
+                        self.last_communication = time.time()
+                    if not wait or credit > 0 or not in_flight or time.time() >= deadline:
+                        return
+            
+            def send_batch(batch):
+                nonlocal credit, seq
+                frame = struct.pack('>BBB', CMD_STREAM_DATA, seq, len(batch))
+                for ts_ms, code1, code2 in batch:
+                    frame += struct.pack('>HHH', int(ts_ms) & 0xFFFF,
+                                         max(0, min(LEVEL_MAX, int(code1))), max(0, min(LEVEL_MAX, int(code2))))
+                self.send_frame(frame)
+                in_flight[seq] = len(batch)
+                credit -= len(batch)
+                seq = (seq + 1) & 0xFF
+            
+            records = list(records)
+            pos = 0
+            stalled_since = time.time()
+            while pos < len(records):
+                collect_acks(0)
+                if credit <= 0:
+                    if in_flight:
+                        collect_acks(STREAM_ACK_TIMEOUT)
+                    else:
+                        # Buffer full and nothing outstanding: an empty frame polls for credit
+                        time.sleep(0.005)
+                        send_batch([])
+                    if time.time() - stalled_since > STREAM_ACK_TIMEOUT and credit <= 0 and in_flight:
+                        raise Exception("Stream stalled: no credit returned")
+                    continue
+                batch = records[pos:pos + min(credit, STREAM_FRAME_MAX_RECORDS)]
+                send_batch(batch)
+                pos += len(batch)
+                stalled_since = time.time()
+            
+            collect_acks(STREAM_ACK_TIMEOUT)
+            return self.get_stream_stats()
+        finally:
+            self.monitor_paused = False
+    
+    def get_metrics(self):
+        """Read the device metrics table, returns {name: value}"""
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHBBBB', CMD_GET_METRICS, 0, 0, 0, 0, 0, 0))
+            header = bytes([CMD_GET_METRICS, len(METRIC_DEFS), 0, 0])
+            size = len(header) + 4 * len(METRIC_DEFS)
+            buffer = b""
+            deadline = time.time() + 0.5
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(header)
+                if i >= 0 and len(buffer) >= i + size:
+                    values = struct.unpack(f'>{len(METRIC_DEFS)}I', buffer[i + len(header):i + size])
+                    self.last_communication = time.time()
+                    metrics = {name: value for (name, _, _), value in zip(METRIC_DEFS, values)}
+                    metrics["uptime_seconds"] /= 1000.0
+                    return metrics
+            raise Exception("No metrics received")
+        finally:
+            self.monitor_paused = False
+    
+    def bench_outputs(self):
+        """Time Set_Relay/Set_Dimmer on the device, returns CPU cycles at 48 MHz
+        
+        The device rewrites the current relay 1 and dimmer 1 state, so nothing
+        switches. The dimmer figures include the I2C bus time of the frame.
+        """
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHBBBB', CMD_BENCH_OUTPUTS, 0, 0, 0, 0, 0, 0))
+            buffer = b""
+            deadline = time.time() + 1.0
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(bytes([CMD_BENCH_OUTPUTS]))
+                if i >= 0 and len(buffer) >= i + 20:
+                    fields = struct.unpack('>BBHIIII', buffer[i:i + 20])
+                    self.last_communication = time.time()
+                    return dict(zip(("driver", "i2c_khz", "relay_min", "relay_avg",
+                                     "dimmer_min", "dimmer_avg"), fields[1:]))
+            raise Exception("No benchmark result received")
+        finally:
+            self.monitor_paused = False
+    
+    def get_memory(self):
+        """Read the RAM usage report: static size, heap and painted-stack peaks in bytes"""
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHBBBB', CMD_GET_MEMORY, 0, 0, 0, 0, 0, 0))
+            buffer = b""
+            deadline = time.time() + 0.5
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(bytes([CMD_GET_MEMORY]))
+                if i >= 0 and len(buffer) >= i + 22:
+                    flags = buffer[i + 1]
+                    usage = dict(zip(MEMORY_FIELDS, struct.unpack('>10H', buffer[i + 2:i + 22])))
+                    usage["warnings"] = [text for bit, text in MEMORY_FLAG_TEXT.items() if flags & bit]
+                    self.last_communication = time.time()
+                    return usage
+            raise Exception("No memory report received")
+        finally:
+            self.monitor_paused = False
+    
+    def get_timing(self, reset=False):
+        """Read the DWT cycle statistics of the USB ISR and command path
+        
+        Returns (in_ram, queue_high_water, {name: (samples, min, avg, max)})
+        in CPU cycles; in_ram tells whether the firmware runs the hot path from
+        .RamFunc, queue_high_water is the deepest PendSV queue fill seen.
+        """
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHBBBB', CMD_GET_TIMING, 1 if reset else 0, 0, 0, 0, 0, 0))
+            buffer = b""
+            deadline = time.time() + 0.5
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(bytes([CMD_GET_TIMING]))
+                if i >= 0 and len(buffer) >= i + 4 and len(buffer) >= i + 4 + 14 * buffer[i + 2]:
+                    flags, count, queue = buffer[i + 1], buffer[i + 2], buffer[i + 3]
+                    stats = {}
+                    for n in range(count):
+                        name = TIMING_NAMES[n] if n < len(TIMING_NAMES) else f"timing_{n}"
+                        stats[name] = struct.unpack('>HIII', buffer[i + 4 + 14 * n:i + 18 + 14 * n])
+                    self.last_communication = time.time()
+                    return bool(flags & 0x01), queue, stats
+            raise Exception("No timing statistics received")
+        finally:
+            self.monitor_paused = False
+    
+    def isr_load_test(self, seconds=12):
+        """Worst-case USB ISR latency under combined load
+        
+        Restarts the timing statistics, then streams a 1 kHz triangle fade on
+        both dimmers for the given time. That is a STREAM_DATA command burst
+        handled in the USB interrupt, DAC transfers from TIM4 and, every 5 s,
+        the status task push. SOF interrupts arrive exactly 1 ms apart, so the
+        spread of their interval bounds the USB ISR entry latency.
+        """
+        self.get_timing(reset=True)
+        ramp = list(range(0, LEVEL_MAX + 1, 256)) + list(range(LEVEL_MAX, -1, -256))
+        records = [(t, ramp[t % len(ramp)], ramp[(t + len(ramp) // 2) % len(ramp)])
+                   for t in range(int(seconds * 1000))]
+        stream_stats = self.stream_setpoints(records)
+        in_ram, queue, stats = self.get_timing()
+        samples, low, _, high = stats["sof_interval"]
+        return {"in_ram": in_ram, "queue_high_water": queue, "stats": stats, "stream": stream_stats,
+                "sof_late_cycles": max(high - SOF_CYCLES, 0), "sof_early_cycles": max(SOF_CYCLES - low, 0)}
+    
+    def get_tasks(self, reset=False):
+        """Read the per-task CPU accounting of the firmware scheduler
+        
+        Returns (elapsed_ms, idle_permille, {name: (runs, busy_permille,
+        max_cycles)}). Idle is time spent in WFI; what is left of 1000 after
+        idle and the tasks went to interrupt handlers.
+        """
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHBBBB', CMD_GET_TASKS, 1 if reset else 0, 0, 0, 0, 0, 0))
+            buffer = b""
+            deadline = time.time() + 0.5
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(bytes([CMD_GET_TASKS]))
+                if i >= 0 and len(buffer) >= i + 8 and len(buffer) >= i + 8 + 10 * buffer[i + 1]:
+                    count = buffer[i + 1]
+                    idle, elapsed = struct.unpack('>HI', buffer[i + 2:i + 8])
+                    tasks = {}
+                    for n in range(count):
+                        name = TASK_NAMES[n] if n < len(TASK_NAMES) else f"task_{n}"
+                        tasks[name] = struct.unpack('>IHI', buffer[i + 8 + 10 * n:i + 18 + 10 * n])
+                    self.last_communication = time.time()
+                    return elapsed, idle, tasks
+            raise Exception("No task accounting received")
+        finally:
+            self.monitor_paused = False
+    
+    def get_power(self):
+        """Read the USB suspend and low-power statistics
+        
+        stop_ms is counted on the LSI-clocked RTC, so it is only accurate to
+        the LSI tolerance. wake_us is STOP exit until the PLL runs again,
+        without the regulator wake-up time before the first instruction.
+        """
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHBBBB', CMD_GET_POWER, 0, 0, 0, 0, 0, 0))
+            buffer = b""
+            deadline = time.time() + 0.5
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(bytes([CMD_GET_POWER]))
+                if i >= 0 and len(buffer) >= i + POWER_REPLY_SIZE:
+                    flags = buffer[i + 1]
+                    fields = struct.unpack('>HIIIHH', buffer[i + 2:i + POWER_REPLY_SIZE])
+                    self.last_communication = time.time()
+                    power = dict(zip(("suspends", "stop_entries", "stop_ms", "sleep_entries",
+                                      "wake_us_last", "wake_us_max"), fields))
+                    power["suspended"] = bool(flags & 0x01)
+                    power["outputs_busy"] = bool(flags & 0x02)
+                    return power
+            raise Exception("No power statistics received")
+        finally:
+            self.monitor_paused = False
+    
+    def get_capabilities(self):
+        """Read the channel map, DAC addresses and firmware features
+        
+        dimmers_present has a bit per dimmer whose GP8413 answered the boot
+        probe; commands for the others fail with "no DAC at that channel".
+        """
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHBBBB', CMD_GET_CAPABILITIES, 0, 0, 0, 0, 0, 0))
+            buffer = b""
+            deadline = time.time() + 0.5
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(bytes([CMD_GET_CAPABILITIES]))
+                if i >= 0 and len(buffer) >= i + CAPS_HEADER_SIZE and \
+                        len(buffer) >= i + CAPS_HEADER_SIZE + 2 * buffer[i + 6]:
+                    (protocol, major, minor, patch, relays, dimmers, dacs_found,
+                     present, i2c_khz, features) = struct.unpack('>7BHHI', buffer[i + 1:i + CAPS_HEADER_SIZE])
+                    table = buffer[i + CAPS_HEADER_SIZE:i + CAPS_HEADER_SIZE + 2 * dimmers]
+                    self.last_communication = time.time()
+                    return {
+                        "protocol": protocol,
+                        "firmware": f"{major}.{minor}.{patch}",
+                        "relays": relays,
+                        "dimmers": [{"address": table[2 * n], "bits": table[2 * n + 1],
+                                     "present": bool(present & (1 << n))} for n in range(dimmers)],
+                        "dacs_found": [GP8413_ADDRESS + n for n in range(8) if dacs_found & (1 << n)],
+                        "i2c_khz": i2c_khz,
+                        "features": [name for n, name in enumerate(FEATURE_NAMES) if features & (1 << n)],
+                    }
+            raise Exception("No capabilities received")
+        finally:
+            self.monitor_paused = False
+    
+    def dither(self, param, value=0):
+        """Send CMD_DITHER and return (status, rate_hz, stats dict)"""
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHBBBB', CMD_DITHER, param, value, 0, 0, 0, 0))
+            buffer = b""
+            deadline = time.time() + 0.5
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(bytes([CMD_DITHER]))
+                if i >= 0 and len(buffer) >= i + DITHER_REPLY_SIZE:
+                    status = buffer[i + 1]
+                    rate = struct.unpack('>H', buffer[i + 2:i + 4])[0]
+                    fields = struct.unpack('>6I', buffer[i + 4:i + 28])
+                    self.last_communication = time.time()
+                    return status, rate, dict(zip(("elapsed_ms", "ticks", "writes", "busy",
+                                                   "cycles", "cycles_max"), fields))
+            raise Exception("No dither reply received")
+        finally:
+            self.monitor_paused = False
+    
+    def set_dither(self, rate_hz):
+        """Dither dimmers 1 and 2 at rate_hz (one of DITHER_RATES), 0 = off"""
+        status, _, _ = self.dither(DITHER_CMD_SET, rate_hz)
+        if status != 0:
+            raise ValueError(f"Dither rate must be 0 or one of {DITHER_RATES}")
+    
+    def bench_dither(self, seconds=2.0, mask=0x03):
+        """Measure the CPU and I2C cost of the dither at each rate
+        
+        Parks the dimmers in mask on the level near 50 % whose DAC code has
+        a fraction closest to 1/2, so every update toggles the code: the
+        worst case. CPU load is the cycles counted in the TIM4 updates; bus
+        load is the frames sent at 38 SCL periods each. Restores the levels
+        and switches the dither off afterwards.
+        """
+        caps = self.get_capabilities()
+        channels = [n for n in range(2) if mask & (1 << n) and caps["dimmers"][n]["present"]]
+        if not channels:
+            raise ValueError("No dithered dimmer (1 or 2) present in the mask")
+        mask = sum(1 << n for n in channels)
+        previous = [self.dimmer1_value, self.dimmer2_value]     # from the last status reply
+        level = min(range(LEVEL_MAX // 2 - 64, LEVEL_MAX // 2 + 64),
+                    key=lambda l: abs((level_to_q16(l) & 0xFFFF) - 0x8000))
+        self.bulk_outputs(BULK_DIMMERS_SAME, mask, [level])
+        rows = []
+        try:
+            for rate in DITHER_RATES:
+                self.set_dither(rate)
+                time.sleep(seconds)
+                _, _, s = self.dither(DITHER_CMD_STATS)
+                elapsed = max(s["elapsed_ms"], 1) / 1000
+                frames = s["writes"] * len(channels)
+                rows.append({
+                    "rate_hz": rate,
+                    "updates_per_s": s["ticks"] / elapsed,
+                    "cpu_pct": 100 * s["cycles"] / (elapsed * CPU_HZ),
+                    "cycles_avg": s["cycles"] // max(s["ticks"], 1),
+                    "cycles_max": s["cycles_max"],
+                    "bus_pct": 100 * frames * 38 / (elapsed * caps["i2c_khz"] * 1000),
+                    "busy": s["busy"],
+                })
+        finally:
+            self.set_dither(0)
+            self.bulk_outputs(BULK_DIMMERS, mask, [previous[n] for n in channels])
+        return level, rows
+    
+    def set_curve(self, mask, curve):
+        """Select the dimming curve (name from CURVE_NAMES) of the dimmers in mask
+        
+        The levels stay as they are; the device maps them through the new
+        curve from now on, with the tables generated by dimming_curves.py.
+        """
+        if curve not in CURVE_NAMES:
+            raise ValueError(f"Curve must be one of {', '.join(CURVE_NAMES)}")
+        self.monitor_paused = True
+        try:
+            status, _ = self.wave_transaction(
+                struct.pack('>BBHBBBB', CMD_SET_CURVE, CURVE_NAMES.index(curve), mask, 0, 0, 0, 0))
+        finally:
+            self.monitor_paused = False
+        if status != 0:
+            raise Exception(f"Set curve failed: {STATE_STATUS_TEXT.get(status, status)}")
+    
+    def pulse_relay(self, relay_num, width_ms):
+        """Move a relay away from its state for width_ms (1-65535), timed by the device"""
+        self.blink_relay(relay_num, width_ms, 0, 1)
+    
+    def blink_relay(self, relay_num, on_ms, period_ms, count=0):
+        """Blink a relay: on_ms away from its state every period_ms, count times (0 = endless)
+        
+        The edges come from a timer and DMA on the device, so they do not
+        depend on USB or the main loop. Any later write to the relay ends
+        the blink and puts it back to its state.
+        """
+        if count == 1:
+            frame = struct.pack('>BBHBBBB', CMD_PULSE_RELAY, relay_num, on_ms, 0, 0, 0, 0)
+        else:
+            frame = struct.pack('>BBHHH', CMD_BLINK_RELAY, relay_num, on_ms, period_ms, count)
+        self.monitor_paused = True
+        try:
+            status, _ = self.wave_transaction(frame)
+        finally:
+            self.monitor_paused = False
+        if status != 0:
+            raise Exception(f"Relay timing failed: {RELAY_TIMER_STATUS_TEXT.get(status, status)}")
+    
+    def trigger(self, frame):
+        """Send one CMD_TRIGGER frame and return (status, trigger dict)
+        
+        Every sub-command answers with the armed action, the settings and
+        the counters; latencies are converted from CPU cycles to us.
+        """
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(frame)
+            buffer = b""
+            deadline = time.time() + 0.5
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(bytes([CMD_TRIGGER]))
+                if i >= 0 and len(buffer) >= i + TRIGGER_REPLY_SIZE:
+                    status, action, flags, holdoff_ms, debounce_us = struct.unpack(
+                        '>BBBHH', buffer[i + 1:i + 8])
+                    counters = struct.unpack('>6I', buffer[i + 8:i + 32])
+                    self.last_communication = time.time()
+                    info = {
+                        "action": TRIGGER_ACTION_NAMES[action] if action < len(TRIGGER_ACTION_NAMES) else action,
+                        "edge": "falling" if flags & TRIGGER_FLAG_FALLING else "rising",
+                        "rearm": bool(flags & TRIGGER_FLAG_REARM),
+                        "holdoff_ms": holdoff_ms,
+                        "debounce_us": debounce_us,
+                    }
+                    info.update(zip(("fired", "holdoff", "debounce", "late"), counters[:4]))
+                    info["latency_us_last"] = counters[4] * 1e6 / CPU_HZ
+                    info["latency_us_max"] = counters[5] * 1e6 / CPU_HZ
+                    return status, info
+            raise Exception("No trigger reply received")
+        finally:
+            self.monitor_paused = False
+    
+    def _trigger_checked(self, frame):
+        status, info = self.trigger(frame)
+        if status != 0:
+            raise Exception(f"Trigger failed: {TRIGGER_STATUS_TEXT.get(status, status)}")
+        return info
+    
+    def configure_trigger(self, falling=False, rearm=False, holdoff_ms=0, debounce_us=0):
+        """Select the trigger edge, one-shot or re-arm, holdoff (ms) and debounce (0-200 us)"""
+        flags = (TRIGGER_FLAG_FALLING if falling else 0) | (TRIGGER_FLAG_REARM if rearm else 0)
+        return self._trigger_checked(struct.pack('>BBHBBH', CMD_TRIGGER, TRIGGER_CMD_CONFIG,
+                                                 holdoff_ms, flags, 0, debounce_us))
+    
+    def arm_trigger_state(self, relay1=None, relay2=None, dimmer1=None, dimmer2=None,
+                          enable1=None, enable2=None):
+        """Arm a state like apply_state(); the device applies it on the next trigger edge
+        
+        Relays and enables switch inside the edge interrupt; dimmer levels
+        follow over I2C, so turn an enable on ahead of a level change.
+        """
+        fields, on, codes = state_fields(relay1, relay2, dimmer1, dimmer2, enable1, enable2)
+        if not fields:
+            raise ValueError("Nothing to arm")
+        return self._trigger_checked(struct.pack('>BBBBHH', CMD_TRIGGER, TRIGGER_CMD_ARM_STATE,
+                                                 fields, on, codes[0], codes[1]))
+    
+    def arm_trigger_wave(self, sample_rate, loop=False):
+        """Arm the start of the uploaded waveform at sample_rate on the next trigger edge"""
+        mode = WAVE_MODE_LOOP if loop else WAVE_MODE_ONESHOT
+        return self._trigger_checked(struct.pack('>BBHBBBB', CMD_TRIGGER, TRIGGER_CMD_ARM_WAVE,
+                                                 sample_rate, mode, 0, 0, 0))
+    
+    def disarm_trigger(self):
+        return self._trigger_checked(struct.pack('>BBHBBBB', CMD_TRIGGER, TRIGGER_CMD_DISARM, 0, 0, 0, 0, 0))
+    
+    def trigger_stats(self, reset=False):
+        """Armed action, settings and counters; reset clears the counters after reading"""
+        param = TRIGGER_CMD_STATS_RESET if reset else TRIGGER_CMD_STATS
+        return self._trigger_checked(struct.pack('>BBHBBBB', CMD_TRIGGER, param, 0, 0, 0, 0, 0))
+    
+    def relay_config(self, frame):
+        """Send one CMD_RELAY_CONFIG frame and return (status, config dict)"""
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(frame)
+            buffer = b""
+            deadline = time.time() + 0.5
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(bytes([CMD_RELAY_CONFIG]))
+                if i >= 0 and len(buffer) >= i + 10 and len(buffer) >= i + 10 + 4 * buffer[i + 3]:
+                    status, stored, relays, mask, offset_us, interval_us = struct.unpack(
+                        '>BBBHHH', buffer[i + 1:i + 10])
+                    delays = struct.unpack(f'>{2 * relays}H', buffer[i + 10:i + 10 + 4 * relays])
+                    self.last_communication = time.time()
+                    return status, {
+                        "stored": bool(stored),
+                        "zero_cross_mask": mask,
+                        "zero_cross_offset_us": offset_us,
+                        "mains_interval_us": interval_us,     # 0 = no sync edges
+                        "operate_us": list(delays[0::2]),
+                        "release_us": list(delays[1::2]),
+                    }
+            raise Exception("No relay config reply received")
+        finally:
+            self.monitor_paused = False
+    
+    def _relay_config_checked(self, frame):
+        status, info = self.relay_config(frame)
+        if status != 0:
+            raise Exception(f"Relay config failed: {CONFIG_STATUS_TEXT.get(status, status)}")
+        return info
+    
+    def get_relay_config(self):
+        return self._relay_config_checked(struct.pack('>BBHBBBB', CMD_RELAY_CONFIG, CONFIG_CMD_GET, 0, 0, 0, 0, 0))
+    
+    def set_relay_delays(self, relay_num, operate_us, release_us):
+        """Set a relay's coil-to-contact times (0-50000 us), as measured on the bench
+        
+        Timed pulses, blinks, delayed and zero-cross switching compensate
+        for them. They apply at once; save_relay_config() keeps them.
+        """
+        return self._relay_config_checked(struct.pack('>BBBBHH', CMD_RELAY_CONFIG, CONFIG_CMD_SET_DELAYS,
+                                                      relay_num, 0, operate_us, release_us))
+    
+    def set_zero_cross(self, mask, offset_us=0):
+        """Switch the relays in mask on mains zero crossings (sync input on PA2)
+        
+        offset_us moves the target from the sync edge to the real crossing.
+        """
+        return self._relay_config_checked(struct.pack('>BBHHBB', CMD_RELAY_CONFIG, CONFIG_CMD_SET_ZERO_CROSS,
+                                                      mask, offset_us, 0, 0))
+    
+    def save_relay_config(self):
+        """Write the relay settings to the device's flash config page"""
+        return self._relay_config_checked(struct.pack('>BBHBBBB', CMD_RELAY_CONFIG, CONFIG_CMD_SAVE, 0, 0, 0, 0, 0))
+    
+    def switch_relay_at(self, relay_num, state, delay_ms):
+        """Switch a relay so that its contacts move delay_ms (0-65535) from now
+        
+        The coil is driven early by the relay's operate or release time.
+        Writing the relay before then applies the new state at once.
+        """
+        self.monitor_paused = True
+        try:
+            status, _ = self.wave_transaction(struct.pack('>BBHBBBB', CMD_SWITCH_RELAY_AT, relay_num,
+                                                          delay_ms, 1 if state else 0, 0, 0, 0))
+        finally:
+            self.monitor_paused = False
+        if status != 0:
+            raise Exception(f"Delayed switch failed: {RELAY_TIMER_STATUS_TEXT.get(status, status)}")
+    
+    def _telemetry_read(self, buffer, decoder, until, on_frame=None):
+        """Consume telemetry frames from buffer until a CMD_TELEMETRY reply
+        or the deadline; return (reply dict or None, rest of buffer)"""
+        while True:
+            pos = 0
+            while pos < len(buffer):
+                if buffer[pos] == TELEMETRY_FRAME:
+                    result = decoder.decode(buffer, pos)
+                    if result is None:
+                        break
+                    seq, snapshot, pos = result
+                    if on_frame:
+                        on_frame(seq, snapshot)
+                elif buffer[pos] == CMD_TELEMETRY:
+                    if len(buffer) < pos + TELEMETRY_REPLY_SIZE:
+                        break
+                    r = buffer[pos:pos + TELEMETRY_REPLY_SIZE]
+                    status, active, fields, interval_ms, key_every = struct.unpack('>BBBHH', r[1:8])
+                    words = struct.unpack('>8I', r[8:40])
+                    self.last_communication = time.time()
+                    reply = {"status": status, "active": bool(active), "fields": fields,
+                             "interval_ms": interval_ms, "key_every": key_every}
+                    reply.update(zip(("elapsed_ms", "frames", "key_frames", "bytes", "dropped",
+                                      "acks", "cycles", "cycles_max"), words))
+                    return reply, buffer[pos + TELEMETRY_REPLY_SIZE:]
+                else:
+                    pos += 1            # status push or reply queued before the stream started
+            buffer = buffer[pos:]
+            if time.time() >= until:
+                return None, buffer
+            buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+    
+    def telemetry(self, param, interval_ms=0, key_every=0):
+        """Send CMD_TELEMETRY and return the stream settings and device counters"""
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHHBB', CMD_TELEMETRY, param, interval_ms, key_every, 0, 0))
+            reply, _ = self._telemetry_read(b"", TelemetryDecoder(), time.time() + 0.5)
+            if reply is None:
+                raise Exception("No telemetry reply received")
+            if reply["status"] != 0:
+                raise Exception("Telemetry rejected: interval out of range")
+            return reply
+        finally:
+            self.monitor_paused = False
+    
+    def record_telemetry(self, seconds, interval_ms=10, key_every=0, ack_every=1):
+        """Run the telemetry stream for a while and decode it
+        
+        Acks every ack_every-th decoded frame, so the device codes the next
+        ones against it; 0 never acks (deltas against the key frames only).
+        Returns (snapshots as (time, seq, dict), raw bytes, decoder, device
+        counters read before the stop).
+        """
+        decoder = TelemetryDecoder()
+        records = []
+        raw = bytearray()
+        
+        def on_frame(seq, snapshot):
+            if snapshot is None:
+                return
+            records.append((time.time(), seq, snapshot))
+            if ack_every and decoder.frames % ack_every == 0:
+                self.send_frame(struct.pack('>BBBBBBBB', CMD_TELEMETRY, TELEMETRY_CMD_ACK, seq, 0, 0, 0, 0, 0))
+        
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHHBB', CMD_TELEMETRY, TELEMETRY_CMD_START, interval_ms, key_every, 0, 0))
+            reply, buffer = self._telemetry_read(b"", decoder, time.time() + 0.5)
+            if reply is None or reply["status"] != 0:
+                raise Exception("Telemetry start rejected")
+            end = time.time() + seconds
+            while time.time() < end:
+                chunk = self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                raw += chunk
+                _, buffer = self._telemetry_read(buffer + chunk, decoder, 0, on_frame)
+            self.send_frame(struct.pack('>BBHHBB', CMD_TELEMETRY, TELEMETRY_CMD_STATS, 0, 0, 0, 0))
+            stats, _ = self._telemetry_read(buffer, decoder, time.time() + 0.5, on_frame)
+            self.send_frame(struct.pack('>BBHHBB', CMD_TELEMETRY, TELEMETRY_CMD_STOP, 0, 0, 0, 0))
+            time.sleep(0.05)
+            self.serial_conn.reset_input_buffer()
+        finally:
+            self.monitor_paused = False
+        if stats is None:
+            raise Exception("No telemetry statistics received")
+        return records, bytes(raw), decoder, stats
+    
+    def bench_telemetry(self, seconds=2.0, interval_ms=10, key_every=0):
+        """Compare the telemetry stream with the fixed 16-byte status push
+        
+        Bytes per update come from the device counters. Decode cost is the
+        host time to rebuild the recorded snapshots from the raw stream,
+        against parsing the same snapshots as status + health frames. The
+        deltas are only as small as the outputs are quiet: start a
+        waveform or stream first to measure a busy case.
+        """
+        records, raw, decoder, stats = self.record_telemetry(seconds, interval_ms, key_every)
+        if not records:
+            raise Exception("No telemetry frames decoded")
+        
+        # Decode again, offline, without the serial reads in the loop
+        frames = []
+        pos = 0
+        while pos < len(raw):
+            if raw[pos] != TELEMETRY_FRAME:
+                pos += 1
+                continue
+            end = TelemetryDecoder().decode(raw, pos)
+            if end is None:
+                break
+            frames.append(raw[pos:end[2]])
+            pos = end[2]
+        replay = TelemetryDecoder()
+        blob = b"".join(frames)
+        start = time.perf_counter()
+        p = 0
+        while p < len(blob):
+            p = replay.decode(blob, p)[2]
+        delta_s = time.perf_counter() - start
+        
+        fixed = []
+        for _, _, v in records:
+            relays, enables = v["relays"], v["enables"]
+            fixed.append(struct.pack('>BBBHHB', CMD_GET_STATUS, relays & 1, (relays >> 1) & 1,
+                                     v["dimmer1"] & 0xFFFF, v["dimmer2"] & 0xFFFF,
+                                     ((enables & 1) << 1) | ((enables >> 1) & 1)) +
+                         struct.pack('>BBhHH', CMD_GET_HEALTH, 0, v["temperature_dc"], v["vdda_mv"], 0))
+        saved = (self.relay1_state, self.relay2_state, self.dimmer1_value, self.dimmer2_value,
+                 self.dimmer1_enabled, self.dimmer2_enabled, self.health)
+        start = time.perf_counter()
+        for frame in fixed:
+            self.parse_status_response(frame[:8])
+            self.parse_health_response(frame[8:])
+        fixed_s = time.perf_counter() - start
+        (self.relay1_state, self.relay2_state, self.dimmer1_value, self.dimmer2_value,
+         self.dimmer1_enabled, self.dimmer2_enabled, self.health) = saved
+        
+        return {
+            "updates": stats["frames"],
+            "key_frames": stats["key_frames"],
+            "dropped": stats["dropped"],
+            "lost": decoder.lost,
+            "unsynced": decoder.unsynced,
+            "bytes_per_update": stats["bytes"] / max(stats["frames"], 1),
+            "fixed_bytes_per_update": FIXED_STATUS_BYTES,
+            "encode_cycles_avg": stats["cycles"] / max(stats["frames"], 1),
+            "encode_cycles_max": stats["cycles_max"],
+            "decode_us": delta_s * 1e6 / max(replay.frames, 1),
+            "fixed_decode_us": fixed_s * 1e6 / len(fixed),
+        }
+    
+    def get_health(self):
+        """Read the MCU temperature, VDDA and the ADC interrupt load
+        
+        Normally not needed: the firmware appends the same frame to every
+        status reply, and the monitor thread keeps the latest in self.health.
+        """
+        self.monitor_paused = True
+        try:
+            self.serial_conn.reset_input_buffer()
+            self.send_frame(struct.pack('>BBHBBBB', CMD_GET_HEALTH, 0, 0, 0, 0, 0, 0))
+            buffer = b""
+            deadline = time.time() + 0.5
+            while time.time() < deadline:
+                buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+                i = buffer.find(bytes([CMD_GET_HEALTH]))
+                if i >= 0 and len(buffer) >= i + 8:
+                    self.last_communication = time.time()
+                    return self.parse_health_response(buffer[i:i + 8])
+            raise Exception("No health frame received")
+        finally:
+            self.monitor_paused = False
+    
+    def read_crash_page(self, page):
+        """Request one GET_CRASH page and return its 14 words with the header bytes"""
+        self.serial_conn.reset_input_buffer()
+        self.send_frame(struct.pack('>BBHBBBB', CMD_GET_CRASH, page, 0, 0, 0, 0, 0))
+        buffer = b""
+        deadline = time.time() + 0.5
+        while time.time() < deadline:
+            buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+            i = buffer.find(bytes([CMD_GET_CRASH, page]))
+            if i >= 0 and len(buffer) >= i + CRASH_REPLY_SIZE:
+                self.last_communication = time.time()
+                return buffer[i + 2], buffer[i + 3], struct.unpack('>14I', buffer[i + 4:i + CRASH_REPLY_SIZE])
+        raise Exception("No crash report received")
+    
+    def get_crash(self, clear=False):
+        """Read the crash report the device kept from its previous run"""
+        self.monitor_paused = True
+        try:
+            valid, reset_flags, words = self.read_crash_page(CRASH_PAGE_REGISTERS)
+            report = dict(zip(CRASH_REGISTER_NAMES, words))
+            report["valid"] = valid != 0
+            report["frame_valid"] = valid == 1
+            report["reset_cause"] = [name for bit, name in RESET_FLAG_BITS.items() if reset_flags & (1 << bit)]
+            if valid:
+                count, stack_words, words = self.read_crash_page(CRASH_PAGE_STACK)
+                report.update(count=count, mmfar=words[0], uptime_ms=words[1], stack=list(words[2:2 + stack_words]))
+                if clear:
+                    self.wave_transaction(struct.pack('>BBHBBBB', CMD_GET_CRASH, CRASH_PAGE_CLEAR, 0, 0, 0, 0, 0))
+            return report
+        finally:
+            self.monitor_paused = False
+    
+    def get_watchdog_info(self, action=WDG_CMD_INFO, timeout=0.5):
+        """Read the reset cause and watchdog state (action may inject a hang)"""
+        self.serial_conn.reset_input_buffer()
+        self.send_frame(struct.pack('>BBHBBBB', CMD_WATCHDOG, action, 0, 0, 0, 0, 0))
+        buffer = b""
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            buffer += self.serial_conn.read(self.serial_conn.in_waiting or 1)
+            i = buffer.find(bytes([CMD_WATCHDOG]))
+            if i >= 0 and len(buffer) >= i + 8:
+                _, flags, missing, restored, resets, timeout_ms = struct.unpack('>BBBBHH', buffer[i:i + 8])
+                self.last_communication = time.time()
+                return {"reset_cause": [name for bit, name in RESET_FLAG_BITS.items() if flags & (1 << bit)],
+                        "missing": [name for bit, name in WDG_TASK_NAMES.items() if missing & bit],
+                        "restored": bool(restored), "resets": resets, "timeout_ms": timeout_ms}
+        raise Exception("No watchdog info received")
+    
+    def watchdog_test(self, task, timeout=15.0):
+        """Hang one task on a DEBUG build and time the watchdog recovery
+        
+        Returns the post-reset watchdog info plus recovery_s, the time from
+        the injected hang until the control port answered again. That
+        includes USB re-enumeration and the firmware boot delay; the
+        outputs themselves are restored right after the reset.
+        """
+        self.monitor_paused = True
+        try:
+            before = self.get_watchdog_info()
+            port = self.serial_conn.port
+            self.get_watchdog_info(WDG_CMD_HANG[task])
+            start = time.time()
+            self.serial_conn.close()
+            while time.time() - start < timeout:
+                time.sleep(0.05)
+                try:
+                    self.serial_conn = serial.Serial(port=self.find_powerpack_port() or port,
+                                                     baudrate=115200, timeout=0.2)
+                    info = self.get_watchdog_info(timeout=0.2)
+                except Exception:
+                    info = None
+                if info and info["resets"] > before["resets"]:
+                    info["recovery_s"] = time.time() - start
+                    return info
+                if self.serial_conn:
+                    self.serial_conn.close()
+            raise Exception(f"No watchdog recovery within {timeout} s (is this a DEBUG build?)")
+        finally:
+            self.monitor_paused = False
+    
+    def export_metrics(self, path, fmt="openmetrics"):
+        """Write the device metrics to a file for a scraper (openmetrics or text)
+        
+        The file is replaced atomically so a scraper never reads a partial write.
+        """
+        metrics = self.get_metrics()
+        health = self.health
+        if health is None or time.time() - health['time'] > HEALTH_MAX_AGE:
+            health = self.get_health()
+        if health['ready']:
+            metrics["mcu_temperature_celsius"] = health['temperature_c']
+            metrics["supply_volts"] = health['vdda_v']
+            metrics["adc_cpu_percent"] = health['adc_load_pct']
+        defs = METRIC_DEFS + [(name, "gauge", help_text) for name, help_text in HEALTH_METRIC_DEFS
+                              if name in metrics]
+        lines = []
+        for name, kind, help_text in defs:
+            if fmt == "openmetrics":
+                lines.append(f"# TYPE powerpack_{name} {kind}")
+                lines.append(f"# HELP powerpack_{name} {help_text}.")
+                suffix = "_total" if kind == "counter" else ""
+                lines.append(f"powerpack_{name}{suffix} {metrics[name]}")
+            else:
+                lines.append(f"{name} {metrics[name]}")
+        if fmt == "openmetrics":
+            lines.append("# EOF")
+        
+        tmp_path = path + ".tmp"
+        with open(tmp_path, "w", encoding="utf-8") as f:
+            f.write("\n".join(lines) + "\n")
+        os.replace(tmp_path, path)
+        return metrics
+    
+    def dump_trace(self, clear=False):
+        """Read the device event trace, returns (events, info)
+        
+        events is a list of (ts_us, event_id, arg), oldest first, with the
+        32-bit device timestamps unwrapped into one monotonic timeline.
+        """
+        # The request goes out on the control port, the dump comes back on
+        # the diagnostics port (which must be open, or the firmware skips it)
+        if not self.diag_conn or not self.diag_conn.is_open:
+            self.connect_diag()
+        self.diag_conn.reset_input_buffer()
+        self.send_frame(struct.pack('>BBHBBBB', CMD_DUMP_TRACE, 1 if clear else 0, 0, 0, 0, 0, 0))
+        buffer = b""
+        deadline = time.time() + 2.0
+        while time.time() < deadline and bytes([CMD_DUMP_TRACE, ord('E')]) not in buffer:
+            buffer += self.diag_conn.read(self.diag_conn.in_waiting or 1)
+        
+        i = buffer.find(bytes([CMD_DUMP_TRACE, ord('H')]))
+        if i < 0 or len(buffer) < i + 16:
+            raise Exception("No trace header received")
+        count, total, dropped, now_us = struct.unpack('>HIII', buffer[i + 2:i + 16])
+        info = {"count": count, "total": total, "dropped": dropped, "now_us": now_us}
+        
+        raw = []
+        pos = i + 16
+        while len(raw) < count:
+            pos = buffer.find(bytes([CMD_DUMP_TRACE, ord('D')]), pos)
+            if pos < 0 or len(buffer) < pos + 5:
+                break
+            n = buffer[pos + 4]
+            end = pos + 5 + n * TRACE_WIRE_ENTRY_SIZE
+            if len(buffer) < end:
+                break
+            for k in range(pos + 5, end, TRACE_WIRE_ENTRY_SIZE):
+                raw.append(struct.unpack('>IBI', buffer[k:k + TRACE_WIRE_ENTRY_SIZE]))
+            pos = end
+        if len(raw) < count:
+            self.logger.warning(f"Trace incomplete: {len(raw)}/{count} events")
+        
+        events = []
+        base = 0
+        prev = raw[0][0] if raw else 0
+        for ts, event_id, arg in raw:
+            base += (ts - prev) & 0xFFFFFFFF
+            prev = ts
+            events.append((base, event_id, arg))
+        return events, info
+    
     def get_status(self):
         """Request status from device"""
         self.send_command(CMD_GET_STATUS)
@@ -388,6 +2005,8 @@ class PowerPackController:
             return self.parse_status_response(data)
         elif cmd == CMD_GET_VERSION:
             return self.parse_version_response(data)
+        elif cmd == CMD_GET_HEALTH:
+            return self.parse_health_response(data)
         else:
             self.logger.warning(f"Unknown response command: 0x{cmd:02X}")
         
@@ -443,6 +2062,30 @@ class PowerPackController:
             'version': self.firmware_version
         }
     
+    def parse_health_response(self, data):
+        """Parse the temperature/supply frame that follows every status frame
+        
+        The temperature uses the datasheet V25 and slope (the F1 has no
+        factory calibration), so it is good for trends, not to +/-1 C.
+        adc_load is the share of CPU time spent filtering the ADC blocks
+        since the previous frame.
+        """
+        if len(data) < 8 or data[0] != CMD_GET_HEALTH:
+            return None
+        
+        temp_dc, vdda_mv, load = struct.unpack('>hHH', data[2:8])
+        health = {
+            'type': 'health',
+            'ready': data[1] == 0,
+            'temperature_c': temp_dc / 10,
+            'vdda_v': vdda_mv / 1000,
+            'adc_load_pct': load / 100,
+            'time': time.time(),
+        }
+        if health['ready']:
+            self.health = health
+        return health
+    
     def status_monitor_thread(self):
         """Background thread to monitor status"""
         last_status_request = 0
@@ -454,7 +2097,7 @@ class PowerPackController:
             try:
                 # Try to read status response
                 response = None
-                if self.serial_conn and self.serial_conn.is_open:
+                if self.serial_conn and self.serial_conn.is_open and not self.monitor_paused:
                     response = self.read_usb_response()
                     
                     # Periodically request status to maintain communication
@@ -791,22 +2434,16 @@ class PowerPackGUI:
             
             if self.controller.connect_usb(port):
                 self.controller.start_monitoring()
-                self.update_status(f"[OK] Connected to {port}")
-                
-                # Wait a moment for connection to stabilize
-                time.sleep(2)
+                self.update_status(f"[OK] Connected to {port} in {self.controller.connect_ms:.0f} ms")
                 
-                # Request initial data with delays
-                try:
-                    self.update_status("[VERSION] Requesting firmware version...")
-                    self.controller.get_version()
-                    time.sleep(1)
-                    
-                    self.update_status("[INFO] Requesting device status...")
-                    self.controller.get_status()
-                    
-                except Exception as e:
-                    self.update_status(f"[WARN] Initial communication failed: {e}")
+                # The HELLO reply already queued the version and the state;
+                # firmware without it answers the plain requests
+                if self.controller.hello_info is None:
+                    try:
+                        self.controller.get_version()
+                        self.controller.get_status()
+                    except Exception as e:
+                        self.update_status(f"[WARN] Initial communication failed: {e}")
                 
             else:
                 self.update_status("âŒ Connection failed")
@@ -1000,9 +2637,9 @@ class PowerPackGUI:
                     self.dimmer1_enabled_var.set(response['dimmer1_enabled'])
                     self.dimmer2_enabled_var.set(response['dimmer2_enabled'])
                     
-                    # Convert DAC values to percentages
-                    dimmer1_pct = (response['dimmer1_value'] / 4095.0) * 100
-                    dimmer2_pct = (response['dimmer2_value'] / 4095.0) * 100
+                    # Convert levels to percentages
+                    dimmer1_pct = response['dimmer1_value'] * 100 / LEVEL_MAX
+                    dimmer2_pct = response['dimmer2_value'] * 100 / LEVEL_MAX
                     
                     self.dimmer1_var.set(dimmer1_pct)
                     self.dimmer2_var.set(dimmer2_pct)
@@ -1088,12 +2725,47 @@ def main():
         
         print("Available commands:")
         print("  connect_usb [port] - Connect via USB")
+        print("  bench_connect [runs] - Time reconnects: port open to HELLO reply, and the handshake alone")
         print("  relay <1|2> <on|off> - Control relay")
         print("  dimmer <1|2> <0-100> - Set dimmer percentage")
         print("  enable_dimmer <1|2> - Enable dimmer")
         print("  disable_dimmer <1|2> - Disable dimmer")
         print("  status - Get status")
         print("  version - Get version")
+        print("  wave_sine <1|2|3> <points> <rate_hz> - Upload and loop a sine table")
+        print("  wave_stop - Stop waveform playback")
+        print("  stream_sine <1|2|3> <seconds> <rate_hz> - Stream a 1 Hz sine (ch2 inverted)")
+        print("  stream_stop - Stop setpoint streaming")
+        print("  metrics [file] [openmetrics|text] - Show or export device metrics")
+        print("  trace <file.json> [clear] - Dump the event trace for chrome://tracing / Perfetto")
+        print("  log [seconds] - Show log text from the diagnostics port")
+        print("  bench - Time Set_Relay/Set_Dimmer on the device")
+        print("  memory - Show RAM usage: static, heap and stack peaks")
+        print("  timing [reset] - Show USB ISR and command cycle statistics")
+        print("  tasks [reset] - Show per-task CPU use and idle (WFI) time")
+        print("  power - Show USB suspend, STOP mode and wake-up latency statistics")
+        print("  health - Show MCU temperature, supply voltage and the ADC filtering load")
+        print("  pulse <relay> <ms> - Switch a relay away from its state for an exact time")
+        print("  blink <relay> <on_ms> <period_ms> [count] - Blink a relay in hardware (count 0 = until written)")
+        print("  relay_config [delays <relay> <operate_us> <release_us>|zc <mask> [offset_us]|save] - Relay timing settings")
+        print("  switch_at <relay> <on|off> <ms> - Switch a relay so its contacts move after <ms>")
+        print("  telemetry [interval_ms] [seconds] - Record the delta-coded status stream")
+        print("  telemetry bench [interval_ms] [seconds] - Bytes and decode cost against the fixed status frames")
+        print("  trigger [reset|off] - Show the PA3 trigger: armed action, counters, edge-to-output latency")
+        print("  trigger config <rising|falling> [once|rearm] [holdoff_ms] [debounce_us] - Trigger input settings")
+        print("  trigger state relay1=on dimmer1=50 ... - Arm a state for the next edge (relayN, enableN: on/off)")
+        print("  trigger wave <rate_hz> [once|loop] - Arm the start of the uploaded waveform")
+        print("  relays <mask> <on> - Switch relays by bitmask (hex or decimal, bit 0 = relay 1)")
+        print("  enables <mask> <on> - Switch dimmer output enables by bitmask")
+        print("  dimmers <mask> <%> [<%> ...] - Set dimmers by bitmask, one value for all or one each")
+        print("  benchch - DAC update time vs. channel count, up to 16 channels")
+        print("  caps - Channel map, DACs found on the bus and firmware features")
+        print("  dither <rate_hz|off|stats|bench> - Temporal dither of dimmers 1-2, 100-1000 Hz")
+        print(f"  curve <mask> <{'|'.join(CURVE_NAMES)}> - Dimming curve per channel; curve show - DAC codes per curve")
+        print("  loadtest [seconds] - Worst-case USB ISR latency under stream, fade and status load")
+        print("  crash [firmware.elf] [clear] - Show the last fault report, symbolized with the ELF")
+        print("  watchdog [main|usb|i2c] - Show reset cause, or hang a task (DEBUG build) and time recovery")
+        print("  state <r1> <r2> <d1%> <d2%> <en1> <en2> - Apply outputs together ('-' = keep)")
         print("  quit - Exit")
         
         while True:
@@ -1107,7 +2779,10 @@ def main():
                 elif cmd[0] == "connect_usb":
                     port = cmd[1] if len(cmd) > 1 else None
                     if controller.connect_usb(port):
-                        print("Connected via USB")
+                        info = controller.hello_info
+                        print(f"Connected via USB in {controller.connect_ms:.1f} ms" +
+                              (f", firmware {info['firmware']}, up {info['uptime_ms'] / 1000:.1f} s"
+                               if info else " (no HELLO reply)"))
                         controller.start_monitoring()
                     else:
                         print("Connection failed")
@@ -1142,6 +2817,288 @@ def main():
                     controller.get_version()
                     print("Version requested")
                     
+                elif cmd[0] == "wave_sine" and len(cmd) == 4:
+                    import math
+                    mask = int(cmd[1])
+                    points = int(cmd[2])
+                    rate = int(cmd[3])
+                    table = []
+                    for i in range(points):
+                        code = int(LEVEL_MAX / 2 + LEVEL_MAX / 2 * math.sin(2 * math.pi * i / points))
+                        table.extend([code] * (2 if mask == 3 else 1))
+                    max_rate = controller.upload_waveform(table, mask)
+                    controller.play_waveform(rate, loop=True)
+                    print(f"Playing {points} points at {rate} Hz (max {max_rate} Hz)")
+                    
+                elif cmd[0] == "wave_stop":
+                    controller.stop_waveform()
+                    print("Waveform stopped")
+                    
+                elif cmd[0] == "stream_sine" and len(cmd) == 4:
+                    import math
+                    mask = int(cmd[1])
+                    seconds = float(cmd[2])
+                    rate = int(cmd[3])
+                    records = []
+                    for i in range(int(seconds * rate)):
+                        code = int(LEVEL_MAX / 2 + LEVEL_MAX / 2 * math.sin(2 * math.pi * i / rate))
+                        records.append((i * 1000 // rate, code, LEVEL_MAX - code))
+                    stats = controller.stream_setpoints(records, mask)
+                    print(f"Streamed {len(records)} setpoints: {stats}")
+                    
+                elif cmd[0] == "metrics":
+                    if len(cmd) >= 2:
+                        fmt = cmd[2] if len(cmd) >= 3 else "openmetrics"
+                        controller.export_metrics(cmd[1], fmt)
+                        print(f"Metrics written to {cmd[1]}")
+                    else:
+                        for name, value in controller.get_metrics().items():
+                            print(f"  {name}: {value}")
+                    
+                elif cmd[0] == "trace" and len(cmd) >= 2:
+                    events, info = controller.dump_trace(clear=len(cmd) >= 3 and cmd[2] == "clear")
+                    trace_to_chrome_json(events, cmd[1])
+                    print(f"{len(events)} events written to {cmd[1]} ({info['dropped']} dropped during dumps)")
+                    
+                elif cmd[0] == "log":
+                    print(controller.read_diag_log(float(cmd[1]) if len(cmd) >= 2 else 5.0), end="")
+                    
+                elif cmd[0] == "state" and len(cmd) == 7:
+                    def arg(text, number=False):
+                        if text == "-":
+                            return None
+                        return float(text) if number else text.lower() in ("1", "on")
+                    changed = controller.apply_state(arg(cmd[1]), arg(cmd[2]), arg(cmd[3], True),
+                                                     arg(cmd[4], True), arg(cmd[5]), arg(cmd[6]))
+                    print(f"State applied, changed fields 0x{changed:02X}")
+                    
+                elif cmd[0] == "crash":
+                    elf = next((a for a in cmd[1:] if a != "clear"), None)
+                    report = controller.get_crash(clear="clear" in cmd[1:])
+                    print(format_crash_report(report, elf))
+                    
+                elif cmd[0] == "watchdog":
+                    if len(cmd) >= 2:
+                        info = controller.watchdog_test(cmd[1])
+                        print(f"Recovered in {info['recovery_s']:.2f} s, missing: {', '.join(info['missing'])}, "
+                              f"outputs restored: {info['restored']}")
+                    else:
+                        info = controller.get_watchdog_info()
+                        print(f"Reset cause: {', '.join(info['reset_cause']) or 'unknown'}, "
+                              f"watchdog resets: {info['resets']}, timeout {info['timeout_ms']} ms")
+                        if info["missing"]:
+                            print(f"  Tasks that missed the last feed: {', '.join(info['missing'])}")
+                    
+                elif cmd[0] == "loadtest":
+                    result = controller.isr_load_test(float(cmd[1]) if len(cmd) > 1 else 12)
+                    isr = result["stats"]["usb_isr"]
+                    print(f"USB ISR: max {isr[3]} cycles ({isr[3] * 1e6 / CPU_HZ:.1f} us), "
+                          f"avg {isr[2]} over {isr[0]} interrupts")
+                    print(f"SOF entry latency spread: +{result['sof_late_cycles']} / -{result['sof_early_cycles']} cycles "
+                          f"(+{result['sof_late_cycles'] * 1e6 / CPU_HZ:.1f} us worst late)")
+                    print(f"PendSV queue high water: {result['queue_high_water']}, "
+                          f"stream underruns: {result['stream']['underruns']}")
+                    
+                elif cmd[0] == "timing":
+                    in_ram, queue, stats = controller.get_timing(len(cmd) > 1 and cmd[1] == "reset")
+                    print(f"Hot path runs from {'RAM' if in_ram else 'flash'} (cycles at 48 MHz), "
+                          f"PendSV queue high water {queue}")
+                    for name, (samples, low, avg, high) in stats.items():
+                        print(f"  {name:<12} n={samples:<8} min {low:>7}  avg {avg:>7}  max {high:>7}"
+                              f"  ({avg * 1e6 / CPU_HZ:.1f} us avg)")
+                    
+                elif cmd[0] == "tasks":
+                    elapsed, idle, tasks = controller.get_tasks(len(cmd) > 1 and cmd[1] == "reset")
+                    busy = sum(t[1] for t in tasks.values())
+                    print(f"Over {elapsed / 1000:.1f} s: idle (WFI) {idle / 10:.1f}%, "
+                          f"tasks {busy / 10:.1f}%, interrupts {max(1000 - idle - busy, 0) / 10:.1f}%")
+                    for name, (runs, permille, max_cycles) in tasks.items():
+                        print(f"  {name:<10} runs {runs:<8} cpu {permille / 10:>5.1f}%  "
+                              f"max {max_cycles:>7} cycles ({max_cycles * 1e6 / CPU_HZ:.1f} us)")
+                    
+                elif cmd[0] == "power":
+                    p = controller.get_power()
+                    print(f"USB suspends: {p['suspends']}, outputs {'busy' if p['outputs_busy'] else 'static'}")
+                    print(f"  STOP:  {p['stop_entries']} entries, {p['stop_ms'] / 1000:.1f} s")
+                    print(f"  SLEEP: {p['sleep_entries']} clock-gated entries while suspended")
+                    print(f"  Wake-up to PLL: last {p['wake_us_last']} us, worst {p['wake_us_max']} us")
+                    
+                elif cmd[0] == "health":
+                    h = controller.get_health()
+                    if h['ready']:
+                        print(f"MCU {h['temperature_c']:.1f} C, VDDA {h['vdda_v']:.3f} V, "
+                              f"ADC filtering {h['adc_load_pct']:.2f}% CPU")
+                    else:
+                        print("No ADC readings yet")
+                    
+                elif cmd[0] == "memory":
+                    m = controller.get_memory()
+                    print(f"RAM {m['ram_total']} B: static {m['static']} B")
+                    print(f"  Heap:  peak {m['heap_peak']} / {m['heap_reserved']} B reserved, "
+                          f"now {m['heap_used']} B, {m['heap_failures']} refused")
+                    print(f"  Stack: peak {m['stack_peak']} / {m['stack_reserved']} B reserved, "
+                          f"now {m['stack_now']} B")
+                    print(f"  Never touched: {m['free_min']} B")
+                    for warning in m["warnings"]:
+                        print(f"  WARNING: {warning}")
+                    
+                elif cmd[0] == "bench":
+                    r = controller.bench_outputs()
+                    bus = 38 * 48000 // r["i2c_khz"]    # 38 SCL periods per DAC frame
+                    print(f"Driver: {'LL' if r['driver'] else 'HAL'}")
+                    print(f"  Set_Relay:  {r['relay_min']} cycles min, {r['relay_avg']} avg")
+                    print(f"  Set_Dimmer: {r['dimmer_min']} cycles min, {r['dimmer_avg']} avg "
+                          f"(~{bus} of them on the {r['i2c_khz']} kHz bus)")
+                    
+                elif cmd[0] in ("relays", "enables") and len(cmd) == 3:
+                    mask, on = int(cmd[1], 0), int(cmd[2], 0)
+                    if cmd[0] == "relays":
+                        changed = controller.set_relays(mask, on)
+                    else:
+                        changed = controller.enable_dimmers(mask, on)
+                    print(f"Changed channels 0x{changed:04X}")
+                    
+                elif cmd[0] == "dimmers" and len(cmd) >= 3:
+                    changed = controller.set_dimmers(int(cmd[1], 0), [float(v) for v in cmd[2:]])
+                    print(f"Changed channels 0x{changed:04X}")
+                    
+                elif cmd[0] == "benchch":
+                    i2c_khz, rows = controller.bench_channels()
+                    print(f"DAC update time on the {i2c_khz} kHz bus (* = modelled from 1 and 2 channels)")
+                    for channels, us, measured in rows:
+                        print(f"  {channels:>2} channels: {us:>6} us{'' if measured else ' *'}")
+                    
+                elif cmd[0] == "caps":
+                    caps = controller.get_capabilities()
+                    print(f"Firmware {caps['firmware']}, protocol {caps['protocol']}"
+                          f"{'' if caps['protocol'] == PROTOCOL_VERSION else ' (this script speaks ' + str(PROTOCOL_VERSION) + ')'}")
+                    print(f"Relays: {caps['relays']}, I2C bus: {caps['i2c_khz']} kHz")
+                    print("GP8413 found: " + (", ".join(f"0x{a:02X}" for a in caps['dacs_found']) or "none"))
+                    for n, dimmer in enumerate(caps['dimmers']):
+                        print(f"  Dimmer {n + 1}: DAC 0x{dimmer['address']:02X}, {dimmer['bits']} bit"
+                              f"{'' if dimmer['present'] else ', not present'}")
+                    print("Features: " + ", ".join(caps['features']))
+                    
+                elif cmd[0] == "dither" and len(cmd) >= 2:
+                    if cmd[1] == "bench":
+                        level, rows = controller.bench_dither()
+                        print(f"Dither cost at level 0x{level:04X} (code fraction ~1/2, worst case)")
+                        for r in rows:
+                            print(f"  {r['rate_hz']:>4} Hz: CPU {r['cpu_pct']:.3f}% "
+                                  f"({r['cycles_avg']} cycles avg, {r['cycles_max']} max), "
+                                  f"I2C {r['bus_pct']:.1f}%, {r['busy']} busy")
+                    elif cmd[1] == "stats":
+                        _, rate, s = controller.dither(DITHER_CMD_STATS)
+                        print(f"Dither {rate or 'off'} Hz: {s}")
+                    else:
+                        controller.set_dither(0 if cmd[1] == "off" else int(cmd[1]))
+                        print(f"Dither {cmd[1]}")
+                    
+                elif cmd[0] == "curve" and len(cmd) >= 2 and cmd[1] == "show":
+                    print("  level  " + "".join(f"{name:>10}" for name in CURVE_NAMES))
+                    for pct in (1, 2, 5, 10, 20, 30, 50, 70, 100):
+                        level = percent_to_level(pct)
+                        codes = [dimming_curves.level_to_code(level, name) for name in CURVE_NAMES]
+                        print(f"  {pct:>4}%  " + "".join(f"{code:>10}" for code in codes))
+                    
+                elif cmd[0] == "curve" and len(cmd) == 3:
+                    controller.set_curve(int(cmd[1], 0), cmd[2])
+                    print(f"Dimmers 0x{int(cmd[1], 0):04X} use the {cmd[2]} curve")
+                    
+                elif cmd[0] == "pulse" and len(cmd) == 3:
+                    controller.pulse_relay(int(cmd[1]), int(cmd[2]))
+                    print(f"Relay {cmd[1]} pulsed for {cmd[2]} ms")
+                    
+                elif cmd[0] == "blink" and len(cmd) >= 4:
+                    count = int(cmd[4]) if len(cmd) >= 5 else 0
+                    controller.blink_relay(int(cmd[1]), int(cmd[2]), int(cmd[3]), count)
+                    until = f"{count} times" if count else "until the relay is written"
+                    print(f"Relay {cmd[1]} blinking {cmd[2]} ms every {cmd[3]} ms, {until}")
+                    
+                elif cmd[0] == "trigger":
+                    sub = cmd[1] if len(cmd) >= 2 else ""
+                    if sub == "config" and len(cmd) >= 3:
+                        info = controller.configure_trigger(
+                            falling=cmd[2] == "falling",
+                            rearm=len(cmd) >= 4 and cmd[3] == "rearm",
+                            holdoff_ms=int(cmd[4]) if len(cmd) >= 5 else 0,
+                            debounce_us=int(cmd[5]) if len(cmd) >= 6 else 0)
+                    elif sub == "state" and len(cmd) >= 3:
+                        outputs = {}
+                        for item in cmd[2:]:
+                            name, _, value = item.partition("=")
+                            if name.startswith("dimmer"):
+                                outputs[name] = float(value)
+                            else:
+                                outputs[name] = value in ("on", "1")
+                        info = controller.arm_trigger_state(**outputs)
+                    elif sub == "wave" and len(cmd) >= 3:
+                        info = controller.arm_trigger_wave(int(cmd[2]), loop=len(cmd) >= 4 and cmd[3] == "loop")
+                    elif sub == "off":
+                        info = controller.disarm_trigger()
+                    else:
+                        info = controller.trigger_stats(reset=sub == "reset")
+                    print(f"Trigger: {info['action']}, {info['edge']} edge, "
+                          f"{'re-arm' if info['rearm'] else 'one shot'}, "
+                          f"holdoff {info['holdoff_ms']} ms, debounce {info['debounce_us']} us")
+                    print(f"  fired {info['fired']}, in holdoff {info['holdoff']}, "
+                          f"debounced {info['debounce']}, late {info['late']}")
+                    print(f"  entry to outputs: last {info['latency_us_last']:.2f} us, "
+                          f"max {info['latency_us_max']:.2f} us")
+                    
+                elif cmd[0] == "relay_config":
+                    sub = cmd[1] if len(cmd) >= 2 else ""
+                    if sub == "delays" and len(cmd) == 5:
+                        info = controller.set_relay_delays(int(cmd[2]), int(cmd[3]), int(cmd[4]))
+                    elif sub == "zc" and len(cmd) >= 3:
+                        info = controller.set_zero_cross(int(cmd[2], 0), int(cmd[3]) if len(cmd) >= 4 else 0)
+                    elif sub == "save":
+                        info = controller.save_relay_config()
+                    else:
+                        info = controller.get_relay_config()
+                    for n, (operate, release) in enumerate(zip(info['operate_us'], info['release_us'])):
+                        print(f"Relay {n + 1}: operate {operate} us, release {release} us")
+                    mains = f"{info['mains_interval_us']} us between sync edges" if info['mains_interval_us'] else "no sync edges"
+                    print(f"Zero-cross mask 0x{info['zero_cross_mask']:04X}, offset {info['zero_cross_offset_us']} us, {mains}")
+                    print("Stored in flash" if info['stored'] else "Not saved (defaults or changed since boot)")
+                    
+                elif cmd[0] == "switch_at" and len(cmd) == 4:
+                    controller.switch_relay_at(int(cmd[1]), cmd[2] in ("on", "1"), int(cmd[3]))
+                    print(f"Relay {cmd[1]} switches {cmd[2]} in {cmd[3]} ms")
+                    
+                elif cmd[0] == "telemetry":
+                    if len(cmd) >= 2 and cmd[1] == "bench":
+                        interval = int(cmd[2]) if len(cmd) >= 3 else 10
+                        b = controller.bench_telemetry(float(cmd[3]) if len(cmd) >= 4 else 2.0, interval)
+                        print(f"Telemetry every {interval} ms: {b['updates']} updates, {b['key_frames']} key frames, "
+                              f"{b['dropped']} dropped on the device, {b['lost']} lost, {b['unsynced']} undecodable")
+                        print(f"  bytes/update: {b['bytes_per_update']:.2f} (fixed format {b['fixed_bytes_per_update']})")
+                        print(f"  device encode: {b['encode_cycles_avg']:.0f} cycles avg, {b['encode_cycles_max']} max")
+                        print(f"  host decode: {b['decode_us']:.2f} us/update (fixed format {b['fixed_decode_us']:.2f})")
+                    elif len(cmd) >= 2 and cmd[1] == "stats":
+                        print(f"Telemetry: {controller.telemetry(TELEMETRY_CMD_STATS)}")
+                    else:
+                        interval = int(cmd[1]) if len(cmd) >= 2 else 100
+                        seconds = float(cmd[2]) if len(cmd) >= 3 else 2.0
+                        records, _, decoder, stats = controller.record_telemetry(seconds, interval)
+                        for t, seq, v in records[-5:]:
+                            print(f"  #{seq:<3} " + ", ".join(f"{k} {v[k]}" for k in TELEMETRY_FIELDS))
+                        print(f"{len(records)} snapshots, {stats['bytes'] / max(stats['frames'], 1):.2f} bytes each")
+                    
+                elif cmd[0] == "bench_connect":
+                    controller.monitor_paused = True
+                    try:
+                        b = controller.bench_connect(runs=int(cmd[1]) if len(cmd) >= 2 else 10)
+                    finally:
+                        controller.monitor_paused = False
+                    for name in ("connect_ms", "hello_ms"):
+                        v = sorted(b[name])
+                        print(f"  {name:<10} min {v[0]:.2f}  median {v[len(v) // 2]:.2f}  max {v[-1]:.2f} ms")
+                    
+                elif cmd[0] == "stream_stop":
+                    controller.stop_stream()
+                    print("Stream stopped")
+                    
                 else:
                     print("Invalid command")
                     
@@ -27,6 +27,7 @@
 #include "usbd_cdc_if.h"
 
 /* USER CODE BEGIN Includes */
+#include "usbd_composite.h"
 
 /* USER CODE END Includes */
 
@@ -86,7 +87,13 @@ void MX_USB_DEVICE_Init(void)
   }
 
   /* USER CODE BEGIN USB_DEVICE_Init_PostTreatment */
-
+  /* Swap the generated single CDC for the composite device here, so CubeMX
+   * regeneration keeps it. The host only reads descriptors after its attach
+   * debounce (100 ms or more), long after this runs. */
+  if (USBD_COMPOSITE_Register(&hUsbDeviceFS) != USBD_OK)
+  {
+    Error_Handler();
+  }
   /* USER CODE END USB_DEVICE_Init_PostTreatment */
 }
 
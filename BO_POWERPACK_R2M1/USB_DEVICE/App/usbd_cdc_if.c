@@ -18,6 +18,9 @@
 
 /* USER CODE BEGIN INCLUDE */
 #include "main.h"
+#include "metrics.h"
+#include "trace.h"
+#include "usbd_composite.h"
 /* USER CODE END INCLUDE */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -27,6 +30,7 @@
 /* USER CODE BEGIN PV */
 /* Private variables ---------------------------------------------------------*/
 extern void USB_DataReceived(uint8_t* Buf, uint32_t Len);
+extern void USB_TransmitComplete(void);
 /* USER CODE END PV */
 
 /** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
@@ -256,6 +260,7 @@ static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
   /* USER CODE BEGIN 6 */
   // Process the received data immediately
   if (*Len > 0) {
+    Metrics_Inc(METRIC_USB_RX_PACKETS);
     USB_DataReceived(Buf, *Len);
   }
 
@@ -276,6 +281,8 @@ static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
   * @param  Buf: Buffer of data to be sent
   * @param  Len: Number of data to be sent (in bytes)
   * @retval USBD_OK if all operations are OK else USBD_FAIL or USBD_BUSY
+  * @note   Main loop only: the TxState check and the endpoint start are
+  *         not atomic, so an interrupt must not send on this endpoint.
   */
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
 {
@@ -283,15 +290,82 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
   /* USER CODE BEGIN 7 */
   USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
   if (hcdc->TxState != 0){
+    Metrics_Inc(METRIC_USB_TX_BUSY);
+    Trace_Event(TRACE_USB_TX_BUSY, Len);
     return USBD_BUSY;
   }
+  Trace_Event(TRACE_USB_TX_START, Len);
   USBD_CDC_SetTxBuffer(&hUsbDeviceFS, Buf, Len);
   result = USBD_CDC_TransmitPacket(&hUsbDeviceFS);
+  Metrics_Inc((result == USBD_OK) ? METRIC_USB_TX_PACKETS : METRIC_USB_TX_BUSY);
   /* USER CODE END 7 */
   return result;
 }
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+/**
+  * @brief  Wait for the control IN endpoint to finish its packet
+  * @param  timeout_ms: Upper bound on the wait
+  * @retval None
+  */
+void CDC_WaitTxIdle_FS(uint32_t timeout_ms)
+{
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  uint32_t start = HAL_GetTick();
+
+  if (hcdc == NULL) return;
+  while (hcdc->TxState != 0 && (HAL_GetTick() - start) < timeout_ms) {
+  }
+}
+
+/**
+  * @brief  Control IN endpoint finished a packet (USB interrupt)
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_COMPOSITE_ControlTxCplt(USBD_HandleTypeDef *pdev)
+{
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)pdev->pClassData;
+
+  // A ZLP may still follow; wait for the CDC class to release the endpoint
+  if (hcdc != NULL && hcdc->TxState == 0) {
+    USB_TransmitComplete();
+  }
+}
+
+/**
+  * @brief  Queue log text or trace data on the diagnostics CDC port
+  * @param  Buf: Data (copied, may be reused on return)
+  * @param  Len: Number of bytes
+  * @retval Bytes accepted (0 if the port is closed or the buffer is full)
+  */
+uint16_t CDC_Transmit_Diag_FS(const uint8_t* Buf, uint16_t Len)
+{
+  uint16_t sent = USBD_Diag_Write(&hUsbDeviceFS, Buf, Len);
+
+  if (sent == 0 && USBD_Diag_IsOpen()) {
+    Metrics_Inc(METRIC_DIAG_DROPPED);
+  }
+  return sent;
+}
+
+/**
+  * @brief  Free space in the diagnostics transmit buffer
+  * @retval Bytes
+  */
+uint16_t CDC_Diag_GetFree(void)
+{
+  return USBD_Diag_GetFree();
+}
+
+/**
+  * @brief  Check whether a terminal has the diagnostics port open (DTR set)
+  * @retval 1 if open
+  */
+uint8_t CDC_Diag_IsOpen(void)
+{
+  return USBD_Diag_IsOpen();
+}
 
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
@@ -108,6 +108,10 @@ extern USBD_CDC_ItfTypeDef USBD_Interface_fops_FS;
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
+uint16_t CDC_Transmit_Diag_FS(const uint8_t* Buf, uint16_t Len);
+uint16_t CDC_Diag_GetFree(void);
+uint8_t CDC_Diag_IsOpen(void);
+void CDC_WaitTxIdle_FS(uint32_t timeout_ms);
 
 /* USER CODE END EXPORTED_FUNCTIONS */
 
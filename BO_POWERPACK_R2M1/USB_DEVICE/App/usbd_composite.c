@@ -0,0 +1,322 @@
+/**
+  ******************************************************************************
+  * @file           : usbd_composite.c
+  * @brief          : Composite device: control CDC + diagnostics CDC
+  ******************************************************************************
+  * @attention
+  *
+  * Wraps the stock USBD_CDC class so the control channel behaves exactly as
+  * before, and adds a second CDC ACM function (own IAD, interfaces 2/3) for
+  * human-readable logs and trace dumps. Requests and endpoint events for the
+  * diagnostics function are handled here; everything else is forwarded to
+  * USBD_CDC.
+  *
+  * Diagnostic output goes through a ring buffer drained from the IN
+  * complete callback, so callers never wait on the bus. Data is only
+  * accepted while the host holds DTR (terminal open); otherwise it is
+  * dropped so a closed port cannot back the buffer up.
+  *
+  * PMA layout (usbd_conf.c): BTABLE 0x00-0x27 (EP0-EP4), EP0 OUT 0x28,
+  * EP0 IN 0x68, EP1 IN 0xA8, EP1 OUT 0xE8, EP2 IN 0x128, EP3 IN 0x130,
+  * EP3 OUT 0x170, EP4 IN 0x1B0; 440 of 512 bytes used.
+  *
+  ******************************************************************************
+  */
+
+#include "usbd_composite.h"
+#include "usbd_ctlreq.h"
+
+/* Generated device descriptor (usbd_desc.c), patched by USBD_COMPOSITE_Register() */
+extern uint8_t USBD_FS_DeviceDesc[USB_LEN_DEV_DESC];
+
+static uint8_t USBD_COMPOSITE_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t USBD_COMPOSITE_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t USBD_COMPOSITE_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
+static uint8_t USBD_COMPOSITE_EP0_RxReady(USBD_HandleTypeDef *pdev);
+static uint8_t USBD_COMPOSITE_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static uint8_t USBD_COMPOSITE_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static uint8_t *USBD_COMPOSITE_GetCfgDesc(uint16_t *length);
+static uint8_t *USBD_COMPOSITE_GetDeviceQualifierDesc(uint16_t *length);
+
+USBD_ClassTypeDef USBD_COMPOSITE =
+{
+  USBD_COMPOSITE_Init,
+  USBD_COMPOSITE_DeInit,
+  USBD_COMPOSITE_Setup,
+  NULL,                 /* EP0_TxSent */
+  USBD_COMPOSITE_EP0_RxReady,
+  USBD_COMPOSITE_DataIn,
+  USBD_COMPOSITE_DataOut,
+  NULL,
+  NULL,
+  NULL,
+  USBD_COMPOSITE_GetCfgDesc,
+  USBD_COMPOSITE_GetCfgDesc,
+  USBD_COMPOSITE_GetCfgDesc,
+  USBD_COMPOSITE_GetDeviceQualifierDesc,
+};
+
+#define CDC_FUNCTION_DESC(ctrl_itf, data_itf, cmd_ep, out_ep, in_ep)          \
+  /* Interface Association Descriptor */                                      \
+  0x08, 0x0B, (ctrl_itf), 0x02, 0x02, 0x02, 0x01, 0x00,                       \
+  /* Communication interface */                                               \
+  0x09, USB_DESC_TYPE_INTERFACE, (ctrl_itf), 0x00, 0x01, 0x02, 0x02, 0x01, 0x00, \
+  /* Header, Call Management, ACM and Union functional descriptors */         \
+  0x05, 0x24, 0x00, 0x10, 0x01,                                               \
+  0x05, 0x24, 0x01, 0x00, (data_itf),                                         \
+  0x04, 0x24, 0x02, 0x02,                                                     \
+  0x05, 0x24, 0x06, (ctrl_itf), (data_itf),                                   \
+  /* Notification endpoint */                                                 \
+  0x07, USB_DESC_TYPE_ENDPOINT, (cmd_ep), 0x03,                               \
+  LOBYTE(CDC_CMD_PACKET_SIZE), HIBYTE(CDC_CMD_PACKET_SIZE), CDC_FS_BINTERVAL, \
+  /* Data interface */                                                        \
+  0x09, USB_DESC_TYPE_INTERFACE, (data_itf), 0x00, 0x02, 0x0A, 0x00, 0x00, 0x00, \
+  0x07, USB_DESC_TYPE_ENDPOINT, (out_ep), 0x02,                               \
+  LOBYTE(CDC_DATA_FS_MAX_PACKET_SIZE), HIBYTE(CDC_DATA_FS_MAX_PACKET_SIZE), 0x00, \
+  0x07, USB_DESC_TYPE_ENDPOINT, (in_ep), 0x02,                                \
+  LOBYTE(CDC_DATA_FS_MAX_PACKET_SIZE), HIBYTE(CDC_DATA_FS_MAX_PACKET_SIZE), 0x00
+
+__ALIGN_BEGIN static uint8_t USBD_COMPOSITE_CfgDesc[USB_COMPOSITE_CONFIG_DESC_SIZ] __ALIGN_END =
+{
+  /* Configuration Descriptor */
+  0x09,                                 /* bLength */
+  USB_DESC_TYPE_CONFIGURATION,          /* bDescriptorType */
+  LOBYTE(USB_COMPOSITE_CONFIG_DESC_SIZ),/* wTotalLength */
+  HIBYTE(USB_COMPOSITE_CONFIG_DESC_SIZ),
+  0x04,                                 /* bNumInterfaces */
+  0x01,                                 /* bConfigurationValue */
+  0x00,                                 /* iConfiguration */
+  0xC0,                                 /* bmAttributes: self powered */
+  0x32,                                 /* MaxPower 100 mA */
+
+  CDC_FUNCTION_DESC(0x00, 0x01, CDC_CMD_EP, CDC_OUT_EP, CDC_IN_EP),
+  CDC_FUNCTION_DESC(DIAG_CTRL_ITF, DIAG_DATA_ITF, DIAG_CMD_EP, DIAG_OUT_EP, DIAG_IN_EP)
+};
+
+typedef struct
+{
+  uint8_t  line_coding[7];
+  uint8_t  rx_packet[CDC_DATA_FS_MAX_PACKET_SIZE];
+  uint8_t  ep0_pending;           /* SET_LINE_CODING data stage in progress */
+  volatile uint8_t dtr;
+  volatile uint8_t tx_busy;
+  uint16_t tx_inflight;
+  volatile uint16_t head;
+  volatile uint16_t tail;
+  uint8_t  tx_buffer[DIAG_TX_BUFFER_SIZE];
+} USBD_DiagTypeDef;
+
+static USBD_DiagTypeDef diag = { .line_coding = { 0x00, 0xC2, 0x01, 0x00, 0x00, 0x00, 0x08 } };
+
+/**
+  * @brief  Queue the next contiguous run of the ring buffer (IRQs masked or USB ISR)
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void USBD_Diag_Kick(USBD_HandleTypeDef *pdev)
+{
+  uint16_t tail = diag.tail & (DIAG_TX_BUFFER_SIZE - 1U);
+  uint16_t count = (uint16_t)(diag.head - diag.tail);
+
+  if (diag.tx_busy || count == 0U || pdev->dev_state != USBD_STATE_CONFIGURED)
+  {
+    return;
+  }
+  if (count > DIAG_TX_BUFFER_SIZE - tail)
+  {
+    count = DIAG_TX_BUFFER_SIZE - tail;
+  }
+  if (count > CDC_DATA_FS_MAX_PACKET_SIZE - 1U)
+  {
+    count = CDC_DATA_FS_MAX_PACKET_SIZE - 1U;   /* short packet: no ZLP needed */
+  }
+
+  diag.tx_busy = 1U;
+  diag.tx_inflight = count;
+  USBD_LL_Transmit(pdev, DIAG_IN_EP, &diag.tx_buffer[tail], count);
+}
+
+static uint8_t USBD_COMPOSITE_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  uint8_t ret = USBD_CDC.Init(pdev, cfgidx);
+
+  USBD_LL_OpenEP(pdev, DIAG_IN_EP, USBD_EP_TYPE_BULK, CDC_DATA_FS_IN_PACKET_SIZE);
+  pdev->ep_in[DIAG_IN_EP & 0xFU].is_used = 1U;
+  USBD_LL_OpenEP(pdev, DIAG_OUT_EP, USBD_EP_TYPE_BULK, CDC_DATA_FS_OUT_PACKET_SIZE);
+  pdev->ep_out[DIAG_OUT_EP & 0xFU].is_used = 1U;
+  USBD_LL_OpenEP(pdev, DIAG_CMD_EP, USBD_EP_TYPE_INTR, CDC_CMD_PACKET_SIZE);
+  pdev->ep_in[DIAG_CMD_EP & 0xFU].is_used = 1U;
+
+  diag.dtr = 0U;
+  diag.tx_busy = 0U;
+  diag.ep0_pending = 0U;
+  diag.head = diag.tail = 0U;
+
+  USBD_LL_PrepareReceive(pdev, DIAG_OUT_EP, diag.rx_packet, CDC_DATA_FS_OUT_PACKET_SIZE);
+  return ret;
+}
+
+static uint8_t USBD_COMPOSITE_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  USBD_LL_CloseEP(pdev, DIAG_IN_EP);
+  pdev->ep_in[DIAG_IN_EP & 0xFU].is_used = 0U;
+  USBD_LL_CloseEP(pdev, DIAG_OUT_EP);
+  pdev->ep_out[DIAG_OUT_EP & 0xFU].is_used = 0U;
+  USBD_LL_CloseEP(pdev, DIAG_CMD_EP);
+  pdev->ep_in[DIAG_CMD_EP & 0xFU].is_used = 0U;
+
+  diag.dtr = 0U;
+  diag.tx_busy = 0U;
+
+  return USBD_CDC.DeInit(pdev, cfgidx);
+}
+
+/**
+  * @brief  Route a setup request to the function that owns the interface
+  * @param  pdev: device instance
+  * @param  req: usb request
+  * @retval status
+  */
+static uint8_t USBD_COMPOSITE_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
+{
+  uint8_t itf = LOBYTE(req->wIndex);
+
+  if (((req->bmRequest & USB_REQ_RECIPIENT_MASK) != USB_REQ_RECIPIENT_INTERFACE) ||
+      ((req->bmRequest & USB_REQ_TYPE_MASK) != USB_REQ_TYPE_CLASS) ||
+      ((itf != DIAG_CTRL_ITF) && (itf != DIAG_DATA_ITF)))
+  {
+    return USBD_CDC.Setup(pdev, req);
+  }
+
+  switch (req->bRequest)
+  {
+    case CDC_SET_LINE_CODING:
+      diag.ep0_pending = 1U;
+      USBD_CtlPrepareRx(pdev, diag.line_coding, MIN(req->wLength, sizeof(diag.line_coding)));
+      break;
+
+    case CDC_GET_LINE_CODING:
+      USBD_CtlSendData(pdev, diag.line_coding, MIN(req->wLength, sizeof(diag.line_coding)));
+      break;
+
+    case CDC_SET_CONTROL_LINE_STATE:
+      diag.dtr = (req->wValue & 0x0001U) ? 1U : 0U;
+      break;
+
+    default:
+      /* SEND_BREAK etc. are accepted and ignored */
+      break;
+  }
+  return USBD_OK;
+}
+
+static uint8_t USBD_COMPOSITE_EP0_RxReady(USBD_HandleTypeDef *pdev)
+{
+  if (diag.ep0_pending)
+  {
+    diag.ep0_pending = 0U;    /* line coding has no meaning for the log port */
+    return USBD_OK;
+  }
+  return USBD_CDC.EP0_RxReady(pdev);
+}
+
+static uint8_t USBD_COMPOSITE_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  if (epnum != (DIAG_IN_EP & 0x7FU))
+  {
+    uint8_t ret = USBD_CDC.DataIn(pdev, epnum);
+    USBD_COMPOSITE_ControlTxCplt(pdev);
+    return ret;
+  }
+
+  diag.tail += diag.tx_inflight;
+  diag.tx_inflight = 0U;
+  diag.tx_busy = 0U;
+  USBD_Diag_Kick(pdev);
+  return USBD_OK;
+}
+
+static uint8_t USBD_COMPOSITE_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  if (epnum != DIAG_OUT_EP)
+  {
+    return USBD_CDC.DataOut(pdev, epnum);
+  }
+
+  /* Input on the log port is ignored */
+  USBD_LL_PrepareReceive(pdev, DIAG_OUT_EP, diag.rx_packet, CDC_DATA_FS_OUT_PACKET_SIZE);
+  return USBD_OK;
+}
+
+static uint8_t *USBD_COMPOSITE_GetCfgDesc(uint16_t *length)
+{
+  *length = sizeof(USBD_COMPOSITE_CfgDesc);
+  return USBD_COMPOSITE_CfgDesc;
+}
+
+static uint8_t *USBD_COMPOSITE_GetDeviceQualifierDesc(uint16_t *length)
+{
+  return USBD_CDC.GetDeviceQualifierDescriptor(length);
+}
+
+/**
+  * @brief  Replace the registered class with the composite device
+  * @param  pdev: device instance, after USBD_Init()
+  * @retval USBD status
+  * @note   Called from the USB_DEVICE_Init_PostTreatment user block, so the
+  *         generated usb_device.c and usbd_desc.c stay as CubeMX writes them.
+  */
+USBD_StatusTypeDef USBD_COMPOSITE_Register(USBD_HandleTypeDef *pdev)
+{
+  /* Miscellaneous / Common Class / IAD, release 2.01 */
+  USBD_FS_DeviceDesc[4] = 0xEFU;    /* bDeviceClass */
+  USBD_FS_DeviceDesc[5] = 0x02U;    /* bDeviceSubClass */
+  USBD_FS_DeviceDesc[6] = 0x01U;    /* bDeviceProtocol */
+  USBD_FS_DeviceDesc[12] = 0x01U;   /* bcdDevice LSB */
+
+  return USBD_RegisterClass(pdev, &USBD_COMPOSITE);
+}
+
+/**
+  * @brief  Queue diagnostic output (any context)
+  * @param  pdev: device instance
+  * @param  data: bytes to send
+  * @param  length: number of bytes
+  * @retval Bytes accepted: length, or 0 if the port is closed or the buffer full
+  */
+uint16_t USBD_Diag_Write(USBD_HandleTypeDef *pdev, const uint8_t *data, uint16_t length)
+{
+  uint32_t primask;
+
+  if (!diag.dtr || length == 0U)
+  {
+    return 0U;
+  }
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  if (length > DIAG_TX_BUFFER_SIZE - (uint16_t)(diag.head - diag.tail))
+  {
+    __set_PRIMASK(primask);
+    return 0U;    /* whole writes only, so frames and lines are never split */
+  }
+  for (uint16_t i = 0U; i < length; i++)
+  {
+    diag.tx_buffer[(diag.head + i) & (DIAG_TX_BUFFER_SIZE - 1U)] = data[i];
+  }
+  diag.head += length;
+  USBD_Diag_Kick(pdev);
+  __set_PRIMASK(primask);
+
+  return length;
+}
+
+uint16_t USBD_Diag_GetFree(void)
+{
+  return DIAG_TX_BUFFER_SIZE - (uint16_t)(diag.head - diag.tail);
+}
+
+uint8_t USBD_Diag_IsOpen(void)
+{
+  return diag.dtr;
+}
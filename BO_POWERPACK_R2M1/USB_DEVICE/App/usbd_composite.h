@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file           : usbd_composite.h
+  * @brief          : Composite device: control CDC + diagnostics CDC
+  ******************************************************************************
+  */
+
+#ifndef __USBD_COMPOSITE_H__
+#define __USBD_COMPOSITE_H__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "usbd_cdc.h"
+
+/* Function 0 (interfaces 0/1, EP1/EP2) is the stock CDC class carrying the
+ * framed binary control protocol. Function 1 (interfaces 2/3, EP3/EP4) is a
+ * transmit-only CDC ACM used for log text and trace dumps. */
+#define DIAG_CTRL_ITF                   0x02U
+#define DIAG_DATA_ITF                   0x03U
+#define DIAG_IN_EP                      0x83U
+#define DIAG_OUT_EP                     0x03U
+#define DIAG_CMD_EP                     0x84U
+
+#define USB_COMPOSITE_CONFIG_DESC_SIZ   141U  /* 9 + 2 x (IAD 8 + CDC 58) */
+#define DIAG_TX_BUFFER_SIZE             512U  /* power of two */
+
+/* Interface requests above this number are refused by the device core;
+ * CubeMX regenerates usbd_conf.h with its own setting (1 for a single CDC) */
+#if USBD_MAX_NUM_INTERFACES < 4
+#error "USBD_MAX_NUM_INTERFACES must be 4 for the composite device (USB_DEVICE settings in the .ioc)"
+#endif
+
+extern USBD_ClassTypeDef USBD_COMPOSITE;
+
+USBD_StatusTypeDef USBD_COMPOSITE_Register(USBD_HandleTypeDef *pdev);
+uint16_t USBD_Diag_Write(USBD_HandleTypeDef *pdev, const uint8_t *data, uint16_t length);
+uint16_t USBD_Diag_GetFree(void);
+uint8_t  USBD_Diag_IsOpen(void);
+
+/* Called from the USB interrupt when the control IN endpoint completes;
+ * defined by the application (usbd_cdc_if.c) */
+void     USBD_COMPOSITE_ControlTxCplt(USBD_HandleTypeDef *pdev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBD_COMPOSITE_H__ */